@@ -9,9 +9,17 @@ $(NAME)_SOURCES := src/source/base64.c \
                    src/source/jimi_iot.c \
                    src/source/jimi_log.c \
                    src/source/jimi_memory.c \
+                   src/source/jimi_slab.c \
                    src/source/md5.c \
                    src/source/mqtt.c \
                    src/source/mqtt_buffer.c \
+                   src/source/mqtt_histogram.c \
+                   src/source/mqtt_id_table.c \
+                   src/source/mqtt_inflight.c \
+                   src/source/mqtt_outbox.c \
+                   src/source/mqtt_stats.c \
+                   src/source/mqtt_timer_wheel.c \
+                   src/source/mqtt_topic_router.c \
                    src/source/mqtt_wrapper.c \
                    src/source/avl-tree.c \
                    src/source/jimi_http.c \
@@ -24,6 +32,8 @@ $(NAME)_SOURCES := src/source/base64.c \
 
 $(NAME)_INCLUDES :=  . src src/include src/source src/aos
 $(NAME)_DEFINES  := __alios__
+#内存跟踪模式，shell中执行memory命令查看各调用位置的内存占用
+#$(NAME)_DEFINES  += JIMI_MEMORY_TRACK
 $(NAME)_COMPONENTS += cli netmgr yloop
 GLOBAL_INCLUDES += src/aos
 GLOBAL_DEFINES  := WITH_SAL
@@ -0,0 +1,958 @@
+//
+// Created by xzl on 2019/7/20.
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "jimi_log.h"
+#include "jimi_buffer.h"
+#include "jimi_memory.h"
+#include "jimi_slab.h"
+#include "mqtt.h"
+#include "mqtt_buffer.h"
+#include "mqtt_inflight.h"
+#include "base64.h"
+#include "iot_proto.h"
+#include "hash-table.h"
+#include "avl-tree.h"
+
+/**
+ * 编解码、缓冲区以及容器的微基准测试，结果以json格式输出到标准输出，便于逐个提交对比性能回归
+ * 每个测试项先逐步放大迭代次数直到耗时达到最短测量时间，然后重复测量若干轮，输出最好成绩与平均值
+ * 使用方法: bench [-f 名称过滤] [-t 每轮最短测量毫秒数] [-r 重复轮数] [-s] [-l]
+ * -s 启用slab分配器，对比系统malloc的成绩
+ */
+
+//解析测试时每个数据流包含的数据包个数
+#define BENCH_STREAM_PKTS 256
+
+typedef struct bench_case bench_case;
+
+struct bench_case {
+    //测试名称
+    const char *_name;
+    //测试参数描述
+    const char *_param;
+    //测试参数，例如负载字节数或元素个数
+    int _arg;
+    //准备测试数据，成功返回0
+    int (*_setup)(bench_case *bc);
+    //执行不少于n次操作，返回实际执行的操作次数
+    uint64_t (*_run)(bench_case *bc,uint64_t n);
+    //释放测试数据
+    void (*_teardown)(bench_case *bc);
+    //每次操作处理的字节数，0代表不统计吞吐量
+    uint64_t _bytes_per_op;
+    //测试数据
+    void *_state;
+};
+
+//防止编译器把测试代码优化掉
+static volatile uint64_t s_bench_sink = 0;
+
+static uint64_t bench_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//xorshift64，生成可复现的伪随机序列
+static uint64_t bench_rand(uint64_t *seed){
+    uint64_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *seed = x;
+    return x;
+}
+
+///////////////////////////////////////Mqtt_RecvPkt///////////////////////////////////////
+
+typedef struct {
+    struct MqttContext _ctx;
+    char *_stream;
+    //数据流原始内容，用于还原被解析器原地改写的topic
+    char *_origin;
+    int _len;
+    //每个数据包可变头在数据流中的偏移
+    int _var_head[BENCH_STREAM_PKTS];
+    //每个数据包可变头中需要还原的字节数
+    int _restore_len;
+} recv_state;
+
+static int recv_on_writev(void *arg,const struct iovec *iov,int iovcnt){
+    int i,len = 0;
+    for(i = 0 ; i < iovcnt ; ++i){
+        len += iov[i].iov_len;
+    }
+    s_bench_sink += len;
+    return len;
+}
+
+static int recv_on_publish(void *arg,uint16_t pkt_id,const char *topic,const char *payload,
+                           uint32_t payloadsize,int dup,enum MqttQosLevel qos,int retain){
+    s_bench_sink += pkt_id + payloadsize;
+    return 0;
+}
+
+static int recv_on_pub_ack(void *arg,uint16_t pkt_id){
+    s_bench_sink += pkt_id;
+    return 0;
+}
+
+/**
+ * 把缓冲区中的数据追加到连续内存
+ */
+static int recv_flatten(struct MqttBuffer *buf,char *out){
+    struct MqttExtent *ext;
+    int len = 0;
+    for(ext = buf->first_ext ; ext ; ext = ext->next){
+        memcpy(out + len,ext->payload,ext->len);
+        len += ext->len;
+    }
+    return len;
+}
+
+/**
+ * _arg为负载字节数，_param区分数据流类型：qos0发布、qos1发布(会回复PUBACK)、PUBACK
+ * Mqtt_RecvPkt会原地改写topic：qos0时把topic前移两个字节覆盖长度字段，
+ * qos1时把包id高字节改写成'\0'(包id取值1~255，改写后不变)，
+ * 所以qos0每轮解析前需要还原可变头的前几个字节，还原耗时计入测试结果(每个包十几个字节)
+ */
+static int recv_setup(bench_case *bc){
+    recv_state *state = (recv_state *)calloc(1, sizeof(recv_state));
+    int qos = !strcmp(bc->_param,"publish_qos1") ? 1 : 0;
+    int i;
+    bc->_state = state;
+    state->_ctx.user_data = state;
+    state->_ctx.writev_func = recv_on_writev;
+    state->_ctx.handle_publish = recv_on_publish;
+    state->_ctx.handle_pub_ack = recv_on_pub_ack;
+    state->_stream = (char *)malloc(BENCH_STREAM_PKTS * (bc->_arg + 64));
+    if(!strcmp(bc->_param,"puback")){
+        for(i = 0 ; i < BENCH_STREAM_PKTS ; ++i){
+            char *pkt = state->_stream + state->_len;
+            pkt[0] = MQTT_PKT_PUBACK << 4;
+            pkt[1] = 2;
+            pkt[2] = 0;
+            pkt[3] = i % 255 + 1;
+            state->_len += 4;
+        }
+        return 0;
+    }
+
+    char *payload = (char *)malloc(bc->_arg + 1);
+    memset(payload,'x',bc->_arg);
+    struct MqttBuffer buf;
+    MqttBuffer_Init(&buf);
+    for(i = 0 ; i < BENCH_STREAM_PKTS ; ++i){
+        if(MQTTERR_NOERROR != Mqtt_PackPublishPkt(&buf,i % 255 + 1,"bench/topic",payload,bc->_arg,
+                                                  (enum MqttQosLevel)qos,0,0)){
+            MqttBuffer_Destroy(&buf);
+            free(payload);
+            return -1;
+        }
+        int len = recv_flatten(&buf,state->_stream + state->_len);
+        //可变头在固定头(1字节类型+剩余长度)之后
+        state->_var_head[i] = state->_len + len - bc->_arg - (qos ? 2 : 0) - 2 - strlen("bench/topic");
+        state->_len += len;
+        MqttBuffer_Reset(&buf);
+    }
+    MqttBuffer_Destroy(&buf);
+    free(payload);
+    if(!qos){
+        state->_restore_len = 2 + strlen("bench/topic");
+        state->_origin = (char *)malloc(state->_len);
+        memcpy(state->_origin,state->_stream,state->_len);
+    }
+    bc->_bytes_per_op = state->_len / BENCH_STREAM_PKTS;
+    return 0;
+}
+
+static uint64_t recv_run(bench_case *bc,uint64_t n){
+    recv_state *state = (recv_state *)bc->_state;
+    uint64_t done = 0;
+    int customed;
+    int i;
+    while(done < n){
+        for(i = 0 ; state->_restore_len && i < BENCH_STREAM_PKTS ; ++i){
+            memcpy(state->_stream + state->_var_head[i],state->_origin + state->_var_head[i],state->_restore_len);
+        }
+        if(MQTTERR_NOERROR != Mqtt_RecvPkt(&state->_ctx,state->_stream,state->_len,&customed) ||
+           customed != state->_len){
+            LOGE("parse synthetic stream failed");
+            return 0;
+        }
+        done += BENCH_STREAM_PKTS;
+    }
+    return done;
+}
+
+static void recv_teardown(bench_case *bc){
+    recv_state *state = (recv_state *)bc->_state;
+    free(state->_stream);
+    free(state->_origin);
+    free(state);
+}
+
+///////////////////////////////////////Mqtt_PackPublishPkt///////////////////////////////////////
+
+typedef struct {
+    struct MqttBuffer _buf;
+    char *_payload;
+    //是否拷贝负载(批量发送模式)
+    int _own;
+} pack_state;
+
+static int pack_setup(bench_case *bc){
+    pack_state *state = (pack_state *)calloc(1, sizeof(pack_state));
+    bc->_state = state;
+    MqttBuffer_Init(&state->_buf);
+    state->_payload = (char *)malloc(bc->_arg + 1);
+    memset(state->_payload,'x',bc->_arg);
+    //reference模式只引用负载，不统计吞吐量
+    state->_own = !strcmp(bc->_param,"copy");
+    bc->_bytes_per_op = state->_own ? bc->_arg : 0;
+    return 0;
+}
+
+static uint64_t pack_run(bench_case *bc,uint64_t n){
+    pack_state *state = (pack_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        if(MQTTERR_NOERROR != Mqtt_PackPublishPkt(&state->_buf,(uint16_t)(i % 65535 + 1),"bench/topic",
+                                                  state->_payload,bc->_arg,MQTT_QOS_LEVEL1,0,state->_own)){
+            return 0;
+        }
+        s_bench_sink += state->_buf.buffered_bytes;
+        //与发送缓冲区一致，保留第一个内存块给下一个数据包
+        MqttBuffer_ResetRetain(&state->_buf);
+    }
+    return n;
+}
+
+static void pack_teardown(bench_case *bc){
+    pack_state *state = (pack_state *)bc->_state;
+    MqttBuffer_Destroy(&state->_buf);
+    free(state->_payload);
+    free(state);
+}
+
+///////////////////////////////////////共享负载扇出///////////////////////////////////////
+
+//每条数据发布到的主题个数
+#define FANOUT_TOPICS 4
+
+static const char *s_fanout_topics[FANOUT_TOPICS] = {"bench/1","bench/2","bench/3","bench/4"};
+
+typedef struct {
+    struct MqttBuffer _buf;
+    //qos1消息的重发存储
+    mqtt_inflight _inflight;
+    char *_payload;
+    //是否使用共享负载
+    int _shared;
+} fanout_state;
+
+/**
+ * 一次操作把一条数据以qos1发布到多个主题，包括保存重发副本以及收到确认后删除，与mqtt_send_publish流程一致
+ * copy模式每个主题拷贝负载两次(发送缓冲区与重发存储)，shared模式只在创建共享负载时拷贝一次
+ */
+static int fanout_setup(bench_case *bc){
+    fanout_state *state = (fanout_state *)calloc(1, sizeof(fanout_state));
+    bc->_state = state;
+    MqttBuffer_Init(&state->_buf);
+    mqtt_inflight_init(&state->_inflight);
+    state->_payload = (char *)malloc(bc->_arg + 1);
+    memset(state->_payload,'x',bc->_arg);
+    state->_shared = !strcmp(bc->_param,"shared");
+    bc->_bytes_per_op = bc->_arg;
+    return 0;
+}
+
+static uint64_t fanout_run(bench_case *bc,uint64_t n){
+    fanout_state *state = (fanout_state *)bc->_state;
+    struct MqttExtent *cursor;
+    uint64_t i;
+    int k;
+    for(i = 0 ; i < n ; ++i){
+        struct MqttPayload *shared = state->_shared ? MqttPayload_Create(state->_payload,bc->_arg) : NULL;
+        if(state->_shared && !shared){
+            return 0;
+        }
+        for(k = 0 ; k < FANOUT_TOPICS ; ++k){
+            uint16_t pkt_id = (uint16_t)(k + 1);
+            int ret = shared ? Mqtt_PackPublishPktShared(&state->_buf,pkt_id,s_fanout_topics[k],shared,MQTT_QOS_LEVEL1,0) :
+                               Mqtt_PackPublishPkt(&state->_buf,pkt_id,s_fanout_topics[k],state->_payload,bc->_arg,MQTT_QOS_LEVEL1,0,1);
+            if(MQTTERR_NOERROR != ret){
+                MqttPayload_Release(shared);
+                return 0;
+            }
+            //共享负载是最后一个数据块，重发存储只保存引用
+            struct MqttExtent *end = shared ? state->_buf.last_ext : NULL;
+            uint32_t len = 0;
+            for(cursor = state->_buf.first_ext ; cursor != end ; cursor = cursor->next){
+                len += cursor->len;
+            }
+            char *copy = mqtt_inflight_reserve_shared(&state->_inflight,pkt_id,len,shared);
+            if(!copy){
+                MqttPayload_Release(shared);
+                return 0;
+            }
+            for(cursor = state->_buf.first_ext ; cursor != end ; cursor = cursor->next){
+                memcpy(copy,cursor->payload,cursor->len);
+                copy += cursor->len;
+            }
+            s_bench_sink += state->_buf.buffered_bytes;
+            MqttBuffer_ResetRetain(&state->_buf);
+        }
+        MqttPayload_Release(shared);
+        //模拟收到确认
+        for(k = 0 ; k < FANOUT_TOPICS ; ++k){
+            mqtt_inflight_remove(&state->_inflight,(uint16_t)(k + 1));
+        }
+    }
+    return n;
+}
+
+static void fanout_teardown(bench_case *bc){
+    fanout_state *state = (fanout_state *)bc->_state;
+    MqttBuffer_Destroy(&state->_buf);
+    mqtt_inflight_release(&state->_inflight);
+    free(state->_payload);
+    free(state);
+}
+
+///////////////////////////////////////MqttBuffer_AllocExtent///////////////////////////////////////
+
+//每申请这么多次后重置一次缓冲区，模拟一个数据包的生命周期
+#define EXTENT_PER_RESET 64
+
+static int extent_setup(bench_case *bc){
+    struct MqttBuffer *buf = (struct MqttBuffer *)calloc(1, sizeof(struct MqttBuffer));
+    bc->_state = buf;
+    MqttBuffer_Init(buf);
+    return 0;
+}
+
+static uint64_t extent_run(bench_case *bc,uint64_t n){
+    struct MqttBuffer *buf = (struct MqttBuffer *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        struct MqttExtent *ext = MqttBuffer_AllocExtent(buf,bc->_arg);
+        if(!ext){
+            return 0;
+        }
+        MqttBuffer_AppendExtent(buf,ext);
+        if(i % EXTENT_PER_RESET == EXTENT_PER_RESET - 1){
+            s_bench_sink += buf->buffered_bytes;
+            MqttBuffer_Reset(buf);
+        }
+    }
+    MqttBuffer_Reset(buf);
+    return n;
+}
+
+static void extent_teardown(bench_case *bc){
+    MqttBuffer_Destroy((struct MqttBuffer *)bc->_state);
+    free(bc->_state);
+}
+
+///////////////////////////////////////buffer_append///////////////////////////////////////
+
+//再追加就超过该大小时释放缓冲区，从头开始增长
+#define APPEND_GROW_TO (64 * 1024)
+
+typedef struct {
+    buffer _buf;
+    byte_buffer _bytes;
+    char *_chunk;
+} append_state;
+
+static int append_setup(bench_case *bc){
+    append_state *state = (append_state *)calloc(1, sizeof(append_state));
+    bc->_state = state;
+    buffer_init(&state->_buf);
+    byte_buffer_init(&state->_bytes);
+    state->_chunk = (char *)malloc(bc->_arg);
+    memset(state->_chunk,'x',bc->_arg);
+    bc->_bytes_per_op = bc->_arg;
+    return 0;
+}
+
+static uint64_t append_run(bench_case *bc,uint64_t n){
+    append_state *state = (append_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        if(0 != buffer_append(&state->_buf,state->_chunk,bc->_arg)){
+            return 0;
+        }
+        if(state->_buf._len + bc->_arg > APPEND_GROW_TO){
+            s_bench_sink += state->_buf._len;
+            buffer_release(&state->_buf);
+        }
+    }
+    buffer_release(&state->_buf);
+    return n;
+}
+
+static uint64_t byte_append_run(bench_case *bc,uint64_t n){
+    append_state *state = (append_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        if(0 != byte_buffer_append(&state->_bytes,state->_chunk,bc->_arg)){
+            return 0;
+        }
+        if(byte_buffer_size(&state->_bytes) + bc->_arg > APPEND_GROW_TO){
+            s_bench_sink += byte_buffer_size(&state->_bytes);
+            byte_buffer_release(&state->_bytes);
+        }
+    }
+    byte_buffer_release(&state->_bytes);
+    return n;
+}
+
+/**
+ * 模拟接收数据流：每次追加一块数据，然后从头部消费同样多的数据，缓存中始终残留半块数据
+ */
+static uint64_t byte_stream_run(bench_case *bc,uint64_t n){
+    append_state *state = (append_state *)bc->_state;
+    uint64_t i;
+    byte_buffer_append(&state->_bytes,state->_chunk,bc->_arg / 2);
+    for(i = 0 ; i < n ; ++i){
+        if(0 != byte_buffer_append(&state->_bytes,state->_chunk,bc->_arg)){
+            return 0;
+        }
+        s_bench_sink += (uint8_t)byte_buffer_data(&state->_bytes)[0];
+        byte_buffer_consume(&state->_bytes,bc->_arg);
+    }
+    byte_buffer_release(&state->_bytes);
+    return n;
+}
+
+static void append_teardown(bench_case *bc){
+    append_state *state = (append_state *)bc->_state;
+    buffer_release(&state->_buf);
+    byte_buffer_release(&state->_bytes);
+    free(state->_chunk);
+    free(state);
+}
+
+///////////////////////////////////////base64///////////////////////////////////////
+
+typedef struct {
+    uint8_t *_raw;
+    char *_encoded;
+    int _encoded_len;
+    uint8_t *_decoded;
+} base64_state;
+
+static int base64_setup(bench_case *bc){
+    base64_state *state = (base64_state *)calloc(1, sizeof(base64_state));
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    int i;
+    bc->_state = state;
+    state->_raw = (uint8_t *)malloc(bc->_arg);
+    state->_encoded = (char *)malloc(AV_BASE64_SIZE(bc->_arg));
+    state->_decoded = (uint8_t *)malloc(bc->_arg);
+    for(i = 0 ; i < bc->_arg ; ++i){
+        state->_raw[i] = (uint8_t)bench_rand(&seed);
+    }
+    av_base64_encode(state->_encoded,AV_BASE64_SIZE(bc->_arg),state->_raw,bc->_arg);
+    state->_encoded_len = strlen(state->_encoded);
+    if(bc->_arg != av_base64_decode(state->_decoded,bc->_arg,state->_encoded,state->_encoded_len) ||
+       memcmp(state->_raw,state->_decoded,bc->_arg)){
+        LOGE("base64 round trip failed");
+        return -1;
+    }
+    bc->_bytes_per_op = bc->_arg;
+    return 0;
+}
+
+static uint64_t base64_encode_run(bench_case *bc,uint64_t n){
+    base64_state *state = (base64_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        s_bench_sink += (uintptr_t)av_base64_encode(state->_encoded,AV_BASE64_SIZE(bc->_arg),state->_raw,bc->_arg);
+    }
+    return n;
+}
+
+static uint64_t base64_decode_run(bench_case *bc,uint64_t n){
+    base64_state *state = (base64_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        s_bench_sink += av_base64_decode(state->_decoded,bc->_arg,state->_encoded,state->_encoded_len);
+    }
+    return n;
+}
+
+static void base64_teardown(bench_case *bc){
+    base64_state *state = (base64_state *)bc->_state;
+    free(state->_raw);
+    free(state->_encoded);
+    free(state->_decoded);
+    free(state);
+}
+
+///////////////////////////////////////iot_proto///////////////////////////////////////
+
+typedef struct {
+    iot_data_type _type;
+    unsigned char *_content;
+    int _content_len;
+    unsigned char _packet[1024];
+    int _packet_len;
+} iot_state;
+
+/**
+ * _arg为0时打包双精度浮点数，否则打包_arg字节的字符串
+ */
+static int iot_setup(bench_case *bc){
+    iot_state *state = (iot_state *)calloc(1, sizeof(iot_state));
+    bc->_state = state;
+    if(bc->_arg){
+        state->_type = iot_string;
+        state->_content_len = bc->_arg;
+        state->_content = (unsigned char *)malloc(bc->_arg + 1);
+        memset(state->_content,'x',bc->_arg);
+        state->_content[bc->_arg] = '\0';
+    }else{
+        double num = 3.1415926;
+        state->_type = iot_double;
+        state->_content_len = sizeof(num);
+        state->_content = (unsigned char *)malloc(sizeof(num));
+        memcpy(state->_content,&num, sizeof(num));
+    }
+    state->_packet_len = pack_iot_packet(1,1,1,100,state->_type,state->_content,state->_content_len,
+                                         state->_packet, sizeof(state->_packet));
+    if(state->_packet_len <= 0){
+        return -1;
+    }
+    bc->_bytes_per_op = state->_packet_len;
+    return 0;
+}
+
+static uint64_t iot_pack_run(bench_case *bc,uint64_t n){
+    iot_state *state = (iot_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        s_bench_sink += pack_iot_packet(1,1,(uint32_t)i,100,state->_type,state->_content,state->_content_len,
+                                        state->_packet, sizeof(state->_packet));
+    }
+    return n;
+}
+
+static uint64_t iot_unpack_run(bench_case *bc,uint64_t n){
+    iot_state *state = (iot_state *)bc->_state;
+    uint8_t req_flag;
+    uint32_t req_id,tag_id;
+    iot_data_type type;
+    const unsigned char *content;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        int ret = unpack_iot_packet(&req_flag,&req_id,&tag_id,&type,state->_packet,state->_packet_len,&content);
+        if(ret <= 0){
+            return 0;
+        }
+        s_bench_sink += ret + tag_id;
+    }
+    return n;
+}
+
+static void iot_teardown(bench_case *bc){
+    iot_state *state = (iot_state *)bc->_state;
+    free(state->_content);
+    free(state);
+}
+
+///////////////////////////////////////hash_table/avl_tree///////////////////////////////////////
+
+typedef struct {
+    //乱序的键，键值直接存放在指针里面
+    uintptr_t *_keys;
+    HashTable *_table;
+    AVLTree *_tree;
+} container_state;
+
+static unsigned int bench_key_hash(HashTableKey key){
+    return (unsigned int)(((uintptr_t)key * 2654435761U) >> 7);
+}
+
+static int bench_key_equal(HashTableKey key1,HashTableKey key2){
+    return key1 == key2;
+}
+
+static int bench_key_compare(AVLTreeKey key1,AVLTreeKey key2){
+    uintptr_t k1 = (uintptr_t)key1,k2 = (uintptr_t)key2;
+    return k1 < k2 ? -1 : (k1 > k2 ? 1 : 0);
+}
+
+static int container_fill(bench_case *bc){
+    container_state *state = (container_state *)bc->_state;
+    int i;
+    if(!strncmp(bc->_name,"hash_table",10)){
+        state->_table = hash_table_new(bench_key_hash,bench_key_equal);
+        if(!state->_table){
+            return -1;
+        }
+        for(i = 0 ; i < bc->_arg ; ++i){
+            if(!hash_table_insert(state->_table,(HashTableKey)state->_keys[i],(HashTableValue)state->_keys[i])){
+                return -1;
+            }
+        }
+    }else{
+        state->_tree = avl_tree_new(bench_key_compare);
+        if(!state->_tree){
+            return -1;
+        }
+        for(i = 0 ; i < bc->_arg ; ++i){
+            if(!avl_tree_insert(state->_tree,(AVLTreeKey)state->_keys[i],(AVLTreeValue)state->_keys[i],NULL,NULL)){
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void container_clear(container_state *state){
+    if(state->_table){
+        hash_table_free(state->_table);
+        state->_table = NULL;
+    }
+    if(state->_tree){
+        avl_tree_free(state->_tree);
+        state->_tree = NULL;
+    }
+}
+
+/**
+ * _arg为元素个数，键为不重复的非0随机数
+ */
+static int container_setup(bench_case *bc){
+    container_state *state = (container_state *)calloc(1, sizeof(container_state));
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    int i;
+    bc->_state = state;
+    state->_keys = (uintptr_t *)malloc(bc->_arg * sizeof(uintptr_t));
+    for(i = 0 ; i < bc->_arg ; ++i){
+        //低位保证不重复，高位打乱顺序
+        state->_keys[i] = (uintptr_t)((bench_rand(&seed) & 0x7FFF0000) | (uint32_t)(i + 1));
+    }
+    if(strstr(bc->_name,"lookup")){
+        //查找测试预先插入全部元素
+        return container_fill(bc);
+    }
+    return 0;
+}
+
+static uint64_t container_insert_run(bench_case *bc,uint64_t n){
+    container_state *state = (container_state *)bc->_state;
+    uint64_t done = 0;
+    while(done < n){
+        if(0 != container_fill(bc)){
+            return 0;
+        }
+        container_clear(state);
+        done += bc->_arg;
+    }
+    return done;
+}
+
+static uint64_t container_lookup_run(bench_case *bc,uint64_t n){
+    container_state *state = (container_state *)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        //以质数步长跳跃查找，避免连续命中同一条缓存线
+        HashTableKey key = (HashTableKey)state->_keys[(i * 7919) % bc->_arg];
+        void *value = state->_table ? hash_table_lookup(state->_table,key) : avl_tree_lookup(state->_tree,key);
+        if(value != key){
+            LOGE("lookup miss:%p",key);
+            return 0;
+        }
+        s_bench_sink += (uintptr_t)value;
+    }
+    return n;
+}
+
+static void container_teardown(bench_case *bc){
+    container_state *state = (container_state *)bc->_state;
+    container_clear(state);
+    free(state->_keys);
+    free(state);
+}
+
+///////////////////////////////////////jimi_malloc///////////////////////////////////////
+
+//同时存活的对象个数
+#define ALLOC_LIVE_COUNT 1024
+
+/**
+ * 模拟长期运行时小对象的分配释放，每次释放最早的一个对象再开辟一个新对象，_arg为对象字节数
+ */
+static int alloc_setup(bench_case *bc){
+    void **live = (void **)calloc(ALLOC_LIVE_COUNT, sizeof(void *));
+    int i;
+    bc->_state = live;
+    if(!live){
+        return -1;
+    }
+    for(i = 0 ; i < ALLOC_LIVE_COUNT ; ++i){
+        live[i] = jimi_malloc(bc->_arg);
+        if(!live[i]){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t alloc_run(bench_case *bc,uint64_t n){
+    void **live = (void **)bc->_state;
+    uint64_t i;
+    for(i = 0 ; i < n ; ++i){
+        void **slot = &live[i % ALLOC_LIVE_COUNT];
+        jimi_free(*slot);
+        //大小上下浮动，避免总是命中同一个规格
+        *slot = jimi_malloc(bc->_arg + (int)(i & 7) * 4);
+        if(!*slot){
+            return 0;
+        }
+        *(char *)*slot = (char)i;
+    }
+    return n;
+}
+
+static void alloc_teardown(bench_case *bc){
+    void **live = (void **)bc->_state;
+    int i;
+    if(!live){
+        return;
+    }
+    for(i = 0 ; i < ALLOC_LIVE_COUNT ; ++i){
+        jimi_free(live[i]);
+    }
+    free(live);
+}
+
+///////////////////////////////////////测试框架///////////////////////////////////////
+
+#define RECV_CASE(param,size) {"mqtt_recv_pkt",param,size,recv_setup,recv_run,recv_teardown}
+#define PACK_CASE(param,size) {"mqtt_pack_publish",param,size,pack_setup,pack_run,pack_teardown}
+#define FANOUT_CASE(param,size) {"mqtt_publish_fanout",param,size,fanout_setup,fanout_run,fanout_teardown}
+#define EXTENT_CASE(param,size) {"mqtt_buffer_alloc_extent",param,size,extent_setup,extent_run,extent_teardown}
+#define APPEND_CASE(name,run,param,size) {name,param,size,append_setup,run,append_teardown}
+#define BASE64_CASE(name,run,param,size) {name,param,size,base64_setup,run,base64_teardown}
+#define IOT_CASE(name,run,param,size) {name,param,size,iot_setup,run,iot_teardown}
+#define CONTAINER_CASE(name,run,param,size) {name,param,size,container_setup,run,container_teardown}
+#define ALLOC_CASE(param,size) {"jimi_malloc_free",param,size,alloc_setup,alloc_run,alloc_teardown}
+
+static bench_case s_cases[] = {
+        RECV_CASE("publish_qos0",16),
+        RECV_CASE("publish_qos0",256),
+        RECV_CASE("publish_qos0",4096),
+        RECV_CASE("publish_qos1",256),
+        RECV_CASE("puback",0),
+        PACK_CASE("reference",16),
+        PACK_CASE("reference",4096),
+        PACK_CASE("copy",16),
+        PACK_CASE("copy",256),
+        PACK_CASE("copy",4096),
+        PACK_CASE("copy",65536),
+        FANOUT_CASE("copy",256),
+        FANOUT_CASE("copy",4096),
+        FANOUT_CASE("shared",256),
+        FANOUT_CASE("shared",4096),
+        EXTENT_CASE("size",16),
+        EXTENT_CASE("size",256),
+        EXTENT_CASE("size",2048),
+        APPEND_CASE("buffer_append",append_run,"chunk",16),
+        APPEND_CASE("buffer_append",append_run,"chunk",256),
+        APPEND_CASE("buffer_append",append_run,"chunk",4096),
+        APPEND_CASE("byte_buffer_append",byte_append_run,"chunk",16),
+        APPEND_CASE("byte_buffer_append",byte_append_run,"chunk",256),
+        APPEND_CASE("byte_buffer_append",byte_append_run,"chunk",4096),
+        APPEND_CASE("byte_buffer_stream",byte_stream_run,"chunk",16),
+        APPEND_CASE("byte_buffer_stream",byte_stream_run,"chunk",1024),
+        BASE64_CASE("base64_encode",base64_encode_run,"size",48),
+        BASE64_CASE("base64_encode",base64_encode_run,"size",1024),
+        BASE64_CASE("base64_decode",base64_decode_run,"size",48),
+        BASE64_CASE("base64_decode",base64_decode_run,"size",1024),
+        IOT_CASE("iot_pack",iot_pack_run,"double",0),
+        IOT_CASE("iot_pack",iot_pack_run,"string",32),
+        IOT_CASE("iot_unpack",iot_unpack_run,"double",0),
+        IOT_CASE("iot_unpack",iot_unpack_run,"string",32),
+        CONTAINER_CASE("hash_table_insert",container_insert_run,"count",1024),
+        CONTAINER_CASE("hash_table_insert",container_insert_run,"count",65536),
+        CONTAINER_CASE("hash_table_lookup",container_lookup_run,"count",1024),
+        CONTAINER_CASE("hash_table_lookup",container_lookup_run,"count",65536),
+        CONTAINER_CASE("avl_tree_insert",container_insert_run,"count",1024),
+        CONTAINER_CASE("avl_tree_insert",container_insert_run,"count",65536),
+        CONTAINER_CASE("avl_tree_lookup",container_lookup_run,"count",1024),
+        CONTAINER_CASE("avl_tree_lookup",container_lookup_run,"count",65536),
+        ALLOC_CASE("size",24),
+        ALLOC_CASE("size",64),
+        ALLOC_CASE("size",256),
+};
+
+/**
+ * 执行一轮测试
+ * @return 执行的操作次数，失败返回0
+ */
+static uint64_t bench_measure(bench_case *bc,uint64_t n,uint64_t *elapsed_ns){
+    uint64_t start = bench_now_ns();
+    uint64_t done = bc->_run(bc,n);
+    *elapsed_ns = bench_now_ns() - start;
+    return done;
+}
+
+/**
+ * 执行一个测试项并输出json对象
+ * @return 0为成功
+ */
+static int bench_run_case(bench_case *bc,uint64_t min_ns,int repeat,int first){
+    uint64_t n = 1,done = 0,elapsed = 0;
+    double best = 0,total_ns = 0;
+    uint64_t total_ops = 0;
+    int i;
+
+    if(0 != bc->_setup(bc)){
+        fprintf(stderr,"setup %s/%s:%d failed\n",bc->_name,bc->_param,bc->_arg);
+        bc->_teardown(bc);
+        return -1;
+    }
+
+    //放大迭代次数直到单轮耗时达到最短测量时间
+    while(1){
+        done = bench_measure(bc,n,&elapsed);
+        if(!done){
+            break;
+        }
+        if(elapsed >= min_ns){
+            break;
+        }
+        uint64_t next = elapsed ? (uint64_t)((double)done * min_ns * 1.2 / elapsed) : done * 100;
+        n = next > done * 100 ? done * 100 : (next <= done ? done + 1 : next);
+    }
+
+    for(i = 0 ; done && i < repeat ; ++i){
+        done = bench_measure(bc,n,&elapsed);
+        if(done){
+            double ns_per_op = (double)elapsed / done;
+            if(!i || ns_per_op < best){
+                best = ns_per_op;
+            }
+            total_ns += elapsed;
+            total_ops += done;
+        }
+    }
+    bc->_teardown(bc);
+    if(!done){
+        fprintf(stderr,"run %s/%s:%d failed\n",bc->_name,bc->_param,bc->_arg);
+        return -1;
+    }
+
+    double mean = total_ns / total_ops;
+    printf("%s\n    {\"name\": \"%s\", \"param\": \"%s\", \"arg\": %d, \"iterations\": %llu, "
+           "\"ns_per_op\": %.3f, \"ns_per_op_mean\": %.3f, \"ops_per_sec\": %.0f, \"mb_per_sec\": %.3f}",
+           first ? "" : ",",
+           bc->_name,
+           bc->_param,
+           bc->_arg,
+           (unsigned long long)total_ops,
+           best,
+           mean,
+           1e9 / best,
+           bc->_bytes_per_op ? bc->_bytes_per_op * 1e9 / best / (1024 * 1024) : 0.0);
+    fflush(stdout);
+    return 0;
+}
+
+//日志输出到标准错误，避免破坏json输出
+static int bench_log_printf(const char *fmt,...){
+    va_list ap;
+    int ret;
+    va_start(ap,fmt);
+    ret = vfprintf(stderr,fmt,ap);
+    va_end(ap);
+    return ret;
+}
+
+static void bench_usage(){
+    fprintf(stderr,"使用方法: bench [-f 名称过滤] [-t 每轮最短测量毫秒数(默认200)] [-r 重复轮数(默认3)] [-s 启用slab分配器] [-l 列出测试项]\n");
+}
+
+int main(int argc,char *argv[]){
+    const char *filter = NULL;
+    int min_ms = 200;
+    int repeat = 3;
+    int list = 0;
+    int slab = 0;
+    int failed = 0,first = 1;
+    int opt;
+    size_t i;
+
+    set_log_level(log_error);
+    set_printf_ptr(bench_log_printf);
+    while((opt = getopt(argc,argv,"f:t:r:slh")) != -1){
+        switch(opt){
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                min_ms = atoi(optarg);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case 's':
+                slab = 1;
+                break;
+            case 'l':
+                list = 1;
+                break;
+            default:
+                bench_usage();
+                return -1;
+        }
+    }
+    if(min_ms <= 0 || repeat <= 0){
+        bench_usage();
+        return -1;
+    }
+
+    if(list){
+        for(i = 0 ; i < sizeof(s_cases) / sizeof(s_cases[0]) ; ++i){
+            printf("%s/%s:%d\n",s_cases[i]._name,s_cases[i]._param,s_cases[i]._arg);
+        }
+        return 0;
+    }
+
+    if(slab && 0 != jimi_slab_init(NULL,0,JIMI_SLAB_THREAD_CACHE)){
+        return -1;
+    }
+
+    printf("{\n  \"min_time_ms\": %d,\n  \"repeat\": %d,\n  \"allocator\": \"%s\",\n  \"benchmarks\": [",min_ms,repeat,slab ? "slab" : "system");
+    for(i = 0 ; i < sizeof(s_cases) / sizeof(s_cases[0]) ; ++i){
+        bench_case *bc = s_cases + i;
+        if(filter && !strstr(bc->_name,filter)){
+            continue;
+        }
+        if(0 != bench_run_case(bc,(uint64_t)min_ms * 1000000,repeat,first)){
+            ++failed;
+            continue;
+        }
+        first = 0;
+    }
+    printf("\n  ],\n  \"failed\": %d\n}\n",failed);
+    if(slab){
+        jimi_slab_release();
+    }
+    return failed ? 1 : 0;
+}
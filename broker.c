@@ -0,0 +1,957 @@
+//
+// Created by xzl on 2019/7/20.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "jimi_event_loop.h"
+#include "jimi_log.h"
+#include "jimi_memory.h"
+#include "mqtt.h"
+#include "mqtt_topic_router.h"
+#include "hash-table.h"
+
+/**
+ * 本地mqtt broker，用于离线测试以及吞吐量、延时、重连等性能测试
+ * 基于mqtt.c编解码以及事件循环，支持CONNECT/SUBSCRIBE/UNSUBSCRIBE/PUBLISH(qos0~2)、保留消息以及遗嘱消息；
+ * 不保存会话，clean_session为0时也按新会话处理
+ * 可以模拟网络延时(broker发出的所有数据包延迟指定毫秒数后发送)以及丢包(按比例丢弃收到的PUBLISH，既不转发也不回复)，
+ * 丢包使用固定种子的伪随机数，相同的输入得到相同的结果
+ * 使用方法: broker [-p 端口] [-a 监听地址] [-d 延时毫秒] [-l 丢包百分比] [-s 随机数种子] [-i 统计间隔秒数] [-e auto|epoll|uring]
+ */
+
+//所有连接共用的接收缓冲区大小
+#define BROKER_INPUT_SIZE (64 * 1024)
+//发送缓冲区已发送部分超过此大小时前移剩余数据
+#define BROKER_COMPACT_SIZE (16 * 1024)
+
+typedef struct broker broker;
+typedef struct broker_conn broker_conn;
+
+/**
+ * 一个连接的一个订阅
+ */
+typedef struct {
+    broker_conn *_conn;
+    char *_filter;
+    uint32_t _route;
+    int _qos;
+} broker_sub;
+
+/**
+ * 保留消息
+ */
+typedef struct {
+    char *_topic;
+    char *_payload;
+    uint32_t _len;
+    int _qos;
+} broker_retained;
+
+/**
+ * 延迟发送的数据，_end为其在发送缓冲区中的末尾位置
+ */
+typedef struct {
+    uint64_t _due_ms;
+    uint32_t _end;
+} broker_delay;
+
+struct broker_conn {
+    broker *_broker;
+    event_session *_session;
+    struct MqttContext _ctx;
+    struct MqttParser _parser;
+    //登录成功后才有
+    char *_client_id;
+    int _connected;
+    //已经调用event_session_close
+    int _closing;
+    //心跳间隔，单位秒，0代表不检查
+    int _keep_alive;
+    uint64_t _last_recv_ms;
+    //遗嘱消息，收到DISCONNECT后清除
+    char *_will_topic;
+    char *_will_msg;
+    uint16_t _will_len;
+    int _will_qos;
+    int _will_retain;
+    //订阅列表
+    broker_sub **_subs;
+    uint32_t _sub_count;
+    uint32_t _sub_capacity;
+    //本次接收的数据中新增的订阅，处理完毕后发送匹配的保留消息(在SUBACK之后)
+    broker_sub **_new_subs;
+    uint32_t _new_sub_count;
+    uint32_t _new_sub_capacity;
+    //收到qos2消息但是还没收到PUBREL的包id，用于丢弃重发的消息
+    uint16_t *_qos2_ids;
+    uint32_t _qos2_count;
+    uint32_t _qos2_capacity;
+    uint16_t _pkt_id;
+    //发送缓冲区，[_out_sent,_out_ready)为可以发送的数据，[_out_ready,_out_len)为延迟发送的数据
+    char *_out;
+    uint32_t _out_len;
+    uint32_t _out_capacity;
+    uint32_t _out_sent;
+    uint32_t _out_ready;
+    //延迟发送的数据队列
+    broker_delay *_delays;
+    uint32_t _delay_head;
+    uint32_t _delay_tail;
+    uint32_t _delay_capacity;
+    //待发送链表
+    broker_conn *_next_flush;
+    int _flushing;
+    //所有连接的双向链表
+    broker_conn *_prev;
+    broker_conn *_next;
+};
+
+struct broker {
+    event_loop *_loop;
+    int _listen_fd;
+    pthread_t _accept_thread;
+    //accept线程投递过来的套接字
+    pthread_mutex_t _mutex;
+    int *_pending;
+    uint32_t _pending_count;
+    uint32_t _pending_capacity;
+    //所有订阅
+    mqtt_topic_router _router;
+    //client_id -> broker_conn
+    HashTable *_clients;
+    //topic -> broker_retained
+    HashTable *_retained;
+    broker_conn *_conns;
+    broker_conn *_flush;
+    uint32_t _auto_id;
+    int _stopping;
+    //模拟网络
+    int _delay_ms;
+    double _loss;
+    uint64_t _rand;
+    //统计
+    uint64_t _received;
+    uint64_t _dropped;
+    uint64_t _delivered;
+    int _stats_ms;
+    char _input[BROKER_INPUT_SIZE];
+};
+
+static event_loop *s_loop = NULL;
+
+static uint64_t broker_now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * xorshift64伪随机数，返回[0,1)
+ */
+static double broker_random(broker *broker){
+    uint64_t x = broker->_rand;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    broker->_rand = x;
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned int broker_hash_string(HashTableKey key){
+    const char *str = (const char *)key;
+    unsigned int hash = 2166136261u;
+    while(*str){
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+static int broker_equal_string(HashTableKey key1,HashTableKey key2){
+    return 0 == strcmp((const char *)key1,(const char *)key2);
+}
+
+/**
+ * 保证数组至少能容纳count个元素
+ * @return 0为成功
+ */
+static int broker_reserve(void **array,uint32_t *capacity,uint32_t count,uint32_t size){
+    if(count <= *capacity){
+        return 0;
+    }
+    uint32_t new_capacity = *capacity ? *capacity : 8;
+    while(new_capacity < count){
+        new_capacity *= 2;
+    }
+    void *ptr = *array ? jimi_realloc(*array,new_capacity * size) : jimi_malloc(new_capacity * size);
+    if(!ptr){
+        LOGE("out of memory:%d",new_capacity * size);
+        return -1;
+    }
+    *array = ptr;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static void broker_conn_close(broker_conn *conn){
+    if(!conn->_closing){
+        conn->_closing = 1;
+        event_session_close(conn->_session);
+    }
+}
+
+/**
+ * 发送可以发送的数据，发送缓冲区满时等待可写
+ * @return 0为成功，-1为失败
+ */
+static int broker_conn_flush(broker_conn *conn){
+    uint64_t now = conn->_delay_head != conn->_delay_tail ? broker_now_ms() : 0;
+    while(conn->_delay_head != conn->_delay_tail && conn->_delays[conn->_delay_head]._due_ms <= now){
+        conn->_out_ready = conn->_delays[conn->_delay_head++]._end;
+    }
+    if(conn->_delay_head == conn->_delay_tail){
+        conn->_delay_head = conn->_delay_tail = 0;
+    }
+    while(conn->_out_sent < conn->_out_ready){
+        struct iovec iov;
+        iov.iov_base = conn->_out + conn->_out_sent;
+        iov.iov_len = conn->_out_ready - conn->_out_sent;
+        int ret = event_session_write(conn->_session,&iov,1);
+        if(ret < 0){
+            return -1;
+        }
+        if(ret == 0){
+            break;
+        }
+        conn->_out_sent += ret;
+    }
+    if(conn->_out_sent == conn->_out_len){
+        conn->_out_len = conn->_out_ready = conn->_out_sent = 0;
+    }else if(conn->_out_sent > BROKER_COMPACT_SIZE){
+        uint32_t i;
+        memmove(conn->_out,conn->_out + conn->_out_sent,conn->_out_len - conn->_out_sent);
+        for(i = conn->_delay_head ; i < conn->_delay_tail ; ++i){
+            conn->_delays[i]._end -= conn->_out_sent;
+        }
+        conn->_out_len -= conn->_out_sent;
+        conn->_out_ready -= conn->_out_sent;
+        conn->_out_sent = 0;
+    }
+    return 0;
+}
+
+/**
+ * 发送本轮所有连接新增的数据
+ */
+static void broker_flush_all(broker *broker){
+    while(broker->_flush){
+        broker_conn *conn = broker->_flush;
+        broker->_flush = conn->_next_flush;
+        conn->_flushing = 0;
+        if(conn->_closing){
+            continue;
+        }
+        if(0 != broker_conn_flush(conn)){
+            broker_conn_close(conn);
+            continue;
+        }
+        if(conn->_delay_head != conn->_delay_tail){
+            //更新延迟发送的定时器
+            event_session_refresh(conn->_session);
+        }
+    }
+}
+
+/**
+ * 编解码器的输出回调，数据先拷贝到发送缓冲区，本轮处理完毕后统一发送
+ */
+static int broker_conn_writev(void *arg,const struct iovec *iov,int iovcnt){
+    broker_conn *conn = (broker_conn *)arg;
+    broker *broker = conn->_broker;
+    uint32_t total = 0;
+    int i;
+    for(i = 0 ; i < iovcnt ; ++i){
+        total += iov[i].iov_len;
+    }
+    if(0 != broker_reserve((void **)&conn->_out,&conn->_out_capacity,conn->_out_len + total,1)){
+        return -1;
+    }
+    for(i = 0 ; i < iovcnt ; ++i){
+        memcpy(conn->_out + conn->_out_len,iov[i].iov_base,iov[i].iov_len);
+        conn->_out_len += iov[i].iov_len;
+    }
+    if(broker->_delay_ms <= 0){
+        conn->_out_ready = conn->_out_len;
+    }else{
+        uint64_t due = broker_now_ms() + broker->_delay_ms;
+        if(conn->_delay_head != conn->_delay_tail && conn->_delays[conn->_delay_tail - 1]._due_ms == due){
+            //同一毫秒内的数据合并
+            conn->_delays[conn->_delay_tail - 1]._end = conn->_out_len;
+        }else{
+            if(conn->_delay_head && conn->_delay_tail == conn->_delay_capacity){
+                memmove(conn->_delays,conn->_delays + conn->_delay_head,(conn->_delay_tail - conn->_delay_head) * sizeof(broker_delay));
+                conn->_delay_tail -= conn->_delay_head;
+                conn->_delay_head = 0;
+            }
+            if(0 != broker_reserve((void **)&conn->_delays,&conn->_delay_capacity,conn->_delay_tail + 1, sizeof(broker_delay))){
+                return -1;
+            }
+            conn->_delays[conn->_delay_tail]._due_ms = due;
+            conn->_delays[conn->_delay_tail]._end = conn->_out_len;
+            ++conn->_delay_tail;
+        }
+    }
+    if(!conn->_flushing){
+        conn->_flushing = 1;
+        conn->_next_flush = broker->_flush;
+        broker->_flush = conn;
+    }
+    return total;
+}
+
+/**
+ * 向一个连接发送PUBLISH
+ */
+static void broker_conn_publish(broker_conn *conn,
+                                const char *topic,
+                                const char *payload,
+                                uint32_t len,
+                                int qos,
+                                int retain){
+    struct MqttBuffer buf[1];
+    if(conn->_closing || !conn->_connected){
+        return;
+    }
+    if(++conn->_pkt_id == 0){
+        conn->_pkt_id = 1;
+    }
+    MqttBuffer_Init(buf);
+    if(MQTTERR_NOERROR == Mqtt_PackPublishPkt(buf,conn->_pkt_id,topic,payload,len,(enum MqttQosLevel)qos,retain,0)){
+        if(Mqtt_SendPkt(&conn->_ctx,buf,0) == (int)buf->buffered_bytes){
+            ++conn->_broker->_delivered;
+        }
+    }
+    MqttBuffer_Destroy(buf);
+}
+
+/**
+ * 路由器回调，把消息转发给订阅者
+ */
+static void broker_on_route(void *arg,
+                            uint16_t pkt_id,
+                            const char *topic,
+                            const char *payload,
+                            uint32_t payloadsize,
+                            int dup,
+                            enum MqttQosLevel qos){
+    broker_sub *sub = (broker_sub *)arg;
+    broker_conn_publish(sub->_conn,topic,payload,payloadsize,(int)qos < sub->_qos ? (int)qos : sub->_qos,0);
+}
+
+static void broker_retained_free(HashTableValue value){
+    broker_retained *retained = (broker_retained *)value;
+    jimi_free(retained->_topic);
+    jimi_free(retained->_payload);
+    jimi_free(retained);
+}
+
+/**
+ * 更新保留消息，负载为空时删除
+ */
+static void broker_retain(broker *broker,const char *topic,const char *payload,uint32_t len,int qos){
+    hash_table_remove(broker->_retained,(HashTableKey)topic);
+    if(!len){
+        return;
+    }
+    broker_retained *retained = (broker_retained *)jimi_malloc(sizeof(broker_retained));
+    if(!retained){
+        LOGE("malloc broker_retained failed!");
+        return;
+    }
+    retained->_topic = jimi_strdup(topic);
+    retained->_payload = (char *)jimi_malloc(len);
+    retained->_len = len;
+    retained->_qos = qos;
+    if(!retained->_topic || !retained->_payload ||
+       !hash_table_insert(broker->_retained,retained->_topic,retained)){
+        LOGE("save retained message failed:%s",topic);
+        broker_retained_free(retained);
+        return;
+    }
+    memcpy(retained->_payload,payload,len);
+}
+
+/**
+ * 分发一条消息给所有订阅者
+ */
+static void broker_publish(broker *broker,const char *topic,const char *payload,uint32_t len,int qos,int retain){
+    if(retain){
+        broker_retain(broker,topic,payload,len,qos);
+    }
+    mqtt_topic_router_dispatch(&broker->_router,0,topic,payload,len,0,(enum MqttQosLevel)qos);
+}
+
+/**
+ * 发送与新订阅匹配的保留消息
+ */
+static void broker_conn_send_retained(broker_conn *conn){
+    broker *broker = conn->_broker;
+    uint32_t i;
+    for(i = 0 ; i < conn->_new_sub_count ; ++i){
+        broker_sub *sub = conn->_new_subs[i];
+        if(!sub){
+            //已经取消订阅
+            continue;
+        }
+        HashTableIterator it;
+        hash_table_iterate(broker->_retained,&it);
+        while(hash_table_iter_has_more(&it)){
+            broker_retained *retained = (broker_retained *)hash_table_iter_next(&it).value;
+            if(mqtt_topic_router_match(sub->_filter,retained->_topic)){
+                broker_conn_publish(conn,retained->_topic,retained->_payload,retained->_len,
+                                    retained->_qos < sub->_qos ? retained->_qos : sub->_qos,1);
+            }
+        }
+    }
+    conn->_new_sub_count = 0;
+}
+
+static void broker_sub_free(broker *broker,broker_sub *sub){
+    mqtt_topic_router_remove(&broker->_router,sub->_route);
+    jimi_free(sub->_filter);
+    jimi_free(sub);
+}
+
+static int broker_handle_connect(void *arg, const char *client_id, uint16_t keep_alive,
+                                 int clean_session, const char *will_topic,
+                                 const char *will_msg, uint16_t will_len,
+                                 enum MqttQosLevel will_qos, int will_retain,
+                                 const char *user, const char *password, uint16_t pswd_len){
+    broker_conn *conn = (broker_conn *)arg;
+    broker *broker = conn->_broker;
+    if(conn->_connected){
+        LOGW("duplicate connect:%s",conn->_client_id);
+        return MQTTERR_ILLEGAL_PKT;
+    }
+    if(!*client_id && !clean_session){
+        return MQTT_CONNACK_IDENTIFIER_REJECTED;
+    }
+    if(*client_id){
+        conn->_client_id = jimi_strdup(client_id);
+    }else{
+        char auto_id[32];
+        snprintf(auto_id, sizeof(auto_id),"auto-%u",++broker->_auto_id);
+        conn->_client_id = jimi_strdup(auto_id);
+    }
+    if(!conn->_client_id){
+        return MQTT_CONNACK_SERVER_UNAVAILABLE;
+    }
+    if(will_topic){
+        conn->_will_topic = jimi_strdup(will_topic);
+        conn->_will_msg = (char *)jimi_malloc(will_len ? will_len : 1);
+        if(!conn->_will_topic || !conn->_will_msg){
+            return MQTT_CONNACK_SERVER_UNAVAILABLE;
+        }
+        memcpy(conn->_will_msg,will_msg,will_len);
+        conn->_will_len = will_len;
+        conn->_will_qos = will_qos;
+        conn->_will_retain = will_retain;
+    }
+
+    //相同client_id的旧连接被踢下线
+    broker_conn *old = (broker_conn *)hash_table_lookup(broker->_clients,conn->_client_id);
+    if(old){
+        LOGI("client takeover:%s",conn->_client_id);
+        hash_table_remove(broker->_clients,conn->_client_id);
+        broker_conn_close(old);
+    }
+    if(!hash_table_insert(broker->_clients,conn->_client_id,conn)){
+        return MQTT_CONNACK_SERVER_UNAVAILABLE;
+    }
+    conn->_connected = 1;
+    conn->_keep_alive = keep_alive;
+    LOGD("client connected:%s",conn->_client_id);
+    return MQTT_CONNACK_ACCEPTED;
+}
+
+static int broker_handle_subscribe(void *arg, uint16_t pkt_id, const char *topic, enum MqttQosLevel qos){
+    broker_conn *conn = (broker_conn *)arg;
+    broker *broker = conn->_broker;
+    uint32_t i;
+    if(!conn->_connected){
+        return MQTTERR_ILLEGAL_PKT;
+    }
+    for(i = 0 ; i < conn->_sub_count ; ++i){
+        if(!strcmp(conn->_subs[i]->_filter,topic)){
+            //重复订阅只更新qos
+            conn->_subs[i]->_qos = qos;
+            break;
+        }
+    }
+    if(i == conn->_sub_count){
+        if(0 != broker_reserve((void **)&conn->_subs,&conn->_sub_capacity,conn->_sub_count + 1, sizeof(broker_sub *))){
+            return MQTT_SUBACK_FAILUER;
+        }
+        broker_sub *sub = (broker_sub *)jimi_malloc(sizeof(broker_sub));
+        if(!sub){
+            return MQTT_SUBACK_FAILUER;
+        }
+        sub->_conn = conn;
+        sub->_qos = qos;
+        sub->_filter = jimi_strdup(topic);
+        sub->_route = sub->_filter ? mqtt_topic_router_add(&broker->_router,topic,broker_on_route,sub) : 0;
+        if(!sub->_route){
+            jimi_free(sub->_filter);
+            jimi_free(sub);
+            return MQTT_SUBACK_FAILUER;
+        }
+        conn->_subs[conn->_sub_count++] = sub;
+    }
+    if(0 == broker_reserve((void **)&conn->_new_subs,&conn->_new_sub_capacity,conn->_new_sub_count + 1, sizeof(broker_sub *))){
+        conn->_new_subs[conn->_new_sub_count++] = conn->_subs[i];
+    }
+    return qos;
+}
+
+static int broker_handle_unsubscribe(void *arg, uint16_t pkt_id, const char *topic){
+    broker_conn *conn = (broker_conn *)arg;
+    uint32_t i, j;
+    if(!conn->_connected){
+        return MQTTERR_ILLEGAL_PKT;
+    }
+    for(i = 0 ; i < conn->_sub_count ; ++i){
+        broker_sub *sub = conn->_subs[i];
+        if(strcmp(sub->_filter,topic)){
+            continue;
+        }
+        for(j = 0 ; j < conn->_new_sub_count ; ++j){
+            if(conn->_new_subs[j] == sub){
+                conn->_new_subs[j] = NULL;
+            }
+        }
+        conn->_subs[i] = conn->_subs[--conn->_sub_count];
+        broker_sub_free(conn->_broker,sub);
+        break;
+    }
+    return 0;
+}
+
+static int broker_handle_publish(void *arg, uint16_t pkt_id, const char *topic,
+                                 const char *payload, uint32_t payloadsize,
+                                 int dup, enum MqttQosLevel qos, int retain){
+    broker_conn *conn = (broker_conn *)arg;
+    broker *broker = conn->_broker;
+    uint32_t i;
+    if(!conn->_connected){
+        return MQTTERR_ILLEGAL_PKT;
+    }
+    if(broker->_loss > 0 && broker_random(broker) < broker->_loss){
+        //模拟丢包，不转发也不回复
+        ++broker->_dropped;
+        return 1;
+    }
+    if(qos == MQTT_QOS_LEVEL2){
+        for(i = 0 ; i < conn->_qos2_count ; ++i){
+            if(conn->_qos2_ids[i] == pkt_id){
+                //等待PUBREL期间的重发，只回复PUBREC
+                return 0;
+            }
+        }
+        if(0 != broker_reserve((void **)&conn->_qos2_ids,&conn->_qos2_capacity,conn->_qos2_count + 1, sizeof(uint16_t))){
+            return MQTTERR_OUTOFMEMORY;
+        }
+        conn->_qos2_ids[conn->_qos2_count++] = pkt_id;
+    }
+    ++broker->_received;
+    broker_publish(broker,topic,payload,payloadsize,qos,retain);
+    return 0;
+}
+
+static int broker_handle_pub_rel(void *arg, uint16_t pkt_id){
+    broker_conn *conn = (broker_conn *)arg;
+    uint32_t i;
+    for(i = 0 ; i < conn->_qos2_count ; ++i){
+        if(conn->_qos2_ids[i] == pkt_id){
+            conn->_qos2_ids[i] = conn->_qos2_ids[--conn->_qos2_count];
+            break;
+        }
+    }
+    return 0;
+}
+
+static int broker_handle_pub_ack(void *arg, uint16_t pkt_id){
+    //不重发，确认无需处理
+    return 0;
+}
+
+static int broker_handle_ping_req(void *arg){
+    return 0;
+}
+
+static int broker_handle_disconnect(void *arg){
+    broker_conn *conn = (broker_conn *)arg;
+    //正常断开不发送遗嘱
+    jimi_free(conn->_will_topic);
+    jimi_free(conn->_will_msg);
+    conn->_will_topic = conn->_will_msg = NULL;
+    broker_conn_close(conn);
+    return 0;
+}
+
+static int broker_input_prepare(void *ctx,struct iovec *iov){
+    broker_conn *conn = (broker_conn *)ctx;
+    //数据在input_commit中立即处理，不完整的数据包由解析器缓存，所以所有连接可以共用接收缓冲区
+    iov[0].iov_base = conn->_broker->_input;
+    iov[0].iov_len = BROKER_INPUT_SIZE;
+    return 1;
+}
+
+static int broker_input_commit(void *ctx,int len){
+    broker_conn *conn = (broker_conn *)ctx;
+    if(conn->_closing){
+        return 0;
+    }
+    conn->_last_recv_ms = broker_now_ms();
+    int ret = Mqtt_ParsePkt(&conn->_ctx,&conn->_parser,conn->_broker->_input,len);
+    if(MQTTERR_NOERROR != ret){
+        LOGW("parse failed:%d, client:%s",ret,conn->_client_id ? conn->_client_id : "");
+    }else if(conn->_new_sub_count){
+        broker_conn_send_retained(conn);
+    }
+    broker_flush_all(conn->_broker);
+    return MQTTERR_NOERROR == ret ? 0 : -1;
+}
+
+static int broker_on_writable(void *ctx){
+    return broker_conn_flush((broker_conn *)ctx);
+}
+
+static int broker_next_timeout(void *ctx){
+    broker_conn *conn = (broker_conn *)ctx;
+    uint64_t deadline = 0;
+    if(conn->_delay_head != conn->_delay_tail){
+        deadline = conn->_delays[conn->_delay_head]._due_ms;
+    }
+    if(conn->_keep_alive){
+        //超过1.5倍心跳间隔没有收到数据则断开
+        uint64_t expire = conn->_last_recv_ms + conn->_keep_alive * 1500;
+        if(!deadline || expire < deadline){
+            deadline = expire;
+        }
+    }
+    if(!deadline){
+        return -1;
+    }
+    uint64_t now = broker_now_ms();
+    return deadline <= now ? 0 : (int)(deadline - now);
+}
+
+static int broker_timer_schedule(void *ctx){
+    broker_conn *conn = (broker_conn *)ctx;
+    if(conn->_keep_alive && broker_now_ms() >= conn->_last_recv_ms + conn->_keep_alive * 1500){
+        LOGI("keep alive timeout:%s",conn->_client_id);
+        broker_conn_close(conn);
+        return 0;
+    }
+    if(conn->_delay_head != conn->_delay_tail && 0 != broker_conn_flush(conn)){
+        broker_conn_close(conn);
+        return -1;
+    }
+    return 0;
+}
+
+static const event_session_ops broker_ops = {
+        broker_input_prepare,
+        broker_input_commit,
+        broker_on_writable,
+        broker_timer_schedule,
+        broker_next_timeout
+};
+
+static void broker_conn_free(broker_conn *conn){
+    uint32_t i;
+    for(i = 0 ; i < conn->_sub_count ; ++i){
+        broker_sub_free(conn->_broker,conn->_subs[i]);
+    }
+    MqttParser_Destroy(&conn->_parser);
+    jimi_free(conn->_subs);
+    jimi_free(conn->_new_subs);
+    jimi_free(conn->_qos2_ids);
+    jimi_free(conn->_out);
+    jimi_free(conn->_delays);
+    jimi_free(conn->_will_topic);
+    jimi_free(conn->_will_msg);
+    jimi_free(conn->_client_id);
+    jimi_free(conn);
+}
+
+static void broker_on_close(void *user_data,event_session *session,int err){
+    broker_conn *conn = (broker_conn *)user_data;
+    broker *broker = conn->_broker;
+    LOGD("client closed:%s, err:%d",conn->_client_id ? conn->_client_id : "",err);
+    conn->_closing = 1;
+    if(conn->_client_id && hash_table_lookup(broker->_clients,conn->_client_id) == conn){
+        hash_table_remove(broker->_clients,conn->_client_id);
+    }
+    if(conn->_prev){
+        conn->_prev->_next = conn->_next;
+    }else{
+        broker->_conns = conn->_next;
+    }
+    if(conn->_next){
+        conn->_next->_prev = conn->_prev;
+    }
+    //先删除订阅，遗嘱不发给自己
+    for(; conn->_sub_count ; --conn->_sub_count){
+        broker_sub_free(broker,conn->_subs[conn->_sub_count - 1]);
+    }
+    if(conn->_will_topic && !broker->_stopping){
+        broker_publish(broker,conn->_will_topic,conn->_will_msg,conn->_will_len,conn->_will_qos,conn->_will_retain);
+        broker_flush_all(broker);
+    }
+    broker_conn_free(conn);
+}
+
+static int broker_add_conn(broker *broker,int fd){
+    broker_conn *conn = (broker_conn *)jimi_malloc(sizeof(broker_conn));
+    if(!conn){
+        LOGE("malloc broker_conn failed!");
+        return -1;
+    }
+    memset(conn,0, sizeof(broker_conn));
+    conn->_broker = broker;
+    conn->_last_recv_ms = broker_now_ms();
+    conn->_ctx.user_data = conn;
+    conn->_ctx.writev_func = broker_conn_writev;
+    conn->_ctx.handle_publish = broker_handle_publish;
+    conn->_ctx.handle_pub_ack = broker_handle_pub_ack;
+    conn->_ctx.handle_pub_rec = broker_handle_pub_ack;
+    conn->_ctx.handle_pub_rel = broker_handle_pub_rel;
+    conn->_ctx.handle_pub_comp = broker_handle_pub_ack;
+    conn->_ctx.handle_connect = broker_handle_connect;
+    conn->_ctx.handle_subscribe = broker_handle_subscribe;
+    conn->_ctx.handle_unsubscribe = broker_handle_unsubscribe;
+    conn->_ctx.handle_ping_req = broker_handle_ping_req;
+    conn->_ctx.handle_disconnect = broker_handle_disconnect;
+    MqttParser_Init(&conn->_parser);
+    conn->_session = event_session_add(broker->_loop,fd,&broker_ops,conn,broker_on_close,conn);
+    if(!conn->_session){
+        broker_conn_free(conn);
+        return -1;
+    }
+    //未登录的连接按默认心跳间隔检查
+    conn->_keep_alive = 60;
+    event_session_refresh(conn->_session);
+    conn->_next = broker->_conns;
+    if(broker->_conns){
+        broker->_conns->_prev = conn;
+    }
+    broker->_conns = conn;
+    return 0;
+}
+
+/**
+ * 事件循环被唤醒，接管accept线程投递的套接字
+ */
+static void broker_on_wakeup(void *user_data){
+    broker *broker = (struct broker *)user_data;
+    int fds[256];
+    uint32_t count, i;
+    do{
+        pthread_mutex_lock(&broker->_mutex);
+        count = broker->_pending_count < 256 ? broker->_pending_count : 256;
+        broker->_pending_count -= count;
+        memcpy(fds,broker->_pending + broker->_pending_count,count * sizeof(int));
+        pthread_mutex_unlock(&broker->_mutex);
+        for(i = 0 ; i < count ; ++i){
+            if(0 != broker_add_conn(broker,fds[i])){
+                close(fds[i]);
+            }
+        }
+    }while(count);
+}
+
+static void *broker_accept_run(void *arg){
+    broker *broker = (struct broker *)arg;
+    while(1){
+        int fd = accept(broker->_listen_fd,NULL,NULL);
+        if(fd == -1){
+            if(errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE){
+                if(errno == EMFILE || errno == ENFILE){
+                    usleep(10 * 1000);
+                }
+                continue;
+            }
+            //监听套接字被关闭
+            break;
+        }
+        int on = 1;
+        setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on, sizeof(on));
+        pthread_mutex_lock(&broker->_mutex);
+        if(0 != broker_reserve((void **)&broker->_pending,&broker->_pending_capacity,broker->_pending_count + 1, sizeof(int))){
+            pthread_mutex_unlock(&broker->_mutex);
+            close(fd);
+            continue;
+        }
+        broker->_pending[broker->_pending_count++] = fd;
+        pthread_mutex_unlock(&broker->_mutex);
+        event_loop_wakeup(broker->_loop);
+    }
+    return NULL;
+}
+
+static int broker_listen(broker *broker,const char *addr,unsigned short port){
+    struct sockaddr_in sin;
+    memset(&sin,0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    if(1 != inet_pton(AF_INET,addr,&sin.sin_addr)){
+        LOGE("invalid address:%s",addr);
+        return -1;
+    }
+    broker->_listen_fd = socket(AF_INET,SOCK_STREAM,0);
+    if(broker->_listen_fd == -1){
+        LOGE("socket failed:%d %s",errno,strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    setsockopt(broker->_listen_fd,SOL_SOCKET,SO_REUSEADDR,&on, sizeof(on));
+    if(-1 == bind(broker->_listen_fd,(struct sockaddr *)&sin, sizeof(sin)) ||
+       -1 == listen(broker->_listen_fd,1024)){
+        LOGE("listen %s:%d failed:%d %s",addr,port,errno,strerror(errno));
+        close(broker->_listen_fd);
+        broker->_listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int broker_on_stats(void *user_data){
+    broker *broker = (struct broker *)user_data;
+    LOGI("clients:%u received:%llu dropped:%llu delivered:%llu retained:%u",
+         event_loop_session_count(broker->_loop),
+         (unsigned long long)broker->_received,
+         (unsigned long long)broker->_dropped,
+         (unsigned long long)broker->_delivered,
+         hash_table_num_entries(broker->_retained));
+    return broker->_stats_ms;
+}
+
+static void broker_on_signal(int sig){
+    event_loop_stop(s_loop);
+}
+
+static void broker_usage(){
+    LOGE("使用方法: broker [-p 端口] [-a 监听地址] [-d 延时毫秒] [-l 丢包百分比] [-s 随机数种子] [-i 统计间隔秒数] [-e auto|epoll|uring]");
+}
+
+int main(int argc,char *argv[]){
+    const char *addr = "0.0.0.0";
+    int port = 1883;
+    int stats_sec = 0;
+    event_backend backend = event_backend_auto;
+    static broker server;
+    int opt;
+
+    server._rand = 0x9E3779B97F4A7C15ULL;
+    while((opt = getopt(argc,argv,"p:a:d:l:s:i:e:h")) != -1){
+        switch(opt){
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'a':
+                addr = optarg;
+                break;
+            case 'd':
+                server._delay_ms = atoi(optarg);
+                break;
+            case 'l':
+                server._loss = atof(optarg) / 100;
+                break;
+            case 's':
+                //xorshift的状态不能为0
+                server._rand = strtoull(optarg,NULL,0) | 1;
+                break;
+            case 'i':
+                stats_sec = atoi(optarg);
+                break;
+            case 'e':
+                if(!strcmp(optarg,"epoll")){
+                    backend = event_backend_epoll;
+                }else if(!strcmp(optarg,"uring")){
+                    backend = event_backend_uring;
+                }else if(strcmp(optarg,"auto")){
+                    broker_usage();
+                    return -1;
+                }
+                break;
+            default:
+                broker_usage();
+                return -1;
+        }
+    }
+    if(port <= 0 || port > 65535 || server._delay_ms < 0 || server._loss < 0 || server._loss > 1 || stats_sec < 0){
+        broker_usage();
+        return -1;
+    }
+
+    signal(SIGPIPE,SIG_IGN);
+    pthread_mutex_init(&server._mutex,NULL);
+    mqtt_topic_router_init(&server._router);
+    server._clients = hash_table_new(broker_hash_string,broker_equal_string);
+    server._retained = hash_table_new(broker_hash_string,broker_equal_string);
+    server._loop = event_loop_alloc_backend(backend);
+    if(!server._clients || !server._retained || !server._loop || 0 != broker_listen(&server,addr,(unsigned short)port)){
+        LOGE("start broker failed!");
+        return -1;
+    }
+    hash_table_register_free_functions(server._retained,NULL,broker_retained_free);
+    event_loop_set_wakeup(server._loop,broker_on_wakeup,&server);
+    if(stats_sec){
+        server._stats_ms = stats_sec * 1000;
+        event_loop_add_timer(server._loop,server._stats_ms,broker_on_stats,&server);
+    }
+    if(0 != pthread_create(&server._accept_thread,NULL,broker_accept_run,&server)){
+        LOGE("pthread_create failed!");
+        return -1;
+    }
+
+    s_loop = server._loop;
+    signal(SIGINT,broker_on_signal);
+    signal(SIGTERM,broker_on_signal);
+    LOGI("broker listening on %s:%d, backend:%s, delay:%dms, loss:%.2f%%",
+         addr,port,
+         event_loop_get_backend(server._loop) == event_backend_uring ? "uring" : "epoll",
+         server._delay_ms,
+         server._loss * 100);
+    event_loop_run(server._loop);
+
+    //关闭监听套接字使accept线程退出
+    shutdown(server._listen_fd,SHUT_RDWR);
+    pthread_join(server._accept_thread,NULL);
+    close(server._listen_fd);
+    server._stopping = 1;
+    broker_on_stats(&server);
+    event_loop_free(server._loop);
+    uint32_t i;
+    for(i = 0 ; i < server._pending_count ; ++i){
+        close(server._pending[i]);
+    }
+    jimi_free(server._pending);
+    hash_table_free(server._clients);
+    hash_table_free(server._retained);
+    mqtt_topic_router_release(&server._router);
+    pthread_mutex_destroy(&server._mutex);
+    return 0;
+}
@@ -0,0 +1,335 @@
+//
+// Created by xzl on 2019/7/19.
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "jimi_event_loop.h"
+#include "jimi_log.h"
+#include "mqtt_wrapper.h"
+
+/**
+ * 比较事件循环各个后端的发布性能：本进程内启动一个简易broker线程(回复CONNACK/PUBACK)，
+ * 主线程用一个事件循环驱动所有连接持续发布消息，统计broker每秒收到的消息数以及客户端线程每条消息消耗的cpu时间
+ * 使用方法: event_bench [epoll|uring|all] [连接数] [秒数] [qos] [负载字节数]
+ */
+
+#define BROKER_BUF_SIZE (64 * 1024)
+//每个连接每轮事件循环最多发布的消息数
+#define BENCH_BURST 32
+
+typedef struct {
+    int _fd;
+    int _len;
+    char _buf[BROKER_BUF_SIZE];
+} broker_conn;
+
+typedef struct {
+    int _listen_fd;
+    int _epoll_fd;
+    int _stop;
+    uint64_t _publishes;
+    pthread_t _thread;
+} bench_broker;
+
+typedef struct {
+    void *_ctx;
+    event_session *_session;
+    int _connected;
+} bench_client;
+
+static uint64_t bench_now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t bench_thread_cpu_us(){
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD,&usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+ * 解析完整的mqtt包并回复，返回已经处理的字节数
+ */
+static int broker_on_data(bench_broker *broker,broker_conn *conn){
+    unsigned char *buf = (unsigned char *)conn->_buf;
+    int offset = 0;
+    while(conn->_len - offset >= 2){
+        int pos = offset + 1;
+        int multiplier = 1;
+        int remain = 0;
+        unsigned char byte;
+        do{
+            if(pos >= conn->_len){
+                return offset;
+            }
+            byte = buf[pos++];
+            remain += (byte & 0x7F) * multiplier;
+            multiplier *= 128;
+        }while(byte & 0x80);
+        if(conn->_len - pos < remain){
+            break;
+        }
+        int type = buf[offset] >> 4;
+        if(type == 1){
+            //CONNECT
+            unsigned char ack[4] = {0x20,0x02,0x00,0x00};
+            write(conn->_fd,ack, sizeof(ack));
+        }else if(type == 3){
+            //PUBLISH，qos1时回复PUBACK
+            int qos = (buf[offset] >> 1) & 0x03;
+            ++broker->_publishes;
+            if(qos){
+                int topic_len = (buf[pos] << 8) | buf[pos + 1];
+                unsigned char ack[4] = {0x40,0x02,buf[pos + 2 + topic_len],buf[pos + 3 + topic_len]};
+                write(conn->_fd,ack, sizeof(ack));
+            }
+        }
+        offset = pos + remain;
+    }
+    return offset;
+}
+
+static void *broker_run(void *arg){
+    bench_broker *broker = (bench_broker *)arg;
+    struct epoll_event events[256];
+    while(!__atomic_load_n(&broker->_stop,__ATOMIC_ACQUIRE)){
+        int count = epoll_wait(broker->_epoll_fd,events,256,50);
+        int i;
+        for(i = 0 ; i < count ; ++i){
+            if(!events[i].data.ptr){
+                int fd = accept(broker->_listen_fd,NULL,NULL);
+                if(fd == -1){
+                    continue;
+                }
+                broker_conn *conn = (broker_conn *)malloc(sizeof(broker_conn));
+                conn->_fd = fd;
+                conn->_len = 0;
+                struct epoll_event ev = {0};
+                ev.events = EPOLLIN;
+                ev.data.ptr = conn;
+                epoll_ctl(broker->_epoll_fd,EPOLL_CTL_ADD,fd,&ev);
+                continue;
+            }
+            broker_conn *conn = (broker_conn *)events[i].data.ptr;
+            int ret = read(conn->_fd,conn->_buf + conn->_len,BROKER_BUF_SIZE - conn->_len);
+            if(ret <= 0){
+                epoll_ctl(broker->_epoll_fd,EPOLL_CTL_DEL,conn->_fd,NULL);
+                close(conn->_fd);
+                free(conn);
+                continue;
+            }
+            conn->_len += ret;
+            int used = broker_on_data(broker,conn);
+            memmove(conn->_buf,conn->_buf + used,conn->_len - used);
+            conn->_len -= used;
+        }
+    }
+    return NULL;
+}
+
+static int broker_start(bench_broker *broker,unsigned short *port){
+    memset(broker,0, sizeof(bench_broker));
+    broker->_listen_fd = socket(AF_INET,SOCK_STREAM,0);
+    struct sockaddr_in addr;
+    memset(&addr,0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(-1 == bind(broker->_listen_fd,(struct sockaddr *)&addr, sizeof(addr)) ||
+       -1 == listen(broker->_listen_fd,1024) ||
+       -1 == getsockname(broker->_listen_fd,(struct sockaddr *)&addr,&len)){
+        LOGE("start broker failed:%d %s",errno,strerror(errno));
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    broker->_epoll_fd = epoll_create1(0);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    epoll_ctl(broker->_epoll_fd,EPOLL_CTL_ADD,broker->_listen_fd,&ev);
+    return pthread_create(&broker->_thread,NULL,broker_run,broker);
+}
+
+static void broker_stop(bench_broker *broker){
+    __atomic_store_n(&broker->_stop,1,__ATOMIC_RELEASE);
+    pthread_join(broker->_thread,NULL);
+    close(broker->_epoll_fd);
+    close(broker->_listen_fd);
+}
+
+static int bench_output(void *arg,const struct iovec *iov,int iovcnt){
+    bench_client *client = (bench_client *)arg;
+    return event_session_write(client->_session,iov,iovcnt);
+}
+
+static void bench_on_conn_ack(void *arg,char flags,char ret_code){
+    bench_client *client = (bench_client *)arg;
+    client->_connected = (ret_code == 0);
+}
+
+static void bench_on_ping_resp(void *arg){}
+
+static void bench_on_close(void *user_data,event_session *session,int err){
+    bench_client *client = (bench_client *)user_data;
+    client->_session = NULL;
+    client->_connected = 0;
+}
+
+/**
+ * 运行一个后端的测试
+ * @return 0为成功
+ */
+static int bench_run(event_backend backend,int conns,int seconds,int qos,int payload_len){
+    event_loop *loop = event_loop_alloc_backend(backend);
+    if(!loop){
+        printf("%-6s unavailable\n",backend == event_backend_uring ? "uring" : "epoll");
+        return -1;
+    }
+    bench_broker broker;
+    unsigned short port;
+    if(0 != broker_start(&broker,&port)){
+        event_loop_free(loop);
+        return -1;
+    }
+
+    char *payload = (char *)malloc(payload_len + 1);
+    memset(payload,'x',payload_len);
+    payload[payload_len] = '\0';
+    bench_client *clients = (bench_client *)calloc(conns, sizeof(bench_client));
+    int i;
+    for(i = 0 ; i < conns ; ++i){
+        bench_client *client = clients + i;
+        int fd = socket(AF_INET,SOCK_STREAM,0);
+        struct sockaddr_in addr;
+        memset(&addr,0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(-1 == connect(fd,(struct sockaddr *)&addr, sizeof(addr))){
+            LOGE("connect failed:%d %s",errno,strerror(errno));
+            close(fd);
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on, sizeof(on));
+        mqtt_callback callback = {bench_output,bench_on_conn_ack,bench_on_ping_resp,NULL,NULL,client};
+        client->_ctx = mqtt_alloc_contex(&callback);
+        client->_session = event_session_add(loop,fd,&event_mqtt_ops,client->_ctx,bench_on_close,client);
+        if(!client->_session){
+            close(fd);
+            continue;
+        }
+        mqtt_set_flow_control(client->_ctx,qos ? 256 : 0,64 * 1024,NULL);
+        mqtt_send_connect_pkt(client->_ctx,60,"bench",1,NULL,NULL,0,MQTT_QOS_LEVEL0,0,"user","password");
+        event_session_refresh(client->_session);
+    }
+
+    //等待全部登录成功
+    uint64_t deadline = bench_now_us() + 5000000;
+    int connected = 0;
+    while(connected < conns && bench_now_us() < deadline){
+        event_loop_run_once(loop,10);
+        for(connected = 0, i = 0 ; i < conns ; ++i){
+            connected += clients[i]._connected;
+        }
+    }
+
+    uint64_t published = 0;
+    uint64_t start_publishes = __atomic_load_n(&broker._publishes,__ATOMIC_RELAXED);
+    uint64_t start_us = bench_now_us();
+    uint64_t start_cpu = bench_thread_cpu_us();
+    uint64_t end_us = start_us + (uint64_t)seconds * 1000000;
+    while(bench_now_us() < end_us){
+        int sent = 0;
+        for(i = 0 ; i < conns ; ++i){
+            bench_client *client = clients + i;
+            if(!client->_connected){
+                continue;
+            }
+            //两个后端都把一批发布合并为一次写入，epoll为一次writev，io_uring为一次链式发送
+            mqtt_batch_begin(client->_ctx,0,0,0);
+            int n;
+            for(n = 0 ; n < BENCH_BURST ; ++n){
+                if(mqtt_publish_would_block(client->_ctx,(enum MqttQosLevel)qos) ||
+                   0 != mqtt_send_publish_pkt(client->_ctx,"bench/topic",payload,payload_len,
+                                              (enum MqttQosLevel)qos,0,0,NULL,NULL,NULL,10)){
+                    break;
+                }
+            }
+            mqtt_batch_end(client->_ctx);
+            if(n){
+                event_session_refresh(client->_session);
+                sent += n;
+            }
+        }
+        published += sent;
+        //全部连接都被流量控制时等待回复或者可写
+        event_loop_run_once(loop,sent ? 0 : 1);
+    }
+    uint64_t cpu_us = bench_thread_cpu_us() - start_cpu;
+    uint64_t elapsed_us = bench_now_us() - start_us;
+    uint64_t received = __atomic_load_n(&broker._publishes,__ATOMIC_RELAXED) - start_publishes;
+
+    printf("%-6s conns=%d connected=%d qos=%d payload=%d published=%llu received=%llu msgs/sec=%.0f cpu_us/msg=%.3f\n",
+           event_loop_get_backend(loop) == event_backend_uring ? "uring" : "epoll",
+           conns,
+           connected,
+           qos,
+           payload_len,
+           (unsigned long long)published,
+           (unsigned long long)received,
+           received * 1000000.0 / elapsed_us,
+           received ? (double)cpu_us / received : 0);
+
+    event_loop_free(loop);
+    for(i = 0 ; i < conns ; ++i){
+        if(clients[i]._ctx){
+            mqtt_free_contex(clients[i]._ctx);
+        }
+    }
+    broker_stop(&broker);
+    free(clients);
+    free(payload);
+    return 0;
+}
+
+int main(int argc,char *argv[]){
+    //释放对象时未回复的请求会打印超时日志
+    set_log_level(log_error);
+    signal(SIGPIPE,SIG_IGN);
+    const char *backend = argc > 1 ? argv[1] : "all";
+    int conns = argc > 2 ? atoi(argv[2]) : 100;
+    int seconds = argc > 3 ? atoi(argv[3]) : 3;
+    int qos = argc > 4 ? atoi(argv[4]) : 0;
+    int payload_len = argc > 5 ? atoi(argv[5]) : 64;
+    if(conns <= 0 || seconds <= 0 || qos < 0 || qos > 1 || payload_len <= 0){
+        LOGE("使用方法: event_bench [epoll|uring|all] [连接数] [秒数] [qos(0/1)] [负载字节数]");
+        return -1;
+    }
+    if(!strcmp(backend,"epoll") || !strcmp(backend,"all")){
+        bench_run(event_backend_epoll,conns,seconds,qos,payload_len);
+    }
+    if(!strcmp(backend,"uring") || !strcmp(backend,"all")){
+        bench_run(event_backend_uring,conns,seconds,qos,payload_len);
+    }
+    return 0;
+}
@@ -0,0 +1,602 @@
+//
+// Created by xzl on 2019/7/21.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "jimi_event_loop.h"
+#include "jimi_iot.h"
+#include "jimi_log.h"
+#include "jimi_memory.h"
+#include "mqtt_histogram.h"
+
+/**
+ * 设备集群压测工具：一个事件循环模拟大量iot设备(每个设备一个iot_context)，
+ * 按指定速率建立连接，每个设备按指定速率发布由bool/double/enum/string端点数据混合组成的数据包，
+ * 周期性统计每秒登录数、每秒发布数、每秒确认数以及登录耗时、确认耗时的分位数
+ * 配合本地broker可以离线压测：broker -p 1883 & loadgen -n 1000 -r 10
+ * 使用方法: loadgen [-a 服务器地址] [-p 端口] [-n 设备数] [-c 每秒新建连接数] [-r 每个设备每秒发布数] [-q qos]
+ *                  [-m bool:double:enum:string权重] [-b 每包端点数] [-z 字符串长度] [-t 秒数] [-i 统计间隔秒数] [-e auto|epoll|uring]
+ */
+
+//每个设备记录发送时间的槽位数，同时也是qos1/2时最多未确认的消息数
+#define LOADGEN_WINDOW 256
+//驱动连接与发布的定时器间隔
+#define LOADGEN_TICK_MS 2
+
+typedef struct loadgen loadgen;
+
+typedef struct {
+    loadgen *_gen;
+    void *_ctx;
+    event_session *_session;
+    int _index;
+    int _connected;
+    //本次开始连接的时间
+    uint64_t _connect_us;
+    //下次发布的时间
+    uint64_t _next_pub_us;
+    //发送时间，按req_id取模保存
+    uint64_t _sent_us[LOADGEN_WINDOW];
+    uint32_t _sent_id[LOADGEN_WINDOW];
+} loadgen_device;
+
+/**
+ * 一个统计周期内的计数
+ */
+typedef struct {
+    uint64_t _connects;
+    uint64_t _connect_fails;
+    uint64_t _disconnects;
+    uint64_t _publishes;
+    uint64_t _blocked;
+    uint64_t _acks;
+    uint64_t _timeouts;
+    uint64_t _bytes;
+    mqtt_histogram _connect_hist;
+    mqtt_histogram _ack_hist;
+} loadgen_stats;
+
+struct loadgen {
+    event_loop *_loop;
+    struct sockaddr_storage _addr;
+    socklen_t _addr_len;
+    const char *_user;
+    const char *_secret;
+    const char *_prefix;
+    int _qos;
+    //每秒新建连接数，0为不限制
+    double _connect_rate;
+    //每个设备每秒发布数
+    double _publish_rate;
+    //bool/double/enum/string的累计权重
+    int _mix[4];
+    int _points;
+    int _string_len;
+
+    loadgen_device *_devices;
+    int _device_count;
+    //等待连接的设备队列
+    int *_queue;
+    int _queue_head;
+    int _queue_count;
+    double _connect_tokens;
+    int _connected;
+
+    uint64_t _start_us;
+    uint64_t _last_tick_us;
+    uint64_t _stats_us;
+    uint64_t _interval_start_us;
+    uint64_t _rand;
+    int _stopping;
+    char *_string;
+    buffer _buf;
+
+    loadgen_stats _interval;
+    loadgen_stats _total;
+};
+
+static event_loop *s_loop = NULL;
+
+static uint64_t loadgen_now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t loadgen_rand(loadgen *gen){
+    //xorshift64
+    gen->_rand ^= gen->_rand << 13;
+    gen->_rand ^= gen->_rand >> 7;
+    gen->_rand ^= gen->_rand << 17;
+    return gen->_rand;
+}
+
+static void hist_print(const char *name,const mqtt_histogram *hist){
+    if(!hist->_total){
+        printf(" %s=-",name);
+        return;
+    }
+    printf(" %s(ms)=p50:%.2f/p90:%.2f/p99:%.2f/p999:%.2f/max:%.2f",
+           name,
+           mqtt_histogram_percentile(hist,50) / 1000.0,
+           mqtt_histogram_percentile(hist,90) / 1000.0,
+           mqtt_histogram_percentile(hist,99) / 1000.0,
+           mqtt_histogram_percentile(hist,99.9) / 1000.0,
+           hist->_max / 1000.0);
+}
+
+static void loadgen_print(loadgen *gen,const char *title,const loadgen_stats *stats,uint64_t elapsed_us){
+    double sec = elapsed_us ? elapsed_us / 1000000.0 : 1;
+    printf("[%s] online=%d/%d connects/sec=%.1f publishes/sec=%.1f acks/sec=%.1f kbytes/sec=%.1f "
+           "connects=%llu connect_fails=%llu disconnects=%llu publishes=%llu blocked=%llu acks=%llu timeouts=%llu",
+           title,
+           gen->_connected,
+           gen->_device_count,
+           stats->_connects / sec,
+           stats->_publishes / sec,
+           stats->_acks / sec,
+           stats->_bytes / sec / 1024,
+           (unsigned long long)stats->_connects,
+           (unsigned long long)stats->_connect_fails,
+           (unsigned long long)stats->_disconnects,
+           (unsigned long long)stats->_publishes,
+           (unsigned long long)stats->_blocked,
+           (unsigned long long)stats->_acks,
+           (unsigned long long)stats->_timeouts);
+    hist_print("connect",&stats->_connect_hist);
+    hist_print("ack",&stats->_ack_hist);
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * 把统计周期内的计数累加到总计并清零
+ */
+static void loadgen_roll_stats(loadgen *gen){
+    loadgen_stats *total = &gen->_total;
+    loadgen_stats *interval = &gen->_interval;
+    total->_connects += interval->_connects;
+    total->_connect_fails += interval->_connect_fails;
+    total->_disconnects += interval->_disconnects;
+    total->_publishes += interval->_publishes;
+    total->_blocked += interval->_blocked;
+    total->_acks += interval->_acks;
+    total->_timeouts += interval->_timeouts;
+    total->_bytes += interval->_bytes;
+    mqtt_histogram_merge(&total->_connect_hist,&interval->_connect_hist);
+    mqtt_histogram_merge(&total->_ack_hist,&interval->_ack_hist);
+    memset(interval,0, sizeof(loadgen_stats));
+}
+
+static void loadgen_enqueue(loadgen *gen,loadgen_device *device){
+    gen->_queue[(gen->_queue_head + gen->_queue_count++) % gen->_device_count] = device->_index;
+}
+
+static int device_output(void *arg,const struct iovec *iov,int iovcnt){
+    loadgen_device *device = (loadgen_device *)arg;
+    if(!device->_session){
+        return -1;
+    }
+    return event_session_write(device->_session,iov,iovcnt);
+}
+
+static void device_on_connect(void *arg,char ret_code){
+    loadgen_device *device = (loadgen_device *)arg;
+    loadgen *gen = device->_gen;
+    if(ret_code != 0){
+        LOGW("device %d login failed:%d",device->_index,(int)ret_code);
+        //在关闭回调中计为连接失败并重新排队
+        if(device->_session){
+            event_session_close(device->_session);
+        }
+        return;
+    }
+    uint64_t now = loadgen_now_us();
+    device->_connected = 1;
+    ++gen->_connected;
+    ++gen->_interval._connects;
+    mqtt_histogram_record(&gen->_interval._connect_hist,(uint32_t)(now - device->_connect_us));
+    //随机错开各设备的发布时间
+    if(gen->_publish_rate > 0){
+        device->_next_pub_us = now + loadgen_rand(gen) % (uint64_t)(1000000 / gen->_publish_rate + 1);
+    }
+}
+
+static void device_on_ack(void *arg,uint32_t req_id,int time_out){
+    loadgen_device *device = (loadgen_device *)arg;
+    loadgen *gen = device->_gen;
+    int slot = req_id % LOADGEN_WINDOW;
+    if(device->_sent_id[slot] != req_id || !device->_sent_us[slot]){
+        return;
+    }
+    if(time_out){
+        ++gen->_interval._timeouts;
+    }else{
+        ++gen->_interval._acks;
+        mqtt_histogram_record(&gen->_interval._ack_hist,(uint32_t)(loadgen_now_us() - device->_sent_us[slot]));
+    }
+    device->_sent_us[slot] = 0;
+}
+
+static void device_on_close(void *user_data,event_session *session,int err){
+    loadgen_device *device = (loadgen_device *)user_data;
+    loadgen *gen = device->_gen;
+    device->_session = NULL;
+    iot_connection_lost(device->_ctx);
+    if(device->_connected){
+        device->_connected = 0;
+        --gen->_connected;
+        ++gen->_interval._disconnects;
+    }else{
+        ++gen->_interval._connect_fails;
+    }
+    memset(device->_sent_us,0, sizeof(device->_sent_us));
+    if(!gen->_stopping){
+        //重新排队连接
+        loadgen_enqueue(gen,device);
+    }
+}
+
+/**
+ * 非阻塞连接服务器并发送登录包
+ */
+static int device_connect(loadgen *gen,loadgen_device *device){
+    int fd = socket(gen->_addr.ss_family,SOCK_STREAM | SOCK_NONBLOCK,0);
+    if(fd == -1){
+        LOGE("socket failed:%d %s",errno,strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on, sizeof(on));
+    if(-1 == connect(fd,(struct sockaddr *)&gen->_addr,gen->_addr_len) && errno != EINPROGRESS){
+        LOGE("connect failed:%d %s",errno,strerror(errno));
+        close(fd);
+        return -1;
+    }
+    device->_session = event_session_add(gen->_loop,fd,&event_iot_ops,device->_ctx,device_on_close,device);
+    if(!device->_session){
+        close(fd);
+        return -1;
+    }
+    //客户端id只能包含字母与数字
+    char client_id[64];
+    snprintf(client_id, sizeof(client_id),"%s%d",gen->_prefix,device->_index);
+    device->_connect_us = loadgen_now_us();
+    if(0 != iot_send_connect_pkt(device->_ctx,client_id,gen->_secret,gen->_user)){
+        LOGE("iot_send_connect_pkt failed:%s",client_id);
+        event_session_close(device->_session);
+        return 0;
+    }
+    event_session_refresh(device->_session);
+    return 0;
+}
+
+/**
+ * 按权重随机生成一个数据包的端点数据
+ */
+static void device_make_payload(loadgen *gen,loadgen_device *device){
+    static const char *enums[] = {"on","off","idle","busy"};
+    iot_buffer_start(&gen->_buf,1,iot_get_request_id(device->_ctx));
+    int i;
+    for(i = 0 ; i < gen->_points ; ++i){
+        uint64_t rand = loadgen_rand(gen);
+        uint32_t tag_id = 1 + (rand >> 32) % 100;
+        int pick = (int)(rand % gen->_mix[3]);
+        if(pick < gen->_mix[0]){
+            iot_buffer_append_bool(&gen->_buf,tag_id,rand & 0x100 ? 1 : 0);
+        }else if(pick < gen->_mix[1]){
+            iot_buffer_append_double(&gen->_buf,tag_id,(double)(rand % 100000) / 100);
+        }else if(pick < gen->_mix[2]){
+            iot_buffer_append_enum(&gen->_buf,tag_id,enums[(rand >> 8) % 4]);
+        }else{
+            iot_buffer_append_string(&gen->_buf,tag_id,gen->_string);
+        }
+    }
+}
+
+static void device_publish(loadgen *gen,loadgen_device *device,uint64_t now){
+    uint64_t interval_us = (uint64_t)(1000000 / gen->_publish_rate);
+    int sent = 0;
+    while(device->_next_pub_us <= now){
+        device_make_payload(gen,device);
+        //数据包第2~5个字节为大端的req_id
+        const unsigned char *head = (const unsigned char *)gen->_buf._data;
+        uint32_t req_id = ((uint32_t)head[1] << 24) | ((uint32_t)head[2] << 16) | ((uint32_t)head[3] << 8) | head[4];
+        int slot = req_id % LOADGEN_WINDOW;
+        device->_sent_id[slot] = req_id;
+        device->_sent_us[slot] = now;
+        int ret = iot_send_buffer(device->_ctx,&gen->_buf);
+        if(ret != 0){
+            device->_sent_us[slot] = 0;
+            if(ret == IOT_ERR_WOULDBLOCK){
+                //跳过本次发布，避免积压后突发
+                ++gen->_interval._blocked;
+                device->_next_pub_us = now + interval_us;
+            }else{
+                LOGW("device %d publish failed:%d",device->_index,ret);
+                device->_next_pub_us += interval_us;
+            }
+            break;
+        }
+        ++gen->_interval._publishes;
+        gen->_interval._bytes += gen->_buf._len;
+        device->_next_pub_us += interval_us;
+        sent = 1;
+    }
+    if(sent && device->_session){
+        event_session_refresh(device->_session);
+    }
+}
+
+static int loadgen_on_tick(void *user_data){
+    loadgen *gen = (loadgen *)user_data;
+    uint64_t now = loadgen_now_us();
+
+    //令牌桶控制新建连接速率，最多积攒一秒的令牌
+    if(gen->_connect_rate > 0){
+        gen->_connect_tokens += (now - gen->_last_tick_us) * gen->_connect_rate / 1000000;
+        if(gen->_connect_tokens > gen->_connect_rate){
+            gen->_connect_tokens = gen->_connect_rate;
+        }
+    }else{
+        gen->_connect_tokens = gen->_queue_count;
+    }
+    gen->_last_tick_us = now;
+    while(gen->_queue_count && gen->_connect_tokens >= 1){
+        loadgen_device *device = gen->_devices + gen->_queue[gen->_queue_head];
+        gen->_queue_head = (gen->_queue_head + 1) % gen->_device_count;
+        --gen->_queue_count;
+        gen->_connect_tokens -= 1;
+        if(0 != device_connect(gen,device)){
+            ++gen->_interval._connect_fails;
+            loadgen_enqueue(gen,device);
+            break;
+        }
+    }
+
+    if(gen->_publish_rate > 0){
+        int i;
+        for(i = 0 ; i < gen->_device_count ; ++i){
+            loadgen_device *device = gen->_devices + i;
+            if(device->_connected && device->_next_pub_us <= now){
+                device_publish(gen,device,now);
+            }
+        }
+    }
+
+    if(gen->_stats_us && now - gen->_interval_start_us >= gen->_stats_us){
+        loadgen_print(gen,"interval",&gen->_interval,now - gen->_interval_start_us);
+        loadgen_roll_stats(gen);
+        gen->_interval_start_us = now;
+    }
+    return LOADGEN_TICK_MS;
+}
+
+static int loadgen_on_finish(void *user_data){
+    event_loop_stop(((loadgen *)user_data)->_loop);
+    return 0;
+}
+
+static void loadgen_on_signal(int sig){
+    event_loop_stop(s_loop);
+}
+
+static int loadgen_resolve(loadgen *gen,const char *host,int port){
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    char service[16];
+    memset(&hints,0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service),"%d",port);
+    int ret = getaddrinfo(host,service,&hints,&res);
+    if(ret != 0 || !res){
+        LOGE("resolve %s failed:%s",host,gai_strerror(ret));
+        return -1;
+    }
+    memcpy(&gen->_addr,res->ai_addr,res->ai_addrlen);
+    gen->_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * 解析bool:double:enum:string权重为累计权重
+ */
+static int loadgen_parse_mix(loadgen *gen,const char *str){
+    int weights[4] = {0};
+    if(4 != sscanf(str,"%d:%d:%d:%d",weights,weights + 1,weights + 2,weights + 3)){
+        return -1;
+    }
+    int i, sum = 0;
+    for(i = 0 ; i < 4 ; ++i){
+        if(weights[i] < 0){
+            return -1;
+        }
+        sum += weights[i];
+        gen->_mix[i] = sum;
+    }
+    return sum > 0 ? 0 : -1;
+}
+
+static void loadgen_usage(){
+    LOGE("使用方法: loadgen [-a 服务器地址] [-p 端口] [-n 设备数] [-c 每秒新建连接数] [-r 每个设备每秒发布数] [-q qos] "
+         "[-m bool:double:enum:string权重] [-b 每包端点数] [-z 字符串长度] [-t 秒数] [-i 统计间隔秒数] [-e auto|epoll|uring]");
+}
+
+int main(int argc,char *argv[]){
+    const char *host = "127.0.0.1";
+    int port = 1883;
+    int seconds = 10;
+    int stats_sec = 1;
+    event_backend backend = event_backend_auto;
+    static loadgen gen;
+    int opt;
+
+    gen._device_count = 100;
+    gen._connect_rate = 100;
+    gen._publish_rate = 1;
+    gen._qos = 1;
+    gen._points = 4;
+    gen._string_len = 32;
+    gen._user = "JIMIMAX";
+    gen._secret = "loadgen";
+    gen._prefix = "loadgen";
+    gen._rand = 0x9E3779B97F4A7C15ULL;
+    loadgen_parse_mix(&gen,"1:1:1:1");
+    while((opt = getopt(argc,argv,"a:p:n:c:r:q:m:b:z:t:i:e:h")) != -1){
+        switch(opt){
+            case 'a':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'n':
+                gen._device_count = atoi(optarg);
+                break;
+            case 'c':
+                gen._connect_rate = atof(optarg);
+                break;
+            case 'r':
+                gen._publish_rate = atof(optarg);
+                break;
+            case 'q':
+                gen._qos = atoi(optarg);
+                break;
+            case 'm':
+                if(0 != loadgen_parse_mix(&gen,optarg)){
+                    loadgen_usage();
+                    return -1;
+                }
+                break;
+            case 'b':
+                gen._points = atoi(optarg);
+                break;
+            case 'z':
+                gen._string_len = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'i':
+                stats_sec = atoi(optarg);
+                break;
+            case 'e':
+                if(!strcmp(optarg,"epoll")){
+                    backend = event_backend_epoll;
+                }else if(!strcmp(optarg,"uring")){
+                    backend = event_backend_uring;
+                }else if(strcmp(optarg,"auto")){
+                    loadgen_usage();
+                    return -1;
+                }
+                break;
+            default:
+                loadgen_usage();
+                return -1;
+        }
+    }
+    if(port <= 0 || port > 65535 || gen._device_count <= 0 || gen._connect_rate < 0 || gen._publish_rate < 0 ||
+       gen._publish_rate > 1000000 || gen._qos < 0 || gen._qos > 2 || gen._points <= 0 || gen._string_len < 0 ||
+       seconds < 0 || stats_sec < 0){
+        loadgen_usage();
+        return -1;
+    }
+    if(0 != loadgen_resolve(&gen,host,port)){
+        return -1;
+    }
+
+    //每个设备占用一个文件描述符
+    struct rlimit limit;
+    if(0 == getrlimit(RLIMIT_NOFILE,&limit) && limit.rlim_cur < limit.rlim_max){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE,&limit);
+    }
+    signal(SIGPIPE,SIG_IGN);
+    set_log_level(log_warn);
+
+    gen._loop = event_loop_alloc_backend(backend);
+    gen._devices = (loadgen_device *)jimi_malloc(sizeof(loadgen_device) * gen._device_count);
+    gen._queue = (int *)jimi_malloc(sizeof(int) * gen._device_count);
+    gen._string = (char *)jimi_malloc(gen._string_len + 1);
+    if(!gen._loop || !gen._devices || !gen._queue || !gen._string){
+        LOGE("start loadgen failed!");
+        return -1;
+    }
+    memset(gen._string,'x',gen._string_len);
+    gen._string[gen._string_len] = '\0';
+    memset(gen._devices,0, sizeof(loadgen_device) * gen._device_count);
+    buffer_init(&gen._buf);
+
+    int i;
+    for(i = 0 ; i < gen._device_count ; ++i){
+        loadgen_device *device = gen._devices + i;
+        device->_gen = &gen;
+        device->_index = i;
+        iot_callback callback = {device_output,device_on_connect,NULL,device};
+        device->_ctx = iot_context_alloc(&callback);
+        if(!device->_ctx){
+            LOGE("iot_context_alloc failed!");
+            return -1;
+        }
+        iot_set_publish_qos(device->_ctx,gen._qos);
+        iot_set_ack_callback(device->_ctx,device_on_ack);
+        if(gen._qos){
+            //未确认的消息不超过发送时间的槽位数
+            iot_set_flow_control(device->_ctx,LOADGEN_WINDOW,0,NULL);
+        }else{
+            iot_set_flow_control(device->_ctx,0,64 * 1024,NULL);
+        }
+        loadgen_enqueue(&gen,device);
+    }
+
+    s_loop = gen._loop;
+    signal(SIGINT,loadgen_on_signal);
+    signal(SIGTERM,loadgen_on_signal);
+    printf("loadgen %s:%d backend:%s devices:%d connects/sec:%.1f publishes/sec/device:%.2f qos:%d points:%d\n",
+           host,port,
+           event_loop_get_backend(gen._loop) == event_backend_uring ? "uring" : "epoll",
+           gen._device_count,
+           gen._connect_rate,
+           gen._publish_rate,
+           gen._qos,
+           gen._points);
+
+    gen._start_us = gen._last_tick_us = gen._interval_start_us = loadgen_now_us();
+    gen._stats_us = (uint64_t)stats_sec * 1000000;
+    event_loop_add_timer(gen._loop,0,loadgen_on_tick,&gen);
+    if(seconds){
+        event_loop_add_timer(gen._loop,seconds * 1000,loadgen_on_finish,&gen);
+    }
+    event_loop_run(gen._loop);
+
+    uint64_t elapsed_us = loadgen_now_us() - gen._start_us;
+    loadgen_roll_stats(&gen);
+    loadgen_print(&gen,"total",&gen._total,elapsed_us);
+
+    gen._stopping = 1;
+    //释放对象时未确认的消息会打印超时日志
+    set_log_level(log_error);
+    event_loop_free(gen._loop);
+    for(i = 0 ; i < gen._device_count ; ++i){
+        iot_context_free(gen._devices[i]._ctx);
+    }
+    buffer_release(&gen._buf);
+    jimi_free(gen._devices);
+    jimi_free(gen._queue);
+    jimi_free(gen._string);
+    return 0;
+}
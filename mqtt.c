@@ -6,6 +6,7 @@
 #include "jimi_log.h"
 
 #ifdef __alios__
+#include <aos/kernel.h>
 #include <netmgr.h>
 #include <network/network.h>
 #include "app_entry.h"
@@ -15,6 +16,7 @@
 #else
 #include <string.h>
 #include <errno.h>
+#include "jimi_event_loop.h"
 #endif
 
 
@@ -29,6 +31,10 @@ typedef struct {
     void *_ctx;
     //套接字描述符
     int _fd;
+#ifndef __alios__
+    //事件循环中的连接
+    event_session *_session;
+#endif
 } iot_user_data;
 
 /**
@@ -53,12 +59,13 @@ static int send_data_to_sock(void *arg, const struct iovec *iov, int iovcnt){
     }
     int ret = write(user_data->_fd, buf, size);
     jimi_free(buf);
-#else
-    int ret = writev(user_data->_fd,iov,iovcnt);
-#endif
     if(ret == 0){
         LOGW("send failed:%d %s",errno,strerror(errno));
     }
+#else
+    //非阻塞发送，发送缓冲区满时剩余数据由iot对象缓存
+    int ret = event_session_write(user_data->_session,iov,iovcnt);
+#endif
     return ret;
 }
 
@@ -82,10 +89,13 @@ void on_timer_tick(iot_user_data *user_data){
     get_now_time_str(time_str,sizeof(time_str));
 
     if(flag){
+         //四个数据包合并为一次writev发送
+         iot_batch_begin(user_data->_ctx,0,0,0);
          iot_send_bool_pkt(user_data->_ctx,210038,1);
          iot_send_enum_pkt(user_data->_ctx,410498,"1");
          iot_send_string_pkt(user_data->_ctx,410499,time_str);
          iot_send_double_pkt(user_data->_ctx,410500,db);
+         iot_batch_end(user_data->_ctx);
     }else{
         buffer buffer;
         buffer_init(&buffer);
@@ -132,6 +142,15 @@ void iot_on_message(void *arg,int req_flag, uint32_t req_id, iot_data *data){
     }
 }
 
+#ifdef __alios__
+/**
+ * 获取单调递增的时间戳
+ * @return 毫秒
+ */
+static uint64_t now_ms(){
+    return aos_now_ms();
+}
+
 int s_exit_flag  = 0;
 void on_stop(int sig){
     s_exit_flag = 1;
@@ -160,37 +179,129 @@ void run_main(){
     //开始登陆iot服务器
     iot_send_connect_pkt(user_data._ctx,CLIENT_ID,SECRET,USER_NAME);
 
-    //设置socket接收超时时间，两秒超时一次，目的是产生一个定时器
-    net_set_sock_timeout(user_data._fd ,1,2);
-
-    //socket接收buffer
-    char buffer[1024];
+    //每两秒上报一次数据
+    uint64_t next_tick = now_ms() + 2000;
     int timeout = 0x7FFFFFFF;
     signal(SIGINT,on_stop);
     while (!s_exit_flag){
-        //接收数据
-        int recv = read(user_data._fd,buffer, sizeof(buffer));
+        uint64_t now = now_ms();
+        if(now >= next_tick){
+            //触发定时器
+            on_timer_tick(&user_data);
+            next_tick = now + 2000;
+            if(--timeout == 0){
+                //程序到了需要退出的时刻
+                break;
+            }
+        }
+
+        //每次循环都处理到期的定时器，持续收到数据时心跳与超时也不会被饿死
+        iot_timer_schedule(user_data._ctx);
+        //一直等待到iot对象的下一个定时器到期或者下次上报数据，不再轮询
+        int wait_ms = iot_next_timeout(user_data._ctx);
+        if(wait_ms < 0 || wait_ms > next_tick - now){
+            wait_ms = next_tick - now;
+        }
+        int readable = net_wait_readable(user_data._fd,wait_ms);
+        if(readable == -1){
+            break;
+        }
+        if(readable == 0){
+            //等待超时，下次循环处理到期的定时器
+            continue;
+        }
+
+        //直接接收数据到iot对象内部的缓冲区
+        struct iovec iov[2];
+        int iovcnt = iot_input_prepare(user_data._ctx,iov);
+        if(iovcnt <= 0){
+            LOGE("iot_input_prepare failed:%d\r\n",iovcnt);
+            break;
+        }
+        //缓冲区回绕时两块内存都要填充
+        int recv = net_read_iov(user_data._fd,iov,iovcnt);
         if(recv == 0){
             //服务器断开连接
             LOGE("read eof\r\n");
             break;
         }
         if(recv == -1 ){
-            //接收超时，触发定时器
-            on_timer_tick(&user_data);
-            if(--timeout == 0){
-                //程序到了需要退出的时刻
-                break;
+            if(errno == EINTR || errno == EAGAIN){
+                continue;
             }
-            continue;
+            LOGE("read failed:%d %s\r\n",errno,strerror(errno));
+            break;
         }
-        //收到数据，输入到iot对象
-        iot_input_data(user_data._ctx,buffer,recv);
+        //收到数据，提交给iot对象处理
+        iot_input_commit(user_data._ctx,recv);
     }
     //是否iot对象
     iot_context_free(user_data._ctx);
 }
 
+#else
+static event_loop *s_loop = NULL;
+void on_stop(int sig){
+    event_loop_stop(s_loop);
+}
+
+/**
+ * 每两秒上报一次数据
+ */
+static int on_report_timer(void *arg){
+    on_timer_tick((iot_user_data *)arg);
+    return 2000;
+}
+
+/**
+ * 连接断开回调
+ */
+static void on_session_closed(void *arg, event_session *session, int err){
+    LOGE("connection closed:%d %s\r\n",err,strerror(err));
+    event_loop_stop(s_loop);
+}
+
+/**
+ * 运行主函数
+ */
+void run_main(){
+    //设置日志等级
+    set_log_level(log_trace);
+
+    //数据结构体
+    iot_user_data user_data;
+
+    //网络层连接服务器
+    user_data._fd = net_connet_server(SERVER_IP,SERVER_PORT,3);
+    if(user_data._fd  == -1){
+        return ;
+    }
+    //回调函数列表
+    iot_callback callback = {send_data_to_sock,iot_on_connect,iot_on_message,&user_data};
+
+    //创建iot对象，交给事件循环驱动
+    user_data._ctx = iot_context_alloc(&callback);
+    s_loop = event_loop_alloc();
+    user_data._session = event_session_add(s_loop,user_data._fd,&event_iot_ops,user_data._ctx,on_session_closed,&user_data);
+    if(!user_data._session){
+        close(user_data._fd);
+        event_loop_free(s_loop);
+        iot_context_free(user_data._ctx);
+        return;
+    }
+    //开始登陆iot服务器
+    iot_send_connect_pkt(user_data._ctx,CLIENT_ID,SECRET,USER_NAME);
+    event_session_refresh(user_data._session);
+
+    event_loop_add_timer(s_loop,2000,on_report_timer,&user_data);
+    signal(SIGINT,on_stop);
+    event_loop_run(s_loop);
+    event_loop_free(s_loop);
+    //是否iot对象
+    iot_context_free(user_data._ctx);
+}
+#endif
+
 #ifdef __alios__
 int linkkit_main(void *paras){
     int ret;
@@ -5,50 +5,458 @@
 #include "net.h"
 #ifdef __alios__
 #include <network/network.h>
+#include <aos/kernel.h>
 #else
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 #endif
 #include <sys/errno.h>
+#include <fcntl.h>
 #include <memory.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include "jimi_log.h"
+#include "jimi_memory.h"
 
-#ifndef INADDR_NONE
-#define INADDR_NONE ((uint32_t)0xffffffffUL)
+/**
+ * 获取单调递增的时间戳
+ * @return 毫秒
+ */
+static uint64_t net_now_ms(){
+#ifdef __alios__
+    return aos_now_ms();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 #endif
+}
 
-in_addr_t get_host_addr(const char *host){
-    in_addr_t ret = inet_addr(host);
-    struct hostent *hostinfo = NULL;
-
-    if(INADDR_NONE != ret){
+/**
+ * 调用getaddrinfo解析域名，结果去重并且保持系统给出的顺序
+ * @return 0为成功，其他为getaddrinfo错误码
+ */
+static int net_getaddrinfo(const char *host,net_addr_list *list){
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints,0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    memset(list,0, sizeof(net_addr_list));
+    int ret = getaddrinfo(host,NULL,&hints,&result);
+    if(ret != 0){
+        LOGW("getaddrinfo failed:%d, domain %s",ret,host);
         return ret;
     }
+    struct addrinfo *ai;
+    for(ai = result ; ai && list->_count < NET_MAX_ADDRS ; ai = ai->ai_next){
+        if(ai->ai_addrlen > sizeof(struct sockaddr_storage)){
+            continue;
+        }
+        int i;
+        for(i = 0 ; i < list->_count ; ++i){
+            if(0 == memcmp(&list->_addrs[i],ai->ai_addr,ai->ai_addrlen)){
+                break;
+            }
+        }
+        if(i == list->_count){
+            memcpy(&list->_addrs[list->_count++],ai->ai_addr,ai->ai_addrlen);
+        }
+    }
+    freeaddrinfo(result);
+    return list->_count ? 0 : EAI_NONAME;
+}
+
+#ifndef __alios__
+
+//后台解析线程个数
+#define NET_RESOLVE_THREADS 2
+//最多缓存的域名个数
+#define NET_RESOLVE_CACHE_MAX 64
+
+typedef struct net_resolve_waiter {
+    struct net_resolve_waiter *_next;
+    on_net_resolve _cb;
+    void *_user_data;
+} net_resolve_waiter;
+
+typedef struct net_resolve_entry {
+    //缓存链表，最近使用的在前
+    struct net_resolve_entry *_next;
+    //待解析队列
+    struct net_resolve_entry *_job_next;
+    char *_host;
+    //是否正在解析
+    int _resolving;
+    int _err;
+    net_addr_list _list;
+    //缓存过期时间
+    uint64_t _expire_ms;
+    //等待解析结果的回调
+    net_resolve_waiter *_waiters;
+} net_resolve_entry;
+
+static pthread_mutex_t s_resolve_mtx = PTHREAD_MUTEX_INITIALIZER;
+//有新的解析任务
+static pthread_cond_t s_resolve_job_cond = PTHREAD_COND_INITIALIZER;
+//同步解析完成
+static pthread_cond_t s_resolve_done_cond;
+static pthread_once_t s_resolve_once = PTHREAD_ONCE_INIT;
+static int s_resolve_started = 0;
+static net_resolve_entry *s_resolve_cache = NULL;
+static int s_resolve_cache_size = 0;
+static net_resolve_entry *s_resolve_job_head = NULL;
+static net_resolve_entry *s_resolve_job_tail = NULL;
+static int s_resolve_ttl_ms = 60 * 1000;
+static int s_resolve_fail_ttl_ms = 5 * 1000;
+
+static void net_resolve_entry_free(net_resolve_entry *entry){
+    jimi_free(entry->_host);
+    jimi_free(entry);
+}
+
+static void *net_resolve_worker(void *arg){
+    pthread_mutex_lock(&s_resolve_mtx);
+    while(1){
+        while(!s_resolve_job_head){
+            pthread_cond_wait(&s_resolve_job_cond,&s_resolve_mtx);
+        }
+        net_resolve_entry *entry = s_resolve_job_head;
+        s_resolve_job_head = entry->_job_next;
+        if(!s_resolve_job_head){
+            s_resolve_job_tail = NULL;
+        }
+        entry->_job_next = NULL;
+        pthread_mutex_unlock(&s_resolve_mtx);
+
+        //解析中的条目不会被淘汰，可以在锁外访问_host
+        net_addr_list list;
+        int err = net_getaddrinfo(entry->_host,&list);
+
+        pthread_mutex_lock(&s_resolve_mtx);
+        memcpy(&entry->_list,&list, sizeof(list));
+        entry->_err = err;
+        entry->_resolving = 0;
+        entry->_expire_ms = net_now_ms() + (err ? s_resolve_fail_ttl_ms : s_resolve_ttl_ms);
+        net_resolve_waiter *waiters = entry->_waiters;
+        entry->_waiters = NULL;
+        //解锁后条目可能被淘汰
+        char host[NI_MAXHOST];
+        snprintf(host, sizeof(host),"%s",entry->_host);
+        pthread_mutex_unlock(&s_resolve_mtx);
+
+        //在锁外回调，回调中可以再次解析
+        while(waiters){
+            net_resolve_waiter *next = waiters->_next;
+            waiters->_cb(waiters->_user_data,host,err ? NULL : &list,err);
+            jimi_free(waiters);
+            waiters = next;
+        }
+        pthread_mutex_lock(&s_resolve_mtx);
+    }
+    return NULL;
+}
+
+static void net_resolve_start(){
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+    pthread_cond_init(&s_resolve_done_cond,&attr);
+    pthread_condattr_destroy(&attr);
+
+    int i;
+    for(i = 0 ; i < NET_RESOLVE_THREADS ; ++i){
+        pthread_t tid;
+        if(0 != pthread_create(&tid,NULL,net_resolve_worker,NULL)){
+            LOGE("pthread_create failed!");
+            continue;
+        }
+        pthread_detach(tid);
+        ++s_resolve_started;
+    }
+}
+
+/**
+ * 查找缓存条目，并移动到链表头部；请在加锁后调用
+ */
+static net_resolve_entry *net_resolve_find(const char *host){
+    net_resolve_entry **pp = &s_resolve_cache;
+    while(*pp){
+        net_resolve_entry *entry = *pp;
+        if(0 == strcmp(entry->_host,host)){
+            *pp = entry->_next;
+            entry->_next = s_resolve_cache;
+            s_resolve_cache = entry;
+            return entry;
+        }
+        pp = &entry->_next;
+    }
+    return NULL;
+}
+
+/**
+ * 缓存已满时淘汰最久未使用且不在解析中的条目；请在加锁后调用
+ */
+static void net_resolve_evict(){
+    net_resolve_entry **victim = NULL;
+    net_resolve_entry **pp = &s_resolve_cache;
+    while(*pp){
+        if(!(*pp)->_resolving){
+            victim = pp;
+        }
+        pp = &(*pp)->_next;
+    }
+    if(victim){
+        net_resolve_entry *entry = *victim;
+        *victim = entry->_next;
+        net_resolve_entry_free(entry);
+        --s_resolve_cache_size;
+    }
+}
+
+/**
+ * 获取可用的缓存或者加入等待队列；请在加锁后调用
+ * @return 1代表缓存命中(*hit被赋值)，0代表已加入等待，-1代表失败
+ */
+static int net_resolve_lookup_l(const char *host,net_resolve_waiter *waiter,net_resolve_entry **hit){
+    net_resolve_entry *entry = net_resolve_find(host);
+    if(entry && !entry->_resolving && net_now_ms() < entry->_expire_ms){
+        *hit = entry;
+        return 1;
+    }
+    if(!entry){
+        if(s_resolve_cache_size >= NET_RESOLVE_CACHE_MAX){
+            net_resolve_evict();
+        }
+        entry = (net_resolve_entry *)jimi_malloc(sizeof(net_resolve_entry));
+        if(!entry){
+            LOGE("malloc net_resolve_entry failed!");
+            return -1;
+        }
+        memset(entry,0, sizeof(net_resolve_entry));
+        entry->_host = jimi_strdup(host);
+        if(!entry->_host){
+            jimi_free(entry);
+            return -1;
+        }
+        entry->_next = s_resolve_cache;
+        s_resolve_cache = entry;
+        ++s_resolve_cache_size;
+    }
+    if(!entry->_resolving){
+        //没有正在进行的解析，投递给后台线程
+        entry->_resolving = 1;
+        if(s_resolve_job_tail){
+            s_resolve_job_tail->_job_next = entry;
+        }else{
+            s_resolve_job_head = entry;
+        }
+        s_resolve_job_tail = entry;
+        pthread_cond_signal(&s_resolve_job_cond);
+    }
+    waiter->_next = entry->_waiters;
+    entry->_waiters = waiter;
+    return 0;
+}
 
-    if ((hostinfo = gethostbyname(host)) == NULL) {
-        LOGW("gethostbyname failed, errno: %d(%s) domain %s ", errno,strerror(errno), host);
-        return INADDR_NONE;
+/**
+ * 解析ip字符串，无需查询dns
+ * @return 0代表host是ip
+ */
+static int net_parse_ip(const char *host,net_addr_list *list){
+    memset(list,0, sizeof(net_addr_list));
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)&list->_addrs[0];
+    if(1 == inet_pton(AF_INET,host,&addr4->sin_addr)){
+        addr4->sin_family = AF_INET;
+        list->_count = 1;
+        return 0;
+    }
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&list->_addrs[0];
+    if(1 == inet_pton(AF_INET6,host,&addr6->sin6_addr)){
+        addr6->sin6_family = AF_INET6;
+        list->_count = 1;
+        return 0;
     }
+    return -1;
+}
 
-    ret = (*((struct in_addr *)hostinfo->h_addr)).s_addr;
-    return ret;
+int net_resolve_async(const char *host,on_net_resolve cb,void *user_data){
+    CHECK_PTR(host,-1);
+    CHECK_PTR(cb,-1);
+    //同步解析的回调会通知s_resolve_done_cond，ip字符串也在回调前完成初始化
+    pthread_once(&s_resolve_once,net_resolve_start);
+    net_addr_list list;
+    if(0 == net_parse_ip(host,&list)){
+        cb(user_data,host,&list,0);
+        return 0;
+    }
+    if(!s_resolve_started){
+        return -1;
+    }
+    net_resolve_waiter *waiter = (net_resolve_waiter *)jimi_malloc(sizeof(net_resolve_waiter));
+    if(!waiter){
+        LOGE("malloc net_resolve_waiter failed!");
+        return -1;
+    }
+    waiter->_cb = cb;
+    waiter->_user_data = user_data;
+
+    net_resolve_entry *hit = NULL;
+    pthread_mutex_lock(&s_resolve_mtx);
+    int ret = net_resolve_lookup_l(host,waiter,&hit);
+    int err = 0;
+    if(ret == 1){
+        err = hit->_err;
+        memcpy(&list,&hit->_list, sizeof(list));
+    }
+    pthread_mutex_unlock(&s_resolve_mtx);
+
+    if(ret != 0){
+        jimi_free(waiter);
+    }
+    if(ret == 1){
+        cb(user_data,host,err ? NULL : &list,err);
+    }
+    return ret == -1 ? -1 : 0;
 }
 
-int get_server_addr(const char *host, unsigned short port, struct sockaddr_in *server_addr){
-    in_addr_t addr = get_host_addr(host);
-    if(INADDR_NONE == addr){
+typedef struct {
+    net_addr_list *_list;
+    int _err;
+    int _done;
+} net_resolve_sync;
+
+static void net_resolve_on_sync(void *user_data,const char *host,const net_addr_list *list,int err){
+    net_resolve_sync *sync = (net_resolve_sync *)user_data;
+    pthread_mutex_lock(&s_resolve_mtx);
+    if(list){
+        memcpy(sync->_list,list, sizeof(net_addr_list));
+    }
+    sync->_err = err;
+    sync->_done = 1;
+    pthread_cond_broadcast(&s_resolve_done_cond);
+    pthread_mutex_unlock(&s_resolve_mtx);
+}
+
+/**
+ * 超时后从等待队列移除；请在加锁后调用
+ * @return 0代表已移除，-1代表回调正在进行
+ */
+static int net_resolve_cancel_l(const char *host,net_resolve_sync *sync){
+    net_resolve_entry *entry;
+    for(entry = s_resolve_cache ; entry ; entry = entry->_next){
+        if(0 != strcmp(entry->_host,host)){
+            continue;
+        }
+        net_resolve_waiter **pp = &entry->_waiters;
+        while(*pp){
+            if((*pp)->_user_data == sync){
+                net_resolve_waiter *waiter = *pp;
+                *pp = waiter->_next;
+                jimi_free(waiter);
+                return 0;
+            }
+            pp = &(*pp)->_next;
+        }
+        break;
+    }
+    return -1;
+}
+
+int net_resolve(const char *host,net_addr_list *list,int timeout_ms){
+    CHECK_PTR(host,-1);
+    CHECK_PTR(list,-1);
+    net_resolve_sync sync = {list,0,0};
+    if(-1 == net_resolve_async(host,net_resolve_on_sync,&sync)){
         return -1;
     }
-    memset(server_addr, 0, sizeof(struct sockaddr_in));
-    server_addr->sin_family = AF_INET;
-    server_addr->sin_port = htons(port);
-    server_addr->sin_addr.s_addr = addr;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC,&deadline);
+    if(timeout_ms > 0){
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&s_resolve_mtx);
+    while(!sync._done){
+        if(timeout_ms < 0){
+            pthread_cond_wait(&s_resolve_done_cond,&s_resolve_mtx);
+            continue;
+        }
+        if(ETIMEDOUT == pthread_cond_timedwait(&s_resolve_done_cond,&s_resolve_mtx,&deadline) && !sync._done){
+            if(0 == net_resolve_cancel_l(host,&sync)){
+                //解析仍在后台进行，结果会被缓存
+                LOGW("resolve timeout, domain %s",host);
+                sync._err = ETIMEDOUT;
+                break;
+            }
+            //回调已经开始，等待其完成
+            timeout_ms = -1;
+        }
+    }
+    pthread_mutex_unlock(&s_resolve_mtx);
+    return (sync._done && !sync._err) ? 0 : -1;
+}
+
+void net_resolve_set_ttl(int ttl_sec,int fail_ttl_sec){
+    pthread_mutex_lock(&s_resolve_mtx);
+    s_resolve_ttl_ms = ttl_sec * 1000;
+    s_resolve_fail_ttl_ms = fail_ttl_sec * 1000;
+    pthread_mutex_unlock(&s_resolve_mtx);
+}
+
+void net_resolve_flush(){
+    pthread_mutex_lock(&s_resolve_mtx);
+    net_resolve_entry **pp = &s_resolve_cache;
+    while(*pp){
+        net_resolve_entry *entry = *pp;
+        if(entry->_resolving){
+            pp = &entry->_next;
+            continue;
+        }
+        *pp = entry->_next;
+        net_resolve_entry_free(entry);
+        --s_resolve_cache_size;
+    }
+    pthread_mutex_unlock(&s_resolve_mtx);
+}
+
+#else
+
+//AliOS没有通用的线程池，在调用线程中同步解析且不缓存
+int net_resolve_async(const char *host,on_net_resolve cb,void *user_data){
+    CHECK_PTR(host,-1);
+    CHECK_PTR(cb,-1);
+    net_addr_list list;
+    int err = net_getaddrinfo(host,&list);
+    cb(user_data,host,err ? NULL : &list,err);
     return 0;
 }
 
+int net_resolve(const char *host,net_addr_list *list,int timeout_ms){
+    CHECK_PTR(host,-1);
+    CHECK_PTR(list,-1);
+    return net_getaddrinfo(host,list) ? -1 : 0;
+}
+
+void net_resolve_set_ttl(int ttl_sec,int fail_ttl_sec){}
+
+void net_resolve_flush(){}
+
+#endif //__alios__
+
 int net_set_sock_timeout(int fd, int recv, float second){
     struct timeval timeout;
     unsigned int milli_sec = second * 1000;
@@ -62,36 +470,296 @@ int net_set_sock_timeout(int fd, int recv, float second){
     }
     return 0;
 }
-int net_connet_server(const char *host, unsigned short port,float second){
-    int sockfd ;
-    struct sockaddr_in server_addr;
-    if(-1 == get_server_addr(host,port,&server_addr)){
-        LOGW("get_server_addr failed, domain %s ", host);
+
+/**
+ * 等待套接字事件
+ * @param write 0代表等待可读，1代表等待可写
+ */
+static int net_wait_event(int fd, int write, int timeout_ms){
+#ifdef __alios__
+    fd_set fd_set;
+    FD_ZERO(&fd_set);
+    FD_SET(fd, &fd_set);
+
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = 1000 * (timeout_ms % 1000);
+    int ret = select(fd + 1, write ? NULL : &fd_set, write ? &fd_set : NULL, NULL, timeout_ms < 0 ? NULL : &timeout);
+#else
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = write ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, timeout_ms);
+#endif
+    if (ret == -1 && errno != EINTR) {
+        LOGW("wait socket failed, errno: %d(%s)", errno, strerror(errno));
         return -1;
     }
+    return ret > 0 ? 1 : 0;
+}
+
+int net_wait_readable(int fd, int timeout_ms){
+    return net_wait_event(fd, 0, timeout_ms);
+}
+
+int net_wait_writable(int fd, int timeout_ms){
+    return net_wait_event(fd, 1, timeout_ms);
+}
+
+int net_read_iov(int fd, const struct iovec *iov, int iovcnt){
+    int total = 0;
+    int i;
+    for (i = 0; i < iovcnt; ++i) {
+        if (i && net_wait_readable(fd, 0) != 1) {
+            //后续内存块只读取已经到达的数据
+            break;
+        }
+        int ret = read(fd, iov[i].iov_base, iov[i].iov_len);
+        if (ret <= 0) {
+            //已经读取到数据时先返回，错误或者连接关闭在下次读取时报告
+            return total ? total : ret;
+        }
+        total += ret;
+        if ((size_t)ret < iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+
+/**
+ * 发起非阻塞连接
+ * @param connected 立即连接成功时被置1
+ * @return 套接字(非阻塞模式)，-1为失败
+ */
+static int net_connect_start(const struct sockaddr_storage *addr, unsigned short port, int *connected){
+    struct sockaddr_storage server_addr;
+    memcpy(&server_addr, addr, sizeof(server_addr));
+    socklen_t addr_len;
+    if (server_addr.ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *) &server_addr)->sin6_port = htons(port);
+        addr_len = sizeof(struct sockaddr_in6);
+    } else {
+        ((struct sockaddr_in *) &server_addr)->sin_port = htons(port);
+        addr_len = sizeof(struct sockaddr_in);
+    }
+
+    int sockfd = socket(server_addr.ss_family, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        LOGW("create socket failed, errno %d(%s) ", errno, strerror(errno));
+        return -1;
+    }
+
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        LOGW("set nonblock failed, errno %d(%s) ", errno, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    *connected = 0;
+    if (connect(sockfd, (struct sockaddr *) &server_addr, addr_len) == -1) {
+        if (errno != EINPROGRESS) {
+            LOGD("connect failed, errno = %d(%s), family %d port %d ", errno, strerror(errno), server_addr.ss_family, port);
+            close(sockfd);
+            return -1;
+        }
+    } else {
+        *connected = 1;
+    }
+    return sockfd;
+}
+
+/**
+ * 获取非阻塞连接的结果
+ * @return 0为成功，其他为errno
+ */
+static int net_connect_result(int fd){
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *) &err, &err_len) == -1) {
+        return errno;
+    }
+    return err;
+}
 
-    sockfd = socket(AF_INET,SOCK_STREAM,0);
-    if(sockfd == -1){
-        LOGW("create socket failed, errno %d(%s) ", errno,strerror(errno));
+/**
+ * 地址按协议族交替排列(rfc8305第4节)，第一个地址的协议族优先
+ */
+static void net_sort_addrs(const net_addr_list *list, const struct sockaddr_storage *sorted[]){
+    int used[NET_MAX_ADDRS] = {0};
+    int family = list->_count ? list->_addrs[0].ss_family : AF_INET;
+    int i, n;
+    for (n = 0; n < list->_count; ++n) {
+        int pick = -1;
+        for (i = 0; i < list->_count; ++i) {
+            if (used[i]) {
+                continue;
+            }
+            if (pick == -1) {
+                pick = i;
+            }
+            if (list->_addrs[i].ss_family == family) {
+                pick = i;
+                break;
+            }
+        }
+        used[pick] = 1;
+        sorted[n] = &list->_addrs[pick];
+        family = list->_addrs[pick].ss_family == AF_INET6 ? AF_INET : AF_INET6;
+    }
+}
+
+/**
+ * 计算连接的截止时间
+ * @param timeout_ms 超时毫秒数，负数代表不超时
+ * @return 截止时间，不超时返回UINT64_MAX
+ */
+static uint64_t net_connect_deadline(int timeout_ms){
+    return timeout_ms < 0 ? UINT64_MAX : net_now_ms() + timeout_ms;
+}
+
+/**
+ * 计算距离截止时间的毫秒数，用于poll/select
+ * @return 毫秒数，不超时返回-1
+ */
+static int net_wait_ms(uint64_t deadline, uint64_t now){
+    if (deadline == UINT64_MAX) {
         return -1;
     }
+    return deadline > now ? (int) (deadline - now) : 0;
+}
+
+#ifndef __alios__
+
+int net_connect_addrs(const net_addr_list *list, unsigned short port, int delay_ms, int timeout_ms){
+    CHECK_PTR(list, -1);
+    const struct sockaddr_storage *sorted[NET_MAX_ADDRS];
+    net_sort_addrs(list, sorted);
+
+    struct pollfd pfds[NET_MAX_ADDRS];
+    int pending = 0;
+    int next = 0;
+    int winner = -1;
+    uint64_t now = net_now_ms();
+    uint64_t deadline = net_connect_deadline(timeout_ms);
+    uint64_t next_start = now;
 
-    do {
-        if (net_set_sock_timeout(sockfd,1,second) == -1) {
+    while (winner == -1) {
+        now = net_now_ms();
+        if (next < list->_count && (pending == 0 || now >= next_start)) {
+            //上一个尝试超过delay_ms未完成或者已经失败，开始下一个
+            int connected;
+            int fd = net_connect_start(sorted[next++], port, &connected);
+            if (fd != -1 && connected) {
+                winner = fd;
+                break;
+            }
+            if (fd != -1) {
+                pfds[pending].fd = fd;
+                pfds[pending].events = POLLOUT;
+                pfds[pending].revents = 0;
+                ++pending;
+            }
+            next_start = now + delay_ms;
+            continue;
+        }
+        if (pending == 0 || now >= deadline) {
             break;
         }
 
-        if (connect(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) == -1) {
-            LOGW("connect failed, errno = %d(%s), host %s port %d ", errno,strerror(errno), host, port);
+        uint64_t wake = deadline;
+        if (next < list->_count && next_start < wake) {
+            wake = next_start;
+        }
+        int ret = poll(pfds, pending, net_wait_ms(wake, now));
+        if (ret == -1 && errno != EINTR) {
+            LOGW("poll failed, errno: %d(%s)", errno, strerror(errno));
             break;
         }
+        int i = 0;
+        while (ret > 0 && i < pending) {
+            if (!pfds[i].revents) {
+                ++i;
+                continue;
+            }
+            int err = net_connect_result(pfds[i].fd);
+            if (err == 0) {
+                winner = pfds[i].fd;
+                pfds[i] = pfds[--pending];
+                break;
+            }
+            LOGD("connect failed, errno = %d(%s), port %d ", err, strerror(err), port);
+            close(pfds[i].fd);
+            pfds[i] = pfds[--pending];
+            //失败后立即尝试下一个地址
+            next_start = now;
+        }
+    }
 
-        //connect success!
-        LOGI("connect server %s %d success!",host,port);
-        net_set_sock_timeout(sockfd,1,0);
-        return sockfd;
-    }while (0);
+    //关闭落败的连接
+    while (pending) {
+        close(pfds[--pending].fd);
+    }
+    if (winner != -1) {
+        fcntl(winner, F_SETFL, fcntl(winner, F_GETFL, 0) & ~O_NONBLOCK);
+    }
+    return winner;
+}
 
-    close(sockfd);
+#else
+
+//AliOS上依次尝试每个地址
+int net_connect_addrs(const net_addr_list *list, unsigned short port, int delay_ms, int timeout_ms){
+    CHECK_PTR(list, -1);
+    const struct sockaddr_storage *sorted[NET_MAX_ADDRS];
+    net_sort_addrs(list, sorted);
+    uint64_t deadline = net_connect_deadline(timeout_ms);
+    int i;
+    for (i = 0; i < list->_count; ++i) {
+        uint64_t now = net_now_ms();
+        if (now >= deadline) {
+            break;
+        }
+        int connected;
+        int fd = net_connect_start(sorted[i], port, &connected);
+        if (fd == -1) {
+            continue;
+        }
+        if (connected ||
+            (1 == net_wait_writable(fd, net_wait_ms(deadline, now)) && 0 == net_connect_result(fd))) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+            return fd;
+        }
+        close(fd);
+    }
     return -1;
-}
\ No newline at end of file
+}
+
+#endif //__alios__
+
+int net_connet_server(const char *host, unsigned short port,float second){
+    //0或者负数代表不超时，与旧版本一致
+    int timeout_ms = second > 0 ? (int) (second * 1000) : -1;
+    uint64_t deadline = net_connect_deadline(timeout_ms);
+    net_addr_list list;
+    if (-1 == net_resolve(host, &list, timeout_ms)) {
+        LOGW("resolve failed, domain %s ", host);
+        return -1;
+    }
+
+    uint64_t now = net_now_ms();
+    int sockfd = -1;
+    if (now < deadline) {
+        sockfd = net_connect_addrs(&list, port, NET_CONNECT_ATTEMPT_DELAY_MS,
+                                   deadline == UINT64_MAX ? -1 : (int) (deadline - now));
+    }
+    if (sockfd == -1) {
+        LOGW("connect failed, host %s port %d ", host, port);
+        return -1;
+    }
+    //connect success!
+    LOGI("connect server %s %d success!", host, port);
+    return sockfd;
+}
@@ -4,12 +4,115 @@
 
 #ifndef MQTT_NET_H
 #define MQTT_NET_H
+
+#ifdef __alios__
+#include <network/network.h>
+#else
+#include <sys/socket.h>
+#endif
+#include "jimi_type.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
 
+//一个域名最多缓存的地址个数
+#define NET_MAX_ADDRS 8
+//上一个连接尝试未完成时，多少毫秒后并行尝试下一个地址(rfc8305推荐250毫秒)
+#define NET_CONNECT_ATTEMPT_DELAY_MS 250
+
+/**
+ * 域名解析结果，地址中的端口为0
+ */
+typedef struct {
+    int _count;
+    struct sockaddr_storage _addrs[NET_MAX_ADDRS];
+} net_addr_list;
+
+/**
+ * 域名解析结果回调，缓存命中时在调用线程中触发，否则在解析线程中触发
+ * @param user_data 用户数据指针
+ * @param host 域名
+ * @param list 解析结果，失败时为NULL
+ * @param err 0代表成功，其他为getaddrinfo的错误码
+ */
+typedef void (*on_net_resolve)(void *user_data,const char *host,const net_addr_list *list,int err);
+
+/**
+ * 异步解析域名，由少量后台线程调用getaddrinfo完成；结果会被缓存，同一个域名同时只会解析一次
+ * @param host 域名或者ip
+ * @param cb 结果回调
+ * @param user_data 回调用户数据指针
+ * @return 0代表成功投递，-1代表失败(不会回调)
+ */
+int net_resolve_async(const char *host,on_net_resolve cb,void *user_data);
+
+/**
+ * 同步解析域名，与net_resolve_async共享缓存以及正在进行的解析
+ * @param host 域名或者ip
+ * @param list 解析结果
+ * @param timeout_ms 最多等待的毫秒数，-1为一直等待
+ * @return 0代表成功，-1代表失败或者超时
+ */
+int net_resolve(const char *host,net_addr_list *list,int timeout_ms);
+
+/**
+ * 设置域名缓存时间，getaddrinfo不提供dns记录的ttl，所以由用户指定
+ * @param ttl_sec 解析成功的缓存秒数，0代表不缓存
+ * @param fail_ttl_sec 解析失败的缓存秒数，0代表不缓存
+ */
+void net_resolve_set_ttl(int ttl_sec,int fail_ttl_sec);
+
+/**
+ * 清空域名缓存(正在解析的除外)
+ */
+void net_resolve_flush();
+
+/**
+ * 并行连接多个地址(Happy Eyeballs)，地址按协议族交替排列(第一个地址的协议族优先)，
+ * 上一个尝试失败或者超过delay_ms仍未完成时开始下一个，保留第一个连接成功的套接字
+ * @param list 地址列表
+ * @param port 端口
+ * @param delay_ms 相邻两次尝试的间隔
+ * @param timeout_ms 总超时时间，单位毫秒，负数代表不超时(直到所有地址都连接失败)
+ * @return 阻塞模式的套接字，-1为失败
+ */
+int net_connect_addrs(const net_addr_list *list, unsigned short port, int delay_ms, int timeout_ms);
+
+/**
+ * 连接服务器，域名解析与连接均不会超过指定时间；ipv4与ipv6地址竞速连接，@see net_connect_addrs
+ * @param host 域名或者ip
+ * @param port 端口
+ * @param second 超时时间，单位秒，0或者负数代表不超时
+ * @return 阻塞模式的套接字，-1为失败
+ */
 int net_connet_server(const char *host, unsigned short port,float second);
 int net_set_sock_timeout(int fd, int recv, float second);
+/**
+ * 等待套接字可读
+ * @param fd 套接字
+ * @param timeout_ms 最多等待的毫秒数，-1为一直等待
+ * @return 1代表可读，0代表超时，-1代表失败
+ */
+int net_wait_readable(int fd, int timeout_ms);
+
+/**
+ * 等待套接字可写(例如非阻塞连接完成)
+ * @param fd 套接字
+ * @param timeout_ms 最多等待的毫秒数，-1为一直等待
+ * @return 1代表可写，0代表超时，-1代表失败
+ */
+int net_wait_writable(int fd, int timeout_ms);
+
+/**
+ * 读取数据到多个内存块，第一块按套接字的阻塞设置读取，读满后只读取已经到达的数据到后续内存块，不再等待
+ * 用于把数据直接读取到回绕的接收缓冲区(iot_input_prepare)中，不要求系统支持readv
+ * @param fd 套接字
+ * @param iov 内存块数组
+ * @param iovcnt 内存块个数
+ * @return 读取的字节数，0代表对方关闭连接，-1代表失败
+ */
+int net_read_iov(int fd, const struct iovec *iov, int iovcnt);
 
 
 #ifdef __cplusplus
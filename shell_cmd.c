@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include "jimi_shell.h"
 #include "jimi_log.h"
+#include "mqtt_stats.h"
+#include "jimi_memory.h"
 
 
 #define FAILED_STR "Failed: "
@@ -94,6 +96,94 @@ static void on_complete_reboot(void *user_data, printf_func func,cmd_context *cm
     func(user_data,SUCCESS_STR"系统将重启!\r\n");
 }
 
+//////////////////////////////////////////////////////////stats命令//////////////////////////////////////////////////////
+
+static void on_complete_stats(void *user_data, printf_func func,cmd_context *cmd,opt_map all_opt){
+    mqtt_stats stats;
+    int contexts = mqtt_stats_aggregate(&stats);
+    uint64_t pkts_in = 0, pkts_out = 0, bytes_in = 0, bytes_out = 0;
+    int i;
+    for(i = 0 ; i < MQTT_STATS_PKT_TYPES ; ++i){
+        pkts_in += stats._pkts_in[i];
+        pkts_out += stats._pkts_out[i];
+        bytes_in += stats._bytes_in[i];
+        bytes_out += stats._bytes_out[i];
+    }
+    func(user_data,SUCCESS_STR"contexts:%d\r\n",contexts);
+    func(user_data,"  in: %llu pkts %llu bytes, out: %llu pkts %llu bytes\r\n",
+         (unsigned long long)pkts_in,(unsigned long long)bytes_in,
+         (unsigned long long)pkts_out,(unsigned long long)bytes_out);
+    func(user_data,"  publishes:%llu acks:%llu timeouts:%llu retransmits:%llu parse_errors:%llu\r\n",
+         (unsigned long long)stats._publishes,(unsigned long long)stats._acks,
+         (unsigned long long)stats._timeouts,(unsigned long long)stats._retransmits,
+         (unsigned long long)stats._parse_errors);
+    func(user_data,"  connects:%llu reconnects:%llu\r\n",
+         (unsigned long long)stats._connects,(unsigned long long)stats._reconnects);
+    func(user_data,"  high water, output:%llu bytes input:%llu bytes inflight:%llu msgs\r\n",
+         (unsigned long long)stats._output_high_water,(unsigned long long)stats._input_high_water,
+         (unsigned long long)stats._inflight_high_water);
+    if(!opt_map_get_value(all_opt,"packets")){
+        return;
+    }
+    for(i = 0 ; i < MQTT_STATS_PKT_TYPES ; ++i){
+        if(!stats._pkts_in[i] && !stats._pkts_out[i]){
+            continue;
+        }
+        func(user_data,"  %-11s in: %llu pkts %llu bytes, out: %llu pkts %llu bytes\r\n",
+             mqtt_stats_pkt_name(i),
+             (unsigned long long)stats._pkts_in[i],(unsigned long long)stats._bytes_in[i],
+             (unsigned long long)stats._pkts_out[i],(unsigned long long)stats._bytes_out[i]);
+    }
+}
+
+//////////////////////////////////////////////////////////memory命令//////////////////////////////////////////////////////
+
+static option_value_ret on_option_memory_sort(void *user_data,printf_func func,cmd_context *cmd,const char *opt_long_name,const char *opt_val){
+    if(strcmp(opt_val,"live") && strcmp(opt_val,"peak") && strcmp(opt_val,"allocs")){
+        func(user_data,FAILED_STR"%d %s\r\n",-1, "排序方式必须是live、peak或allocs");
+        return ret_interrupt;
+    }
+    return ret_continue;
+}
+
+static void on_complete_memory(void *user_data, printf_func func,cmd_context *cmd,opt_map all_opt){
+    jimi_memory_totals totals;
+    jimi_memory_site sites[32];
+    jimi_memory_sort sort = memory_sort_live;
+    const char *sort_str = opt_map_get_value(all_opt,"sort");
+    int top = atoi(opt_map_get_value(all_opt,"top"));
+    int i,count;
+    if(0 != jimi_memory_get_totals(&totals)){
+        func(user_data,FAILED_STR"%d %s\r\n",-1, "未启用内存跟踪，请定义JIMI_MEMORY_TRACK后重新编译");
+        return;
+    }
+    if(!strcmp(sort_str,"peak")){
+        sort = memory_sort_peak;
+    }else if(!strcmp(sort_str,"allocs")){
+        sort = memory_sort_allocs;
+    }
+    if(top <= 0 || top > (int)(sizeof(sites) / sizeof(sites[0]))){
+        top = sizeof(sites) / sizeof(sites[0]);
+    }
+    count = jimi_memory_get_hotspots(sites,top,sort);
+    func(user_data,SUCCESS_STR"live:%u bytes %u blocks, peak:%u bytes, allocs:%llu frees:%llu sites:%u\r\n",
+         totals._live_bytes,totals._live_count,totals._peak_bytes,
+         (unsigned long long)totals._allocs,(unsigned long long)totals._frees,totals._sites);
+    for(i = 0 ; i < count ; ++i){
+        if(sites[i]._file){
+            func(user_data,"  %s:%d",sites[i]._file,sites[i]._line);
+        }else{
+            func(user_data,"  %p",sites[i]._addr);
+        }
+        func(user_data," live:%u bytes %u blocks, peak:%u bytes, allocs:%llu total:%llu bytes\r\n",
+             sites[i]._live_bytes,sites[i]._live_count,sites[i]._peak_bytes,
+             (unsigned long long)sites[i]._allocs,(unsigned long long)sites[i]._total_bytes);
+    }
+    if(opt_map_get_value(all_opt,"reset")){
+        jimi_memory_reset_stats();
+    }
+}
+
 //////////////////////////////////////////////////////////regist_cmd/////////////////////////////////////////////////////
 
 void regist_cmd(){
@@ -155,6 +245,22 @@ void regist_cmd(){
         cmd_regist(cmd);
     }
 
+    {
+        //mqtt运行统计
+        cmd_context *cmd = cmd_context_alloc("stats", "打印所有mqtt客户端的运行统计", on_complete_stats);
+        cmd_context_add_option_bool(cmd, NULL, 'p', "packets", "按数据包类型打印收发统计");
+        cmd_regist(cmd);
+    }
+
+    {
+        //内存开辟热点
+        cmd_context *cmd = cmd_context_alloc("memory", "按调用位置打印内存占用排行(需要内存跟踪模式)", on_complete_memory);
+        cmd_context_add_option_default(cmd, NULL, 't', "top", "打印前多少个调用位置，最多32个", "10");
+        cmd_context_add_option_default(cmd, on_option_memory_sort, 's', "sort", "排序方式:live(存活字节数)、peak(峰值字节数)、allocs(开辟次数)", "live");
+        cmd_context_add_option_bool(cmd, NULL, 'r', "reset", "打印后清零开辟次数并把峰值重置为当前值");
+        cmd_regist(cmd);
+    }
+
     {
         //reboot
         cmd_context *cmd = cmd_context_alloc("reboot", "重启系统", on_complete_reboot);
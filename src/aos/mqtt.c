@@ -38,6 +38,13 @@ static int  s_led_shake_ms = 300;
 
 static iot_user_data user_data = {NULL , -1};
 
+//因流量控制暂未发送的数据个数上限，超过时丢弃最早的一条
+#define PENDING_REPORT_MAX 4
+//因流量控制暂未发送的数据，恢复可发送时按顺序补发
+static buffer s_pending_report[PENDING_REPORT_MAX];
+static int s_pending_head = 0;
+static int s_pending_count = 0;
+
 static void on_timer(iot_user_data *user_data);
 static void startup_mqtt(void *);
 static void reconnect_mqtt_delay();
@@ -187,6 +194,47 @@ static void on_event(input_event_t *event, iot_user_data *user_data) {
     }
 }
 
+/**
+ * 按顺序补发因流量控制暂未发送的数据，再次被阻塞时等待on_credit继续
+ * @param user_data 用户数据指针
+ */
+static void flush_pending_report(iot_user_data *user_data){
+    while(s_pending_count){
+        buffer *buf = s_pending_report + s_pending_head;
+        if(iot_send_buffer(user_data->_ctx,buf) == IOT_ERR_WOULDBLOCK){
+            return;
+        }
+        buffer_release(buf);
+        s_pending_head = (s_pending_head + 1) % PENDING_REPORT_MAX;
+        --s_pending_count;
+    }
+}
+
+/**
+ * 发送数据，排在未补发的数据之后保证顺序
+ * @param user_data 用户数据指针
+ * @param buf 数据，内容被移走
+ */
+static void send_report(iot_user_data *user_data,buffer *buf){
+    if(s_pending_count == PENDING_REPORT_MAX){
+        LOGW("待发送数据过多，丢弃最早的一条");
+        buffer_release(s_pending_report + s_pending_head);
+        s_pending_head = (s_pending_head + 1) % PENDING_REPORT_MAX;
+        --s_pending_count;
+    }
+    buffer_move(s_pending_report + (s_pending_head + s_pending_count) % PENDING_REPORT_MAX,buf);
+    ++s_pending_count;
+    flush_pending_report(user_data);
+}
+
+/**
+ * 流量控制解除后回调
+ * @param arg 用户数据指针
+ */
+static void on_credit(iot_user_data *user_data){
+    flush_pending_report(user_data);
+}
+
 static void on_timer(iot_user_data *user_data){
     //定时器
     iot_timer_schedule(user_data->_ctx);
@@ -231,7 +279,7 @@ static void on_timer(iot_user_data *user_data){
         sprintf(time_str,"%d",time(NULL));
         iot_buffer_append_string(&buffer,210130,time_str);
     }
-    iot_send_buffer(user_data->_ctx,&buffer);
+    send_report(user_data,&buffer);
     buffer_release(&buffer);
     //下次执行
     aos_post_delayed_action(s_timer_ms,on_timer,user_data);
@@ -243,7 +291,7 @@ static void report_wifi(iot_user_data *user_data){
     iot_buffer_start(&buffer,1,iot_get_request_id(user_data->_ctx));
     iot_buffer_append_string(&buffer,210125,s_wifi_config.ssid);
     iot_buffer_append_string(&buffer,210126,s_wifi_config.pwd);
-    iot_send_buffer(user_data->_ctx,&buffer);
+    send_report(user_data,&buffer);
     buffer_release(&buffer);
 }
 
@@ -278,9 +326,16 @@ static void reconnect_mqtt_delay(){
 }
 
 static void on_sock_read(int fd, iot_user_data *user_data){
-    //socket接收buffer
-    char buffer[256];
-    int size = read(fd,buffer, sizeof(buffer));
+    //直接接收数据到iot对象内部的缓冲区
+    struct iovec iov[2];
+    int iovcnt = iot_input_prepare(user_data->_ctx,iov);
+    if(iovcnt <= 0){
+        LOGE("iot_input_prepare failed");
+        reconnect_mqtt_delay();
+        return;
+    }
+    //缓冲区回绕时两块内存都要填充
+    int size = net_read_iov(fd,iov,iovcnt);
     if(size == 0){
         //服务器断开连接
         LOGE("与mqtt服务器间断开链接");
@@ -292,14 +347,14 @@ static void on_sock_read(int fd, iot_user_data *user_data){
         reconnect_mqtt_delay();
         return;
     }
-    //收到数据，输入到iot对象
-    iot_input_data(user_data->_ctx,buffer,size);
+    //收到数据，提交给iot对象处理
+    iot_input_commit(user_data->_ctx,size);
 }
 
 static void clean_mqtt(iot_user_data *user_data){
     if(user_data->_ctx){
-        iot_context_free(user_data->_ctx);
-        user_data->_ctx = NULL;
+        //保留iot对象，未确认的消息在重连登录后重发
+        iot_connection_lost(user_data->_ctx);
     }
 
     if(user_data->_fd != -1){
@@ -334,8 +389,15 @@ static void startup_mqtt(void *ptr){
 
     //回调函数列表
     iot_callback callback = {send_data_to_sock,on_iot_connect,on_iot_message,&user_data};
-    //创建iot对象
-    user_data._ctx = iot_context_alloc(&callback);
+    if(!user_data._ctx){
+        //创建iot对象，重连时复用
+        user_data._ctx = iot_context_alloc(&callback);
+        //设备内存有限，限制未确认的消息个数以及待发送的字节数
+        //超过限制时数据暂存于s_pending_report，恢复可发送时在on_credit中补发
+        iot_set_flow_control(user_data._ctx,8,4 * 1024,on_credit);
+        //断线期间的数据暂存于内存，重连后补发
+        iot_outbox_enable(user_data._ctx,NULL,8 * 1024,0);
+    }
     //监听socket读取事件
     aos_poll_read_fd(user_data._fd,on_sock_read,&user_data);
     //开始登陆iot服务器
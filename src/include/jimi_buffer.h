@@ -79,6 +79,122 @@ int buffer_assign(buffer *buf,const char *data,int len);
  */
 int buffer_move(buffer *dst,buffer *src);
 
+//byte_buffer内置存储大小，数据不超过该大小时不开辟堆内存
+#define BYTE_BUFFER_INLINE_SIZE 64
+
+/**
+ * 带读写偏移的字节缓冲区
+ * 写入时容量按倍数增长，从头部消费数据只移动读偏移，
+ * 写入空间不够并且已消费的数据不少于剩余数据时才搬移剩余数据(延迟压缩)
+ * 可读数据末尾总是保留一个'\0'，可以直接当作字符串使用
+ * 小数据存放在对象内置存储中，所以不能直接memcpy对象，请使用byte_buffer_move
+ */
+typedef struct {
+    //堆内存，为NULL时使用_inline
+    char *_heap;
+    //读偏移
+    int _read;
+    //写偏移
+    int _write;
+    //当前存储的总容量
+    int _capacity;
+    char _inline[BYTE_BUFFER_INLINE_SIZE];
+} byte_buffer;
+
+/**
+ * 初始化byte_buffer对象
+ * @param buf 对象指针
+ * @return 0为成功
+ */
+int byte_buffer_init(byte_buffer *buf);
+
+/**
+ * 释放byte_buffer对象开辟的堆内存，释放后对象回到初始状态，可以继续使用
+ * @param buf 对象指针
+ * @return 0为成功
+ */
+int byte_buffer_release(byte_buffer *buf);
+
+/**
+ * 获取可读数据起始地址，数据末尾有'\0'
+ * @param buf 对象指针
+ * @return 可读数据起始地址
+ */
+char *byte_buffer_data(byte_buffer *buf);
+
+/**
+ * 获取可读数据长度
+ * @param buf 对象指针
+ * @return 可读数据字节数
+ */
+int byte_buffer_size(byte_buffer *buf);
+
+/**
+ * 确保至少还能写入len个字节，必要时压缩或扩容，扩容后之前获取的数据指针失效
+ * @param buf 对象指针
+ * @param len 需要写入的字节数
+ * @return 0为成功
+ */
+int byte_buffer_reserve(byte_buffer *buf,int len);
+
+/**
+ * 获取可写空间，用于直接接收数据(例如read)，写完后调用byte_buffer_commit提交
+ * @param buf 对象指针
+ * @param len 至少需要的可写字节数
+ * @param writable 返回实际可写的字节数，可以为NULL
+ * @return 可写空间起始地址，失败返回NULL
+ */
+char *byte_buffer_prepare(byte_buffer *buf,int len,int *writable);
+
+/**
+ * 提交byte_buffer_prepare后写入的数据
+ * @param buf 对象指针
+ * @param len 写入的字节数，不能超过可写字节数
+ * @return 0为成功
+ */
+int byte_buffer_commit(byte_buffer *buf,int len);
+
+/**
+ * 追加数据至末尾
+ * @param buf 对象指针
+ * @param data 数据指针
+ * @param len 数据长度，可以为0，为0时内部使用strlen获得长度
+ * @return 0为成功
+ */
+int byte_buffer_append(byte_buffer *buf,const char *data,int len);
+
+/**
+ * 复制数据至byte_buffer对象，之前的数据被清空
+ * @param buf 对象指针
+ * @param data 数据指针
+ * @param len 数据长度，可以为0，为0时内部使用strlen获得长度
+ * @return 0为成功
+ */
+int byte_buffer_assign(byte_buffer *buf,const char *data,int len);
+
+/**
+ * 从头部消费数据，只移动读偏移
+ * @param buf 对象指针
+ * @param len 消费的字节数，超过可读数据长度时清空
+ * @return 0为成功
+ */
+int byte_buffer_consume(byte_buffer *buf,int len);
+
+/**
+ * 清空数据，不释放内存
+ * @param buf 对象指针
+ * @return 0为成功
+ */
+int byte_buffer_clear(byte_buffer *buf);
+
+/**
+ * 把src对象里面的数据移动至dst，src使用堆内存时无memcpy
+ * @param dst 目标对象
+ * @param src 源对象
+ * @return 0为成功
+ */
+int byte_buffer_move(byte_buffer *dst,byte_buffer *src);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
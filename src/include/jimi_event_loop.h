@@ -0,0 +1,225 @@
+//
+// Created by xzl on 2019/7/17.
+//
+
+#ifndef MQTT_JIMI_EVENT_LOOP_H
+#define MQTT_JIMI_EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 基于epoll(边缘触发)或者io_uring的事件循环，一个线程驱动大量mqtt_context/iot_context连接，仅支持linux
+ * 发送缓冲区满时剩余数据由对象内部缓存，可写时继续发送；
+ * 所有对象的定时任务由事件循环的时间轮统一驱动，无需再定时调用xxx_timer_schedule
+ * 请勿跨线程调用本模块的接口(event_loop_stop、event_loop_wakeup除外)
+ */
+typedef struct event_loop event_loop;
+
+/**
+ * 事件循环的io后端
+ */
+typedef enum {
+    //编译时开启ENABLE_IO_URING并且内核支持时使用io_uring，否则使用epoll
+    event_backend_auto = 0,
+    //epoll边缘触发，readv/writev直接读写套接字
+    event_backend_epoll,
+    //io_uring多次接收(共享接收缓冲区环)，发送数据拷贝到注册缓冲区后链式提交，需要linux 6.0+
+    event_backend_uring,
+} event_backend;
+
+/**
+ * 事件循环中的一个连接
+ */
+typedef struct event_session event_session;
+
+/**
+ * 事件循环驱动对象所需的接口，参数与iot_xxx/mqtt_xxx同名函数一致
+ */
+typedef struct {
+    int (*input_prepare)(void *ctx,struct iovec *iov);
+    int (*input_commit)(void *ctx,int len);
+    int (*on_writable)(void *ctx);
+    int (*timer_schedule)(void *ctx);
+    int (*next_timeout)(void *ctx);
+} event_session_ops;
+
+//驱动iot_context_alloc创建的对象
+extern const event_session_ops event_iot_ops;
+//驱动mqtt_alloc_contex创建的对象
+extern const event_session_ops event_mqtt_ops;
+
+/**
+ * 连接关闭回调，回调之后会话对象失效；请在此处释放或者复用(xxx_connection_lost)对象
+ * @param user_data 用户数据指针
+ * @param session 会话对象
+ * @param err 0代表对端正常断开或者主动关闭，其他为errno
+ */
+typedef void (*on_session_close)(void *user_data,event_session *session,int err);
+
+/**
+ * 事件循环定时器回调
+ * @param user_data 用户数据指针
+ * @return 多少毫秒后再次触发，<=0代表不再触发
+ */
+typedef int (*on_loop_timer)(void *user_data);
+
+/**
+ * 事件循环被event_loop_wakeup唤醒时回调，在事件循环线程中触发
+ * @param user_data 用户数据指针
+ */
+typedef void (*on_loop_wakeup)(void *user_data);
+
+/**
+ * 创建事件循环，@see event_backend_auto
+ * @return 事件循环对象，NULL代表失败
+ */
+event_loop *event_loop_alloc();
+
+/**
+ * 使用指定后端创建事件循环
+ * @param backend io后端
+ * @return 事件循环对象，NULL代表失败(例如未开启ENABLE_IO_URING或者内核不支持io_uring)
+ */
+event_loop *event_loop_alloc_backend(event_backend backend);
+
+/**
+ * 获取事件循环实际使用的后端
+ * @param loop 事件循环对象
+ * @return event_backend_epoll或者event_backend_uring
+ */
+event_backend event_loop_get_backend(event_loop *loop);
+
+/**
+ * 关闭所有连接(触发关闭回调)并释放事件循环
+ * @param loop 事件循环对象
+ * @return 0为成功
+ */
+int event_loop_free(event_loop *loop);
+
+/**
+ * 运行事件循环，直到调用event_loop_stop
+ * @param loop 事件循环对象
+ * @return 0为正常退出，-1为失败
+ */
+int event_loop_run(event_loop *loop);
+
+/**
+ * 处理一轮事件
+ * @param loop 事件循环对象
+ * @param max_wait_ms 没有事件时最多等待的毫秒数，-1代表一直等到下一个定时器
+ * @return 处理的网络事件个数，-1为失败
+ */
+int event_loop_run_once(event_loop *loop,int max_wait_ms);
+
+/**
+ * 停止事件循环，可以在其他线程或者信号处理函数中调用
+ * @param loop 事件循环对象
+ */
+void event_loop_stop(event_loop *loop);
+
+/**
+ * 唤醒事件循环，可以在其他线程中调用，多次唤醒可能只触发一次回调
+ * @param loop 事件循环对象
+ */
+void event_loop_wakeup(event_loop *loop);
+
+/**
+ * 设置唤醒回调，请在事件循环运行前设置
+ * @param loop 事件循环对象
+ * @param cb 回调函数
+ * @param user_data 回调用户数据指针
+ */
+void event_loop_set_wakeup(event_loop *loop,on_loop_wakeup cb,void *user_data);
+
+/**
+ * 添加定时器
+ * @param loop 事件循环对象
+ * @param delay_ms 多少毫秒后触发
+ * @param cb 回调函数
+ * @param user_data 回调用户数据指针
+ * @return 定时器句柄，0代表失败
+ */
+uint32_t event_loop_add_timer(event_loop *loop,int delay_ms,on_loop_timer cb,void *user_data);
+
+/**
+ * 取消定时器，定时器回调返回<=0之后句柄失效
+ * @param loop 事件循环对象
+ * @param timer 定时器句柄
+ */
+void event_loop_cancel_timer(event_loop *loop,uint32_t timer);
+
+/**
+ * 获取连接个数
+ * @param loop 事件循环对象
+ * @return 连接个数
+ */
+uint32_t event_loop_session_count(event_loop *loop);
+
+/**
+ * 把已经连接(或者正在非阻塞连接)的套接字加入事件循环，关闭连接时由事件循环close
+ * epoll后端把套接字设置为非阻塞模式，io_uring后端则设置为阻塞模式(由io_uring负责等待)
+ * 对象的输出回调请调用event_session_write
+ * @param loop 事件循环对象
+ * @param fd 套接字
+ * @param ops 驱动对象的接口，@see event_iot_ops event_mqtt_ops
+ * @param ctx iot_context或者mqtt_context对象
+ * @param cb 连接关闭回调
+ * @param user_data 回调用户数据指针
+ * @return 会话对象，NULL代表失败(此时不会close套接字)
+ */
+event_session *event_session_add(event_loop *loop,
+                                 int fd,
+                                 const event_session_ops *ops,
+                                 void *ctx,
+                                 on_session_close cb,
+                                 void *user_data);
+
+/**
+ * 非阻塞发送数据，请在对象的输出回调中调用
+ * io_uring后端把数据拷贝到发送块中，在本轮事件处理完毕后提交
+ * @param session 会话对象
+ * @param iov 数据块
+ * @param iovcnt 数据块个数
+ * @return 实际发送(或者拷贝)的字节数，发送缓冲区满时可能为0；-1为失败，此时连接将被关闭
+ */
+int event_session_write(event_session *session,const struct iovec *iov,int iovcnt);
+
+/**
+ * 关闭连接，本轮事件处理完毕后触发关闭回调，可以在任意回调中调用
+ * io_uring后端已经拷贝到发送块的数据在发送完毕后才关闭套接字；
+ * epoll后端立即关闭套接字，对象中尚未写入内核的数据被丢弃，需要保证送达时请等待输出缓冲区发送完毕后再关闭
+ * @param session 会话对象
+ * @return 0为成功
+ */
+int event_session_close(event_session *session);
+
+/**
+ * 在事件循环回调之外对对象进行了操作(例如发布消息)，请调用本函数更新对象的定时器
+ * 事件循环回调中的操作无需调用
+ * @param session 会话对象
+ */
+void event_session_refresh(event_session *session);
+
+/**
+ * 获取会话的对象指针
+ * @param session 会话对象
+ * @return iot_context或者mqtt_context对象
+ */
+void *event_session_context(event_session *session);
+
+/**
+ * 获取会话的套接字
+ * @param session 会话对象
+ * @return 套接字
+ */
+int event_session_fd(event_session *session);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_JIMI_EVENT_LOOP_H
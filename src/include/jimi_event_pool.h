@@ -0,0 +1,144 @@
+//
+// Created by xzl on 2019/7/18.
+//
+
+#ifndef MQTT_JIMI_EVENT_POOL_H
+#define MQTT_JIMI_EVENT_POOL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 多线程连接池，每个线程(绑定到一个cpu核心)运行一个事件循环，连接按client_id哈希分配到线程
+ * mqtt_context只在所属线程中访问，本身无需加锁；其他线程通过每个线程的无锁多生产者单消费者队列投递命令
+ * 仅支持linux
+ */
+typedef struct event_pool event_pool;
+
+/**
+ * 连接池事件回调，均在连接所属的线程中触发
+ */
+typedef struct {
+    /**
+     * 登录服务器结果
+     * @param user_data 用户数据指针
+     * @param client_id 客户端id
+     * @param ctx mqtt_context对象，可以在本线程中直接操作
+     * @param ret_code 0代表成功
+     */
+    void (*pool_on_connect)(void *user_data,const char *client_id,void *ctx,char ret_code);
+
+    /**
+     * 收到服务器发布的消息
+     * @param user_data 用户数据指针
+     * @param client_id 客户端id
+     * @param topic 主题
+     * @param payload 负载
+     * @param payloadsize 负载长度
+     * @param qos qos等级
+     */
+    void (*pool_on_publish)(void *user_data,
+                            const char *client_id,
+                            const char *topic,
+                            const char *payload,
+                            uint32_t payloadsize,
+                            int qos);
+
+    /**
+     * 连接关闭，回调后连接对应的mqtt_context被释放
+     * @param user_data 用户数据指针
+     * @param client_id 客户端id
+     * @param err 0代表正常关闭，其他为errno
+     */
+    void (*pool_on_close)(void *user_data,const char *client_id,int err);
+
+    void *_user_data;
+} event_pool_callback;
+
+/**
+ * 在连接所属线程中执行的任务
+ * @param ctx mqtt_context对象
+ * @param arg 用户数据指针
+ */
+typedef void (*event_pool_task)(void *ctx,void *arg);
+
+/**
+ * 创建连接池并启动线程
+ * @param threads 线程个数，<=0代表cpu核心数
+ * @param cb 事件回调
+ * @return 连接池对象，NULL代表失败
+ */
+event_pool *event_pool_alloc(int threads,const event_pool_callback *cb);
+
+/**
+ * 停止所有线程，关闭所有连接并释放连接池
+ * @param pool 连接池对象
+ * @return 0为成功
+ */
+int event_pool_free(event_pool *pool);
+
+/**
+ * 获取client_id所属的线程序号
+ * @param pool 连接池对象
+ * @param client_id 客户端id
+ * @return 线程序号
+ */
+int event_pool_shard(event_pool *pool,const char *client_id);
+
+/**
+ * 把已经连接服务器的套接字交给连接池，由所属线程创建mqtt_context并登录；可以在任意线程调用
+ * client_id已经存在时先关闭旧连接
+ * @param pool 连接池对象
+ * @param client_id 客户端id
+ * @param fd 套接字，此后由连接池负责关闭
+ * @param keep_alive 心跳间隔，单位秒
+ * @param user 用户名
+ * @param password 密码
+ * @return 0代表命令投递成功，-1代表失败(此时不会关闭套接字)
+ */
+int event_pool_connect(event_pool *pool,const char *client_id,int fd,int keep_alive,const char *user,const char *password);
+
+/**
+ * 发布消息，负载被拷贝后投递给连接所属线程；可以在任意线程调用
+ * @param pool 连接池对象
+ * @param client_id 客户端id
+ * @param topic 主题
+ * @param payload 负载
+ * @param payload_len 负载长度，<=0时通过strlen获取
+ * @param qos qos等级
+ * @param retain 是否保留
+ * @return 0代表命令投递成功
+ */
+int event_pool_publish(event_pool *pool,
+                       const char *client_id,
+                       const char *topic,
+                       const char *payload,
+                       int payload_len,
+                       int qos,
+                       int retain);
+
+/**
+ * 在连接所属线程中对其mqtt_context执行任务，连接不存在时不执行；可以在任意线程调用
+ * @param pool 连接池对象
+ * @param client_id 客户端id
+ * @param task 任务
+ * @param arg 任务用户数据指针
+ * @return 0代表命令投递成功
+ */
+int event_pool_execute(event_pool *pool,const char *client_id,event_pool_task task,void *arg);
+
+/**
+ * 断开连接，可以在任意线程调用
+ * @param pool 连接池对象
+ * @param client_id 客户端id
+ * @return 0代表命令投递成功
+ */
+int event_pool_disconnect(event_pool *pool,const char *client_id);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_JIMI_EVENT_POOL_H
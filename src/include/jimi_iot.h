@@ -32,13 +32,30 @@ typedef struct {
 
 } iot_data;
 
+//未确认的消息或者待发送的数据已达上限，请等待可发送回调后重试，@see iot_set_flow_control
+#define IOT_ERR_WOULDBLOCK (-10)
+
+/**
+ * 发送数据因流量控制返回IOT_ERR_WOULDBLOCK后，恢复可发送时的回调
+ * @param arg 用户数据指针,即iot_callback::_user_data
+ */
+typedef void (*iot_on_credit)(void *arg);
+
+/**
+ * 发送的数据被服务器确认或者等待确认超时后的回调
+ * @param arg 用户数据指针,即iot_callback::_user_data
+ * @param req_id 数据包的请求序号
+ * @param time_out 非0代表等待确认超时
+ */
+typedef void (*iot_on_ack)(void *arg, uint32_t req_id, int time_out);
+
 typedef struct {
     /**
      * 对象输出协议数据，请调用writev发送给服务器
      * @param arg 用户数据指针,即本结构体的_user_data参数
      * @param iov 数据块
      * @param iovcnt 数据块个数
-     * @param 返回-1代表失败，大于0则为成功
+     * @param 返回-1代表失败，否则为实际发送的字节数，未发送的部分在iot_on_writable时继续发送
      */
     int (*iot_on_output)(void *arg, const struct iovec *iov, int iovcnt);
 
@@ -125,6 +142,23 @@ int iot_send_enum_pkt(void *iot_ctx,uint32_t tag_id,const char *enum_str);
  */
 int iot_send_string_pkt(void *iot_ctx,uint32_t tag_id,const char *str);
 
+/**
+ * 开始批量发送模式，此后发送的数据包先缓存，满足任一条件时合并为一次系统调用发送
+ * @param iot_ctx 对象指针
+ * @param max_bytes 缓存的字节数达到该值时发送，0为不限制
+ * @param max_pkts 缓存的数据包个数达到该值时发送，0为不限制
+ * @param max_delay_ms 第一个数据包缓存后最多等待的时间，由iot_timer_schedule触发发送，0为不限制
+ * @return 0为成功，其他为错误代码
+ */
+int iot_batch_begin(void *iot_ctx,uint32_t max_bytes,int max_pkts,int max_delay_ms);
+
+/**
+ * 结束批量发送模式，并发送缓存的数据包
+ * @param iot_ctx 对象指针
+ * @return 0为成功，其他为错误代码
+ */
+int iot_batch_end(void *iot_ctx);
+
 ///////////////////////////////////////////////////////////////////////////////
 /**
  * 开始批量生成多个端点数据
@@ -192,6 +226,77 @@ int iot_send_buffer(void *iot_ctx,buffer *buffer);
  */
 int iot_input_data(void *iot_ctx,char *data,int len);
 
+/**
+ * 获取对象内部接收缓冲区中可写入的内存，网络层可以直接把数据读取到此处，免去一次拷贝
+ * 缓冲区回绕时返回两块内存，可以用readv一次读满
+ * @see iot_input_commit
+ * @param iot_ctx 对象指针
+ * @param iov 返回可写入的内存块数组，至少有两个成员
+ * @return 可写入的内存块个数，-1为失败
+ */
+int iot_input_prepare(void *iot_ctx,struct iovec *iov);
+
+/**
+ * 提交已经写入内部接收缓冲区的数据并处理
+ * @see iot_input_prepare
+ * @param iot_ctx 对象指针
+ * @param len 实际写入的字节数
+ * @return 0代表成功，其他为错误代码
+ */
+int iot_input_commit(void *iot_ctx,int len);
+
+/**
+ * 网络层可写时请调用此函数，继续发送上次未发送完毕的数据
+ * @param iot_ctx 对象指针
+ * @return 0为成功，其他为错误代码
+ */
+int iot_on_writable(void *iot_ctx);
+
+/**
+ * 网络连接断开时请调用此方法，之后可以复用本对象重新连接服务器；
+ * 未确认的qos1/2消息在重新登录成功后按顺序重发
+ * @param iot_ctx 对象指针
+ * @return 0为成功，-1为失败
+ */
+int iot_connection_lost(void *iot_ctx);
+
+/**
+ * 设置发送数据的流量控制，超过限制时iot_send_xxx返回IOT_ERR_WOULDBLOCK
+ * @param iot_ctx 对象指针
+ * @param max_inflight 最多未确认的消息个数，0为不限制
+ * @param max_output_bytes 最多未发送完毕的字节数，0为不限制
+ * @param cb 返回IOT_ERR_WOULDBLOCK之后恢复可发送时回调一次，可以为NULL
+ * @return 0为成功，-1为失败
+ */
+int iot_set_flow_control(void *iot_ctx,int max_inflight,uint32_t max_output_bytes,iot_on_credit cb);
+
+/**
+ * 设置发送数据的qos等级，默认为1
+ * @param iot_ctx 对象指针
+ * @param qos 0~2，qos0的数据服务器不确认，不会触发iot_on_ack
+ * @return 0为成功，-1为失败
+ */
+int iot_set_publish_qos(void *iot_ctx,int qos);
+
+/**
+ * 设置数据被服务器确认后的回调，qos2的数据在完成全部交互后回调；
+ * 存入离线消息队列的数据在补发并被确认后回调，被丢弃的数据以超时回调，上次进程存入的数据不会回调
+ * @param iot_ctx 对象指针
+ * @param cb 回调函数，NULL代表取消
+ * @return 0为成功，-1为失败
+ */
+int iot_set_ack_callback(void *iot_ctx,iot_on_ack cb);
+
+/**
+ * 启用离线消息队列，断线期间iot_send_xxx发送的数据暂存于队列，重新登录成功后按顺序补发
+ * @param iot_ctx 对象指针
+ * @param path 队列文件路径，进程重启后仍然有效；NULL代表只保存在内存中
+ * @param capacity 队列大小，单位字节，队列满时丢弃最旧的数据
+ * @param sync_interval_ms 队列修改后最多间隔多少毫秒同步到磁盘
+ * @return 0为成功，-1为失败
+ */
+int iot_outbox_enable(void *iot_ctx,const char *path,uint32_t capacity,int sync_interval_ms);
+
 /**
  * 请每隔一段时间触发此函数，建议1~3秒
  * 本对象内部需要定时器管理状态
@@ -200,6 +305,13 @@ int iot_input_data(void *iot_ctx,char *data,int len);
  */
 int iot_timer_schedule(void *iot_ctx);
 
+/**
+ * 获取距离下一次需要调用iot_timer_schedule的时间
+ * @param iot_ctx 对象指针
+ * @return 毫秒，0代表需要立即调用，-1代表没有定时任务
+ */
+int iot_next_timeout(void *iot_ctx);
+
 /**
  * 获取本次请求req_id
  * @see iot_buffer_start
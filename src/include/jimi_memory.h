@@ -4,6 +4,9 @@
 
 #ifndef MQTT_JIMI_MEMORY_H
 #define MQTT_JIMI_MEMORY_H
+
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -26,6 +29,89 @@ void jimi_free(void *ptr);
 void *jimi_realloc(void *ptr,int size);
 char *jimi_strdup(const char *str);
 
+///////////////////内存分配跟踪/////////////////////////////
+/**
+ * 定义JIMI_MEMORY_TRACK(cmake -DENABLE_MEMORY_TRACK=ON)后编译为跟踪模式：
+ * jimi_malloc等函数按调用位置(文件与行号)统计开辟次数、存活字节数与峰值字节数，用于在设备上定位各层的内存开辟热点
+ * 通过函数指针调用时无法获取文件与行号，按返回地址统计；释放内存时计入开辟该内存的调用位置
+ * 每块内存额外占用16字节头部，非跟踪模式下以下函数返回-1
+ */
+
+/**
+ * 单个调用位置的统计
+ */
+typedef struct {
+    //源文件，为NULL时按返回地址统计
+    const char *_file;
+    int _line;
+    void *_addr;
+    //累计开辟次数与释放次数
+    uint64_t _allocs;
+    uint64_t _frees;
+    //累计开辟字节数
+    uint64_t _total_bytes;
+    //当前存活块数与字节数
+    uint32_t _live_count;
+    uint32_t _live_bytes;
+    //存活字节数峰值
+    uint32_t _peak_bytes;
+} jimi_memory_site;
+
+/**
+ * 全局统计
+ */
+typedef struct {
+    uint64_t _allocs;
+    uint64_t _frees;
+    uint32_t _live_count;
+    uint32_t _live_bytes;
+    uint32_t _peak_bytes;
+    //已经记录的调用位置个数
+    uint32_t _sites;
+} jimi_memory_totals;
+
+typedef enum {
+    memory_sort_live = 0,//按存活字节数排序
+    memory_sort_peak,//按峰值字节数排序
+    memory_sort_allocs,//按开辟次数排序
+} jimi_memory_sort;
+
+/**
+ * 获取全局统计
+ * @return 0为成功，非跟踪模式返回-1
+ */
+int jimi_memory_get_totals(jimi_memory_totals *totals);
+
+/**
+ * 获取按指定方式从大到小排序的调用位置统计
+ * @param sites 输出数组
+ * @param max 数组长度
+ * @param sort 排序方式
+ * @return 输出的个数，非跟踪模式返回-1
+ */
+int jimi_memory_get_hotspots(jimi_memory_site *sites,int max,jimi_memory_sort sort);
+
+/**
+ * 通过日志打印函数输出排名前top的调用位置
+ * @return 0为成功，非跟踪模式返回-1
+ */
+int jimi_memory_dump(int top,jimi_memory_sort sort);
+
+/**
+ * 清零累计开辟释放次数，峰值重置为当前存活字节数，便于只统计某段时间内的开辟
+ */
+void jimi_memory_reset_stats();
+
+#ifdef JIMI_MEMORY_TRACK
+void *jimi_malloc_track(int size,const char *file,int line);
+void *jimi_realloc_track(void *ptr,int size,const char *file,int line);
+char *jimi_strdup_track(const char *str,const char *file,int line);
+
+#define jimi_malloc(size) jimi_malloc_track(size,__FILE__,__LINE__)
+#define jimi_realloc(ptr,size) jimi_realloc_track(ptr,size,__FILE__,__LINE__)
+#define jimi_strdup(str) jimi_strdup_track(str,__FILE__,__LINE__)
+#endif //JIMI_MEMORY_TRACK
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
@@ -0,0 +1,91 @@
+//
+// Created by xzl on 2019/7/24.
+//
+
+#ifndef MQTT_JIMI_SLAB_H
+#define MQTT_JIMI_SLAB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 按固定规格分块的slab内存分配器，通过jimi_memory的替换函数接管jimi_malloc等函数
+ * 小对象(mqtt请求回调、hash表节点、avl树节点、MqttBuffer内存块等)按规格从内存页中分配，
+ * 同规格对象集中存放，整页空闲后归还页池给其他规格使用，避免长期运行后内存碎片导致开辟失败
+ * 超过最大规格或者slab内存耗尽时交给系统malloc
+ * 返回的内存按8字节对齐
+ */
+
+//规格个数
+#define JIMI_SLAB_CLASS_COUNT 12
+
+//启用线程本地缓存，分配释放小对象时大部分情况下无需加锁，仅linux有效
+#define JIMI_SLAB_THREAD_CACHE 0x01
+
+/**
+ * 单个规格的占用统计
+ */
+typedef struct {
+    //块大小
+    uint32_t _block_size;
+    //该规格占用的页数
+    uint32_t _pages;
+    //已经分配的块数，包括线程本地缓存中的块
+    uint32_t _used;
+    //总块数
+    uint32_t _total;
+} jimi_slab_class_stats;
+
+/**
+ * slab分配器占用统计
+ */
+typedef struct {
+    jimi_slab_class_stats _classes[JIMI_SLAB_CLASS_COUNT];
+    //页大小
+    uint32_t _page_size;
+    //总页数以及空闲页数(包括尚未使用的页)
+    uint32_t _pages_total;
+    uint32_t _pages_free;
+    //开辟的内存区个数，固定内存模式下为1
+    uint32_t _arenas;
+    //交给系统malloc的次数以及释放次数
+    uint64_t _fallback_allocs;
+    uint64_t _fallback_frees;
+} jimi_slab_stats;
+
+/**
+ * 启用slab分配器，之后jimi_malloc/jimi_free/jimi_realloc/jimi_strdup均由slab分配器处理
+ * 启用之前开辟的内存可以在启用之后正常释放
+ * @param arena 固定内存起始地址，适用于单片机；为NULL时按需从系统malloc开辟内存区
+ * @param arena_size 固定内存字节数，arena为NULL时忽略
+ * @param flags 选项，@see JIMI_SLAB_THREAD_CACHE
+ * @return 0为成功
+ */
+int jimi_slab_init(void *arena,int arena_size,int flags);
+
+/**
+ * 停用slab分配器并释放开辟的内存区，恢复使用系统malloc
+ * 调用前必须释放全部通过slab分配的内存
+ * @return 0为成功
+ */
+int jimi_slab_release();
+
+/**
+ * 把当前线程的本地缓存归还slab，线程退出时会自动归还
+ */
+void jimi_slab_thread_flush();
+
+/**
+ * 获取占用统计
+ * @param stats 统计输出
+ * @return 0为成功，slab分配器未启用时返回-1
+ */
+int jimi_slab_get_stats(jimi_slab_stats *stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_JIMI_SLAB_H
@@ -85,10 +85,17 @@ static int hash_table_allocate_table(HashTable *hash_table)
 
 	/* Allocate the table and initialise to NULL for all entries */
 
-	hash_table->table = calloc(hash_table->table_size,
-	                           sizeof(HashTableEntry *));
+	hash_table->table = jimi_malloc(hash_table->table_size
+	                                * sizeof(HashTableEntry *));
 
-	return hash_table->table != NULL;
+	if (hash_table->table == NULL) {
+		return 0;
+	}
+
+	memset(hash_table->table, 0,
+	       hash_table->table_size * sizeof(HashTableEntry *));
+
+	return 1;
 }
 
 /* Free an entry, calling the free functions if there are any registered */
@@ -13,6 +13,25 @@
 extern "C" {
 #endif // __cplusplus
 
+/**
+ * 打包一个端点数据
+ * @param with_head 是否带请求标记与请求id头
+ * @param type 数据类型，bool、double类型为定长，忽略in_len
+ * @param data_in 数据内容
+ * @param in_len 数据长度，变长类型小于等于0时按字符串计算长度
+ * @param data_out 输出缓存
+ * @param out_len 输出缓存大小
+ * @return 打包后的字节数，失败返回-1
+ */
+int pack_iot_packet(int with_head,
+                    uint8_t req_flag,
+                    uint32_t req_id,
+                    uint32_t tag_id,
+                    iot_data_type type,
+                    const unsigned char *data_in,
+                    int in_len,
+                    unsigned char *data_out,
+                    int out_len);
 
 int pack_iot_bool_packet(int with_head,
                          int req_flag,
@@ -73,20 +73,24 @@ int buffer_append(buffer *buf,const char *data,int len){
         return 0;
     }
 
-    //已经开辟的容量不够
-    buf->_data = jimi_realloc(buf->_data,len + buf->_len + RESERVED_SIZE);
-    //LOGD("realloc:%d",len + buf->_len + RESERVED_SIZE);
+    //已经开辟的容量不够，按倍数扩容，避免多次小块追加时反复拷贝
+    int capacity = buf->_capacity * 2;
+    if(capacity < len + buf->_len + RESERVED_SIZE){
+        capacity = len + buf->_len + RESERVED_SIZE;
+    }
+    char *data_new = jimi_realloc(buf->_data,capacity);
+    //LOGD("realloc:%d",capacity);
 
-    if(!buf->_data){
-        //out of memory
+    if(!data_new){
+        //out of memory，原数据保持不变
         LOGE("out of memory:%d",len + buf->_len);
-        buf->_len = 0;
         return -1;
     }
+    buf->_data = data_new;
     memcpy(buf->_data + buf->_len ,data,len);
     buf->_len += len;
     buf->_data[buf->_len] = '\0';
-    buf->_capacity = buf->_len + RESERVED_SIZE;
+    buf->_capacity = capacity;
     return 0;
 }
 int buffer_assign(buffer *buf,const char *data,int len){
@@ -112,4 +116,172 @@ int buffer_move(buffer *dst,buffer *src){
     dst->_capacity = src->_capacity;
     memset(src,0, sizeof(buffer));
     return 0;
-}
\ No newline at end of file
+}
+//byte_buffer开辟堆内存的最小容量
+#define BYTE_BUFFER_MIN_HEAP 256
+
+int byte_buffer_init(byte_buffer *buf){
+    CHECK_PTR(buf,-1);
+    buf->_heap = NULL;
+    buf->_read = 0;
+    buf->_write = 0;
+    buf->_capacity = BYTE_BUFFER_INLINE_SIZE;
+    buf->_inline[0] = '\0';
+    return 0;
+}
+
+int byte_buffer_release(byte_buffer *buf){
+    CHECK_PTR(buf,-1);
+    if(buf->_heap){
+        jimi_free(buf->_heap);
+    }
+    return byte_buffer_init(buf);
+}
+
+static inline char *byte_buffer_storage(byte_buffer *buf){
+    return buf->_heap ? buf->_heap : buf->_inline;
+}
+
+char *byte_buffer_data(byte_buffer *buf){
+    CHECK_PTR(buf,NULL);
+    return byte_buffer_storage(buf) + buf->_read;
+}
+
+int byte_buffer_size(byte_buffer *buf){
+    CHECK_PTR(buf,0);
+    return buf->_write - buf->_read;
+}
+
+int byte_buffer_reserve(byte_buffer *buf,int len){
+    CHECK_PTR(buf,-1);
+    if(len < 0){
+        return -1;
+    }
+    //末尾保留一个字节存放'\0'
+    if(buf->_capacity - buf->_write - 1 >= len){
+        return 0;
+    }
+
+    char *storage = byte_buffer_storage(buf);
+    int size = buf->_write - buf->_read;
+    if(size + len + 1 <= buf->_capacity && buf->_read >= size){
+        //已消费的空间足够并且搬移的数据不多于已消费的数据，压缩即可
+        memmove(storage,storage + buf->_read,size + 1);
+        buf->_read = 0;
+        buf->_write = size;
+        return 0;
+    }
+
+    int capacity = buf->_capacity * 2;
+    if(capacity < size + len + 1){
+        capacity = size + len + 1;
+    }
+    if(capacity < BYTE_BUFFER_MIN_HEAP){
+        capacity = BYTE_BUFFER_MIN_HEAP;
+    }
+    if(buf->_heap && !buf->_read){
+        //堆内存并且没有已消费的数据，原地扩容，分配器可以直接延长内存块而不用拷贝
+        char *heap = (char *)jimi_realloc(buf->_heap,capacity);
+        if(!heap){
+            LOGE("out of memory:%d",capacity);
+            return -1;
+        }
+        buf->_heap = heap;
+        buf->_capacity = capacity;
+        return 0;
+    }
+    char *heap = (char *)jimi_malloc(capacity);
+    if(!heap){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    //从内嵌缓冲区搬到堆上或者丢弃已消费的数据，只拷贝未消费的数据
+    memcpy(heap,storage + buf->_read,size + 1);
+    if(buf->_heap){
+        jimi_free(buf->_heap);
+    }
+    buf->_heap = heap;
+    buf->_capacity = capacity;
+    buf->_read = 0;
+    buf->_write = size;
+    return 0;
+}
+
+char *byte_buffer_prepare(byte_buffer *buf,int len,int *writable){
+    if(0 != byte_buffer_reserve(buf,len)){
+        return NULL;
+    }
+    if(writable){
+        *writable = buf->_capacity - buf->_write - 1;
+    }
+    return byte_buffer_storage(buf) + buf->_write;
+}
+
+int byte_buffer_commit(byte_buffer *buf,int len){
+    CHECK_PTR(buf,-1);
+    if(len < 0 || buf->_write + len >= buf->_capacity){
+        LOGE("invalid commit len:%d",len);
+        return -1;
+    }
+    buf->_write += len;
+    byte_buffer_storage(buf)[buf->_write] = '\0';
+    return 0;
+}
+
+int byte_buffer_append(byte_buffer *buf,const char *data,int len){
+    CHECK_PTR(buf,-1);
+    CHECK_PTR(data,-1);
+    if(len <= 0){
+        len = strlen(data);
+    }
+    if(buf->_capacity - buf->_write - 1 < len){
+        CHECK_RET(-1,byte_buffer_reserve(buf,len));
+    }
+    char *storage = byte_buffer_storage(buf);
+    memcpy(storage + buf->_write,data,len);
+    buf->_write += len;
+    storage[buf->_write] = '\0';
+    return 0;
+}
+
+int byte_buffer_assign(byte_buffer *buf,const char *data,int len){
+    CHECK_RET(-1,byte_buffer_clear(buf));
+    return byte_buffer_append(buf,data,len);
+}
+
+int byte_buffer_consume(byte_buffer *buf,int len){
+    CHECK_PTR(buf,-1);
+    if(len >= buf->_write - buf->_read){
+        //全部消费完毕，回到起始位置，相当于免费压缩
+        return byte_buffer_clear(buf);
+    }
+    if(len > 0){
+        buf->_read += len;
+    }
+    return 0;
+}
+
+int byte_buffer_clear(byte_buffer *buf){
+    CHECK_PTR(buf,-1);
+    buf->_read = 0;
+    buf->_write = 0;
+    byte_buffer_storage(buf)[0] = '\0';
+    return 0;
+}
+
+int byte_buffer_move(byte_buffer *dst,byte_buffer *src){
+    CHECK_PTR(dst,-1);
+    CHECK_PTR(src,-1);
+    if(dst == src){
+        return 0;
+    }
+    byte_buffer_release(dst);
+    if(src->_heap){
+        memcpy(dst,src, sizeof(byte_buffer));
+    }else{
+        //内置存储必须拷贝
+        memcpy(dst->_inline,src->_inline + src->_read,src->_write - src->_read + 1);
+        dst->_write = src->_write - src->_read;
+    }
+    return byte_buffer_init(src);
+}
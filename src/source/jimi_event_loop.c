@@ -0,0 +1,1466 @@
+//
+// Created by xzl on 2019/7/17.
+//
+
+#include "jimi_event_loop.h"
+
+#if defined(__linux__) && !defined(__alios__)
+#include <memory.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "jimi_iot.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+#include "mqtt_wrapper.h"
+#include "mqtt_timer_wheel.h"
+#ifdef ENABLE_IO_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+//每次epoll_wait最多返回的事件个数
+#define EVENT_LOOP_MAX_EVENTS 256
+#define EVENT_LOOP_MIN_SIZE 16
+//定时器标识最高位代表用户定时器，其余位为数组下标
+#define EVENT_TIMER_USER 0x80000000
+
+#ifdef ENABLE_IO_URING
+//提交队列长度，完成队列为其4倍
+#define EVENT_URING_ENTRIES 1024
+//一条发送链最多包含的发送块个数
+#define EVENT_URING_MAX_LINK 64
+//接收缓冲区环中的缓冲区个数(2的幂)以及大小，所有连接共享
+#define EVENT_URING_RECV_BUFS 1024
+#define EVENT_URING_RECV_BUF_SIZE 4096
+//发送块个数以及大小，整个发送区注册为一个固定缓冲区
+#define EVENT_URING_SEND_CHUNKS 2048
+#define EVENT_URING_SEND_CHUNK_SIZE 4096
+//接收缓冲区组
+#define EVENT_URING_BGID 0
+//cqe的user_data低3位为操作类型，其余位为会话或者发送块指针
+#define EVENT_URING_OP_WAKE 0
+#define EVENT_URING_OP_RECV 1
+#define EVENT_URING_OP_SEND 2
+#define EVENT_URING_OP_PROBE 3
+#define EVENT_URING_OP_MASK 7
+
+typedef struct uring_chunk uring_chunk;
+typedef struct event_uring event_uring;
+#endif
+
+const event_session_ops event_iot_ops = {
+        iot_input_prepare,
+        iot_input_commit,
+        iot_on_writable,
+        iot_timer_schedule,
+        iot_next_timeout
+};
+
+const event_session_ops event_mqtt_ops = {
+        mqtt_input_prepare,
+        mqtt_input_commit,
+        mqtt_on_writable,
+        mqtt_timer_schedule,
+        mqtt_next_timeout
+};
+
+struct event_session {
+    event_loop *_loop;
+    int _fd;
+    const event_session_ops *_ops;
+    void *_ctx;
+    on_session_close _cb;
+    void *_user_data;
+    //在会话数组中的下标，同时也是定时器标识
+    uint32_t _index;
+    //对象下次需要处理定时任务的时间以及对应的定时器，0代表没有
+    uint64_t _deadline;
+    uint32_t _timer;
+    //需要更新定时器
+    int _dirty;
+    event_session *_next_dirty;
+    //已经关闭，等待本轮事件处理完毕后回调并释放
+    int _closed;
+    int _err;
+    event_session *_next_closed;
+#ifdef ENABLE_IO_URING
+    //未完成的io_uring操作个数，为0之后才能关闭套接字并释放
+    int _uring_ops;
+    int _recv_armed;
+    //发送块队列以及已经提交的块数
+    uring_chunk *_send_head;
+    uring_chunk *_send_tail;
+    int _send_inflight;
+    //在待提交链表中
+    int _flushing;
+    event_session *_next_flush;
+    //发送块不足，在等待可写链表中
+    int _blocked;
+    event_session *_next_blocked;
+    //关闭回调已经触发，等待io_uring操作完成
+    int _zombie;
+    event_session *_prev_zombie;
+    event_session *_next_zombie;
+#endif
+};
+
+typedef struct {
+    on_loop_timer _cb;
+    void *_user_data;
+    //时间轮中的定时器，0代表空闲
+    uint32_t _timer;
+} event_loop_timer;
+
+struct event_loop {
+    int _epoll_fd;
+    //用于跨线程唤醒
+    int _wake_fd;
+    int _stop;
+    on_loop_wakeup _wakeup_cb;
+    void *_wakeup_data;
+    mqtt_timer_wheel _timers;
+    //会话数组以及空闲下标栈
+    event_session **_sessions;
+    uint32_t *_free_index;
+    uint32_t _free_count;
+    uint32_t _capacity;
+    uint32_t _count;
+    //用户定时器数组
+    event_loop_timer *_user_timers;
+    uint32_t _user_timer_capacity;
+    event_session *_dirty;
+    event_session *_closed;
+#ifdef ENABLE_IO_URING
+    //不为NULL时使用io_uring，否则使用epoll
+    event_uring *_uring;
+    //有待提交发送块的会话
+    event_session *_flush;
+    //等待空闲发送块的会话(先进先出)
+    event_session *_blocked_head;
+    event_session *_blocked_tail;
+    //已经回调关闭但是io_uring操作未完成的会话
+    event_session *_zombies;
+#endif
+    struct epoll_event _events[EVENT_LOOP_MAX_EVENTS];
+};
+
+static uint64_t event_now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void event_session_mark_dirty(event_session *session);
+static void event_session_shutdown(event_session *session,int err);
+
+#ifdef ENABLE_IO_URING
+
+struct uring_chunk {
+    uring_chunk *_next;
+    event_session *_session;
+    char *_data;
+    uint32_t _len;
+    //已经发送的字节数
+    uint32_t _sent;
+    //已经提交给内核
+    int _submitted;
+};
+
+struct event_uring {
+    int _fd;
+    //提交队列，_sq_local_tail为尚未同步给内核的尾部
+    void *_sq_ring;
+    size_t _sq_ring_size;
+    uint32_t *_sq_head;
+    uint32_t *_sq_tail;
+    uint32_t *_sq_flags;
+    uint32_t *_sq_array;
+    uint32_t _sq_mask;
+    uint32_t _sq_entries;
+    uint32_t _sq_local_tail;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+    //完成队列，与提交队列共用映射时_cq_ring为NULL
+    void *_cq_ring;
+    size_t _cq_ring_size;
+    uint32_t *_cq_head;
+    uint32_t *_cq_tail;
+    uint32_t _cq_mask;
+    struct io_uring_cqe *_cqes;
+    //接收缓冲区环
+    struct io_uring_buf_ring *_buf_ring;
+    size_t _buf_ring_size;
+    uint16_t _buf_tail;
+    char *_recv_bufs;
+    //发送区以及空闲发送块
+    char *_send_bufs;
+    uring_chunk *_chunks;
+    uring_chunk *_free_chunks;
+};
+
+static int event_uring_setup(uint32_t entries,struct io_uring_params *params){
+    return (int)syscall(__NR_io_uring_setup,entries,params);
+}
+
+static int event_uring_enter(int fd,uint32_t to_submit,uint32_t min_complete,uint32_t flags,void *arg,size_t arg_size){
+    return (int)syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,arg,arg_size);
+}
+
+static int event_uring_register(int fd,uint32_t opcode,void *arg,uint32_t nr_args){
+    return (int)syscall(__NR_io_uring_register,fd,opcode,arg,nr_args);
+}
+
+static void event_uring_free(event_uring *uring){
+    if(uring->_fd != -1){
+        //关闭后内核取消所有未完成的操作
+        close(uring->_fd);
+    }
+    if(uring->_sqes){
+        munmap(uring->_sqes,uring->_sqes_size);
+    }
+    if(uring->_cq_ring){
+        munmap(uring->_cq_ring,uring->_cq_ring_size);
+    }
+    if(uring->_sq_ring){
+        munmap(uring->_sq_ring,uring->_sq_ring_size);
+    }
+    if(uring->_buf_ring){
+        munmap(uring->_buf_ring,uring->_buf_ring_size);
+    }
+    if(uring->_send_bufs){
+        munmap(uring->_send_bufs,(size_t)EVENT_URING_SEND_CHUNKS * EVENT_URING_SEND_CHUNK_SIZE);
+    }
+    jimi_free(uring->_recv_bufs);
+    jimi_free(uring->_chunks);
+    jimi_free(uring);
+}
+
+/**
+ * 把接收缓冲区归还给内核
+ */
+static void event_uring_recycle(event_uring *uring,uint16_t bid){
+    struct io_uring_buf *buf = &uring->_buf_ring->bufs[uring->_buf_tail & (EVENT_URING_RECV_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(uring->_recv_bufs + (size_t)bid * EVENT_URING_RECV_BUF_SIZE);
+    buf->len = EVENT_URING_RECV_BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&uring->_buf_ring->tail,++uring->_buf_tail,__ATOMIC_RELEASE);
+}
+
+static event_uring *event_uring_alloc(){
+    event_uring *uring = (event_uring *)jimi_malloc(sizeof(event_uring));
+    if(!uring){
+        LOGE("malloc event_uring failed!");
+        return NULL;
+    }
+    memset(uring,0, sizeof(event_uring));
+
+    struct io_uring_params params;
+    memset(&params,0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = EVENT_URING_ENTRIES * 4;
+    uring->_fd = event_uring_setup(EVENT_URING_ENTRIES,&params);
+    if(uring->_fd == -1){
+        LOGW("io_uring_setup failed:%d %s",errno,strerror(errno));
+        event_uring_free(uring);
+        return NULL;
+    }
+    if(!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)){
+        LOGW("io_uring features not supported:%x",params.features);
+        event_uring_free(uring);
+        return NULL;
+    }
+
+    //映射提交队列、完成队列以及sqe数组
+    uring->_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(uring->_cq_ring_size > uring->_sq_ring_size){
+            uring->_sq_ring_size = uring->_cq_ring_size;
+        }
+    }
+    uring->_sq_ring = mmap(NULL,uring->_sq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,
+                           uring->_fd,IORING_OFF_SQ_RING);
+    if(uring->_sq_ring == MAP_FAILED){
+        uring->_sq_ring = NULL;
+        LOGE("mmap io_uring failed:%d %s",errno,strerror(errno));
+        event_uring_free(uring);
+        return NULL;
+    }
+    char *cq_ring = (char *)uring->_sq_ring;
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP)){
+        uring->_cq_ring = mmap(NULL,uring->_cq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,
+                               uring->_fd,IORING_OFF_CQ_RING);
+        if(uring->_cq_ring == MAP_FAILED){
+            uring->_cq_ring = NULL;
+            LOGE("mmap io_uring failed:%d %s",errno,strerror(errno));
+            event_uring_free(uring);
+            return NULL;
+        }
+        cq_ring = (char *)uring->_cq_ring;
+    }
+    uring->_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->_sqes = (struct io_uring_sqe *)mmap(NULL,uring->_sqes_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,
+                                               uring->_fd,IORING_OFF_SQES);
+    if(uring->_sqes == MAP_FAILED){
+        uring->_sqes = NULL;
+        LOGE("mmap io_uring failed:%d %s",errno,strerror(errno));
+        event_uring_free(uring);
+        return NULL;
+    }
+    char *sq_ring = (char *)uring->_sq_ring;
+    uring->_sq_head = (uint32_t *)(sq_ring + params.sq_off.head);
+    uring->_sq_tail = (uint32_t *)(sq_ring + params.sq_off.tail);
+    uring->_sq_flags = (uint32_t *)(sq_ring + params.sq_off.flags);
+    uring->_sq_array = (uint32_t *)(sq_ring + params.sq_off.array);
+    uring->_sq_mask = *(uint32_t *)(sq_ring + params.sq_off.ring_mask);
+    uring->_sq_entries = params.sq_entries;
+    uring->_sq_local_tail = *uring->_sq_tail;
+    uring->_cq_head = (uint32_t *)(cq_ring + params.cq_off.head);
+    uring->_cq_tail = (uint32_t *)(cq_ring + params.cq_off.tail);
+    uring->_cq_mask = *(uint32_t *)(cq_ring + params.cq_off.ring_mask);
+    uring->_cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+    //注册接收缓冲区环，多次接收时由内核从中挑选缓冲区
+    uring->_buf_ring_size = EVENT_URING_RECV_BUFS * sizeof(struct io_uring_buf);
+    uring->_buf_ring = (struct io_uring_buf_ring *)mmap(NULL,uring->_buf_ring_size,PROT_READ | PROT_WRITE,
+                                                        MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    uring->_recv_bufs = (char *)jimi_malloc((size_t)EVENT_URING_RECV_BUFS * EVENT_URING_RECV_BUF_SIZE);
+    if(uring->_buf_ring == MAP_FAILED || !uring->_recv_bufs){
+        if(uring->_buf_ring == MAP_FAILED){
+            uring->_buf_ring = NULL;
+        }
+        LOGE("alloc io_uring receive buffers failed!");
+        event_uring_free(uring);
+        return NULL;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg,0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)uring->_buf_ring;
+    reg.ring_entries = EVENT_URING_RECV_BUFS;
+    reg.bgid = EVENT_URING_BGID;
+    if(0 != event_uring_register(uring->_fd,IORING_REGISTER_PBUF_RING,&reg,1)){
+        LOGW("register io_uring buffer ring failed:%d %s",errno,strerror(errno));
+        event_uring_free(uring);
+        return NULL;
+    }
+    uint16_t bid;
+    for(bid = 0 ; bid < EVENT_URING_RECV_BUFS ; ++bid){
+        event_uring_recycle(uring,bid);
+    }
+
+    //注册发送区，发送时内核无需每次映射用户内存
+    size_t send_size = (size_t)EVENT_URING_SEND_CHUNKS * EVENT_URING_SEND_CHUNK_SIZE;
+    uring->_send_bufs = (char *)mmap(NULL,send_size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    uring->_chunks = (uring_chunk *)jimi_malloc(EVENT_URING_SEND_CHUNKS * sizeof(uring_chunk));
+    if(uring->_send_bufs == MAP_FAILED || !uring->_chunks){
+        if(uring->_send_bufs == MAP_FAILED){
+            uring->_send_bufs = NULL;
+        }
+        LOGE("alloc io_uring send buffers failed!");
+        event_uring_free(uring);
+        return NULL;
+    }
+    struct iovec iov = {uring->_send_bufs,send_size};
+    if(0 != event_uring_register(uring->_fd,IORING_REGISTER_BUFFERS,&iov,1)){
+        LOGW("register io_uring buffers failed:%d %s",errno,strerror(errno));
+        event_uring_free(uring);
+        return NULL;
+    }
+    int i;
+    for(i = EVENT_URING_SEND_CHUNKS - 1 ; i >= 0 ; --i){
+        uring_chunk *chunk = uring->_chunks + i;
+        memset(chunk,0, sizeof(uring_chunk));
+        chunk->_data = uring->_send_bufs + (size_t)i * EVENT_URING_SEND_CHUNK_SIZE;
+        chunk->_next = uring->_free_chunks;
+        uring->_free_chunks = chunk;
+    }
+    return uring;
+}
+
+/**
+ * 把本地提交的sqe同步给内核并且进入内核
+ * @param wait_ms 0代表不等待，-1代表一直等到有完成事件
+ */
+static int event_uring_submit(event_uring *uring,int wait_ms){
+    uint32_t to_submit = uring->_sq_local_tail - *uring->_sq_tail;
+    if(to_submit){
+        __atomic_store_n(uring->_sq_tail,uring->_sq_local_tail,__ATOMIC_RELEASE);
+    }
+    int overflow = __atomic_load_n(uring->_sq_flags,__ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW;
+    uint32_t flags = 0;
+    uint32_t min_complete = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg,0, sizeof(arg));
+    if(wait_ms != 0 && __atomic_load_n(uring->_cq_tail,__ATOMIC_ACQUIRE) == *uring->_cq_head){
+        min_complete = 1;
+        if(wait_ms > 0){
+            ts.tv_sec = wait_ms / 1000;
+            ts.tv_nsec = (long long)(wait_ms % 1000) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    }
+    if(min_complete || overflow){
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+    if(!to_submit && !flags){
+        //完成队列中已有事件并且没有要提交的sqe，无需系统调用
+        return 0;
+    }
+    if(-1 == event_uring_enter(uring->_fd,to_submit,min_complete,flags,
+                               (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                               (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0)){
+        if(errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN){
+            LOGE("io_uring_enter failed:%d %s",errno,strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *event_uring_get_sqe(event_uring *uring){
+    if(uring->_sq_local_tail - __atomic_load_n(uring->_sq_head,__ATOMIC_ACQUIRE) >= uring->_sq_entries){
+        //提交队列已满，先提交
+        event_uring_submit(uring,0);
+        if(uring->_sq_local_tail - __atomic_load_n(uring->_sq_head,__ATOMIC_ACQUIRE) >= uring->_sq_entries){
+            LOGE("io_uring submission queue is full");
+            return NULL;
+        }
+    }
+    uint32_t index = uring->_sq_local_tail & uring->_sq_mask;
+    struct io_uring_sqe *sqe = uring->_sqes + index;
+    memset(sqe,0, sizeof(struct io_uring_sqe));
+    uring->_sq_array[index] = index;
+    ++uring->_sq_local_tail;
+    return sqe;
+}
+
+/**
+ * 剩余可用的sqe个数
+ */
+static uint32_t event_uring_sq_space(event_uring *uring){
+    return uring->_sq_entries - (uring->_sq_local_tail - __atomic_load_n(uring->_sq_head,__ATOMIC_ACQUIRE));
+}
+
+static int event_uring_arm_wakeup(event_loop *loop){
+    struct io_uring_sqe *sqe = event_uring_get_sqe(loop->_uring);
+    if(!sqe){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->_wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = EVENT_URING_OP_WAKE;
+    return 0;
+}
+
+static void event_uring_arm_recv(event_session *session){
+    struct io_uring_sqe *sqe = event_uring_get_sqe(session->_loop->_uring);
+    if(!sqe){
+        event_session_shutdown(session,ENOMEM);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = session->_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = EVENT_URING_BGID;
+    sqe->user_data = (uint64_t)(uintptr_t)session | EVENT_URING_OP_RECV;
+    session->_recv_armed = 1;
+    ++session->_uring_ops;
+}
+
+/**
+ * 检测内核是否支持多次接收(linux 6.0+)，5.19只支持接收缓冲区环，提交多次接收时返回EINVAL
+ * 在socketpair上写入一个字节并关闭写端，提交一次多次接收，收齐所有完成事件后判断结果
+ * @return 0代表支持
+ */
+static int event_uring_probe_recv(event_uring *uring){
+    int fds[2];
+    if(-1 == socketpair(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0,fds)){
+        LOGW("socketpair failed:%d %s",errno,strerror(errno));
+        return -1;
+    }
+    char byte = 0;
+    int ret = -1;
+    if(1 != write(fds[1],&byte,1)){
+        LOGW("write socketpair failed:%d %s",errno,strerror(errno));
+        goto done;
+    }
+    //对端关闭后多次接收以0字节结束，不会残留在提交队列中
+    close(fds[1]);
+    fds[1] = -1;
+    struct io_uring_sqe *sqe = event_uring_get_sqe(uring);
+    if(!sqe){
+        goto done;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fds[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = EVENT_URING_BGID;
+    sqe->user_data = EVENT_URING_OP_PROBE;
+    int received = 0;
+    int more = 1;
+    int retry;
+    for(retry = 0 ; more && retry < 10 ; ++retry){
+        if(0 != event_uring_submit(uring,100)){
+            break;
+        }
+        uint32_t head = *uring->_cq_head;
+        uint32_t tail = __atomic_load_n(uring->_cq_tail,__ATOMIC_ACQUIRE);
+        for(; head != tail ; ++head){
+            struct io_uring_cqe *cqe = uring->_cqes + (head & uring->_cq_mask);
+            if(cqe->flags & IORING_CQE_F_BUFFER){
+                event_uring_recycle(uring,(uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            if(cqe->res < 0){
+                LOGW("io_uring multishot recv not supported:%d %s",-cqe->res,strerror(-cqe->res));
+            }else if(cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE)){
+                received = 1;
+            }
+            if(!(cqe->flags & IORING_CQE_F_MORE)){
+                more = 0;
+            }
+        }
+        __atomic_store_n(uring->_cq_head,head,__ATOMIC_RELEASE);
+    }
+    if(more){
+        //内核迟迟不返回，不能确认接收操作已结束，不使用io_uring
+        LOGW("io_uring multishot recv probe timeout");
+    }else if(received){
+        ret = 0;
+    }
+
+done:
+    close(fds[0]);
+    if(fds[1] != -1){
+        close(fds[1]);
+    }
+    return ret;
+}
+
+/**
+ * 会话已经回调关闭，并且没有未完成的操作、不在任何链表中时关闭套接字并释放
+ */
+static void event_uring_try_release(event_session *session){
+    if(!session->_zombie || session->_uring_ops || session->_flushing || session->_blocked){
+        return;
+    }
+    event_loop *loop = session->_loop;
+    if(session->_prev_zombie){
+        session->_prev_zombie->_next_zombie = session->_next_zombie;
+    }else{
+        loop->_zombies = session->_next_zombie;
+    }
+    if(session->_next_zombie){
+        session->_next_zombie->_prev_zombie = session->_prev_zombie;
+    }
+    while(session->_send_head){
+        uring_chunk *chunk = session->_send_head;
+        session->_send_head = chunk->_next;
+        chunk->_next = loop->_uring->_free_chunks;
+        loop->_uring->_free_chunks = chunk;
+    }
+    close(session->_fd);
+    jimi_free(session);
+}
+
+static void event_uring_add_flush(event_session *session){
+    if(!session->_flushing){
+        session->_flushing = 1;
+        session->_next_flush = session->_loop->_flush;
+        session->_loop->_flush = session;
+    }
+}
+
+static void event_uring_add_blocked(event_session *session){
+    if(session->_blocked){
+        return;
+    }
+    event_loop *loop = session->_loop;
+    session->_blocked = 1;
+    session->_next_blocked = NULL;
+    if(loop->_blocked_tail){
+        loop->_blocked_tail->_next_blocked = session;
+    }else{
+        loop->_blocked_head = session;
+    }
+    loop->_blocked_tail = session;
+}
+
+/**
+ * 拷贝到发送块，空闲发送块不足时返回已经拷贝的字节数
+ */
+static int event_uring_write(event_session *session,const struct iovec *iov,int iovcnt){
+    event_uring *uring = session->_loop->_uring;
+    int total = 0;
+    int i;
+    for(i = 0 ; i < iovcnt ; ++i){
+        const char *data = (const char *)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        while(len){
+            uring_chunk *chunk = session->_send_tail;
+            if(!chunk || chunk->_submitted || chunk->_len == EVENT_URING_SEND_CHUNK_SIZE){
+                chunk = uring->_free_chunks;
+                if(!chunk){
+                    //剩余数据由对象缓存，有空闲发送块时触发可写
+                    event_uring_add_blocked(session);
+                    goto done;
+                }
+                uring->_free_chunks = chunk->_next;
+                chunk->_next = NULL;
+                chunk->_session = session;
+                chunk->_len = 0;
+                chunk->_sent = 0;
+                chunk->_submitted = 0;
+                if(session->_send_tail){
+                    session->_send_tail->_next = chunk;
+                }else{
+                    session->_send_head = chunk;
+                }
+                session->_send_tail = chunk;
+            }
+            size_t n = EVENT_URING_SEND_CHUNK_SIZE - chunk->_len;
+            if(n > len){
+                n = len;
+            }
+            memcpy(chunk->_data + chunk->_len,data,n);
+            chunk->_len += n;
+            data += n;
+            len -= n;
+            total += n;
+        }
+    }
+done:
+    if(total){
+        event_uring_add_flush(session);
+    }
+    return total;
+}
+
+/**
+ * 把未提交的发送块作为一条链提交，链中前一个发送完成后才开始下一个，保证顺序
+ * 上一条链完成之前不提交新的链
+ */
+static void event_uring_submit_send(event_session *session){
+    event_uring *uring = session->_loop->_uring;
+    if(session->_send_inflight){
+        return;
+    }
+    uint32_t space = event_uring_sq_space(uring);
+    if(space < 2){
+        event_uring_submit(uring,0);
+        space = event_uring_sq_space(uring);
+    }
+    //链必须在同一次提交中
+    if(space > EVENT_URING_MAX_LINK){
+        space = EVENT_URING_MAX_LINK;
+    }
+    struct io_uring_sqe *last = NULL;
+    uring_chunk *chunk;
+    for(chunk = session->_send_head ; chunk && space ; chunk = chunk->_next, --space){
+        struct io_uring_sqe *sqe = event_uring_get_sqe(uring);
+        if(!sqe){
+            break;
+        }
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = session->_fd;
+        sqe->addr = (uint64_t)(uintptr_t)(chunk->_data + chunk->_sent);
+        sqe->len = chunk->_len - chunk->_sent;
+        sqe->buf_index = 0;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (uint64_t)(uintptr_t)chunk | EVENT_URING_OP_SEND;
+        chunk->_submitted = 1;
+        ++session->_send_inflight;
+        ++session->_uring_ops;
+        last = sqe;
+    }
+    if(last){
+        last->flags &= ~IOSQE_IO_LINK;
+    }
+}
+
+static void event_uring_on_recv(event_session *session,int res,uint32_t flags){
+    event_loop *loop = session->_loop;
+    if(!(flags & IORING_CQE_F_MORE)){
+        session->_recv_armed = 0;
+        --session->_uring_ops;
+    }
+    if(flags & IORING_CQE_F_BUFFER){
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *data = loop->_uring->_recv_bufs + (size_t)bid * EVENT_URING_RECV_BUF_SIZE;
+        int offset = 0;
+        while(offset < res && !session->_closed){
+            struct iovec iov[2];
+            int iovcnt = session->_ops->input_prepare(session->_ctx,iov);
+            if(iovcnt <= 0){
+                LOGE("input_prepare failed:%d",iovcnt);
+                event_session_shutdown(session,ENOBUFS);
+                break;
+            }
+            int copied = 0;
+            int i;
+            for(i = 0 ; i < iovcnt && offset + copied < res ; ++i){
+                size_t n = iov[i].iov_len;
+                if(n > (size_t)(res - offset - copied)){
+                    n = res - offset - copied;
+                }
+                memcpy(iov[i].iov_base,data + offset + copied,n);
+                copied += n;
+            }
+            offset += copied;
+            if(0 != session->_ops->input_commit(session->_ctx,copied)){
+                LOGW("input_commit failed, close session:%d",session->_fd);
+                event_session_shutdown(session,EPROTO);
+            }
+        }
+        event_uring_recycle(loop->_uring,bid);
+    }
+    if(session->_closed){
+        return;
+    }
+    if(res == 0){
+        event_session_shutdown(session,0);
+        return;
+    }
+    if(res < 0 && res != -ENOBUFS){
+        event_session_shutdown(session,-res);
+        return;
+    }
+    event_session_mark_dirty(session);
+    if(!session->_recv_armed){
+        //接收缓冲区耗尽或者内核结束了多次接收，重新提交
+        event_uring_arm_recv(session);
+    }
+}
+
+static void event_uring_on_send(uring_chunk *chunk,int res){
+    event_session *session = chunk->_session;
+    --session->_uring_ops;
+    --session->_send_inflight;
+    if(res > 0){
+        chunk->_sent += res;
+    }else if(res != -ECANCELED && !session->_closed){
+        //被取消说明链中前一个发送不完整，稍后重新提交
+        event_session_shutdown(session,res < 0 ? -res : EPIPE);
+    }
+    if(session->_send_inflight){
+        return;
+    }
+    event_uring *uring = session->_loop->_uring;
+    while(session->_send_head && session->_send_head->_sent == session->_send_head->_len){
+        uring_chunk *done = session->_send_head;
+        session->_send_head = done->_next;
+        done->_next = uring->_free_chunks;
+        uring->_free_chunks = done;
+    }
+    if(!session->_send_head){
+        session->_send_tail = NULL;
+        return;
+    }
+    for(chunk = session->_send_head ; chunk ; chunk = chunk->_next){
+        chunk->_submitted = 0;
+    }
+    if(!session->_closed || !session->_err){
+        event_uring_add_flush(session);
+    }
+}
+
+/**
+ * 提交所有待发送的数据
+ */
+static void event_uring_process_flush(event_loop *loop){
+    while(loop->_flush){
+        event_session *session = loop->_flush;
+        loop->_flush = session->_next_flush;
+        session->_flushing = 0;
+        //主动关闭时仍然发送剩余数据
+        if(!session->_closed || !session->_err){
+            event_uring_submit_send(session);
+        }
+        event_uring_try_release(session);
+    }
+}
+
+/**
+ * 有空闲发送块后通知等待的会话
+ */
+static void event_uring_process_blocked(event_loop *loop){
+    while(loop->_blocked_head && loop->_uring->_free_chunks){
+        event_session *session = loop->_blocked_head;
+        loop->_blocked_head = session->_next_blocked;
+        if(!loop->_blocked_head){
+            loop->_blocked_tail = NULL;
+        }
+        session->_blocked = 0;
+        if(!session->_closed){
+            if(session->_ops->on_writable(session->_ctx) < 0 && !session->_closed){
+                event_session_shutdown(session,EIO);
+            }
+            if(!session->_closed){
+                event_session_mark_dirty(session);
+            }
+        }
+        event_uring_try_release(session);
+    }
+}
+
+/**
+ * 处理完成队列中的所有事件
+ * @return 处理的事件个数
+ */
+static int event_uring_reap(event_loop *loop){
+    event_uring *uring = loop->_uring;
+    int count = 0;
+    while(1){
+        uint32_t head = *uring->_cq_head;
+        uint32_t tail = __atomic_load_n(uring->_cq_tail,__ATOMIC_ACQUIRE);
+        if(head == tail){
+            break;
+        }
+        for(; head != tail ; ++head, ++count){
+            struct io_uring_cqe *cqe = uring->_cqes + (head & uring->_cq_mask);
+            uint64_t user_data = cqe->user_data;
+            void *ptr = (void *)(uintptr_t)(user_data & ~(uint64_t)EVENT_URING_OP_MASK);
+            switch (user_data & EVENT_URING_OP_MASK){
+                case EVENT_URING_OP_WAKE: {
+                    uint64_t value;
+                    while(read(loop->_wake_fd,&value, sizeof(value)) > 0);
+                    if(!(cqe->flags & IORING_CQE_F_MORE)){
+                        event_uring_arm_wakeup(loop);
+                    }
+                    if(loop->_wakeup_cb){
+                        loop->_wakeup_cb(loop->_wakeup_data);
+                    }
+                    break;
+                }
+                case EVENT_URING_OP_RECV: {
+                    event_session *session = (event_session *)ptr;
+                    event_uring_on_recv(session,cqe->res,cqe->flags);
+                    event_uring_try_release(session);
+                    break;
+                }
+                case EVENT_URING_OP_SEND: {
+                    event_session *session = ((uring_chunk *)ptr)->_session;
+                    event_uring_on_send((uring_chunk *)ptr,cqe->res);
+                    event_uring_try_release(session);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        __atomic_store_n(uring->_cq_head,head,__ATOMIC_RELEASE);
+    }
+    event_uring_process_blocked(loop);
+    return count;
+}
+
+#endif //ENABLE_IO_URING
+
+event_loop *event_loop_alloc(){
+    return event_loop_alloc_backend(event_backend_auto);
+}
+
+event_loop *event_loop_alloc_backend(event_backend backend){
+#ifndef ENABLE_IO_URING
+    if(backend == event_backend_uring){
+        LOGW("io_uring is not enabled, please build with ENABLE_IO_URING");
+        return NULL;
+    }
+#endif
+    event_loop *loop = (event_loop *)jimi_malloc(sizeof(event_loop));
+    if(!loop){
+        LOGE("malloc event_loop failed!");
+        return NULL;
+    }
+    memset(loop,0, sizeof(event_loop));
+    mqtt_timer_wheel_init(&loop->_timers,event_now_ms());
+    loop->_epoll_fd = -1;
+    loop->_wake_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+    if(loop->_wake_fd == -1){
+        LOGE("create eventfd failed:%d %s",errno,strerror(errno));
+        event_loop_free(loop);
+        return NULL;
+    }
+#ifdef ENABLE_IO_URING
+    if(backend != event_backend_epoll){
+        loop->_uring = event_uring_alloc();
+        if(loop->_uring && 0 == event_uring_probe_recv(loop->_uring) && 0 == event_uring_arm_wakeup(loop)){
+            return loop;
+        }
+        if(backend == event_backend_uring){
+            event_loop_free(loop);
+            return NULL;
+        }
+        //内核不支持io_uring或者多次接收时退回epoll
+        LOGW("io_uring unavailable, fallback to epoll");
+        if(loop->_uring){
+            event_uring_free(loop->_uring);
+            loop->_uring = NULL;
+        }
+    }
+#endif
+    loop->_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->_epoll_fd == -1){
+        LOGE("create epoll failed:%d %s",errno,strerror(errno));
+        event_loop_free(loop);
+        return NULL;
+    }
+    //唤醒事件的data.ptr为NULL
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    if(-1 == epoll_ctl(loop->_epoll_fd,EPOLL_CTL_ADD,loop->_wake_fd,&ev)){
+        LOGE("epoll_ctl failed:%d %s",errno,strerror(errno));
+        event_loop_free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+static void event_loop_process_closed(event_loop *loop);
+
+int event_loop_free(event_loop *loop){
+    CHECK_PTR(loop,-1);
+    uint32_t i;
+    for(i = 0 ; i < loop->_capacity ; ++i){
+        if(loop->_sessions[i]){
+            event_session_close(loop->_sessions[i]);
+        }
+    }
+    event_loop_process_closed(loop);
+#ifdef ENABLE_IO_URING
+    if(loop->_uring){
+        //中止仍在发送的连接，等待其操作完成后释放
+        event_session *session;
+        for(session = loop->_zombies ; session ; session = session->_next_zombie){
+            shutdown(session->_fd,SHUT_RDWR);
+        }
+        int retry = 100;
+        while((loop->_zombies || loop->_flush) && retry--){
+            event_uring_process_flush(loop);
+            event_uring_submit(loop->_uring,10);
+            event_uring_reap(loop);
+        }
+        //关闭io_uring后内核取消剩余操作，发送块随发送区一起释放
+        event_uring_free(loop->_uring);
+        loop->_uring = NULL;
+        while(loop->_zombies){
+            session = loop->_zombies;
+            loop->_zombies = session->_next_zombie;
+            close(session->_fd);
+            jimi_free(session);
+        }
+    }
+#endif
+    if(loop->_epoll_fd != -1){
+        close(loop->_epoll_fd);
+    }
+    if(loop->_wake_fd != -1){
+        close(loop->_wake_fd);
+    }
+    mqtt_timer_wheel_release(&loop->_timers);
+    jimi_free(loop->_sessions);
+    jimi_free(loop->_free_index);
+    jimi_free(loop->_user_timers);
+    jimi_free(loop);
+    return 0;
+}
+
+void event_loop_stop(event_loop *loop){
+    __atomic_store_n(&loop->_stop,1,__ATOMIC_RELEASE);
+    event_loop_wakeup(loop);
+}
+
+void event_loop_wakeup(event_loop *loop){
+    uint64_t one = 1;
+    if(write(loop->_wake_fd,&one, sizeof(one)) == -1 && errno != EAGAIN){
+        LOGW("wake up event loop failed:%d",errno);
+    }
+}
+
+void event_loop_set_wakeup(event_loop *loop,on_loop_wakeup cb,void *user_data){
+    loop->_wakeup_cb = cb;
+    loop->_wakeup_data = user_data;
+}
+
+uint32_t event_loop_session_count(event_loop *loop){
+    CHECK_PTR(loop,0);
+    return loop->_count;
+}
+
+event_backend event_loop_get_backend(event_loop *loop){
+#ifdef ENABLE_IO_URING
+    if(loop && loop->_uring){
+        return event_backend_uring;
+    }
+#endif
+    return event_backend_epoll;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void event_session_mark_dirty(event_session *session){
+    if(!session->_dirty){
+        session->_dirty = 1;
+        session->_next_dirty = session->_loop->_dirty;
+        session->_loop->_dirty = session;
+    }
+}
+
+/**
+ * 根据对象的下一个定时任务时间重新设置定时器
+ */
+static void event_session_update_timer(event_session *session){
+    event_loop *loop = session->_loop;
+    int ms = session->_ops->next_timeout(session->_ctx);
+    uint64_t now = event_now_ms();
+    uint64_t deadline = ms < 0 ? 0 : now + ms;
+    if(deadline == session->_deadline && (!deadline || session->_timer)){
+        return;
+    }
+    if(session->_timer){
+        mqtt_timer_wheel_cancel(&loop->_timers,session->_timer);
+        session->_timer = 0;
+    }
+    session->_deadline = deadline;
+    if(deadline){
+        session->_timer = mqtt_timer_wheel_add(&loop->_timers,now,(uint32_t)ms,session->_index);
+    }
+}
+
+static int event_loop_grow(event_loop *loop){
+    uint32_t capacity = loop->_capacity ? loop->_capacity * 2 : EVENT_LOOP_MIN_SIZE;
+    event_session **sessions = loop->_sessions ?
+                               jimi_realloc(loop->_sessions,capacity * sizeof(event_session *)) :
+                               jimi_malloc(capacity * sizeof(event_session *));
+    if(!sessions){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    loop->_sessions = sessions;
+    uint32_t *free_index = loop->_free_index ?
+                           jimi_realloc(loop->_free_index,capacity * sizeof(uint32_t)) :
+                           jimi_malloc(capacity * sizeof(uint32_t));
+    if(!free_index){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    loop->_free_index = free_index;
+    uint32_t i;
+    for(i = capacity ; i > loop->_capacity ; --i){
+        loop->_sessions[i - 1] = NULL;
+        loop->_free_index[loop->_free_count++] = i - 1;
+    }
+    loop->_capacity = capacity;
+    return 0;
+}
+
+event_session *event_session_add(event_loop *loop,
+                                 int fd,
+                                 const event_session_ops *ops,
+                                 void *ctx,
+                                 on_session_close cb,
+                                 void *user_data){
+    CHECK_PTR(loop,NULL);
+    CHECK_PTR(ops,NULL);
+    CHECK_PTR(ctx,NULL);
+    if(!loop->_free_count && -1 == event_loop_grow(loop)){
+        return NULL;
+    }
+    event_session *session = (event_session *)jimi_malloc(sizeof(event_session));
+    if(!session){
+        LOGE("malloc event_session failed!");
+        return NULL;
+    }
+    memset(session,0, sizeof(event_session));
+    session->_loop = loop;
+    session->_fd = fd;
+    session->_ops = ops;
+    session->_ctx = ctx;
+    session->_cb = cb;
+    session->_user_data = user_data;
+
+    int flags = fcntl(fd,F_GETFL,0);
+#ifdef ENABLE_IO_URING
+    if(loop->_uring){
+        //由io_uring等待套接字就绪，非阻塞套接字的操作可能直接返回EAGAIN
+        if(flags == -1 || -1 == fcntl(fd,F_SETFL,flags & ~O_NONBLOCK)){
+            LOGE("set blocking failed:%d %s",errno,strerror(errno));
+            jimi_free(session);
+            return NULL;
+        }
+        session->_index = loop->_free_index[--loop->_free_count];
+        loop->_sessions[session->_index] = session;
+        ++loop->_count;
+        event_uring_arm_recv(session);
+        event_session_mark_dirty(session);
+        return session;
+    }
+#endif
+    if(flags == -1 || -1 == fcntl(fd,F_SETFL,flags | O_NONBLOCK)){
+        LOGE("set non-blocking failed:%d %s",errno,strerror(errno));
+        jimi_free(session);
+        return NULL;
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = session;
+    if(-1 == epoll_ctl(loop->_epoll_fd,EPOLL_CTL_ADD,fd,&ev)){
+        LOGE("epoll_ctl failed:%d %s",errno,strerror(errno));
+        jimi_free(session);
+        return NULL;
+    }
+    session->_index = loop->_free_index[--loop->_free_count];
+    loop->_sessions[session->_index] = session;
+    ++loop->_count;
+    event_session_mark_dirty(session);
+    return session;
+}
+
+/**
+ * 关闭连接但不回调，回调以及释放在本轮事件处理完毕后进行
+ */
+static void event_session_shutdown(event_session *session,int err){
+    if(session->_closed){
+        return;
+    }
+    event_loop *loop = session->_loop;
+    session->_closed = 1;
+    session->_err = err;
+#ifdef ENABLE_IO_URING
+    if(loop->_uring){
+        //结束多次接收；主动关闭时剩余数据发送完毕后才关闭套接字
+        shutdown(session->_fd,err ? SHUT_RDWR : SHUT_RD);
+    }else
+#endif
+    {
+        //epoll后端的待发送数据缓存在对象中，关闭回调后对象即失效，无法继续发送
+        epoll_ctl(loop->_epoll_fd,EPOLL_CTL_DEL,session->_fd,NULL);
+        close(session->_fd);
+    }
+    if(session->_timer){
+        mqtt_timer_wheel_cancel(&loop->_timers,session->_timer);
+        session->_timer = 0;
+    }
+    loop->_sessions[session->_index] = NULL;
+    loop->_free_index[loop->_free_count++] = session->_index;
+    --loop->_count;
+    session->_next_closed = loop->_closed;
+    loop->_closed = session;
+}
+
+int event_session_close(event_session *session){
+    CHECK_PTR(session,-1);
+    event_session_shutdown(session,0);
+    return 0;
+}
+
+void event_session_refresh(event_session *session){
+    if(session && !session->_closed){
+        event_session_mark_dirty(session);
+    }
+}
+
+void *event_session_context(event_session *session){
+    CHECK_PTR(session,NULL);
+    return session->_ctx;
+}
+
+int event_session_fd(event_session *session){
+    CHECK_PTR(session,-1);
+    return session->_fd;
+}
+
+int event_session_write(event_session *session,const struct iovec *iov,int iovcnt){
+    CHECK_PTR(session,-1);
+    if(session->_closed){
+        return -1;
+    }
+#ifdef ENABLE_IO_URING
+    if(session->_loop->_uring){
+        int ret = event_uring_write(session,iov,iovcnt);
+        event_session_mark_dirty(session);
+        return ret;
+    }
+#endif
+    while(1){
+        ssize_t ret = writev(session->_fd,iov,iovcnt);
+        if(ret >= 0){
+            event_session_mark_dirty(session);
+            return (int)ret;
+        }
+        if(errno == EINTR){
+            continue;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            //剩余数据由对象缓存，可写时继续发送
+            return 0;
+        }
+        LOGW("writev failed:%d %s",errno,strerror(errno));
+        event_session_shutdown(session,errno);
+        return -1;
+    }
+}
+
+/**
+ * 边缘触发模式下需要把数据读完
+ */
+static void event_session_on_read(event_session *session){
+    while(!session->_closed){
+        struct iovec iov[2];
+        int iovcnt = session->_ops->input_prepare(session->_ctx,iov);
+        if(iovcnt <= 0){
+            LOGE("input_prepare failed:%d",iovcnt);
+            event_session_shutdown(session,ENOBUFS);
+            return;
+        }
+        size_t total = iov[0].iov_len + (iovcnt > 1 ? iov[1].iov_len : 0);
+        ssize_t recv = readv(session->_fd,iov,iovcnt);
+        if(recv == 0){
+            event_session_shutdown(session,0);
+            return;
+        }
+        if(recv == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                event_session_shutdown(session,errno);
+            }
+            return;
+        }
+        if(0 != session->_ops->input_commit(session->_ctx,(int)recv)){
+            LOGW("input_commit failed, close session:%d",session->_fd);
+            event_session_shutdown(session,EPROTO);
+            return;
+        }
+        if((size_t)recv < total){
+            //接收缓冲区已经读空，新数据到达时会再次触发
+            return;
+        }
+    }
+}
+
+static void event_session_on_event(event_session *session,uint32_t events){
+    if(session->_closed){
+        return;
+    }
+    if(events & EPOLLERR){
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(session->_fd,SOL_SOCKET,SO_ERROR,&err,&len);
+        event_session_shutdown(session,err ? err : EIO);
+        return;
+    }
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)){
+        event_session_on_read(session);
+    }
+    if(!session->_closed && (events & EPOLLOUT)){
+        if(session->_ops->on_writable(session->_ctx) < 0 && !session->_closed){
+            event_session_shutdown(session,EIO);
+        }
+    }
+    if(!session->_closed){
+        event_session_mark_dirty(session);
+    }
+}
+
+static void event_loop_on_timer(void *arg,uint32_t key){
+    event_loop *loop = (event_loop *)arg;
+    if(key & EVENT_TIMER_USER){
+        event_loop_timer *timer = loop->_user_timers + (key & ~EVENT_TIMER_USER);
+        timer->_timer = 0;
+        int next = timer->_cb(timer->_user_data);
+        //回调中可能添加定时器导致数组扩容
+        timer = loop->_user_timers + (key & ~EVENT_TIMER_USER);
+        if(next > 0 && !timer->_timer && timer->_cb){
+            timer->_timer = mqtt_timer_wheel_add(&loop->_timers,event_now_ms(),next,key);
+        }
+        if(!timer->_timer){
+            timer->_cb = NULL;
+        }
+        return;
+    }
+    event_session *session = loop->_sessions[key];
+    if(!session){
+        return;
+    }
+    session->_timer = 0;
+    session->_deadline = 0;
+    session->_ops->timer_schedule(session->_ctx);
+    if(!session->_closed){
+        event_session_mark_dirty(session);
+    }
+}
+
+/**
+ * 更新本轮被操作过的对象的定时器
+ */
+static void event_loop_process_dirty(event_loop *loop){
+    while(loop->_dirty){
+        event_session *session = loop->_dirty;
+        loop->_dirty = session->_next_dirty;
+        session->_dirty = 0;
+        if(!session->_closed){
+            event_session_update_timer(session);
+        }
+    }
+}
+
+static void event_loop_process_closed(event_loop *loop){
+    while(loop->_closed){
+        event_session *session = loop->_closed;
+        loop->_closed = session->_next_closed;
+        if(session->_cb){
+            session->_cb(session->_user_data,session,session->_err);
+        }
+        //回调中可能继续操作其他对象
+        event_loop_process_dirty(loop);
+#ifdef ENABLE_IO_URING
+        if(loop->_uring){
+            session->_zombie = 1;
+            session->_prev_zombie = NULL;
+            session->_next_zombie = loop->_zombies;
+            if(loop->_zombies){
+                loop->_zombies->_prev_zombie = session;
+            }
+            loop->_zombies = session;
+            event_uring_try_release(session);
+            continue;
+        }
+#endif
+        jimi_free(session);
+    }
+}
+
+int event_loop_run_once(event_loop *loop,int max_wait_ms){
+    CHECK_PTR(loop,-1);
+    event_loop_process_dirty(loop);
+    event_loop_process_closed(loop);
+
+    int wait_ms = max_wait_ms;
+    uint64_t expires;
+    if(0 == mqtt_timer_wheel_next(&loop->_timers,&expires)){
+        uint64_t now = event_now_ms();
+        int timer_ms = expires > now ? (int)(expires - now) : 0;
+        if(wait_ms < 0 || timer_ms < wait_ms){
+            wait_ms = timer_ms;
+        }
+    }
+    if(__atomic_load_n(&loop->_stop,__ATOMIC_ACQUIRE)){
+        wait_ms = 0;
+    }
+
+#ifdef ENABLE_IO_URING
+    if(loop->_uring){
+        event_uring_process_flush(loop);
+        if(-1 == event_uring_submit(loop->_uring,wait_ms)){
+            return -1;
+        }
+        int events = event_uring_reap(loop);
+        mqtt_timer_wheel_expire(&loop->_timers,event_now_ms(),event_loop_on_timer,loop);
+        event_loop_process_dirty(loop);
+        event_loop_process_closed(loop);
+        //回调中产生的发送数据在下一轮等待之前提交
+        return events;
+    }
+#endif
+
+    int count = epoll_wait(loop->_epoll_fd,loop->_events,EVENT_LOOP_MAX_EVENTS,wait_ms);
+    if(count == -1){
+        if(errno != EINTR){
+            LOGE("epoll_wait failed:%d %s",errno,strerror(errno));
+            return -1;
+        }
+        count = 0;
+    }
+    int i;
+    for(i = 0 ; i < count ; ++i){
+        event_session *session = (event_session *)loop->_events[i].data.ptr;
+        if(!session){
+            uint64_t value;
+            while(read(loop->_wake_fd,&value, sizeof(value)) > 0);
+            if(loop->_wakeup_cb){
+                loop->_wakeup_cb(loop->_wakeup_data);
+            }
+            continue;
+        }
+        event_session_on_event(session,loop->_events[i].events);
+    }
+
+    mqtt_timer_wheel_expire(&loop->_timers,event_now_ms(),event_loop_on_timer,loop);
+    event_loop_process_dirty(loop);
+    event_loop_process_closed(loop);
+    return count;
+}
+
+int event_loop_run(event_loop *loop){
+    CHECK_PTR(loop,-1);
+    //在其他线程中可能先于本函数调用event_loop_stop，所以退出时才清除标记
+    while(!__atomic_load_n(&loop->_stop,__ATOMIC_ACQUIRE)){
+        if(-1 == event_loop_run_once(loop,-1)){
+            return -1;
+        }
+    }
+    __atomic_store_n(&loop->_stop,0,__ATOMIC_RELAXED);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+uint32_t event_loop_add_timer(event_loop *loop,int delay_ms,on_loop_timer cb,void *user_data){
+    CHECK_PTR(loop,0);
+    CHECK_PTR(cb,0);
+    uint32_t index;
+    for(index = 0 ; index < loop->_user_timer_capacity ; ++index){
+        if(!loop->_user_timers[index]._cb){
+            break;
+        }
+    }
+    if(index == loop->_user_timer_capacity){
+        uint32_t capacity = index ? index * 2 : EVENT_LOOP_MIN_SIZE;
+        event_loop_timer *timers = loop->_user_timers ?
+                                   jimi_realloc(loop->_user_timers,capacity * sizeof(event_loop_timer)) :
+                                   jimi_malloc(capacity * sizeof(event_loop_timer));
+        if(!timers){
+            LOGE("out of memory:%d",capacity);
+            return 0;
+        }
+        memset(timers + index,0,(capacity - index) * sizeof(event_loop_timer));
+        loop->_user_timers = timers;
+        loop->_user_timer_capacity = capacity;
+    }
+    event_loop_timer *timer = loop->_user_timers + index;
+    timer->_timer = mqtt_timer_wheel_add(&loop->_timers,event_now_ms(),delay_ms > 0 ? delay_ms : 0,
+                                         EVENT_TIMER_USER | index);
+    if(!timer->_timer){
+        return 0;
+    }
+    timer->_cb = cb;
+    timer->_user_data = user_data;
+    return index + 1;
+}
+
+void event_loop_cancel_timer(event_loop *loop,uint32_t timer){
+    if(!loop || !timer || timer > loop->_user_timer_capacity){
+        return;
+    }
+    event_loop_timer *user_timer = loop->_user_timers + timer - 1;
+    if(user_timer->_timer){
+        mqtt_timer_wheel_cancel(&loop->_timers,user_timer->_timer);
+    }
+    user_timer->_timer = 0;
+    user_timer->_cb = NULL;
+}
+
+#endif //defined(__linux__) && !defined(__alios__)
@@ -0,0 +1,525 @@
+//
+// Created by xzl on 2019/7/18.
+//
+
+#if defined(__linux__) && !defined(__alios__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <memory.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "jimi_event_pool.h"
+#include "jimi_event_loop.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+#include "mqtt_wrapper.h"
+#include "hash-table.h"
+
+typedef enum {
+    pool_cmd_connect = 0,
+    pool_cmd_publish,
+    pool_cmd_execute,
+    pool_cmd_disconnect,
+} pool_cmd_type;
+
+/**
+ * 投递给线程的命令，主题以及负载与命令在同一块内存中
+ */
+typedef struct pool_cmd {
+    struct pool_cmd *_next;
+    pool_cmd_type _type;
+    //以下字符串以及负载均位于_data中
+    char *_client_id;
+    //登录命令为用户名、密码，发布命令为主题
+    char *_str[2];
+    char *_payload;
+    int _payload_len;
+    int _qos;
+    int _retain;
+    int _fd;
+    int _keep_alive;
+    event_pool_task _task;
+    void *_arg;
+    char _data[];
+} pool_cmd;
+
+/**
+ * 无锁多生产者单消费者队列(侵入式链表，Dmitry Vyukov算法)
+ * 生产者只做一次原子交换，消费者无需任何原子读改写操作
+ */
+typedef struct {
+    //生产者写入端
+    pool_cmd *_head;
+    char _pad[64 - sizeof(pool_cmd *)];
+    //消费者读取端
+    pool_cmd *_tail;
+    pool_cmd _stub;
+} pool_queue;
+
+typedef struct pool_shard pool_shard;
+
+/**
+ * 线程中的一个连接
+ */
+typedef struct {
+    pool_shard *_shard;
+    char *_client_id;
+    void *_ctx;
+    event_session *_session;
+} pool_conn;
+
+struct pool_shard {
+    pool_queue _queue;
+    //是否已经唤醒过事件循环并且还未处理队列
+    int _wake_pending;
+    event_pool *_pool;
+    int _index;
+    event_loop *_loop;
+    pthread_t _thread;
+    int _started;
+    //client_id到pool_conn的映射，只在本线程访问
+    HashTable *_conns;
+};
+
+struct event_pool {
+    event_pool_callback _callback;
+    pool_shard *_shards;
+    int _count;
+};
+
+static void pool_queue_init(pool_queue *queue){
+    memset(queue,0, sizeof(pool_queue));
+    queue->_head = &queue->_stub;
+    queue->_tail = &queue->_stub;
+}
+
+/**
+ * 投递命令，可以在任意线程调用
+ */
+static void pool_queue_push(pool_queue *queue,pool_cmd *cmd){
+    __atomic_store_n(&cmd->_next,NULL,__ATOMIC_RELAXED);
+    pool_cmd *prev = __atomic_exchange_n(&queue->_head,cmd,__ATOMIC_ACQ_REL);
+    //在此之前消费者看不到cmd，最多暂时读不到后续命令
+    __atomic_store_n(&prev->_next,cmd,__ATOMIC_RELEASE);
+}
+
+/**
+ * 取出命令，只能在消费者线程调用
+ * @return 命令，NULL代表队列为空或者生产者正在投递
+ */
+static pool_cmd *pool_queue_pop(pool_queue *queue){
+    pool_cmd *tail = queue->_tail;
+    pool_cmd *next = __atomic_load_n(&tail->_next,__ATOMIC_ACQUIRE);
+    if(tail == &queue->_stub){
+        if(!next){
+            return NULL;
+        }
+        queue->_tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->_next,__ATOMIC_ACQUIRE);
+    }
+    if(next){
+        queue->_tail = next;
+        return tail;
+    }
+    if(tail != __atomic_load_n(&queue->_head,__ATOMIC_ACQUIRE)){
+        //生产者已经交换了_head但还未链接，稍后再取
+        return NULL;
+    }
+    //tail是最后一个命令，放回桩节点后才能取出
+    pool_queue_push(queue,&queue->_stub);
+    next = __atomic_load_n(&tail->_next,__ATOMIC_ACQUIRE);
+    if(next){
+        queue->_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static unsigned int pool_hash_string(HashTableKey key){
+    const char *str = (const char *)key;
+    unsigned int hash = 2166136261u;
+    while(*str){
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+static int pool_equal_string(HashTableKey key1,HashTableKey key2){
+    return 0 == strcmp((const char *)key1,(const char *)key2);
+}
+
+int event_pool_shard(event_pool *pool,const char *client_id){
+    CHECK_PTR(pool,-1);
+    CHECK_PTR(client_id,-1);
+    return (int)(pool_hash_string((HashTableKey)client_id) % pool->_count);
+}
+
+static int pool_conn_output(void *arg,const struct iovec *iov,int iovcnt){
+    pool_conn *conn = (pool_conn *)arg;
+    return event_session_write(conn->_session,iov,iovcnt);
+}
+
+static void pool_conn_on_conn_ack(void *arg,char flags,char ret_code){
+    pool_conn *conn = (pool_conn *)arg;
+    event_pool *pool = conn->_shard->_pool;
+    if(pool->_callback.pool_on_connect){
+        pool->_callback.pool_on_connect(pool->_callback._user_data,conn->_client_id,conn->_ctx,ret_code);
+    }
+}
+
+static void pool_conn_on_ping_resp(void *arg){}
+
+static void pool_conn_on_publish(void *arg,
+                                 uint16_t pkt_id,
+                                 const char *topic,
+                                 const char *payload,
+                                 uint32_t payloadsize,
+                                 int dup,
+                                 enum MqttQosLevel qos){
+    pool_conn *conn = (pool_conn *)arg;
+    event_pool *pool = conn->_shard->_pool;
+    if(pool->_callback.pool_on_publish){
+        pool->_callback.pool_on_publish(pool->_callback._user_data,conn->_client_id,topic,payload,payloadsize,qos);
+    }
+}
+
+static void pool_conn_on_publish_rel(void *arg,uint16_t pkt_id){}
+
+static void pool_conn_on_close(void *arg,event_session *session,int err){
+    pool_conn *conn = (pool_conn *)arg;
+    pool_shard *shard = conn->_shard;
+    event_pool *pool = shard->_pool;
+    if(pool->_callback.pool_on_close){
+        pool->_callback.pool_on_close(pool->_callback._user_data,conn->_client_id,err);
+    }
+    //被新连接顶替时映射已经指向新连接
+    if(hash_table_lookup(shard->_conns,conn->_client_id) == conn){
+        hash_table_remove(shard->_conns,conn->_client_id);
+    }
+    mqtt_free_contex(conn->_ctx);
+    jimi_free(conn->_client_id);
+    jimi_free(conn);
+}
+
+static void pool_shard_connect(pool_shard *shard,pool_cmd *cmd){
+    pool_conn *old = (pool_conn *)hash_table_lookup(shard->_conns,cmd->_client_id);
+    if(old){
+        LOGW("client_id already connected, close the old one:%s",cmd->_client_id);
+        hash_table_remove(shard->_conns,cmd->_client_id);
+        event_session_close(old->_session);
+    }
+
+    pool_conn *conn = (pool_conn *)jimi_malloc(sizeof(pool_conn));
+    if(!conn){
+        LOGE("malloc pool_conn failed!");
+        close(cmd->_fd);
+        return;
+    }
+    memset(conn,0, sizeof(pool_conn));
+    conn->_shard = shard;
+    conn->_client_id = jimi_strdup(cmd->_client_id);
+    mqtt_callback callback = {pool_conn_output,
+                              pool_conn_on_conn_ack,
+                              pool_conn_on_ping_resp,
+                              pool_conn_on_publish,
+                              pool_conn_on_publish_rel,
+                              conn};
+    conn->_ctx = conn->_client_id ? mqtt_alloc_contex(&callback) : NULL;
+    if(conn->_ctx){
+        conn->_session = event_session_add(shard->_loop,cmd->_fd,&event_mqtt_ops,conn->_ctx,pool_conn_on_close,conn);
+    }
+    if(!conn->_session){
+        LOGE("add connection failed:%s",cmd->_client_id);
+        close(cmd->_fd);
+        if(conn->_ctx){
+            mqtt_free_contex(conn->_ctx);
+        }
+        jimi_free(conn->_client_id);
+        jimi_free(conn);
+        return;
+    }
+    if(!hash_table_insert(shard->_conns,conn->_client_id,conn)){
+        LOGE("add connection failed:%s",cmd->_client_id);
+        //在关闭回调中释放
+        event_session_close(conn->_session);
+        return;
+    }
+    mqtt_send_connect_pkt(conn->_ctx,
+                          cmd->_keep_alive,
+                          conn->_client_id,
+                          1,
+                          NULL,
+                          NULL,
+                          0,
+                          MQTT_QOS_LEVEL0,
+                          0,
+                          cmd->_str[0],
+                          cmd->_str[1]);
+}
+
+static void pool_shard_execute(pool_shard *shard,pool_cmd *cmd){
+    if(cmd->_type == pool_cmd_connect){
+        pool_shard_connect(shard,cmd);
+        return;
+    }
+    pool_conn *conn = (pool_conn *)hash_table_lookup(shard->_conns,cmd->_client_id);
+    if(!conn){
+        LOGW("client_id not connected:%s",cmd->_client_id);
+        return;
+    }
+    switch (cmd->_type){
+        case pool_cmd_publish:
+            mqtt_send_publish_pkt(conn->_ctx,
+                                  cmd->_str[0],
+                                  cmd->_payload,
+                                  cmd->_payload_len,
+                                  (enum MqttQosLevel)cmd->_qos,
+                                  cmd->_retain,
+                                  0,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  10);
+            break;
+        case pool_cmd_execute:
+            cmd->_task(conn->_ctx,cmd->_arg);
+            break;
+        case pool_cmd_disconnect:
+            mqtt_send_disconnect_pkt(conn->_ctx);
+            event_session_close(conn->_session);
+            break;
+        default:
+            break;
+    }
+    event_session_refresh(conn->_session);
+}
+
+/**
+ * 事件循环被唤醒，处理队列中的所有命令
+ */
+static void pool_shard_on_wakeup(void *arg){
+    pool_shard *shard = (pool_shard *)arg;
+    //先清除标记再取命令，之后投递的命令会再次唤醒
+    __atomic_store_n(&shard->_wake_pending,0,__ATOMIC_SEQ_CST);
+    pool_cmd *cmd;
+    while((cmd = pool_queue_pop(&shard->_queue))){
+        pool_shard_execute(shard,cmd);
+        jimi_free(cmd);
+    }
+    if(__atomic_load_n(&shard->_queue._tail->_next,__ATOMIC_ACQUIRE) ||
+       shard->_queue._tail != __atomic_load_n(&shard->_queue._head,__ATOMIC_ACQUIRE)){
+        //生产者投递到一半，稍后再处理
+        if(!__atomic_exchange_n(&shard->_wake_pending,1,__ATOMIC_SEQ_CST)){
+            event_loop_wakeup(shard->_loop);
+        }
+    }
+}
+
+static void *pool_shard_run(void *arg){
+    pool_shard *shard = (pool_shard *)arg;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus > 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(shard->_index % cpus,&set);
+        if(0 != pthread_setaffinity_np(pthread_self(), sizeof(set),&set)){
+            LOGW("bind thread to cpu %d failed",(int)(shard->_index % cpus));
+        }
+    }
+    event_loop_run(shard->_loop);
+    return NULL;
+}
+
+static void pool_shard_release(pool_shard *shard){
+    pool_cmd *cmd;
+    while((cmd = pool_queue_pop(&shard->_queue))){
+        if(cmd->_type == pool_cmd_connect){
+            close(cmd->_fd);
+        }
+        jimi_free(cmd);
+    }
+    if(shard->_loop){
+        //关闭所有连接，在关闭回调中释放连接
+        event_loop_free(shard->_loop);
+        shard->_loop = NULL;
+    }
+    if(shard->_conns){
+        hash_table_free(shard->_conns);
+        shard->_conns = NULL;
+    }
+}
+
+event_pool *event_pool_alloc(int threads,const event_pool_callback *cb){
+    CHECK_PTR(cb,NULL);
+    if(threads <= 0){
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(threads <= 0){
+            threads = 1;
+        }
+    }
+    event_pool *pool = (event_pool *)jimi_malloc(sizeof(event_pool));
+    if(!pool){
+        LOGE("malloc event_pool failed!");
+        return NULL;
+    }
+    memset(pool,0, sizeof(event_pool));
+    memcpy(&pool->_callback,cb, sizeof(event_pool_callback));
+    pool->_shards = (pool_shard *)jimi_malloc(threads * sizeof(pool_shard));
+    if(!pool->_shards){
+        LOGE("malloc pool_shard failed!");
+        jimi_free(pool);
+        return NULL;
+    }
+    memset(pool->_shards,0,threads * sizeof(pool_shard));
+    pool->_count = threads;
+
+    int i;
+    for(i = 0 ; i < threads ; ++i){
+        pool_shard *shard = pool->_shards + i;
+        pool_queue_init(&shard->_queue);
+        shard->_pool = pool;
+        shard->_index = i;
+        shard->_loop = event_loop_alloc();
+        shard->_conns = hash_table_new(pool_hash_string,pool_equal_string);
+        if(!shard->_loop || !shard->_conns){
+            event_pool_free(pool);
+            return NULL;
+        }
+        event_loop_set_wakeup(shard->_loop,pool_shard_on_wakeup,shard);
+        if(0 != pthread_create(&shard->_thread,NULL,pool_shard_run,shard)){
+            LOGE("pthread_create failed!");
+            event_pool_free(pool);
+            return NULL;
+        }
+        shard->_started = 1;
+    }
+    return pool;
+}
+
+int event_pool_free(event_pool *pool){
+    CHECK_PTR(pool,-1);
+    int i;
+    for(i = 0 ; i < pool->_count ; ++i){
+        pool_shard *shard = pool->_shards + i;
+        if(!shard->_pool){
+            //创建失败时后面的线程未初始化
+            break;
+        }
+        if(shard->_started){
+            event_loop_stop(shard->_loop);
+            pthread_join(shard->_thread,NULL);
+        }
+        pool_shard_release(shard);
+    }
+    jimi_free(pool->_shards);
+    jimi_free(pool);
+    return 0;
+}
+
+/**
+ * 分配命令，client_id、字符串参数以及负载拷贝到命令之后
+ */
+static pool_cmd *pool_cmd_alloc(pool_cmd_type type,
+                                const char *client_id,
+                                const char *str1,
+                                const char *str2,
+                                const char *payload,
+                                int payload_len){
+    const char *strs[] = {client_id,str1,str2};
+    int lens[3];
+    int total = 0;
+    int i;
+    for(i = 0 ; i < 3 ; ++i){
+        lens[i] = strs[i] ? strlen(strs[i]) + 1 : 0;
+        total += lens[i];
+    }
+    pool_cmd *cmd = (pool_cmd *)jimi_malloc(sizeof(pool_cmd) + total + payload_len + 1);
+    if(!cmd){
+        LOGE("malloc pool_cmd failed!");
+        return NULL;
+    }
+    memset(cmd,0, sizeof(pool_cmd));
+    cmd->_type = type;
+    char *ptr = cmd->_data;
+    char **dst[] = {&cmd->_client_id,&cmd->_str[0],&cmd->_str[1]};
+    for(i = 0 ; i < 3 ; ++i){
+        if(strs[i]){
+            *dst[i] = ptr;
+            memcpy(ptr,strs[i],lens[i]);
+            ptr += lens[i];
+        }
+    }
+    cmd->_payload = ptr;
+    cmd->_payload_len = payload_len;
+    if(payload_len){
+        memcpy(ptr,payload,payload_len);
+    }
+    ptr[payload_len] = '\0';
+    return cmd;
+}
+
+static int pool_post(event_pool *pool,pool_cmd *cmd){
+    pool_shard *shard = pool->_shards + event_pool_shard(pool,cmd->_client_id);
+    pool_queue_push(&shard->_queue,cmd);
+    //只有第一个投递者需要唤醒事件循环
+    if(!__atomic_exchange_n(&shard->_wake_pending,1,__ATOMIC_SEQ_CST)){
+        event_loop_wakeup(shard->_loop);
+    }
+    return 0;
+}
+
+int event_pool_connect(event_pool *pool,const char *client_id,int fd,int keep_alive,const char *user,const char *password){
+    CHECK_PTR(pool,-1);
+    CHECK_PTR(client_id,-1);
+    pool_cmd *cmd = pool_cmd_alloc(pool_cmd_connect,client_id,user,password,NULL,0);
+    CHECK_PTR(cmd,-1);
+    cmd->_fd = fd;
+    cmd->_keep_alive = keep_alive;
+    return pool_post(pool,cmd);
+}
+
+int event_pool_publish(event_pool *pool,
+                       const char *client_id,
+                       const char *topic,
+                       const char *payload,
+                       int payload_len,
+                       int qos,
+                       int retain){
+    CHECK_PTR(pool,-1);
+    CHECK_PTR(client_id,-1);
+    CHECK_PTR(topic,-1);
+    if(payload_len <= 0){
+        payload_len = payload ? strlen(payload) : 0;
+    }
+    pool_cmd *cmd = pool_cmd_alloc(pool_cmd_publish,client_id,topic,NULL,payload,payload_len);
+    CHECK_PTR(cmd,-1);
+    cmd->_qos = qos;
+    cmd->_retain = retain;
+    return pool_post(pool,cmd);
+}
+
+int event_pool_execute(event_pool *pool,const char *client_id,event_pool_task task,void *arg){
+    CHECK_PTR(pool,-1);
+    CHECK_PTR(client_id,-1);
+    CHECK_PTR(task,-1);
+    pool_cmd *cmd = pool_cmd_alloc(pool_cmd_execute,client_id,NULL,NULL,NULL,0);
+    CHECK_PTR(cmd,-1);
+    cmd->_task = task;
+    cmd->_arg = arg;
+    return pool_post(pool,cmd);
+}
+
+int event_pool_disconnect(event_pool *pool,const char *client_id){
+    CHECK_PTR(pool,-1);
+    CHECK_PTR(client_id,-1);
+    pool_cmd *cmd = pool_cmd_alloc(pool_cmd_disconnect,client_id,NULL,NULL,NULL,0);
+    CHECK_PTR(cmd,-1);
+    return pool_post(pool,cmd);
+}
+
+#endif //defined(__linux__) && !defined(__alios__)
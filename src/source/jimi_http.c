@@ -153,7 +153,7 @@ void test_http_request(){
 }
 
 typedef struct http_response{
-    buffer _data;
+    byte_buffer _data;
     AVLTree *_header;
     on_split_response _split_cb;
     void *_user_data;
@@ -171,6 +171,7 @@ http_response *http_response_alloc(on_split_response cb,void *user_data){
     http_response *ctx = (http_response *)jimi_malloc(sizeof(http_response));
     CHECK_PTR(ctx,NULL);
     memset(ctx,0, sizeof(http_response));
+    byte_buffer_init(&ctx->_data);
     ctx->_header = avl_tree_new(AVLTreeCompare);
     ctx->_split_cb = cb;
     ctx->_user_data = user_data;
@@ -180,7 +181,7 @@ http_response *http_response_alloc(on_split_response cb,void *user_data){
 
 int http_response_free(http_response *ctx){
     CHECK_PTR(ctx,-1);
-    buffer_release(&ctx->_data);
+    byte_buffer_release(&ctx->_data);
     avl_tree_free(ctx->_header);
     jimi_free(ctx);
     return 0;
@@ -233,44 +234,45 @@ int http_response_input(http_response *ctx,const char *data,int len){
             //上个包处理完毕，重置
             if(len) {
                 //有剩余数据
-                //新建一个临时buffer，用于保存ctx->_data，目的是为了保存data指针有效
-                buffer buffer_tmp;
-                buffer_init(&buffer_tmp);
-                buffer_move(&buffer_tmp, &ctx->_data);
-                //把data指针拷贝至ctx->_data，用于处理下一个包
-                buffer_assign(&ctx->_data, data, len);
-                //data指针已经使用完毕，可以释放了
-                buffer_release(&buffer_tmp);
+                char *start = byte_buffer_data(&ctx->_data);
+                if(data >= start && data < start + byte_buffer_size(&ctx->_data)){
+                    //剩余数据就是缓存的末尾部分，只移动读偏移
+                    byte_buffer_consume(&ctx->_data, data - start);
+                }else{
+                    //把data指针拷贝至ctx->_data，用于处理下一个包
+                    byte_buffer_assign(&ctx->_data, data, len);
+                }
                 len = 0;
             }else{
-                buffer_release(&ctx->_data);
+                byte_buffer_clear(&ctx->_data);
             }
             //重置对象
             avl_tree_free(ctx->_header);
             ctx->_header = avl_tree_new(AVLTreeCompare);
             CLEAR_OFFSET(ctx, http_response, _header_len);
-            if(!ctx->_data._len){
+            if(!byte_buffer_size(&ctx->_data)){
                 return 0;
             }
         }
 
         if(len){
-            buffer_append(&ctx->_data, data, len);
+            CHECK_RET(-1,byte_buffer_append(&ctx->_data, data, len));
         }
 
         //处理http回复头
-        char *pos = strstr(ctx->_data._data, "\r\n\r\n");
+        char *header = byte_buffer_data(&ctx->_data);
+        char *pos = strstr(header, "\r\n\r\n");
         if (!pos) {
             //还未接收完毕http头
             return 0;
         }
 
-        ctx->_header_len = pos + 4 - ctx->_data._data;
+        ctx->_header_len = pos + 4 - header;
         char *line_start, *line_end;
-        for (line_end = ctx->_data._data; line_end < ctx->_data._data + ctx->_header_len - 2;) {
+        for (line_end = header; line_end < header + ctx->_header_len - 2;) {
             line_start = line_end;
             line_end = strstr(line_start, "\r\n");
-            if (line_start == ctx->_data._data) {
+            if (line_start == header) {
                 sscanf(line_start, "%15s %d %15[^\r]", ctx->_http_version, &ctx->_status_code, ctx->_status_str);
                 continue;
             }
@@ -292,8 +294,8 @@ int http_response_input(http_response *ctx,const char *data,int len){
             ctx->_body_len = 0;
         }
 
-        len = ctx->_data._len - ctx->_header_len;
-        data = ctx->_data._data + ctx->_header_len;
+        len = byte_buffer_size(&ctx->_data) - ctx->_header_len;
+        data = header + ctx->_header_len;
     }
 }
 
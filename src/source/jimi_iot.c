@@ -31,9 +31,23 @@ typedef struct {
     void *_mqtt_context;
     buffer _topic_publish;
     buffer _topic_listen;
+    //监听主题的路由句柄
+    uint32_t _listen_route;
     int _req_id;
+    iot_on_credit _credit_cb;
+    //发布数据的qos等级
+    enum MqttQosLevel _qos;
+    iot_on_ack _ack_cb;
 } iot_context;
 
+/**
+ * 等待服务器确认的数据包，用于回调iot_on_ack
+ */
+typedef struct {
+    iot_context *_ctx;
+    uint32_t _req_id;
+} iot_ack_value;
+
 static int iot_data_output(void *arg, const struct iovec *iov, int iovcnt){
     iot_context *ctx = (iot_context *)arg;
     if(ctx->_callback.iot_on_output){
@@ -172,9 +186,11 @@ void *iot_context_alloc(iot_callback *cb){
         return NULL;
     }
     memset(ctx,0, sizeof(iot_context));
-    memcpy(ctx,cb, sizeof(mqtt_callback));
+    memcpy(&ctx->_callback,cb, sizeof(iot_callback));
+    ctx->_qos = MQTT_QOS_LEVEL1;
 
-    mqtt_callback callback = {iot_data_output,iot_on_connect_cb,iot_on_ping_resp,iot_on_publish,iot_on_publish_rel,ctx};
+    //收到的消息通过主题路由分发给iot_on_publish
+    mqtt_callback callback = {iot_data_output,iot_on_connect_cb,iot_on_ping_resp,NULL,iot_on_publish_rel,ctx};
     ctx->_mqtt_context = mqtt_alloc_contex(&callback);
     return ctx;
 }
@@ -228,6 +244,10 @@ int iot_send_connect_pkt(void *arg,const char *client_id,const char *secret,cons
 
     CHECK_RET(-1,buffer_assign(&ctx->_topic_listen,"/terminal/",0));
     CHECK_RET(-1,buffer_append(&ctx->_topic_listen,client_id,0));
+    if(ctx->_listen_route){
+        mqtt_topic_route_remove(ctx->_mqtt_context,ctx->_listen_route);
+    }
+    ctx->_listen_route = mqtt_topic_route_add(ctx->_mqtt_context,ctx->_topic_listen._data,iot_on_publish,ctx);
 
     CHECK_RET(-1,buffer_assign(&ctx->_topic_publish,"/service/",0));
     CHECK_RET(-1,buffer_append(&ctx->_topic_publish,user_name,0));
@@ -241,7 +261,20 @@ static void mqtt_pub_ack(void *arg,int time_out,pub_type type){
     LOGT("time_out=%d,type=%d",time_out,type);
 }
 
+static void mqtt_pub_ack_notify(void *arg,int time_out,pub_type type){
+    iot_ack_value *value = (iot_ack_value *)arg;
+    if(type == pub_rec){
+        //qos2消息等待pub_comp
+        return;
+    }
+    value->_ctx->_ack_cb(value->_ctx->_callback._user_data,value->_req_id,time_out);
+}
+
 int iot_send_raw_bytes(iot_context *ctx,unsigned char *iot_buf,int iot_len){
+    if(mqtt_publish_would_block(ctx->_mqtt_context,ctx->_qos)){
+        //不必再进行base64编码
+        return IOT_ERR_WOULDBLOCK;
+    }
     int base64_size = AV_BASE64_SIZE(iot_len) + 10;
     char *base64 = jimi_malloc(base64_size);
     if(!base64){
@@ -253,17 +286,36 @@ int iot_send_raw_bytes(iot_context *ctx,unsigned char *iot_buf,int iot_len){
         LOGE("av_base64_encode failed!");
         return -1;
     }
+    mqtt_handle_pub_ack cb = mqtt_pub_ack;
+    void *user_data = ctx;
+    free_user_data free_cb = NULL;
+    if(ctx->_ack_cb && ctx->_qos != MQTT_QOS_LEVEL0 && iot_len >= 5){
+        //数据包第2~5个字节为大端的req_id
+        iot_ack_value *value = (iot_ack_value *)jimi_malloc(sizeof(iot_ack_value));
+        if(value){
+            value->_ctx = ctx;
+            value->_req_id = ((uint32_t)iot_buf[1] << 24) | ((uint32_t)iot_buf[2] << 16) |
+                             ((uint32_t)iot_buf[3] << 8) | (uint32_t)iot_buf[4];
+            cb = mqtt_pub_ack_notify;
+            user_data = value;
+            free_cb = jimi_free;
+        }
+    }
     int ret = mqtt_send_publish_pkt(ctx->_mqtt_context,
                                     ctx->_topic_publish._data,//topic
                                     (const char *)base64,//payload
                                     0,//payload_len
-                                    MQTT_QOS_LEVEL1,//qos
+                                    ctx->_qos,//qos
                                     0,//retain
                                     0,//dup
-                                    mqtt_pub_ack,//mqtt_handle_pub_ack
-                                    ctx,//user_data
-                                    NULL,//free_user_data
+                                    cb,//mqtt_handle_pub_ack
+                                    user_data,//user_data
+                                    free_cb,//free_user_data
                                     10);//timeout_sec
+    if(ret != 0 && free_cb){
+        //发送失败时不会注册回调，需要自行释放
+        free_cb(user_data);
+    }
     jimi_free(base64);
     return ret;
 }
@@ -324,6 +376,18 @@ int iot_send_string_pkt(void *arg,uint32_t tag,const char *str){
     return ret;
 }
 
+int iot_batch_begin(void *arg,uint32_t max_bytes,int max_pkts,int max_delay_ms){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_batch_begin(ctx->_mqtt_context,max_bytes,max_pkts,max_delay_ms);
+}
+
+int iot_batch_end(void *arg){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_batch_end(ctx->_mqtt_context);
+}
+
 int iot_send_buffer(void *arg,buffer *buf){
     iot_context *ctx = (iot_context *)arg;
     CHECK_PTR(ctx,-1);
@@ -339,12 +403,80 @@ int iot_input_data(void *arg,char *data,int len){
     return mqtt_input_data(ctx->_mqtt_context,data,len);
 }
 
+int iot_input_prepare(void *arg,struct iovec *iov){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_input_prepare(ctx->_mqtt_context,iov);
+}
+
+int iot_input_commit(void *arg,int len){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_input_commit(ctx->_mqtt_context,len);
+}
+
+int iot_on_writable(void *arg){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_on_writable(ctx->_mqtt_context);
+}
+
+int iot_connection_lost(void *arg){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_connection_lost(ctx->_mqtt_context);
+}
+
 int iot_timer_schedule(void *arg){
     iot_context *ctx = (iot_context *)arg;
     CHECK_PTR(ctx,-1);
     return mqtt_timer_schedule(ctx->_mqtt_context);
 }
 
+static void iot_on_credit_cb(void *arg){
+    iot_context *ctx = (iot_context *)arg;
+    if(ctx->_credit_cb){
+        ctx->_credit_cb(ctx->_callback._user_data);
+    }
+}
+
+int iot_set_flow_control(void *arg,int max_inflight,uint32_t max_output_bytes,iot_on_credit cb){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    ctx->_credit_cb = cb;
+    return mqtt_set_flow_control(ctx->_mqtt_context,max_inflight,max_output_bytes,iot_on_credit_cb);
+}
+
+int iot_set_publish_qos(void *arg,int qos){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    if(qos < MQTT_QOS_LEVEL0 || qos > MQTT_QOS_LEVEL2){
+        LOGE("bad qos level:%d",qos);
+        return -1;
+    }
+    ctx->_qos = (enum MqttQosLevel)qos;
+    return 0;
+}
+
+int iot_set_ack_callback(void *arg,iot_on_ack cb){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    ctx->_ack_cb = cb;
+    return 0;
+}
+
+int iot_outbox_enable(void *arg,const char *path,uint32_t capacity,int sync_interval_ms){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_outbox_enable(ctx->_mqtt_context,path,capacity,sync_interval_ms);
+}
+
+int iot_next_timeout(void *arg){
+    iot_context *ctx = (iot_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_next_timeout(ctx->_mqtt_context);
+}
+
 int iot_get_request_id(void *arg){
     iot_context *ctx = (iot_context *)arg;
     CHECK_PTR(ctx,-1);
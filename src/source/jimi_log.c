@@ -29,7 +29,13 @@ android_LogPriority LogPriorityArr[] = {ANDROID_LOG_VERBOSE,ANDROID_LOG_DEBUG,AN
 
 void print_time(const struct timeval *tv,char *buf,int buf_size) {
     time_t sec_tmp = tv->tv_sec;
+#ifdef __alios__
     struct tm *tm = localtime(&sec_tmp);
+#else
+    //多线程同时打印日志时localtime的返回值会被覆盖
+    struct tm tm_buf;
+    struct tm *tm = localtime_r(&sec_tmp,&tm_buf);
+#endif
     snprintf(buf,
              buf_size,
              "%d-%02d-%02d %02d:%02d:%02d.%03d",
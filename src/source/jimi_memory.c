@@ -7,6 +7,13 @@
 #include "jimi_memory.h"
 #include "jimi_log.h"
 
+#ifdef JIMI_MEMORY_TRACK
+//本文件实现的是函数本身
+#undef jimi_malloc
+#undef jimi_realloc
+#undef jimi_strdup
+#endif
+
 static malloc_ptr s_malloc_ptr = NULL;
 static free_ptr s_free_ptr = NULL;
 static realloc_ptr s_realloc_ptr = NULL;
@@ -29,6 +36,8 @@ void set_strdup_ptr(strdup_ptr ptr){
     s_strdup_ptr = ptr;
 }
 
+#ifndef JIMI_MEMORY_TRACK
+
 void *jimi_malloc(int size){
     CHECK_PTR(size,NULL);
     void *ptr = s_malloc_ptr ? s_malloc_ptr(size) : malloc(size);
@@ -56,4 +65,327 @@ char *jimi_strdup(const char *str){
     char *ret = s_strdup_ptr ? s_strdup_ptr(str) : strdup(str);
     CHECK_PTR(ret,NULL);
     return ret;
-}
\ No newline at end of file
+}
+
+int jimi_memory_get_totals(jimi_memory_totals *totals){
+    return -1;
+}
+
+int jimi_memory_get_hotspots(jimi_memory_site *sites,int max,jimi_memory_sort sort){
+    return -1;
+}
+
+int jimi_memory_dump(int top,jimi_memory_sort sort){
+    return -1;
+}
+
+void jimi_memory_reset_stats(){
+}
+
+#else //JIMI_MEMORY_TRACK
+
+#ifdef __alios__
+#include <aos/kernel.h>
+#else
+#include <pthread.h>
+#endif
+
+//调用位置表大小，超出后的调用位置合并统计到0号位置
+#ifndef JIMI_MEMORY_TRACK_SITES
+#ifdef __alios__
+#define JIMI_MEMORY_TRACK_SITES 64
+#else
+#define JIMI_MEMORY_TRACK_SITES 512
+#endif
+#endif
+
+//头部固定16字节，保证返回的内存与系统malloc对齐方式相同
+#define TRACK_HEAD_SIZE 16
+#define TRACK_MAGIC 0x4A494D49
+#define TRACK_MAGIC_FREED 0x46524545
+
+#ifdef __GNUC__
+#define TRACK_CALLER __builtin_return_address(0)
+#else
+#define TRACK_CALLER NULL
+#endif
+
+/**
+ * 每块内存前面的头部
+ */
+typedef struct {
+    //用于发现重复释放或者释放非jimi_malloc开辟的内存
+    uint32_t _magic;
+    //调用位置下标
+    uint32_t _site;
+    //用户请求的字节数
+    uint32_t _size;
+} track_head;
+
+static jimi_memory_site s_sites[JIMI_MEMORY_TRACK_SITES] = {{"<other>",0,NULL}};
+static jimi_memory_totals s_totals = {0};
+//每次开辟释放都要加锁，使用平台互斥锁，持有锁的线程被抢占时其他线程不会空转
+#ifdef __alios__
+static aos_mutex_t s_track_mutex;
+static int s_track_mutex_ready = 0;
+static char s_track_mutex_init = 0;
+
+static void track_lock(){
+    if(!__atomic_load_n(&s_track_mutex_ready,__ATOMIC_ACQUIRE)){
+        //aos互斥锁没有静态初始化方式，第一次使用时创建
+        while(__atomic_test_and_set(&s_track_mutex_init,__ATOMIC_ACQUIRE)){
+            aos_msleep(1);
+        }
+        if(!s_track_mutex_ready){
+            aos_mutex_new(&s_track_mutex);
+            __atomic_store_n(&s_track_mutex_ready,1,__ATOMIC_RELEASE);
+        }
+        __atomic_clear(&s_track_mutex_init,__ATOMIC_RELEASE);
+    }
+    aos_mutex_lock(&s_track_mutex,AOS_WAIT_FOREVER);
+}
+
+static void track_unlock(){
+    aos_mutex_unlock(&s_track_mutex);
+}
+#else
+static pthread_mutex_t s_track_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void track_lock(){
+    pthread_mutex_lock(&s_track_mutex);
+}
+
+static void track_unlock(){
+    pthread_mutex_unlock(&s_track_mutex);
+}
+#endif
+
+/**
+ * 查找或者新增调用位置，需要加锁
+ */
+static uint32_t track_site(const char *file,int line,void *addr){
+    uintptr_t key = file ? (uintptr_t)file + (uintptr_t)line * 0x9E3779B1U : (uintptr_t)addr;
+    uint32_t index = (uint32_t)((key * 2654435761U) >> 4) % (JIMI_MEMORY_TRACK_SITES - 1) + 1;
+    int i;
+    for(i = 1 ; i < JIMI_MEMORY_TRACK_SITES ; ++i){
+        jimi_memory_site *site = &s_sites[index];
+        if(!site->_file && !site->_addr){
+            site->_file = file;
+            site->_line = line;
+            site->_addr = addr;
+            ++s_totals._sites;
+            return index;
+        }
+        if(site->_file == file && site->_line == line && site->_addr == addr){
+            return index;
+        }
+        if(++index == JIMI_MEMORY_TRACK_SITES){
+            index = 1;
+        }
+    }
+    return 0;
+}
+
+static void track_add(track_head *head,int size,const char *file,int line,void *addr){
+    track_lock();
+    uint32_t index = track_site(file,line,addr);
+    jimi_memory_site *site = &s_sites[index];
+    ++site->_allocs;
+    site->_total_bytes += size;
+    ++site->_live_count;
+    site->_live_bytes += size;
+    if(site->_live_bytes > site->_peak_bytes){
+        site->_peak_bytes = site->_live_bytes;
+    }
+    ++s_totals._allocs;
+    ++s_totals._live_count;
+    s_totals._live_bytes += size;
+    if(s_totals._live_bytes > s_totals._peak_bytes){
+        s_totals._peak_bytes = s_totals._live_bytes;
+    }
+    track_unlock();
+    head->_magic = TRACK_MAGIC;
+    head->_site = index;
+    head->_size = size;
+}
+
+static void track_remove(track_head *head){
+    track_lock();
+    jimi_memory_site *site = &s_sites[head->_site];
+    ++site->_frees;
+    --site->_live_count;
+    site->_live_bytes -= head->_size;
+    ++s_totals._frees;
+    --s_totals._live_count;
+    s_totals._live_bytes -= head->_size;
+    track_unlock();
+}
+
+static track_head *track_head_of(void *ptr){
+    track_head *head = (track_head *)((char *)ptr - TRACK_HEAD_SIZE);
+    if(head->_magic != TRACK_MAGIC){
+        LOGE("invalid or double freed ptr:%p",ptr);
+        return NULL;
+    }
+    return head;
+}
+
+static void *track_malloc(int size,const char *file,int line,void *addr){
+    CHECK_PTR(size,NULL);
+    track_head *head = (track_head *)(s_malloc_ptr ? s_malloc_ptr(size + TRACK_HEAD_SIZE) : malloc(size + TRACK_HEAD_SIZE));
+    CHECK_PTR(head,NULL);
+    track_add(head,size,file,line,addr);
+    return (char *)head + TRACK_HEAD_SIZE;
+}
+
+static void *track_realloc(void *ptr,int size,const char *file,int line,void *addr){
+    CHECK_PTR(ptr,NULL);
+    CHECK_PTR(size,NULL);
+    track_head *head = track_head_of(ptr);
+    CHECK_PTR(head,NULL);
+    track_head old = *head;
+    track_head *ret = (track_head *)(s_realloc_ptr ? s_realloc_ptr(head,size + TRACK_HEAD_SIZE) : realloc(head,size + TRACK_HEAD_SIZE));
+    CHECK_PTR(ret,NULL);
+    //重新开辟的内存计入本次调用位置
+    track_remove(&old);
+    track_add(ret,size,file,line,addr);
+    return (char *)ret + TRACK_HEAD_SIZE;
+}
+
+static char *track_strdup(const char *str,const char *file,int line,void *addr){
+    CHECK_PTR(str,NULL);
+    int len = strlen(str) + 1;
+    char *ret = (char *)track_malloc(len,file,line,addr);
+    CHECK_PTR(ret,NULL);
+    memcpy(ret,str,len);
+    return ret;
+}
+
+void *jimi_malloc_track(int size,const char *file,int line){
+    return track_malloc(size,file,line,NULL);
+}
+
+void *jimi_realloc_track(void *ptr,int size,const char *file,int line){
+    return track_realloc(ptr,size,file,line,NULL);
+}
+
+char *jimi_strdup_track(const char *str,const char *file,int line){
+    return track_strdup(str,file,line,NULL);
+}
+
+void *jimi_malloc(int size){
+    return track_malloc(size,NULL,0,TRACK_CALLER);
+}
+
+void jimi_free(void *ptr){
+    if(ptr == NULL){
+        return;
+    }
+    track_head *head = track_head_of(ptr);
+    if(!head){
+        //宁可泄露也不破坏堆
+        return;
+    }
+    track_remove(head);
+    head->_magic = TRACK_MAGIC_FREED;
+    s_free_ptr ? s_free_ptr(head) : free(head);
+}
+
+void *jimi_realloc(void *ptr,int size){
+    return track_realloc(ptr,size,NULL,0,TRACK_CALLER);
+}
+
+char *jimi_strdup(const char *str){
+    return track_strdup(str,NULL,0,TRACK_CALLER);
+}
+
+int jimi_memory_get_totals(jimi_memory_totals *totals){
+    CHECK_PTR(totals,-1);
+    track_lock();
+    *totals = s_totals;
+    track_unlock();
+    return 0;
+}
+
+static uint64_t track_sort_key(const jimi_memory_site *site,jimi_memory_sort sort){
+    switch (sort){
+        case memory_sort_peak:
+            return site->_peak_bytes;
+        case memory_sort_allocs:
+            return site->_allocs;
+        default:
+            return site->_live_bytes;
+    }
+}
+
+int jimi_memory_get_hotspots(jimi_memory_site *sites,int max,jimi_memory_sort sort){
+    int count = 0;
+    int i,j;
+    CHECK_PTR(sites,-1);
+    track_lock();
+    for(i = 0 ; i < JIMI_MEMORY_TRACK_SITES ; ++i){
+        const jimi_memory_site *site = &s_sites[i];
+        if(!site->_allocs && !site->_live_count){
+            continue;
+        }
+        uint64_t key = track_sort_key(site,sort);
+        if(count == max && (!max || key <= track_sort_key(&sites[max - 1],sort))){
+            continue;
+        }
+        //插入排序，只保留前max个
+        j = count < max ? count++ : max - 1;
+        for(; j > 0 && track_sort_key(&sites[j - 1],sort) < key ; --j){
+            sites[j] = sites[j - 1];
+        }
+        sites[j] = *site;
+    }
+    track_unlock();
+    return count;
+}
+
+int jimi_memory_dump(int top,jimi_memory_sort sort){
+    jimi_memory_totals totals;
+    int i,count;
+    if(top <= 0){
+        return -1;
+    }
+    //不通过jimi_malloc开辟，避免影响统计
+    jimi_memory_site *sites = (jimi_memory_site *)malloc(top * sizeof(jimi_memory_site));
+    CHECK_PTR(sites,-1);
+    jimi_memory_get_totals(&totals);
+    count = jimi_memory_get_hotspots(sites,top,sort);
+    printf_ptr print = get_printf_ptr();
+    print("memory live:%u bytes %u blocks, peak:%u bytes, allocs:%llu frees:%llu sites:%u\r\n",
+          totals._live_bytes,totals._live_count,totals._peak_bytes,
+          (unsigned long long)totals._allocs,(unsigned long long)totals._frees,totals._sites);
+    for(i = 0 ; i < count ; ++i){
+        jimi_memory_site *site = &sites[i];
+        if(site->_file){
+            print("  %s:%d",site->_file,site->_line);
+        }else{
+            print("  %p",site->_addr);
+        }
+        print(" live:%u bytes %u blocks, peak:%u bytes, allocs:%llu total:%llu bytes\r\n",
+              site->_live_bytes,site->_live_count,site->_peak_bytes,
+              (unsigned long long)site->_allocs,(unsigned long long)site->_total_bytes);
+    }
+    free(sites);
+    return 0;
+}
+
+void jimi_memory_reset_stats(){
+    int i;
+    track_lock();
+    for(i = 0 ; i < JIMI_MEMORY_TRACK_SITES ; ++i){
+        s_sites[i]._allocs = 0;
+        s_sites[i]._frees = 0;
+        s_sites[i]._total_bytes = 0;
+        s_sites[i]._peak_bytes = s_sites[i]._live_bytes;
+    }
+    s_totals._allocs = 0;
+    s_totals._frees = 0;
+    s_totals._peak_bytes = s_totals._live_bytes;
+    track_unlock();
+}
+
+#endif //JIMI_MEMORY_TRACK
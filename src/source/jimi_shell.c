@@ -22,25 +22,20 @@
 typedef int(* on_argv)(void *user_data,int argc,char *argv[]);
 
 typedef struct cmd_splitter{
-    buffer *_buf;
+    byte_buffer _buf;
 } cmd_splitter;
 
 
 cmd_splitter* cmd_splitter_alloc(){
     cmd_splitter *ret = (cmd_splitter *)jimi_malloc(sizeof(cmd_splitter));
     CHECK_PTR(ret,NULL);
-    ret->_buf = buffer_alloc();
-    if(!ret->_buf){
-        jimi_free(ret);
-        LOGE("buffer_alloc failed!");
-        return NULL;
-    }
+    byte_buffer_init(&ret->_buf);
     return ret;
 }
 
 int cmd_splitter_free(cmd_splitter *ctx){
     CHECK_PTR(ctx,-1);
-    buffer_free(ctx->_buf);
+    byte_buffer_release(&ctx->_buf);
     jimi_free(ctx);
     return 0;
 }
@@ -107,8 +102,9 @@ int cmd_splitter_input(cmd_splitter *ctx,const char *data,int len,void *user_dat
     if(len <= 0){
         len = strlen(data);
     }
-    CHECK_RET(-1,buffer_append(ctx->_buf,data,len));
-    char *start = ctx->_buf->_data;
+    CHECK_RET(-1,byte_buffer_append(&ctx->_buf,data,len));
+    char *begin = byte_buffer_data(&ctx->_buf);
+    char *start = begin;
     char *pos = NULL;
     while (1){
         pos = strstr(start,"\n");
@@ -120,10 +116,8 @@ int cmd_splitter_input(cmd_splitter *ctx,const char *data,int len,void *user_dat
         start = pos + 1;
     }
 
-    if(start != ctx->_buf->_data){
-        ctx->_buf->_len -=  (start - ctx->_buf->_data);
-        memmove(ctx->_buf->_data,start,ctx->_buf->_len + 1);
-    }
+    //只移动读偏移，剩余的半行数据等下次写入空间不够时再搬移
+    byte_buffer_consume(&ctx->_buf,start - begin);
     return 0;
 }
 
@@ -0,0 +1,576 @@
+//
+// Created by xzl on 2019/7/24.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "jimi_slab.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+#ifdef __alios__
+#include <aos/kernel.h>
+#else
+#include <pthread.h>
+#endif
+
+#if defined(__linux__) && !defined(__alios__)
+#define SLAB_ENABLE_THREAD_CACHE
+#endif
+
+//页大小，每页只存放同一规格的块
+#ifndef JIMI_SLAB_PAGE_SIZE
+#ifdef __alios__
+#define JIMI_SLAB_PAGE_SIZE 2048
+#else
+#define JIMI_SLAB_PAGE_SIZE 4096
+#endif
+#endif
+
+//非固定内存模式下每次开辟的内存区页数以及最多开辟的内存区个数
+#ifndef JIMI_SLAB_ARENA_PAGES
+#define JIMI_SLAB_ARENA_PAGES 64
+#endif
+#ifndef JIMI_SLAB_MAX_ARENAS
+#define JIMI_SLAB_MAX_ARENAS 64
+#endif
+
+//线程本地缓存每个规格最多缓存的块数以及每次批量转移的块数
+#define SLAB_CACHE_MAX 64
+#define SLAB_CACHE_BATCH 16
+
+//规格按常用结构体大小选取：hash表节点(24)、avl树节点(64)、请求回调以及各种上下文、MqttBuffer标准内存块(256加头部)
+static const uint32_t s_class_size[JIMI_SLAB_CLASS_COUNT] = {16,24,32,48,64,96,128,192,256,288,384,512};
+#define SLAB_MAX_BLOCK 512
+
+/**
+ * 页头部，紧跟着是同一规格的块
+ */
+typedef struct slab_page {
+    //同规格有空闲块的页链表，或者空闲页链表
+    struct slab_page *_next;
+    struct slab_page *_prev;
+    //页内空闲块链表，块的头部保存下一个空闲块地址
+    void *_free;
+    //规格下标，空闲页为-1
+    int16_t _class;
+    //已经分配的块数
+    uint16_t _used;
+} slab_page;
+
+#define SLAB_PAGE_HEAD ((sizeof(slab_page) + 7) & ~7)
+#define SLAB_BLOCKS(cls) ((JIMI_SLAB_PAGE_SIZE - SLAB_PAGE_HEAD) / s_class_size[cls])
+
+typedef struct {
+    char *_base;
+    uint32_t _pages;
+    //尚未使用过的第一页
+    uint32_t _next_page;
+} slab_arena;
+
+typedef struct {
+    //有空闲块的页
+    slab_page *_partial;
+    uint32_t _pages;
+    uint32_t _used;
+    uint32_t _total;
+} slab_class;
+
+static struct {
+    int _enabled;
+    int _flags;
+    //使用调用者提供的固定内存
+    int _fixed;
+    //内存区只追加不删除，释放内存时无锁查找
+    slab_arena _arenas[JIMI_SLAB_MAX_ARENAS];
+    int _arena_count;
+    //整页空闲后归还的页
+    slab_page *_free_pages;
+    uint32_t _free_page_count;
+    slab_class _classes[JIMI_SLAB_CLASS_COUNT];
+    uint64_t _fallback_allocs;
+    uint64_t _fallback_frees;
+    //每次启用停用都会改变，线程本地缓存据此判断是否过期
+    uint32_t _generation;
+} s_slab;
+
+//大小(按8字节向上取整)到规格的映射
+static int8_t s_size_class[SLAB_MAX_BLOCK / 8 + 1];
+//使用平台互斥锁，持有锁的线程被抢占时其他线程睡眠等待而不是空转
+#ifdef __alios__
+static aos_mutex_t s_slab_mutex;
+static int s_slab_mutex_ready = 0;
+static char s_slab_mutex_init = 0;
+
+static void slab_lock(){
+    if(!__atomic_load_n(&s_slab_mutex_ready,__ATOMIC_ACQUIRE)){
+        //aos互斥锁没有静态初始化方式，第一次使用时创建
+        while(__atomic_test_and_set(&s_slab_mutex_init,__ATOMIC_ACQUIRE)){
+            aos_msleep(1);
+        }
+        if(!s_slab_mutex_ready){
+            aos_mutex_new(&s_slab_mutex);
+            __atomic_store_n(&s_slab_mutex_ready,1,__ATOMIC_RELEASE);
+        }
+        __atomic_clear(&s_slab_mutex_init,__ATOMIC_RELEASE);
+    }
+    aos_mutex_lock(&s_slab_mutex,AOS_WAIT_FOREVER);
+}
+
+static void slab_unlock(){
+    aos_mutex_unlock(&s_slab_mutex);
+}
+#else
+static pthread_mutex_t s_slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void slab_lock(){
+    pthread_mutex_lock(&s_slab_mutex);
+}
+
+static void slab_unlock(){
+    pthread_mutex_unlock(&s_slab_mutex);
+}
+#endif
+
+static inline int slab_class_of(int size){
+    return s_size_class[(size + 7) >> 3];
+}
+
+/**
+ * 查找内存所属的页，不属于slab时返回NULL
+ */
+static slab_page *slab_find_page(void *ptr){
+    int count = __atomic_load_n(&s_slab._arena_count,__ATOMIC_ACQUIRE);
+    int i;
+    for(i = 0 ; i < count ; ++i){
+        slab_arena *arena = &s_slab._arenas[i];
+        if((char *)ptr >= arena->_base && (char *)ptr < arena->_base + (size_t)arena->_pages * JIMI_SLAB_PAGE_SIZE){
+            return (slab_page *)(arena->_base + ((char *)ptr - arena->_base) / JIMI_SLAB_PAGE_SIZE * JIMI_SLAB_PAGE_SIZE);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 获取一个空闲页，需要加锁
+ */
+static slab_page *slab_new_page(){
+    slab_page *page = s_slab._free_pages;
+    int i;
+    if(page){
+        s_slab._free_pages = page->_next;
+        --s_slab._free_page_count;
+        return page;
+    }
+    for(i = 0 ; i < s_slab._arena_count ; ++i){
+        slab_arena *arena = &s_slab._arenas[i];
+        if(arena->_next_page < arena->_pages){
+            return (slab_page *)(arena->_base + (size_t)(arena->_next_page++) * JIMI_SLAB_PAGE_SIZE);
+        }
+    }
+    if(s_slab._fixed || s_slab._arena_count == JIMI_SLAB_MAX_ARENAS){
+        return NULL;
+    }
+    //内存区直接从系统开辟，jimi_malloc已经被slab接管
+    char *base = (char *)malloc((size_t)JIMI_SLAB_ARENA_PAGES * JIMI_SLAB_PAGE_SIZE);
+    if(!base){
+        return NULL;
+    }
+    slab_arena *arena = &s_slab._arenas[s_slab._arena_count];
+    arena->_base = base;
+    arena->_pages = JIMI_SLAB_ARENA_PAGES;
+    arena->_next_page = 1;
+    //先写入内存区再发布个数，释放内存时无锁读取
+    __atomic_store_n(&s_slab._arena_count,s_slab._arena_count + 1,__ATOMIC_RELEASE);
+    return (slab_page *)base;
+}
+
+static void slab_list_remove(slab_class *cls,slab_page *page){
+    if(page->_prev){
+        page->_prev->_next = page->_next;
+    }else{
+        cls->_partial = page->_next;
+    }
+    if(page->_next){
+        page->_next->_prev = page->_prev;
+    }
+    page->_next = page->_prev = NULL;
+}
+
+static void slab_list_push(slab_class *cls,slab_page *page){
+    page->_prev = NULL;
+    page->_next = cls->_partial;
+    if(cls->_partial){
+        cls->_partial->_prev = page;
+    }
+    cls->_partial = page;
+}
+
+/**
+ * 分配一块指定规格的内存，需要加锁
+ */
+static void *slab_alloc_locked(int index){
+    slab_class *cls = &s_slab._classes[index];
+    slab_page *page = cls->_partial;
+    if(!page){
+        page = slab_new_page();
+        if(!page){
+            return NULL;
+        }
+        //把整页切分成块串成空闲链表
+        uint32_t size = s_class_size[index];
+        uint32_t count = SLAB_BLOCKS(index);
+        char *block = (char *)page + SLAB_PAGE_HEAD;
+        uint32_t i;
+        for(i = 0 ; i + 1 < count ; ++i){
+            *(void **)(block + i * size) = block + (i + 1) * size;
+        }
+        *(void **)(block + i * size) = NULL;
+        page->_free = block;
+        page->_class = (int16_t)index;
+        page->_used = 0;
+        slab_list_push(cls,page);
+        ++cls->_pages;
+        cls->_total += count;
+    }
+
+    void *ptr = page->_free;
+    page->_free = *(void **)ptr;
+    ++page->_used;
+    ++cls->_used;
+    if(!page->_free){
+        //页已满
+        slab_list_remove(cls,page);
+    }
+    return ptr;
+}
+
+/**
+ * 释放一块内存，需要加锁
+ */
+static void slab_free_locked(slab_page *page,void *ptr){
+    slab_class *cls = &s_slab._classes[page->_class];
+    if(!page->_free){
+        //页之前是满的
+        slab_list_push(cls,page);
+    }
+    *(void **)ptr = page->_free;
+    page->_free = ptr;
+    --page->_used;
+    --cls->_used;
+    if(!page->_used && (page->_next || page->_prev)){
+        //整页空闲并且该规格还有其他可用页，归还页池供其他规格使用
+        slab_list_remove(cls,page);
+        --cls->_pages;
+        cls->_total -= SLAB_BLOCKS(page->_class);
+        page->_class = -1;
+        page->_next = s_slab._free_pages;
+        s_slab._free_pages = page;
+        ++s_slab._free_page_count;
+    }
+}
+
+#ifdef SLAB_ENABLE_THREAD_CACHE
+/**
+ * 线程本地缓存，块的头部保存下一个缓存块地址
+ */
+typedef struct {
+    void *_blocks[JIMI_SLAB_CLASS_COUNT];
+    uint16_t _count[JIMI_SLAB_CLASS_COUNT];
+    uint32_t _generation;
+    int _registered;
+} slab_cache;
+
+static __thread slab_cache s_cache;
+static pthread_key_t s_cache_key;
+static int s_cache_key_created = 0;
+
+static void slab_cache_flush(slab_cache *cache){
+    int i;
+    slab_lock();
+    if(cache->_generation == s_slab._generation && s_slab._enabled){
+        for(i = 0 ; i < JIMI_SLAB_CLASS_COUNT ; ++i){
+            while(cache->_blocks[i]){
+                void *ptr = cache->_blocks[i];
+                cache->_blocks[i] = *(void **)ptr;
+                slab_free_locked(slab_find_page(ptr),ptr);
+            }
+        }
+    }
+    slab_unlock();
+    memset(cache->_blocks,0, sizeof(cache->_blocks));
+    memset(cache->_count,0, sizeof(cache->_count));
+}
+
+static void slab_cache_destructor(void *arg){
+    slab_cache_flush((slab_cache *)arg);
+}
+
+static slab_cache *slab_thread_cache(){
+    slab_cache *cache = &s_cache;
+    uint32_t generation = __atomic_load_n(&s_slab._generation,__ATOMIC_ACQUIRE);
+    if(cache->_generation != generation){
+        //slab重新启用过，旧的缓存已经失效
+        memset(cache->_blocks,0, sizeof(cache->_blocks));
+        memset(cache->_count,0, sizeof(cache->_count));
+        cache->_generation = generation;
+    }
+    if(!cache->_registered){
+        //注册后线程退出时自动归还缓存
+        pthread_setspecific(s_cache_key,cache);
+        cache->_registered = 1;
+    }
+    return cache;
+}
+
+static void *slab_cache_alloc(int index){
+    slab_cache *cache = slab_thread_cache();
+    if(!cache->_count[index]){
+        //批量从页中取出
+        slab_lock();
+        while(cache->_count[index] < SLAB_CACHE_BATCH){
+            void *ptr = slab_alloc_locked(index);
+            if(!ptr){
+                break;
+            }
+            *(void **)ptr = cache->_blocks[index];
+            cache->_blocks[index] = ptr;
+            ++cache->_count[index];
+        }
+        slab_unlock();
+        if(!cache->_count[index]){
+            return NULL;
+        }
+    }
+    void *ptr = cache->_blocks[index];
+    cache->_blocks[index] = *(void **)ptr;
+    --cache->_count[index];
+    return ptr;
+}
+
+static void slab_cache_free(slab_page *page,void *ptr){
+    slab_cache *cache = slab_thread_cache();
+    int index = page->_class;
+    *(void **)ptr = cache->_blocks[index];
+    cache->_blocks[index] = ptr;
+    if(++cache->_count[index] <= SLAB_CACHE_MAX){
+        return;
+    }
+    //缓存已满，批量归还
+    slab_lock();
+    while(cache->_count[index] > SLAB_CACHE_MAX - SLAB_CACHE_BATCH){
+        ptr = cache->_blocks[index];
+        cache->_blocks[index] = *(void **)ptr;
+        --cache->_count[index];
+        slab_free_locked(slab_find_page(ptr),ptr);
+    }
+    slab_unlock();
+}
+#endif //SLAB_ENABLE_THREAD_CACHE
+
+/**
+ * 累加回退到系统malloc的次数
+ * 64位原子操作需要库函数支持的平台(例如32位Cortex-M的裸机libgcc不提供__atomic_fetch_add_8)，在锁内累加
+ */
+static void slab_count_fallback(uint64_t *counter){
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+    __atomic_add_fetch(counter,1,__ATOMIC_RELAXED);
+#else
+    slab_lock();
+    ++*counter;
+    slab_unlock();
+#endif
+}
+
+static void *slab_malloc(int size){
+    void *ptr = NULL;
+    if(size > 0 && size <= SLAB_MAX_BLOCK){
+        int index = slab_class_of(size);
+#ifdef SLAB_ENABLE_THREAD_CACHE
+        if(s_slab._flags & JIMI_SLAB_THREAD_CACHE){
+            ptr = slab_cache_alloc(index);
+        }else
+#endif
+        {
+            slab_lock();
+            ptr = slab_alloc_locked(index);
+            slab_unlock();
+        }
+        if(ptr){
+            return ptr;
+        }
+    }
+    //超过最大规格或者slab内存耗尽
+    slab_count_fallback(&s_slab._fallback_allocs);
+    return malloc(size);
+}
+
+static void slab_free(void *ptr){
+    slab_page *page = slab_find_page(ptr);
+    if(!page){
+        //系统malloc开辟的内存，包括启用slab之前开辟的内存
+        slab_count_fallback(&s_slab._fallback_frees);
+        free(ptr);
+        return;
+    }
+#ifdef SLAB_ENABLE_THREAD_CACHE
+    if(s_slab._flags & JIMI_SLAB_THREAD_CACHE){
+        slab_cache_free(page,ptr);
+        return;
+    }
+#endif
+    slab_lock();
+    slab_free_locked(page,ptr);
+    slab_unlock();
+}
+
+static void *slab_realloc(void *ptr,int size){
+    slab_page *page = slab_find_page(ptr);
+    if(!page){
+        return realloc(ptr,size);
+    }
+    uint32_t old_size = s_class_size[page->_class];
+    if((uint32_t)size <= old_size){
+        //当前规格放得下
+        return ptr;
+    }
+    void *ret = slab_malloc(size);
+    if(!ret){
+        return NULL;
+    }
+    memcpy(ret,ptr,old_size);
+    slab_free(ptr);
+    return ret;
+}
+
+static char *slab_strdup(const char *str){
+    int len = strlen(str) + 1;
+    char *ret = (char *)slab_malloc(len);
+    if(ret){
+        memcpy(ret,str,len);
+    }
+    return ret;
+}
+
+int jimi_slab_init(void *arena,int arena_size,int flags){
+    int i,size;
+    if(s_slab._enabled){
+        LOGW("slab allocator already enabled");
+        return -1;
+    }
+    if(arena){
+        //固定内存按8字节对齐
+        int offset = (int)((8 - ((uintptr_t)arena & 7)) & 7);
+        arena = (char *)arena + offset;
+        arena_size -= offset;
+        if(arena_size / JIMI_SLAB_PAGE_SIZE <= 0){
+            LOGE("arena too small:%d",arena_size);
+            return -1;
+        }
+    }
+
+    for(i = 0 , size = 0 ; size <= SLAB_MAX_BLOCK ; size += 8){
+        while(s_class_size[i] < (uint32_t)size){
+            ++i;
+        }
+        s_size_class[size >> 3] = (int8_t)i;
+    }
+
+    slab_lock();
+    uint32_t generation = s_slab._generation;
+    memset(&s_slab,0, sizeof(s_slab));
+    s_slab._generation = generation + 1;
+    s_slab._flags = flags;
+    if(arena){
+        s_slab._fixed = 1;
+        s_slab._arenas[0]._base = (char *)arena;
+        s_slab._arenas[0]._pages = arena_size / JIMI_SLAB_PAGE_SIZE;
+        s_slab._arena_count = 1;
+    }
+#ifdef SLAB_ENABLE_THREAD_CACHE
+    if((flags & JIMI_SLAB_THREAD_CACHE) && !s_cache_key_created){
+        if(0 != pthread_key_create(&s_cache_key,slab_cache_destructor)){
+            LOGW("pthread_key_create failed, thread cache disabled");
+            s_slab._flags &= ~JIMI_SLAB_THREAD_CACHE;
+        }else{
+            s_cache_key_created = 1;
+        }
+    }
+#else
+    s_slab._flags &= ~JIMI_SLAB_THREAD_CACHE;
+#endif
+    s_slab._enabled = 1;
+    slab_unlock();
+
+    set_malloc_ptr(slab_malloc);
+    set_free_ptr(slab_free);
+    set_realloc_ptr(slab_realloc);
+    set_strdup_ptr(slab_strdup);
+    return 0;
+}
+
+int jimi_slab_release(){
+    int i;
+    if(!s_slab._enabled){
+        return -1;
+    }
+    set_malloc_ptr(NULL);
+    set_free_ptr(NULL);
+    set_realloc_ptr(NULL);
+    set_strdup_ptr(NULL);
+    jimi_slab_thread_flush();
+
+    slab_lock();
+    for(i = 0 ; i < s_slab._arena_count ; ++i){
+        if(!s_slab._fixed){
+            free(s_slab._arenas[i]._base);
+        }
+    }
+    uint32_t generation = s_slab._generation;
+    memset(&s_slab,0, sizeof(s_slab));
+    __atomic_store_n(&s_slab._generation,generation + 1,__ATOMIC_RELEASE);
+    slab_unlock();
+    return 0;
+}
+
+void jimi_slab_thread_flush(){
+#ifdef SLAB_ENABLE_THREAD_CACHE
+    if(s_slab._flags & JIMI_SLAB_THREAD_CACHE){
+        slab_cache_flush(&s_cache);
+    }
+#endif
+}
+
+int jimi_slab_get_stats(jimi_slab_stats *stats){
+    int i;
+    CHECK_PTR(stats,-1);
+    memset(stats,0, sizeof(jimi_slab_stats));
+    slab_lock();
+    if(!s_slab._enabled){
+        slab_unlock();
+        return -1;
+    }
+    for(i = 0 ; i < JIMI_SLAB_CLASS_COUNT ; ++i){
+        stats->_classes[i]._block_size = s_class_size[i];
+        stats->_classes[i]._pages = s_slab._classes[i]._pages;
+        stats->_classes[i]._used = s_slab._classes[i]._used;
+        stats->_classes[i]._total = s_slab._classes[i]._total;
+    }
+    stats->_page_size = JIMI_SLAB_PAGE_SIZE;
+    stats->_pages_free = s_slab._free_page_count;
+    for(i = 0 ; i < s_slab._arena_count ; ++i){
+        stats->_pages_total += s_slab._arenas[i]._pages;
+        stats->_pages_free += s_slab._arenas[i]._pages - s_slab._arenas[i]._next_page;
+    }
+    stats->_arenas = s_slab._arena_count;
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+    stats->_fallback_allocs = __atomic_load_n(&s_slab._fallback_allocs,__ATOMIC_RELAXED);
+    stats->_fallback_frees = __atomic_load_n(&s_slab._fallback_frees,__ATOMIC_RELAXED);
+#else
+    //已经持有锁，计数只在锁内修改
+    stats->_fallback_allocs = s_slab._fallback_allocs;
+    stats->_fallback_frees = s_slab._fallback_frees;
+#endif
+    slab_unlock();
+    return 0;
+}
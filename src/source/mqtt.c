@@ -10,6 +10,9 @@ v2.0 2016/4/19
 #include <stdio.h>
 #include "jimi_memory.h"
 
+//服务端响应包在栈上打包的内存大小(以指针个数计)，放不下时才开辟堆内存
+#define MQTT_RESPONSE_STORAGE 16
+
 
 static const char Mqtt_TrailingBytesForUTF8[256] = {
     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
@@ -50,6 +53,36 @@ static int Mqtt_PackPubRelPkt(struct MqttBuffer *buf, uint16_t pkt_id);
  * @return 成功返回MQTTERR_NOERROR
  */
 static int Mqtt_PackPubCompPkt(struct MqttBuffer *buf, uint16_t pkt_id);
+/**
+ * 封装连接确认数据包
+ * @param buf 存储数据包的缓冲区对象
+ * @param flags 连接确认标志 @see MqttConnAckFlag
+ * @param ret_code 连接返回码 @see MqttRetCode
+ * @return 成功返回MQTTERR_NOERROR
+ */
+static int Mqtt_PackConnAckPkt(struct MqttBuffer *buf, char flags, char ret_code);
+/**
+ * 封装订阅确认数据包
+ * @param buf 存储数据包的缓冲区对象
+ * @param pkt_id 被确认的订阅数据包的ID
+ * @param codes 按顺序对应订阅数据包中每个Topic的返回码
+ * @param count codes的个数
+ * @return 成功返回MQTTERR_NOERROR
+ */
+static int Mqtt_PackSubAckPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *codes, uint32_t count);
+/**
+ * 封装取消订阅确认数据包
+ * @param buf 存储数据包的缓冲区对象
+ * @param pkt_id 被确认的取消订阅数据包的ID
+ * @return 成功返回MQTTERR_NOERROR
+ */
+static int Mqtt_PackUnsubAckPkt(struct MqttBuffer *buf, uint16_t pkt_id);
+/**
+ * 封装ping响应数据包
+ * @param buf 存储数据包的缓冲区对象
+ * @return 成功返回MQTTERR_NOERROR
+ */
+static int Mqtt_PackPingRespPkt(struct MqttBuffer *buf);
 
 uint16_t Mqtt_RB16(const char *v)
 {
@@ -226,7 +259,7 @@ static int Mqtt_CheckUtf8(const char *str, size_t len)
 int Mqtt_HandlePingResp(struct MqttContext *ctx, char flags,
                                char *pkt, size_t size)
 {
-    if((0 != flags) || (0 != size)) {
+    if((NULL == ctx->handle_ping_resp) || (0 != flags) || (0 != size)) {
         return MQTTERR_ILLEGAL_PKT;
     }
 
@@ -238,7 +271,7 @@ int Mqtt_HandleConnAck(struct MqttContext *ctx, char flags,
 {
     char ack_flags, ret_code;
 
-    if((0 != flags) || (2 != size)) {
+    if((NULL == ctx->handle_conn_ack) || (0 != flags) || (2 != size)) {
         return MQTTERR_ILLEGAL_PKT;
     }
 
@@ -252,6 +285,26 @@ int Mqtt_HandleConnAck(struct MqttContext *ctx, char flags,
     return ctx->handle_conn_ack(ctx->user_data, ack_flags, ret_code);
 }
 
+/**
+ * 发送SDK自动回复的响应包，buf由本函数销毁
+ * @param err 打包结果，不是MQTTERR_NOERROR时不发送，直接返回
+ */
+static int Mqtt_SendResponse(struct MqttContext *ctx, struct MqttBuffer *response, int err)
+{
+    if(MQTTERR_NOERROR == err) {
+        if(NULL != ctx->send_response) {
+            if(ctx->send_response(ctx->user_data, response) < 0) {
+                err = MQTTERR_FAILED_SEND_RESPONSE;
+            }
+        }
+        else if(Mqtt_SendPkt(ctx, response, 0) != response->buffered_bytes) {
+            err = MQTTERR_FAILED_SEND_RESPONSE;
+        }
+    }
+    MqttBuffer_Destroy(response);
+    return err;
+}
+
 static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
                               char *pkt, size_t size)
 {
@@ -322,12 +375,17 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
 
     err = ctx->handle_publish(ctx->user_data, pkt_id, topic,
                               payload, payload_len, dup,
-                              (enum MqttQosLevel)qos);
+                              (enum MqttQosLevel)qos, retain);
+    if(err > 0) {
+        // the handler drops the message, no response.
+        return MQTTERR_NOERROR;
+    }
 
     // send the publish response.
     if(err >= 0) {
         struct MqttBuffer response[1];
-        MqttBuffer_Init(response);
+        void *storage[MQTT_RESPONSE_STORAGE];
+        MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
 
         switch(qos) {
         case MQTT_QOS_LEVEL2:
@@ -344,16 +402,15 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
             break;
         }
 
-        if((MQTTERR_NOERROR == err) && (MQTT_QOS_LEVEL0 != qos)) {
-            if(Mqtt_SendPkt(ctx, response, 0) != response->buffered_bytes) {
+        if(MQTT_QOS_LEVEL0 != qos) {
+            err = Mqtt_SendResponse(ctx, response, err);
+            if(MQTTERR_NOERROR != err) {
                 err = MQTTERR_FAILED_SEND_RESPONSE;
             }
         }
-        else if(MQTT_QOS_LEVEL0 != qos){
-            err = MQTTERR_FAILED_SEND_RESPONSE;
+        else {
+            MqttBuffer_Destroy(response);
         }
-
-        MqttBuffer_Destroy(response);
     }
 
     return err;
@@ -394,16 +451,10 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
     err = ctx->handle_pub_rec(ctx->user_data, pkt_id);
     if(err >= 0) {
         struct MqttBuffer response[1];
-        MqttBuffer_Init(response);
+        void *storage[MQTT_RESPONSE_STORAGE];
+        MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
 
-        err = Mqtt_PackPubRelPkt(response, pkt_id);
-        if(MQTTERR_NOERROR == err) {
-            if(Mqtt_SendPkt(ctx, response, 0) != response->buffered_bytes) {
-                err = MQTTERR_FAILED_SEND_RESPONSE;
-            }
-        }
-
-        MqttBuffer_Destroy(response);
+        err = Mqtt_SendResponse(ctx, response, Mqtt_PackPubRelPkt(response, pkt_id));
     }
 
     return err;
@@ -427,14 +478,9 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
     err = ctx->handle_pub_rel(ctx->user_data, pkt_id);
     if(err >= 0) {
         struct MqttBuffer response[1];
-        MqttBuffer_Init(response);
-        err = Mqtt_PackPubCompPkt(response, pkt_id);
-        if(MQTTERR_NOERROR == err) {
-            if(Mqtt_SendPkt(ctx, response, 0) != response->buffered_bytes) {
-                err = MQTTERR_FAILED_SEND_RESPONSE;
-            }
-        }
-        MqttBuffer_Destroy(response);
+        void *storage[MQTT_RESPONSE_STORAGE];
+        MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
+        err = Mqtt_SendResponse(ctx, response, Mqtt_PackPubCompPkt(response, pkt_id));
     }
 
     return err;
@@ -463,7 +509,7 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
     uint16_t pkt_id;
     char *code;
 
-    if((0 != flags) || (size < 2)) {
+    if((NULL == ctx->handle_sub_ack) || (0 != flags) || (size < 2)) {
         return MQTTERR_ILLEGAL_PKT;
     }
 
@@ -486,7 +532,7 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
 {
     uint16_t pkt_id;
 
-    if((0 != flags) || (2 != size)) {
+    if((NULL == ctx->handle_unsub_ack) || (0 != flags) || (2 != size)) {
         return MQTTERR_ILLEGAL_PKT;
     }
 
@@ -498,6 +544,240 @@ static int Mqtt_HandlePublish(struct MqttContext *ctx, char flags,
     return ctx->handle_unsub_ack(ctx->user_data, pkt_id);
 }
 
+/**
+ * 读取以两字节长度开头的字符串，字符串被前移两个字节(覆盖长度字段)后以'\0'结尾
+ * @param cursor 读取位置，成功后指向字符串之后
+ * @param end 数据末尾
+ * @param len 返回字符串长度，可以为NULL
+ * @return 字符串，数据不够时返回NULL
+ */
+static char *Mqtt_ReadString(char **cursor, char *end, uint16_t *len)
+{
+    char *str = *cursor;
+    uint16_t str_len;
+
+    if(end - str < 2) {
+        return NULL;
+    }
+
+    str_len = Mqtt_RB16(str);
+    if(end - str - 2 < str_len) {
+        return NULL;
+    }
+
+    memmove(str, str + 2, str_len);
+    str[str_len] = '\0';
+    *cursor = str + 2 + str_len;
+    if(len) {
+        *len = str_len;
+    }
+    return str;
+}
+
+static int Mqtt_HandleConnect(struct MqttContext *ctx, char flags,
+                              char *pkt, size_t size)
+{
+    char *cursor = pkt, *end = pkt + size;
+    char *protocol, *client_id;
+    char *will_topic = NULL, *will_msg = NULL, *user = NULL, *password = NULL;
+    uint16_t id_len, will_len = 0, pswd_len = 0;
+    uint8_t level, connect_flags, will_qos;
+    uint16_t keep_alive;
+    int ret_code;
+    struct MqttBuffer response[1];
+    void *storage[MQTT_RESPONSE_STORAGE];
+
+    if((NULL == ctx->handle_connect) || (0 != flags)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    protocol = Mqtt_ReadString(&cursor, end, NULL);
+    if((NULL == protocol) || (end - cursor < 4)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    if(strcmp(protocol, "MQTT") && strcmp(protocol, "MQIsdp")) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    level = (uint8_t)cursor[0];
+    connect_flags = (uint8_t)cursor[1];
+    keep_alive = Mqtt_RB16(cursor + 2);
+    cursor += 4;
+
+    will_qos = (connect_flags >> 3) & 0x03;
+    if((connect_flags & 0x01) || (will_qos > MQTT_QOS_LEVEL2)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    client_id = Mqtt_ReadString(&cursor, end, &id_len);
+    if((NULL == client_id) || (Mqtt_CheckUtf8(client_id, id_len) != id_len)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    if(connect_flags & MQTT_CONNECT_WILL_FLAG) {
+        will_topic = Mqtt_ReadString(&cursor, end, NULL);
+        will_msg = Mqtt_ReadString(&cursor, end, &will_len);
+        if((NULL == will_topic) || (NULL == will_msg)) {
+            return MQTTERR_ILLEGAL_PKT;
+        }
+    }
+    else if(connect_flags & (MQTT_CONNECT_WILL_QOS1 | MQTT_CONNECT_WILL_QOS2 | MQTT_CONNECT_WILL_RETAIN)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    if(connect_flags & MQTT_CONNECT_USER_NAME) {
+        user = Mqtt_ReadString(&cursor, end, NULL);
+        if(NULL == user) {
+            return MQTTERR_ILLEGAL_PKT;
+        }
+    }
+
+    if(connect_flags & MQTT_CONNECT_PASSORD) {
+        password = Mqtt_ReadString(&cursor, end, &pswd_len);
+        if(NULL == password) {
+            return MQTTERR_ILLEGAL_PKT;
+        }
+    }
+
+    if(cursor != end) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    // 3: MQTT 3.1, 4: MQTT 3.1.1
+    if((3 != level) && (4 != level)) {
+        ret_code = MQTT_CONNACK_UNACCEPTABLE_PRO_VERSION;
+    }
+    else {
+        ret_code = ctx->handle_connect(ctx->user_data, client_id, keep_alive,
+                                       connect_flags & MQTT_CONNECT_CLEAN_SESSION ? 1 : 0,
+                                       will_topic, will_msg, will_len,
+                                       (enum MqttQosLevel)will_qos,
+                                       connect_flags & MQTT_CONNECT_WILL_RETAIN ? 1 : 0,
+                                       user, password, pswd_len);
+        if(ret_code < 0) {
+            return ret_code;
+        }
+    }
+
+    MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
+    return Mqtt_SendResponse(ctx, response, Mqtt_PackConnAckPkt(response, 0, (char)ret_code));
+}
+
+static int Mqtt_HandleSubscribe(struct MqttContext *ctx, char flags,
+                                char *pkt, size_t size)
+{
+    char *cursor, *end = pkt + size;
+    char *topic;
+    uint16_t pkt_id, topic_len;
+    uint8_t qos;
+    uint32_t count = 0;
+    int code;
+    struct MqttBuffer response[1];
+    void *storage[MQTT_RESPONSE_STORAGE];
+
+    if((NULL == ctx->handle_subscribe) || (2 != flags) || (size < 2)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    pkt_id = Mqtt_RB16(pkt);
+    if(0 == pkt_id) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    // each topic filter takes at least 4 bytes, so the return codes
+    // can be stored in place right after the packet identifier.
+    for(cursor = pkt + 2; cursor < end; ++count) {
+        topic = Mqtt_ReadString(&cursor, end, &topic_len);
+        if((NULL == topic) || (0 == topic_len) || (cursor >= end)) {
+            return MQTTERR_ILLEGAL_PKT;
+        }
+
+        qos = (uint8_t)*cursor++;
+        if((qos > MQTT_QOS_LEVEL2) || (Mqtt_CheckUtf8(topic, topic_len) != topic_len)) {
+            return MQTTERR_ILLEGAL_PKT;
+        }
+
+        code = ctx->handle_subscribe(ctx->user_data, pkt_id, topic, (enum MqttQosLevel)qos);
+        if(code < 0) {
+            return code;
+        }
+        pkt[2 + count] = (char)code;
+    }
+
+    if(0 == count) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
+    return Mqtt_SendResponse(ctx, response, Mqtt_PackSubAckPkt(response, pkt_id, pkt + 2, count));
+}
+
+static int Mqtt_HandleUnsubscribe(struct MqttContext *ctx, char flags,
+                                  char *pkt, size_t size)
+{
+    char *cursor, *end = pkt + size;
+    char *topic;
+    uint16_t pkt_id, topic_len;
+    int err;
+    struct MqttBuffer response[1];
+    void *storage[MQTT_RESPONSE_STORAGE];
+
+    if((NULL == ctx->handle_unsubscribe) || (2 != flags) || (size < 4)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    pkt_id = Mqtt_RB16(pkt);
+    if(0 == pkt_id) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    for(cursor = pkt + 2; cursor < end;) {
+        topic = Mqtt_ReadString(&cursor, end, &topic_len);
+        if((NULL == topic) || (0 == topic_len) || (Mqtt_CheckUtf8(topic, topic_len) != topic_len)) {
+            return MQTTERR_ILLEGAL_PKT;
+        }
+
+        err = ctx->handle_unsubscribe(ctx->user_data, pkt_id, topic);
+        if(err < 0) {
+            return err;
+        }
+    }
+
+    MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
+    return Mqtt_SendResponse(ctx, response, Mqtt_PackUnsubAckPkt(response, pkt_id));
+}
+
+static int Mqtt_HandlePingReq(struct MqttContext *ctx, char flags,
+                              char *pkt, size_t size)
+{
+    int err;
+    struct MqttBuffer response[1];
+    void *storage[MQTT_RESPONSE_STORAGE];
+
+    if((NULL == ctx->handle_ping_req) || (0 != flags) || (0 != size)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    err = ctx->handle_ping_req(ctx->user_data);
+    if(err < 0) {
+        return err;
+    }
+
+    MqttBuffer_InitWithStorage(response, storage, sizeof(storage));
+    return Mqtt_SendResponse(ctx, response, Mqtt_PackPingRespPkt(response));
+}
+
+static int Mqtt_HandleDisconnect(struct MqttContext *ctx, char flags,
+                                 char *pkt, size_t size)
+{
+    if((NULL == ctx->handle_disconnect) || (0 != flags) || (0 != size)) {
+        return MQTTERR_ILLEGAL_PKT;
+    }
+
+    return ctx->handle_disconnect(ctx->user_data);
+}
+
 static int Mqtt_Dispatch(struct MqttContext *ctx, char fh,  char *pkt, size_t size)
 {
     const char flags = fh & 0x0F;
@@ -530,6 +810,21 @@ static int Mqtt_Dispatch(struct MqttContext *ctx, char fh,  char *pkt, size_t si
     case MQTT_PKT_UNSUBACK:
         return Mqtt_HandleUnsubAck(ctx, flags, pkt, size);
 
+    case MQTT_PKT_CONNECT:
+        return Mqtt_HandleConnect(ctx, flags, pkt, size);
+
+    case MQTT_PKT_SUBSCRIBE:
+        return Mqtt_HandleSubscribe(ctx, flags, pkt, size);
+
+    case MQTT_PKT_UNSUBSCRIBE:
+        return Mqtt_HandleUnsubscribe(ctx, flags, pkt, size);
+
+    case MQTT_PKT_PINGREQ:
+        return Mqtt_HandlePingReq(ctx, flags, pkt, size);
+
+    case MQTT_PKT_DISCONNECT:
+        return Mqtt_HandleDisconnect(ctx, flags, pkt, size);
+
     default:
         break;
     }
@@ -577,57 +872,195 @@ int Mqtt_RecvPkt(struct MqttContext *ctx,char *data,int bytes,int *customed) {
     return ret;
 }
 
+//解析器缓存超过此大小时，处理完数据包后释放，避免长期占用大块内存
+static const uint32_t MQTT_PARSER_KEEP_SIZE = 4096;
+
+void MqttParser_Init(struct MqttParser *parser)
+{
+    memset(parser, 0, sizeof(struct MqttParser));
+    parser->state = MQTT_PARSE_FIXED_HEADER;
+}
+
+void MqttParser_Destroy(struct MqttParser *parser)
+{
+    jimi_free(parser->body);
+    MqttParser_Init(parser);
+}
+
+void MqttParser_Reset(struct MqttParser *parser)
+{
+    parser->state = MQTT_PARSE_FIXED_HEADER;
+    parser->remaining_len = 0;
+    parser->multiplier = 0;
+    parser->body_len = 0;
+}
+
+int MqttParser_Pending(const struct MqttParser *parser)
+{
+    return MQTT_PARSE_FIXED_HEADER != parser->state;
+}
+
+/**
+ * 按数据包大小一次性预留缓存，多预留一个字节给handle_publish写'\0'
+ */
+static int MqttParser_Reserve(struct MqttParser *parser)
+{
+    uint32_t bytes = parser->remaining_len + 1;
+    if(parser->body_capacity >= bytes) {
+        return MQTTERR_NOERROR;
+    }
+
+    jimi_free(parser->body);
+    parser->body = (char*)jimi_malloc(bytes);
+    if(!parser->body) {
+        parser->body_capacity = 0;
+        return MQTTERR_OUTOFMEMORY;
+    }
+    parser->body_capacity = bytes;
+    return MQTTERR_NOERROR;
+}
+
+/**
+ * 缓存中的数据包已经完整，处理之
+ */
+static int MqttParser_Complete(struct MqttContext *ctx, struct MqttParser *parser)
+{
+    int ret = Mqtt_Dispatch(ctx, parser->fixed_header, parser->body, parser->remaining_len);
+    MqttParser_Reset(parser);
+    if(parser->body_capacity > MQTT_PARSER_KEEP_SIZE) {
+        jimi_free(parser->body);
+        parser->body = NULL;
+        parser->body_capacity = 0;
+    }
+    return ret;
+}
+
+int Mqtt_ParsePkt(struct MqttContext *ctx,struct MqttParser *parser,char *data,int len)
+{
+    char *cursor = data, *end = data + len;
+    uint32_t bytes;
+    int customed;
+    int ret;
+
+    while(cursor < end) {
+        switch(parser->state) {
+        case MQTT_PARSE_FIXED_HEADER:
+            //没有缓存数据时，完整的数据包直接在调用者的内存中处理
+            ret = Mqtt_RecvPkt(ctx, cursor, end - cursor, &customed);
+            if(MQTTERR_NOERROR != ret) {
+                MqttParser_Reset(parser);
+                return ret;
+            }
+            cursor += customed;
+            if(cursor == end) {
+                break;
+            }
+
+            parser->fixed_header = *cursor++;
+            parser->remaining_len = 0;
+            parser->multiplier = 1;
+            parser->state = MQTT_PARSE_LENGTH;
+            break;
+
+        case MQTT_PARSE_LENGTH:
+            parser->remaining_len += (((uint8_t)*cursor) & 0x7f) * parser->multiplier;
+            if(((uint8_t)*cursor++) & 0x80) {
+                parser->multiplier *= 128;
+                if(parser->multiplier >= 128 * 128 * 128) {
+                    MqttParser_Reset(parser);
+                    return MQTTERR_ILLEGAL_PKT;
+                }
+                break;
+            }
+
+            ret = MqttParser_Reserve(parser);
+            if(MQTTERR_NOERROR != ret) {
+                MqttParser_Reset(parser);
+                return ret;
+            }
+            parser->body_len = 0;
+            parser->state = MQTT_PARSE_BODY;
+            if(0 == parser->remaining_len) {
+                ret = MqttParser_Complete(ctx, parser);
+                if(MQTTERR_NOERROR != ret) {
+                    return ret;
+                }
+            }
+            break;
+
+        case MQTT_PARSE_BODY:
+            bytes = parser->remaining_len - parser->body_len;
+            if(bytes > (uint32_t)(end - cursor)) {
+                bytes = end - cursor;
+            }
+            memcpy(parser->body + parser->body_len, cursor, bytes);
+            parser->body_len += bytes;
+            cursor += bytes;
+
+            if(parser->body_len == parser->remaining_len) {
+                ret = MqttParser_Complete(ctx, parser);
+                if(MQTTERR_NOERROR != ret) {
+                    return ret;
+                }
+            }
+            break;
+
+        default:
+            MqttParser_Reset(parser);
+            return MQTTERR_INTERNAL;
+        }
+    }
+
+    return MQTTERR_NOERROR;
+}
+
 int Mqtt_SendPkt(struct MqttContext *ctx, const struct MqttBuffer *buf, uint32_t offset)
 {
     const struct MqttExtent *cursor;
-    const struct MqttExtent *first_ext;
     uint32_t bytes;
-    int ext_count;
-    int i;
-    struct iovec *iov;
+    uint32_t skip;
+    uint32_t batch_bytes;
+    int total = 0;
+    int iovcnt;
+    int ret;
 
     if(offset >= buf->buffered_bytes) {
         return 0;
     }
 
+    //找到offset所在的数据块
     cursor = buf->first_ext;
     bytes = 0;
-    while(cursor && bytes < offset) {
+    while(cursor && bytes + cursor->len <= offset) {
         bytes += cursor->len;
         cursor = cursor->next;
     }
+    skip = offset - bytes;
+
+    while(cursor) {
+        iovcnt = 0;
+        batch_bytes = 0;
+        for(; cursor && iovcnt < MQTT_IOV_CACHE_SIZE; cursor = cursor->next) {
+            ctx->iov_cache[iovcnt].iov_base = cursor->payload + skip;
+            ctx->iov_cache[iovcnt].iov_len = cursor->len - skip;
+            batch_bytes += cursor->len - skip;
+            skip = 0;
+            ++iovcnt;
+        }
 
-    first_ext = cursor;
-    ext_count = 0;
-    for(; cursor; cursor = cursor->next) {
-        ++ext_count;
-    }
-
-    if(0 == ext_count) {
-        return 0;
-    }
-
-    assert(first_ext);
-
-    iov = (struct iovec*)jimi_malloc(sizeof(struct iovec) * ext_count);
-    if(!iov) {
-        return MQTTERR_OUTOFMEMORY;
-    }
-
-    iov[0].iov_base = first_ext->payload + (offset - bytes);
-    iov[0].iov_len = first_ext->len - (offset - bytes);
+        ret = ctx->writev_func(ctx->user_data, ctx->iov_cache, iovcnt);
+        if(ret < 0) {
+            return total ? total : ret;
+        }
 
-    i = 1;
-    for(cursor = first_ext->next; cursor; cursor = cursor->next) {
-        iov[i].iov_base = cursor->payload;
-        iov[i].iov_len = cursor->len;
-        ++i;
+        total += ret;
+        if((uint32_t)ret < batch_bytes) {
+            //发送缓冲区已满，剩余数据由调用者稍后继续发送
+            break;
+        }
     }
 
-    i = ctx->writev_func(ctx->user_data, iov, ext_count);
-    jimi_free(iov);
-
-    return i;
+    return total;
 }
 
 
@@ -784,16 +1217,16 @@ int Mqtt_PackConnectPkt(struct MqttBuffer *buf, uint16_t keep_alive, const char
 }
 
 
-int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *topic,
-                        const char *payload, uint32_t size,
-                        enum MqttQosLevel qos, int retain, int own)
+/**
+ * 封装发布数据数据包的固定头与可变头，负载由调用者随后添加
+ * @param size 负载大小（字节数）
+ */
+int Mqtt_CheckPublishParam(const char *topic, uint32_t size, enum MqttQosLevel qos)
 {
-    int ret;
     size_t topic_len, total_len;
-    struct MqttExtent *fix_head, *variable_head;
-    char *cursor;
+    char len_buf[4];
 
-    if(0 == pkt_id) {
+    if(NULL == topic) {
         return MQTTERR_INVALID_PARAMETER;
     }
 
@@ -807,6 +1240,43 @@ int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *top
         return MQTTERR_NOT_UTF8;
     }
 
+    total_len = topic_len + size + 2;
+    switch(qos) {
+    case MQTT_QOS_LEVEL0:
+        break;
+    case MQTT_QOS_LEVEL1:
+    case MQTT_QOS_LEVEL2:
+        total_len += 2;
+        break;
+    default:
+        return MQTTERR_INVALID_PARAMETER;
+    }
+
+    if(Mqtt_DumpLength(total_len, len_buf) < 0) {
+        return MQTTERR_PKT_TOO_LARGE;
+    }
+
+    return MQTTERR_NOERROR;
+}
+
+static int Mqtt_PackPublishHead(struct MqttBuffer *buf, uint16_t pkt_id, const char *topic,
+                                uint32_t size, enum MqttQosLevel qos, int retain)
+{
+    int ret;
+    size_t topic_len, total_len;
+    struct MqttExtent *fix_head, *variable_head;
+    char *cursor;
+
+    if(0 == pkt_id) {
+        return MQTTERR_INVALID_PARAMETER;
+    }
+
+    ret = Mqtt_CheckPublishParam(topic, size, qos);
+    if(MQTTERR_NOERROR != ret) {
+        return ret;
+    }
+    topic_len = strlen(topic);
+
     fix_head = MqttBuffer_AllocExtent(buf, 5);
     if(NULL == fix_head) {
         return MQTTERR_OUTOFMEMORY;
@@ -853,6 +1323,19 @@ int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *top
 
     MqttBuffer_AppendExtent(buf, fix_head);
     MqttBuffer_AppendExtent(buf, variable_head);
+
+    return MQTTERR_NOERROR;
+}
+
+int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *topic,
+                        const char *payload, uint32_t size,
+                        enum MqttQosLevel qos, int retain, int own)
+{
+    int ret = Mqtt_PackPublishHead(buf, pkt_id, topic, size, qos, retain);
+    if(MQTTERR_NOERROR != ret) {
+        return ret;
+    }
+
     if(0 != size) {
         MqttBuffer_Append(buf, (char*)payload, size, own);
     }
@@ -861,15 +1344,34 @@ int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *top
     return MQTTERR_NOERROR;
 }
 
+int Mqtt_PackPublishPktShared(struct MqttBuffer *buf, uint16_t pkt_id, const char *topic,
+                              struct MqttPayload *payload,
+                              enum MqttQosLevel qos, int retain)
+{
+    int ret = Mqtt_PackPublishHead(buf, pkt_id, topic, payload->len, qos, retain);
+    if(MQTTERR_NOERROR != ret) {
+        return ret;
+    }
+
+    if(0 != payload->len) {
+        return MqttBuffer_AppendShared(buf, payload);
+    }
+
+    return MQTTERR_NOERROR;
+}
+
 int Mqtt_SetPktDup(struct MqttBuffer *buf)
 {
-    struct MqttExtent *fix_head = buf->first_ext;
-    uint8_t pkt_type = ((uint8_t)buf->first_ext->payload[0]) >> 4;
-    if(!fix_head || (MQTT_PKT_PUBLISH != pkt_type)) {
+    return Mqtt_SetPktDupAt(buf->first_ext);
+}
+
+int Mqtt_SetPktDupAt(struct MqttExtent *fix_head)
+{
+    if(!fix_head || (MQTT_PKT_PUBLISH != ((uint8_t)fix_head->payload[0]) >> 4)) {
         return MQTTERR_INVALID_PARAMETER;
     }
 
-    buf->first_ext->payload[0] |= 0x08;
+    fix_head->payload[0] |= 0x08;
     return MQTTERR_NOERROR;
 }
 
@@ -953,6 +1455,85 @@ static int Mqtt_PackPubCompPkt(struct MqttBuffer *buf, uint16_t pkt_id)
     return MQTTERR_NOERROR;
 }
 
+static int Mqtt_PackConnAckPkt(struct MqttBuffer *buf, char flags, char ret_code)
+{
+    struct MqttExtent *ext = MqttBuffer_AllocExtent(buf, 4);
+    if(!ext) {
+        return MQTTERR_OUTOFMEMORY;
+    }
+
+    ext->payload[0] = MQTT_PKT_CONNACK << 4;
+    ext->payload[1] = 2;
+    ext->payload[2] = flags;
+    ext->payload[3] = ret_code;
+    MqttBuffer_AppendExtent(buf, ext);
+
+    return MQTTERR_NOERROR;
+}
+
+static int Mqtt_PackSubAckPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *codes, uint32_t count)
+{
+    struct MqttExtent *ext;
+    int ret;
+
+    if(0 == pkt_id) {
+        return MQTTERR_INVALID_PARAMETER;
+    }
+
+    ext = MqttBuffer_AllocExtent(buf, 5 + 2 + count);
+    if(!ext) {
+        return MQTTERR_OUTOFMEMORY;
+    }
+
+    ext->payload[0] = (char)(MQTT_PKT_SUBACK << 4);
+    ret = Mqtt_DumpLength(2 + count, ext->payload + 1);
+    if(ret < 0) {
+        return MQTTERR_PKT_TOO_LARGE;
+    }
+
+    Mqtt_WB16(pkt_id, ext->payload + 1 + ret);
+    memcpy(ext->payload + 3 + ret, codes, count);
+    ext->len = 3 + ret + count;
+    MqttBuffer_AppendExtent(buf, ext);
+
+    return MQTTERR_NOERROR;
+}
+
+static int Mqtt_PackUnsubAckPkt(struct MqttBuffer *buf, uint16_t pkt_id)
+{
+    struct MqttExtent *ext;
+
+    if(0 == pkt_id) {
+        return MQTTERR_INVALID_PARAMETER;
+    }
+
+    ext = MqttBuffer_AllocExtent(buf, 4);
+    if(!ext) {
+        return MQTTERR_OUTOFMEMORY;
+    }
+
+    ext->payload[0] = (char)(MQTT_PKT_UNSUBACK << 4);
+    ext->payload[1] = 2;
+    Mqtt_WB16(pkt_id, ext->payload + 2);
+    MqttBuffer_AppendExtent(buf, ext);
+
+    return MQTTERR_NOERROR;
+}
+
+static int Mqtt_PackPingRespPkt(struct MqttBuffer *buf)
+{
+    struct MqttExtent *ext = MqttBuffer_AllocExtent(buf, 2);
+    if(!ext) {
+        return MQTTERR_OUTOFMEMORY;
+    }
+
+    ext->payload[0] = (char)(MQTT_PKT_PINGRESP << 4);
+    ext->payload[1] = 0;
+    MqttBuffer_AppendExtent(buf, ext);
+
+    return MQTTERR_NOERROR;
+}
+
 int Mqtt_PackSubscribePkt(struct MqttBuffer *buf, uint16_t pkt_id,
                           enum MqttQosLevel qos, const char *const *topics, int topics_len)
 {
@@ -984,7 +1565,7 @@ int Mqtt_PackSubscribePkt(struct MqttBuffer *buf, uint16_t pkt_id,
     if(NULL == fixed_head) {
         return MQTTERR_OUTOFMEMORY;
     }
-    fixed_head->payload[0] = (char)((MQTT_PKT_SUBSCRIBE << 4) | 0x00);
+    fixed_head->payload[0] = (char)((MQTT_PKT_SUBSCRIBE << 4) | 0x02);
 
     remaining_len = 2 + 2*topics_len + topic_total_len + topics_len*1;  // 2 bytes packet id, 2 bytes topic length + topic + 1 byte reserve
     ext = MqttBuffer_AllocExtent(buf, remaining_len);
@@ -1090,7 +1671,7 @@ int Mqtt_PackUnsubscribePkt(struct MqttBuffer *buf, uint16_t pkt_id, const char
         return MQTTERR_OUTOFMEMORY;
     }
 
-    fixed_head->payload[0] = (char)(MQTT_PKT_UNSUBSCRIBE << 4 | 0x00);
+    fixed_head->payload[0] = (char)(MQTT_PKT_UNSUBSCRIBE << 4 | 0x02);
     ret = Mqtt_DumpLength(remaining_len, fixed_head->payload + 1);
     if(ret < 0) {
         return MQTTERR_PKT_TOO_LARGE;
@@ -8,6 +8,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <time.h>
+#include <limits.h>
 #include "jimi_type.h"
 #include "mqtt_buffer.h"
 
@@ -22,7 +23,8 @@ enum MqttError {
     MQTTERR_INVALID_PARAMETER        = -6, /**< 参数错误 */
     MQTTERR_PKT_TOO_LARGE            = -7, /**< 数据包过大 */
     MQTTERR_INTERNAL                 = -8,/**< 系统内部错误 */
-    MQTTERR_FAILED_SEND_RESPONSE     = -9 /**< 处理publish系列消息后，发送响应包失败 */
+    MQTTERR_FAILED_SEND_RESPONSE     = -9, /**< 处理publish系列消息后，发送响应包失败 */
+    MQTTERR_WOULDBLOCK               = -10 /**< 未确认的消息或者待发送的数据已达上限，请等待可发送回调后重试 */
 };
 
 /** MQTT数据包类型 */
@@ -90,6 +92,15 @@ enum MqttPacketLength{
     kLengthNotEnough = -2,
 };
 
+/** 发送数据包时一次writev最多使用的数据块个数，不超过系统的IOV_MAX */
+#ifndef MQTT_IOV_CACHE_SIZE
+#define MQTT_IOV_CACHE_SIZE 32
+#endif
+#if defined(IOV_MAX) && IOV_MAX < MQTT_IOV_CACHE_SIZE
+#undef MQTT_IOV_CACHE_SIZE
+#define MQTT_IOV_CACHE_SIZE IOV_MAX
+#endif
+
 /** MQTT 运行时上下文 */
 struct MqttContext {
     void *user_data;
@@ -101,8 +112,16 @@ struct MqttContext {
                   size_t iov_len;
               }
 			  返回发送的字节数，如果失败返回-1.
+			  发送缓冲区满时可以只发送部分数据(或返回0)，剩余数据由调用者稍后从该偏移继续发送
         */
 
+    int (*send_response)(void *arg, const struct MqttBuffer *response);
+        /**< 发送SDK自动回复的响应包(PUBACK、PUBREC、PUBREL、PUBCOMP以及服务端响应)，成功返回非负数；
+             为NULL时直接通过writev_func发送，要求writev_func总是完整写入；
+             writev_func可能只写入部分数据时必须设置，把响应追加到调用者的发送队列末尾，
+             避免响应插入未发送完毕的数据包中间
+         */
+
     int (*handle_ping_resp)(void *arg); /**< 处理ping响应的回调函数，成功则返回非负数 */
 
     int (*handle_conn_ack)(void *arg, char flags, char ret_code);
@@ -112,11 +131,11 @@ struct MqttContext {
 
     int (*handle_publish)(void *arg, uint16_t pkt_id, const char *topic,
                           const char *payload, uint32_t payloadsize,
-                          int dup, enum MqttQosLevel qos);
+                          int dup, enum MqttQosLevel qos, int retain);
         /**< 处理发布数据的回调函数， pkt_id为数据包的ID，topic为
              数据所属的Topic， payload为数据的起始地址， payloadsize为
-             payload的字节数， dup为是否重发状态， qos为QoS等级，成功返回非负数，
-			 SDK将会自动发送对应的响应包。
+             payload的字节数， dup为是否重发状态， qos为QoS等级，retain为保留标志，成功返回非负数，
+			 SDK将会自动发送对应的响应包；返回正数时不发送响应包(例如服务端模拟丢包)。
          */
 
     int (*handle_pub_ack)(void *arg, uint16_t pkt_id);
@@ -140,9 +159,102 @@ struct MqttContext {
 
     int (*handle_unsub_ack)(void *arg, uint16_t packet_id);
         /**< 处理取消订阅确认的回调函数, pkt_id为取消订阅数据包的ID，成功则返回非负数 */
+
+    /* 以下为服务端回调，客户端置为NULL即可；handle_conn_ack、handle_ping_resp、handle_sub_ack、
+       handle_unsub_ack以及以下回调为NULL时，收到对应数据包视为非法数据包 */
+
+    int (*handle_connect)(void *arg, const char *client_id, uint16_t keep_alive,
+                          int clean_session, const char *will_topic,
+                          const char *will_msg, uint16_t will_len,
+                          enum MqttQosLevel will_qos, int will_retain,
+                          const char *user, const char *password, uint16_t pswd_len);
+        /**< 处理连接请求的回调函数，字符串均以'\0'结尾，没有携带的字段为NULL，
+             返回@see MqttRetCode中的连接返回码，SDK将自动回复CONNACK，失败返回负数
+         */
+
+    int (*handle_subscribe)(void *arg, uint16_t pkt_id, const char *topic, enum MqttQosLevel qos);
+        /**< 处理订阅请求的回调函数，数据包中每个主题过滤器回调一次，
+             返回授予的QoS等级或者MQTT_SUBACK_FAILUER，全部回调后SDK自动回复SUBACK
+         */
+
+    int (*handle_unsubscribe)(void *arg, uint16_t pkt_id, const char *topic);
+        /**< 处理取消订阅请求的回调函数，数据包中每个主题过滤器回调一次，
+             全部回调后SDK自动回复UNSUBACK，成功则返回非负数
+         */
+
+    int (*handle_ping_req)(void *arg);
+        /**< 处理ping请求的回调函数，SDK自动回复PINGRESP，成功则返回非负数 */
+
+    int (*handle_disconnect)(void *arg);
+        /**< 处理断开连接请求的回调函数，成功则返回非负数 */
+
+    struct iovec iov_cache[MQTT_IOV_CACHE_SIZE];
+        /**< 发送数据包时使用的iovec数组，避免每次发送都开辟内存，内部使用 */
 };
 
 
+/**
+ * 获取数据包剩余长度
+ * @param stream 长度字段起始地址
+ * @param size 数据流大小
+ * @param len 返回数据包剩余长度
+ * @return 返回长度字段占用字节数，失败返回 @see MqttPacketLength
+ */
+int Mqtt_ReadLength(const char *stream, int size, uint32_t *len);
+
+/** MQTT 增量解析器状态，内部使用 */
+enum MqttParseState {
+    MQTT_PARSE_FIXED_HEADER = 0, /**< 等待固定头 */
+    MQTT_PARSE_LENGTH,           /**< 正在解析剩余长度字段 */
+    MQTT_PARSE_BODY              /**< 正在接收剩余数据 */
+};
+
+/**
+ * MQTT 增量解析器
+ * 记住跨多次输入的固定头与剩余长度，不完整的数据包只拷贝一次到按包大小预留的缓冲区
+ */
+struct MqttParser {
+    //当前解析状态 @see MqttParseState
+    int state;
+    //固定头
+    char fixed_header;
+    //剩余长度，在MQTT_PARSE_LENGTH状态下为已经解析的部分
+    uint32_t remaining_len;
+    //剩余长度字段解析时的乘数
+    uint32_t multiplier;
+    //不完整数据包的缓存
+    char *body;
+    //body中已经接收的字节数
+    uint32_t body_len;
+    //body开辟的字节数
+    uint32_t body_capacity;
+};
+
+/**
+ * 初始化增量解析器，使用完毕后必须用 @see MqttParser_Destroy销毁
+ * @param parser 解析器对象
+ */
+void MqttParser_Init(struct MqttParser *parser);
+
+/**
+ * 销毁增量解析器，释放其缓存
+ * @param parser 解析器对象
+ */
+void MqttParser_Destroy(struct MqttParser *parser);
+
+/**
+ * 重置增量解析器，丢弃不完整的数据包
+ * @param parser 解析器对象
+ */
+void MqttParser_Reset(struct MqttParser *parser);
+
+/**
+ * 判断解析器中是否缓存有不完整的数据包
+ * @param parser 解析器对象
+ * @return 非0代表有
+ */
+int MqttParser_Pending(const struct MqttParser *parser);
+
 /**
  * 接收数据包，并调用ctx中响应的数据处理函数
  * @param ctx MQTT运行时上下文
@@ -150,11 +262,26 @@ struct MqttContext {
  * @return 成功则返回MQTTERR_NOERROR
  */
 int Mqtt_RecvPkt(struct MqttContext *ctx,char *data,int len,int *customed);
+
+/**
+ * 增量接收数据包，并调用ctx中响应的数据处理函数
+ * 完整的数据包直接在data中处理，不做拷贝；
+ * 末尾不完整的数据包会被解析器缓存，下次调用时继续拼接
+ * @param ctx MQTT运行时上下文
+ * @param parser 增量解析器
+ * @param data 数据指针，处理过程中可能被修改
+ * @param len 数据长度
+ * @return 成功则返回MQTTERR_NOERROR，data总是被全部消费
+ */
+int Mqtt_ParsePkt(struct MqttContext *ctx,struct MqttParser *parser,char *data,int len);
+
 /**
  * 发送数据包
+ * 数据块超过MQTT_IOV_CACHE_SIZE个时分多次调用writev_func，遇到部分发送时停止
  * @param buf 保存将要发送数据包的缓冲区对象
  * @param offset 从缓冲区的offset字节处开始发送
- * @return 成功则返回MQTTERR_NOERROR
+ * @return 成功则返回本次实际发送的字节数，小于剩余字节数时请在可写后从offset加上该值处继续发送；
+ *         失败返回负数
  */
 int Mqtt_SendPkt(struct MqttContext *ctx, const struct MqttBuffer *buf, uint32_t offset);
 
@@ -182,6 +309,15 @@ int Mqtt_PackConnectPkt(struct MqttBuffer *buf, uint16_t keep_alive, const char
                         enum MqttQosLevel qos, int will_retain, const char *user,
                         const char *password, uint16_t pswd_len);
 
+/**
+ * 检查发布数据的参数，与封装发布数据包时的检查一致，用于数据包暂不封装(例如存入离线消息队列)时提前报告错误
+ * @param topic 数据发送到哪个topic，不能包含通配符，必须是UTF-8编码
+ * @param size 负载大小（字节数）
+ * @param qos QoS等级
+ * @return 成功则返回MQTTERR_NOERROR
+ */
+int Mqtt_CheckPublishParam(const char *topic, uint32_t size, enum MqttQosLevel qos);
+
 /**
  * 封装发布数据数据包
  * @param buf 存储数据包的缓冲区对象
@@ -199,6 +335,20 @@ int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *top
                         const char *payload, uint32_t size,
                         enum MqttQosLevel qos, int retain, int own);
 
+/**
+ * 封装发布数据数据包，负载引用共享负载对象而不拷贝，同一负载发布到多个主题时只需拷贝一次
+ * @param buf 存储数据包的缓冲区对象，持有负载的一个引用直到被重置或销毁
+ * @param pkt_id 数据包ID，非0
+ * @param topic 数据发送到哪个topic
+ * @param payload 共享负载，@see MqttPayload_Create
+ * @param qos QoS等级
+ * @param retain 非0时，服务器将该publish消息保存到topic下，并替换已有的publish消息
+ * @return 成功则返回MQTTERR_NOERROR
+ */
+int Mqtt_PackPublishPktShared(struct MqttBuffer *buf, uint16_t pkt_id, const char *topic,
+                              struct MqttPayload *payload,
+                              enum MqttQosLevel qos, int retain);
+
 /**
  * 设置发布数据数据包为重发的发布数据数据包
  * @param buf 存储有PUBLISH数据包的缓冲区
@@ -206,6 +356,13 @@ int Mqtt_PackPublishPkt(struct MqttBuffer *buf, uint16_t pkt_id, const char *top
  */
 int Mqtt_SetPktDup(struct MqttBuffer *buf);
 
+/**
+ * 设置发布数据数据包为重发的发布数据数据包
+ * @param fix_head PUBLISH数据包固定头所在的数据块，缓冲区中有多个数据包时使用
+ * @return 成功则返回MQTTERR_NOERROR
+ */
+int Mqtt_SetPktDupAt(struct MqttExtent *fix_head);
+
 /**
  * 封装订阅数据包
  * @param buf 存储数据包的缓冲区对象
@@ -7,8 +7,21 @@
 
 
 #define MQTT_DEFAULT_ALIGNMENT sizeof(int)
+//标准内存块大小，只有标准大小的内存块会被保留或者放入内存块池
 static const uint32_t MQTT_MIN_EXTENT_SIZE = 256;
 
+//内存块头部，记录内存块大小，空闲时挂在内存块池的链表上
+struct MqttChunk {
+    struct MqttChunk *next;
+    uint32_t size;
+};
+
+//共享负载引用，存放在缓冲区自己分配的数据块中，数据块的负载指针指向共享负载的数据
+struct MqttPayloadRef {
+    struct MqttPayload *payload;
+    struct MqttPayloadRef *next;
+};
+
 void MqttBuffer_Init(struct MqttBuffer *buf)
 {
     buf->first_ext = NULL;
@@ -19,6 +32,21 @@ void MqttBuffer_Init(struct MqttBuffer *buf)
     buf->alloc_max_count = 0;
     buf->first_available = NULL;
     buf->buffered_bytes = 0;
+    buf->pool = NULL;
+    buf->shared = NULL;
+}
+
+void MqttBuffer_InitWithStorage(struct MqttBuffer *buf, void *storage, uint32_t size)
+{
+    MqttBuffer_Init(buf);
+    //外部内存不在allocations中，重置时不会被释放
+    buf->first_available = (char*)storage;
+    buf->available_bytes = size;
+}
+
+void MqttBuffer_SetPool(struct MqttBuffer *buf, struct MqttChunkPool *pool)
+{
+    buf->pool = pool;
 }
 
 void MqttBuffer_Destroy(struct MqttBuffer *buf)
@@ -26,16 +54,99 @@ void MqttBuffer_Destroy(struct MqttBuffer *buf)
     MqttBuffer_Reset(buf);
 }
 
+/**
+ * 开辟一个内存块，标准大小的内存块优先从内存块池中获取
+ * @param size 返回内存块可用字节数
+ */
+static struct MqttChunk *MqttBuffer_NewChunk(struct MqttBuffer *buf, uint32_t bytes, uint32_t *size)
+{
+    struct MqttChunk *chunk;
+    uint32_t alloc_bytes = bytes < MQTT_MIN_EXTENT_SIZE ? MQTT_MIN_EXTENT_SIZE : bytes;
+
+    if(buf->pool && buf->pool->free_list && MQTT_MIN_EXTENT_SIZE == alloc_bytes) {
+        chunk = buf->pool->free_list;
+        buf->pool->free_list = chunk->next;
+        buf->pool->count -= 1;
+    }
+    else {
+        chunk = (struct MqttChunk*)jimi_malloc(sizeof(struct MqttChunk) + alloc_bytes);
+        if(NULL == chunk) {
+            return NULL;
+        }
+        chunk->size = alloc_bytes;
+    }
+
+    chunk->next = NULL;
+    *size = chunk->size;
+    return chunk;
+}
+
+/**
+ * 释放内存块，标准大小的内存块优先归还内存块池
+ */
+static void MqttBuffer_FreeChunk(struct MqttChunkPool *pool, struct MqttChunk *chunk)
+{
+    if(pool && MQTT_MIN_EXTENT_SIZE == chunk->size && pool->count < pool->max_count) {
+        chunk->next = pool->free_list;
+        pool->free_list = chunk;
+        pool->count += 1;
+        return;
+    }
+    jimi_free(chunk);
+}
+
+/**
+ * 释放缓冲区持有的全部共享负载引用，必须在释放内存块之前调用
+ */
+static void MqttBuffer_ReleaseShared(struct MqttBuffer *buf)
+{
+    struct MqttPayloadRef *ref;
+    for(ref = buf->shared; ref; ref = ref->next) {
+        MqttPayload_Release(ref->payload);
+    }
+    buf->shared = NULL;
+}
+
 void MqttBuffer_Reset(struct MqttBuffer *buf)
 {
+    struct MqttChunkPool *pool = buf->pool;
     uint32_t i;
+    MqttBuffer_ReleaseShared(buf);
     for(i = 0; i < buf->alloc_count; ++i) {
-        jimi_free(buf->allocations[i]);
+        MqttBuffer_FreeChunk(pool, (struct MqttChunk*)buf->allocations[i]);
     }
     
     jimi_free(buf->allocations);
 
     MqttBuffer_Init(buf);
+    buf->pool = pool;
+}
+
+void MqttBuffer_ResetRetain(struct MqttBuffer *buf)
+{
+    struct MqttChunk *first;
+    uint32_t i;
+
+    MqttBuffer_ReleaseShared(buf);
+    //第一个内存块是大块内存时不保留，避免长期占用
+    if(0 == buf->alloc_count ||
+       MQTT_MIN_EXTENT_SIZE != ((struct MqttChunk*)buf->allocations[0])->size) {
+        MqttBuffer_Reset(buf);
+        return;
+    }
+
+    for(i = 1; i < buf->alloc_count; ++i) {
+        MqttBuffer_FreeChunk(buf->pool, (struct MqttChunk*)buf->allocations[i]);
+        buf->allocations[i] = NULL;
+    }
+
+    first = (struct MqttChunk*)buf->allocations[0];
+    buf->first_ext = NULL;
+    buf->last_ext = NULL;
+    buf->buffered_bytes = 0;
+    buf->alloc_count = 1;
+    buf->first_available = (char*)(first + 1);
+    buf->available_bytes = first->size;
 }
 
 struct MqttExtent *MqttBuffer_AllocExtent(struct MqttBuffer *buf, uint32_t bytes)
@@ -47,7 +158,7 @@ struct MqttExtent *MqttBuffer_AllocExtent(struct MqttBuffer *buf, uint32_t bytes
 
     if(buf->available_bytes < aligned_bytes) {
         uint32_t alloc_bytes;
-        char *chunk;
+        struct MqttChunk *chunk;
 
         if(buf->alloc_count == buf->alloc_max_count) {
             uint32_t max_count = buf->alloc_max_count * 2 + 1;
@@ -63,20 +174,18 @@ struct MqttExtent *MqttBuffer_AllocExtent(struct MqttBuffer *buf, uint32_t bytes
             buf->allocations = tmp;
         }
 
-        alloc_bytes = aligned_bytes < MQTT_MIN_EXTENT_SIZE ? MQTT_MIN_EXTENT_SIZE : aligned_bytes;
-        chunk = (char*)jimi_malloc(alloc_bytes);
+        chunk = MqttBuffer_NewChunk(buf, aligned_bytes, &alloc_bytes);
         if(NULL == chunk) {
             return NULL;
         }
 
         buf->alloc_count += 1;
-        buf->allocations[buf->alloc_count - 1] = chunk;
+        buf->allocations[buf->alloc_count - 1] = (char*)chunk;
         buf->available_bytes = alloc_bytes;
-        buf->first_available = chunk;
+        buf->first_available = (char*)(chunk + 1);
     }
 
     assert(buf->available_bytes >= bytes);
-    assert(buf->alloc_count > 0);
 
     ext = (struct MqttExtent*)(buf->first_available);
     ext->len = bytes;
@@ -114,6 +223,25 @@ int MqttBuffer_Append(struct MqttBuffer *buf, char *payload, uint32_t size, int
 
 }
 
+int MqttBuffer_AppendShared(struct MqttBuffer *buf, struct MqttPayload *payload)
+{
+    struct MqttPayloadRef *ref;
+    struct MqttExtent *ext = MqttBuffer_AllocExtent(buf, sizeof(struct MqttPayloadRef));
+    if(NULL == ext) {
+        return MQTTERR_OUTOFMEMORY;
+    }
+
+    ref = (struct MqttPayloadRef*)ext->payload;
+    ref->payload = MqttPayload_Retain(payload);
+    ref->next = buf->shared;
+    buf->shared = ref;
+
+    ext->payload = MqttPayload_Data(payload);
+    ext->len = payload->len;
+    MqttBuffer_AppendExtent(buf, ext);
+    return MQTTERR_NOERROR;
+}
+
 void MqttBuffer_AppendExtent(struct MqttBuffer *buf, struct MqttExtent *ext)
 {
     ext->next = NULL;
@@ -123,7 +251,6 @@ void MqttBuffer_AppendExtent(struct MqttBuffer *buf, struct MqttExtent *ext)
     }
     else {
         assert(NULL == buf->first_ext);
-        assert(1 <= buf->alloc_count);
 
         buf->first_ext = ext;
         buf->last_ext = ext;
@@ -131,3 +258,128 @@ void MqttBuffer_AppendExtent(struct MqttBuffer *buf, struct MqttExtent *ext)
 
     buf->buffered_bytes += ext->len;
 }
+
+/**
+ * 判断数据块是否引用缓冲区持有的共享负载
+ */
+static int MqttBuffer_IsShared(struct MqttBuffer *buf, struct MqttExtent *ext)
+{
+    struct MqttPayloadRef *ref;
+    for(ref = buf->shared; ref; ref = ref->next) {
+        if(ext->payload == MqttPayload_Data(ref->payload)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int MqttBuffer_OwnExtents(struct MqttBuffer *buf, uint32_t offset)
+{
+    struct MqttExtent *prev = NULL;
+    struct MqttExtent *cursor;
+    struct MqttExtent *copy;
+    uint32_t bytes = 0;
+
+    for(cursor = buf->first_ext; cursor; prev = cursor, cursor = cursor->next) {
+        bytes += cursor->len;
+        //缓冲区自己分配的数据块，负载紧跟在MqttExtent之后；共享负载由缓冲区持有引用
+        if(bytes <= offset || cursor->payload == (char*)(cursor + 1) || MqttBuffer_IsShared(buf, cursor)) {
+            continue;
+        }
+
+        copy = MqttBuffer_AllocExtent(buf, cursor->len);
+        if(NULL == copy) {
+            return MQTTERR_OUTOFMEMORY;
+        }
+        memcpy(copy->payload, cursor->payload, cursor->len);
+        //用拷贝替换原数据块，之后再调用时按自己分配的数据块跳过，不会重复拷贝
+        copy->next = cursor->next;
+        if(prev) {
+            prev->next = copy;
+        }
+        else {
+            buf->first_ext = copy;
+        }
+        if(buf->last_ext == cursor) {
+            buf->last_ext = copy;
+        }
+        cursor = copy;
+    }
+
+    return MQTTERR_NOERROR;
+}
+
+void MqttBuffer_Truncate(struct MqttBuffer *buf, struct MqttExtent *tail)
+{
+    struct MqttExtent *cursor = tail ? tail->next : buf->first_ext;
+    struct MqttPayloadRef **ref;
+
+    for(; cursor; cursor = cursor->next) {
+        buf->buffered_bytes -= cursor->len;
+        for(ref = &buf->shared; *ref; ref = &(*ref)->next) {
+            if(cursor->payload == MqttPayload_Data((*ref)->payload)) {
+                MqttPayload_Release((*ref)->payload);
+                *ref = (*ref)->next;
+                break;
+            }
+        }
+    }
+
+    if(tail) {
+        tail->next = NULL;
+    }
+    else {
+        buf->first_ext = NULL;
+    }
+    buf->last_ext = tail;
+}
+
+struct MqttPayload *MqttPayload_Create(const char *data, uint32_t len)
+{
+    struct MqttPayload *payload = (struct MqttPayload*)jimi_malloc(sizeof(struct MqttPayload) + len);
+    if(NULL == payload) {
+        return NULL;
+    }
+
+    payload->refs = 1;
+    payload->len = len;
+    if(NULL != data) {
+        memcpy(MqttPayload_Data(payload), data, len);
+    }
+    return payload;
+}
+
+char *MqttPayload_Data(struct MqttPayload *payload)
+{
+    return (char*)(payload + 1);
+}
+
+struct MqttPayload *MqttPayload_Retain(struct MqttPayload *payload)
+{
+    __atomic_add_fetch(&payload->refs, 1, __ATOMIC_RELAXED);
+    return payload;
+}
+
+void MqttPayload_Release(struct MqttPayload *payload)
+{
+    if(NULL != payload && 0 == __atomic_sub_fetch(&payload->refs, 1, __ATOMIC_ACQ_REL)) {
+        jimi_free(payload);
+    }
+}
+
+void MqttChunkPool_Init(struct MqttChunkPool *pool, uint32_t max_count)
+{
+    pool->free_list = NULL;
+    pool->count = 0;
+    pool->max_count = max_count;
+}
+
+void MqttChunkPool_Destroy(struct MqttChunkPool *pool)
+{
+    struct MqttChunk *chunk;
+    while(NULL != (chunk = pool->free_list)) {
+        pool->free_list = chunk->next;
+        jimi_free(chunk);
+    }
+    pool->count = 0;
+}
@@ -14,6 +14,34 @@ struct MqttExtent {
     struct MqttExtent *next;
 };
 
+/**
+ * 引用计数的共享负载，负载数据紧跟在对象之后，@see MqttPayload_Data
+ * 同一份数据发布到多个主题，或者同时用于发送与等待重发时，只需拷贝一次
+ * 引用计数使用原子操作，可以在多个线程的缓冲区之间共享，但是创建后不能再修改负载内容
+ */
+struct MqttPayload {
+    //引用计数，为0时释放
+    uint32_t refs;
+    //负载长度
+    uint32_t len;
+};
+
+//缓冲区持有的共享负载引用
+struct MqttPayloadRef;
+
+/**
+ * 内存块池，缓存标准大小的空闲内存块，供多个缓冲区对象在数据包之间循环使用
+ * 同一个内存块池只能在一个线程中使用
+ */
+struct MqttChunkPool {
+    //空闲内存块链表
+    struct MqttChunk *free_list;
+    //空闲内存块个数
+    uint32_t count;
+    //最多缓存的空闲内存块个数
+    uint32_t max_count;
+};
+
 struct MqttBuffer {
     //使用MqttBuffer_AppendExtent添加进来的对象链表
     struct MqttExtent *first_ext;
@@ -31,6 +59,10 @@ struct MqttBuffer {
     uint32_t alloc_max_count;
     //第一块可用的内存块剩余可用内存字节数
     uint32_t available_bytes;
+    //内存块池，为NULL时直接申请释放内存块
+    struct MqttChunkPool *pool;
+    //使用MqttBuffer_AppendShared添加的共享负载引用链表，重置或销毁时释放
+    struct MqttPayloadRef *shared;
 };
 
 /**
@@ -38,6 +70,20 @@ struct MqttBuffer {
  * @param buf 被初始化的缓冲区对象
  */
 void MqttBuffer_Init(struct MqttBuffer *buf);
+/**
+ * 使用调用者提供的内存初始化缓冲区，该内存用完之前不会开辟堆内存，适合在栈上打包小数据包
+ * 缓冲区对象在使用完后，必须用 @see MqttBuffer_Destroy销毁，storage不会被释放
+ * @param buf 被初始化的缓冲区对象
+ * @param storage 内存起始地址，必须按指针大小对齐
+ * @param size 内存字节数
+ */
+void MqttBuffer_InitWithStorage(struct MqttBuffer *buf, void *storage, uint32_t size);
+/**
+ * 设置缓冲区使用的内存块池，必须在缓冲区开辟内存之前设置，内存块池必须比缓冲区后销毁
+ * @param buf 缓冲区对象
+ * @param pool 内存块池，为NULL时直接申请释放内存块
+ */
+void MqttBuffer_SetPool(struct MqttBuffer *buf, struct MqttChunkPool *pool);
 /**
  * 销毁缓冲区对象
  * @param buf 被销毁的缓冲区对象
@@ -48,6 +94,12 @@ void MqttBuffer_Destroy(struct MqttBuffer *buf);
  * @param buf 被重置(清空)的缓冲区对象
  */
 void MqttBuffer_Reset(struct MqttBuffer *buf);
+/**
+ * 重置(清空)缓冲区对象，但是保留第一个标准大小的内存块以及内存块指针数组，供下一个数据包直接使用
+ * 其他内存块归还内存块池(如果有)，连续发送小数据包时不再开辟释放内存
+ * @param buf 被重置(清空)的缓冲区对象
+ */
+void MqttBuffer_ResetRetain(struct MqttBuffer *buf);
 /**
  * 分配一块连续的内存
  * @param buf 用于分配连续缓冲区的缓冲区对象
@@ -64,6 +116,13 @@ struct MqttExtent *MqttBuffer_AllocExtent(struct MqttBuffer *buf, uint32_t size)
  * @remark 当own为0时，必须保证payload在buf未被销毁前一直有效
  */
 int MqttBuffer_Append(struct MqttBuffer *buf, char *payload, uint32_t size, int own);
+/**
+ * 将共享负载添加到缓冲区的末尾，不拷贝数据，缓冲区持有一个引用直到被重置或销毁
+ * @param buf 存储数据块的缓冲区对象
+ * @param payload 共享负载
+ * @return 成功则返回 MQTTERR_NOERROR
+ */
+int MqttBuffer_AppendShared(struct MqttBuffer *buf, struct MqttPayload *payload);
 /**
  * 将一块连续的内存添加到缓冲区的末尾
  * @param buf 存储数据块的缓冲区对象
@@ -72,6 +131,58 @@ int MqttBuffer_Append(struct MqttBuffer *buf, char *payload, uint32_t size, int
  */
 void MqttBuffer_AppendExtent(struct MqttBuffer *buf, struct MqttExtent *ext);
 
+/**
+ * 把offset字节之后仍引用外部内存(own为0时添加)的数据块拷贝到缓冲区内部
+ * 用于数据未能立即发送完毕时，解除缓冲区对调用者内存的依赖
+ * @param buf 缓冲区对象
+ * @param offset 该偏移之前的数据已经发送，无需拷贝
+ * @return 成功则返回 MQTTERR_NOERROR
+ * @remark 拷贝得到的数据块替换原数据块，每个数据块最多拷贝一次；原数据块不再位于链表中
+ */
+int MqttBuffer_OwnExtents(struct MqttBuffer *buf, uint32_t offset);
+
+/**
+ * 删除tail之后的所有数据块，并释放这些数据块持有的共享负载引用
+ * 用于数据包打包后未能发送时撤销该数据包，数据块占用的内存在重置时回收
+ * @param buf 缓冲区对象
+ * @param tail 保留的最后一个数据块，为NULL时删除全部数据块
+ */
+void MqttBuffer_Truncate(struct MqttBuffer *buf, struct MqttExtent *tail);
+
+/**
+ * 创建共享负载并拷贝数据，引用计数为1
+ * @param data 数据首地址，为NULL时不拷贝，由调用者通过MqttPayload_Data填写
+ * @param len 数据长度
+ * @return 共享负载，失败返回NULL
+ */
+struct MqttPayload *MqttPayload_Create(const char *data, uint32_t len);
+/**
+ * 获取共享负载的数据首地址
+ */
+char *MqttPayload_Data(struct MqttPayload *payload);
+/**
+ * 增加一个引用
+ * @return payload本身
+ */
+struct MqttPayload *MqttPayload_Retain(struct MqttPayload *payload);
+/**
+ * 释放一个引用，最后一个引用释放时销毁共享负载
+ * @param payload 共享负载，为NULL时忽略
+ */
+void MqttPayload_Release(struct MqttPayload *payload);
+
+/**
+ * 初始化内存块池
+ * @param pool 内存块池
+ * @param max_count 最多缓存的空闲内存块个数
+ */
+void MqttChunkPool_Init(struct MqttChunkPool *pool, uint32_t max_count);
+/**
+ * 释放内存块池缓存的全部空闲内存块
+ * @param pool 内存块池
+ */
+void MqttChunkPool_Destroy(struct MqttChunkPool *pool);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,87 @@
+//
+// Created by xzl on 2019/7/22.
+//
+
+#include <memory.h>
+#include "mqtt_histogram.h"
+
+#define HISTOGRAM_SUB_COUNT (1 << MQTT_HISTOGRAM_SUB_BITS)
+
+static int mqtt_histogram_index(uint32_t value){
+    if(value < HISTOGRAM_SUB_COUNT){
+        return (int)value;
+    }
+    int exp = 31 - __builtin_clz(value);
+    int sub = (int)(value >> (exp - MQTT_HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1);
+    return ((exp - MQTT_HISTOGRAM_SUB_BITS + 1) << MQTT_HISTOGRAM_SUB_BITS) + sub;
+}
+
+/**
+ * 桶内数值的上界
+ */
+static uint32_t mqtt_histogram_upper(int index){
+    if(index < HISTOGRAM_SUB_COUNT){
+        return (uint32_t)index;
+    }
+    int exp = (index >> MQTT_HISTOGRAM_SUB_BITS) + MQTT_HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = index & (HISTOGRAM_SUB_COUNT - 1);
+    uint64_t upper = ((HISTOGRAM_SUB_COUNT + sub + 1) << (exp - MQTT_HISTOGRAM_SUB_BITS)) - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void mqtt_histogram_init(mqtt_histogram *hist){
+    memset(hist,0, sizeof(mqtt_histogram));
+}
+
+void mqtt_histogram_record(mqtt_histogram *hist,uint32_t value){
+    ++hist->_counts[mqtt_histogram_index(value)];
+    if(!hist->_total || value < hist->_min){
+        hist->_min = value;
+    }
+    if(value > hist->_max){
+        hist->_max = value;
+    }
+    ++hist->_total;
+    hist->_sum += value;
+}
+
+void mqtt_histogram_merge(mqtt_histogram *dst,const mqtt_histogram *src){
+    if(!src->_total){
+        return;
+    }
+    int i;
+    for(i = 0 ; i < MQTT_HISTOGRAM_BUCKETS ; ++i){
+        dst->_counts[i] += src->_counts[i];
+    }
+    if(!dst->_total || src->_min < dst->_min){
+        dst->_min = src->_min;
+    }
+    if(src->_max > dst->_max){
+        dst->_max = src->_max;
+    }
+    dst->_total += src->_total;
+    dst->_sum += src->_sum;
+}
+
+uint32_t mqtt_histogram_percentile(const mqtt_histogram *hist,double percent){
+    if(!hist->_total){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(hist->_total * percent / 100);
+    if(rank >= hist->_total){
+        rank = hist->_total - 1;
+    }
+    uint64_t seen = 0;
+    int i;
+    for(i = 0 ; i < MQTT_HISTOGRAM_BUCKETS ; ++i){
+        seen += hist->_counts[i];
+        if(seen > rank){
+            uint32_t upper = mqtt_histogram_upper(i);
+            if(upper < hist->_min){
+                return hist->_min;
+            }
+            return upper < hist->_max ? upper : hist->_max;
+        }
+    }
+    return hist->_max;
+}
@@ -0,0 +1,63 @@
+//
+// Created by xzl on 2019/7/22.
+//
+
+#ifndef MQTT_MQTT_HISTOGRAM_H
+#define MQTT_MQTT_HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+//每个2的幂区间再细分为16个桶，相对误差不超过1/16
+#define MQTT_HISTOGRAM_SUB_BITS 4
+#define MQTT_HISTOGRAM_BUCKETS ((32 - MQTT_HISTOGRAM_SUB_BITS + 1) << MQTT_HISTOGRAM_SUB_BITS)
+
+/**
+ * 对数分桶的直方图(类似HdrHistogram)，内存固定，记录与查询都不需要开辟内存
+ * 数值范围0 ~ UINT32_MAX，小于16的数值精确记录
+ */
+typedef struct {
+    uint32_t _counts[MQTT_HISTOGRAM_BUCKETS];
+    //样本个数
+    uint64_t _total;
+    //样本之和，用于计算平均值
+    uint64_t _sum;
+    uint32_t _min;
+    uint32_t _max;
+} mqtt_histogram;
+
+/**
+ * 初始化或者清空直方图
+ * @param hist 直方图对象
+ */
+void mqtt_histogram_init(mqtt_histogram *hist);
+
+/**
+ * 记录一个样本
+ * @param hist 直方图对象
+ * @param value 样本值
+ */
+void mqtt_histogram_record(mqtt_histogram *hist,uint32_t value);
+
+/**
+ * 把src的样本合并到dst，用于汇总多个对象的统计
+ * @param dst 目标直方图
+ * @param src 源直方图
+ */
+void mqtt_histogram_merge(mqtt_histogram *dst,const mqtt_histogram *src);
+
+/**
+ * 获取分位数
+ * @param hist 直方图对象
+ * @param percent 百分比，例如99.9
+ * @return 该分位数所在桶的上界(不超过最大样本值)，没有样本时返回0
+ */
+uint32_t mqtt_histogram_percentile(const mqtt_histogram *hist,double percent);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_HISTOGRAM_H
@@ -0,0 +1,150 @@
+//
+// Created by xzl on 2019/7/13.
+//
+
+#include <memory.h>
+#include "mqtt_id_table.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+#define ID_TABLE_MIN_SIZE 16
+#define ID_TABLE_MAX_SIZE 65536
+//槽位头部(数据包id)按8字节对齐，保证用户数据中的指针对齐
+#define ID_TABLE_SLOT_HEAD 8
+
+#define ID_TABLE_STRIDE(table) (ID_TABLE_SLOT_HEAD + (((table)->_value_size + 7) & ~7))
+#define ID_TABLE_SLOT(table,index) ((table)->_slots + (index) * ID_TABLE_STRIDE(table))
+#define ID_TABLE_BUSY(table,index) ((table)->_bitmap[(index) >> 5] & (1u << ((index) & 31)))
+
+void mqtt_id_table_init(mqtt_id_table *table,uint32_t value_size){
+    memset(table,0, sizeof(mqtt_id_table));
+    table->_value_size = value_size;
+    table->_next_id = 1;
+}
+
+void mqtt_id_table_release(mqtt_id_table *table){
+    jimi_free(table->_slots);
+    jimi_free(table->_bitmap);
+    mqtt_id_table_init(table,table->_value_size);
+}
+
+/**
+ * 容量翻倍，原槽位中的数据包移动到新槽位
+ * 两个id在旧容量下槽位不同，在新容量下槽位也一定不同，所以不会冲突
+ */
+static int mqtt_id_table_grow(mqtt_id_table *table){
+    uint32_t capacity = table->_capacity ? table->_capacity * 2 : ID_TABLE_MIN_SIZE;
+    if(capacity > ID_TABLE_MAX_SIZE){
+        LOGW("all packet id are in use");
+        return -1;
+    }
+    uint32_t stride = ID_TABLE_STRIDE(table);
+    uint32_t bitmap_size = (capacity + 31) / 32 * sizeof(uint32_t);
+    char *slots = jimi_malloc(capacity * stride);
+    uint32_t *bitmap = jimi_malloc(bitmap_size);
+    if(!slots || !bitmap){
+        LOGE("out of memory:%d",capacity);
+        jimi_free(slots);
+        jimi_free(bitmap);
+        return -1;
+    }
+    memset(bitmap,0,bitmap_size);
+
+    uint32_t i;
+    for(i = 0 ; i < table->_capacity ; ++i){
+        if(!ID_TABLE_BUSY(table,i)){
+            continue;
+        }
+        char *slot = ID_TABLE_SLOT(table,i);
+        uint32_t index = *((uint16_t *)slot) & (capacity - 1);
+        memcpy(slots + index * stride,slot,stride);
+        bitmap[index >> 5] |= 1u << (index & 31);
+    }
+
+    jimi_free(table->_slots);
+    jimi_free(table->_bitmap);
+    table->_slots = slots;
+    table->_bitmap = bitmap;
+    table->_capacity = capacity;
+    return 0;
+}
+
+uint16_t mqtt_id_table_alloc(mqtt_id_table *table,void **value){
+    CHECK_PTR(table,0);
+    //容量为65536时槽位0只能对应id 0，不可用
+    uint32_t usable = table->_capacity == ID_TABLE_MAX_SIZE ? ID_TABLE_MAX_SIZE - 1 : table->_capacity;
+    if(table->_count == usable && -1 == mqtt_id_table_grow(table)){
+        return 0;
+    }
+
+    //还有空闲槽位，最多查找_capacity + 1次(包括跳过0)
+    uint16_t pkt_id = table->_next_id;
+    uint32_t index;
+    while(1){
+        index = pkt_id & (table->_capacity - 1);
+        if(pkt_id && !ID_TABLE_BUSY(table,index)){
+            break;
+        }
+        ++pkt_id;
+    }
+    table->_next_id = pkt_id + 1;
+    table->_bitmap[index >> 5] |= 1u << (index & 31);
+    ++table->_count;
+
+    char *slot = ID_TABLE_SLOT(table,index);
+    *((uint16_t *)slot) = pkt_id;
+    memset(slot + ID_TABLE_SLOT_HEAD,0,table->_value_size);
+    if(value){
+        *value = slot + ID_TABLE_SLOT_HEAD;
+    }
+    return pkt_id;
+}
+
+void *mqtt_id_table_find(mqtt_id_table *table,uint16_t pkt_id){
+    CHECK_PTR(table,NULL);
+    if(!table->_capacity){
+        return NULL;
+    }
+    uint32_t index = pkt_id & (table->_capacity - 1);
+    char *slot = ID_TABLE_SLOT(table,index);
+    if(!ID_TABLE_BUSY(table,index) || *((uint16_t *)slot) != pkt_id){
+        return NULL;
+    }
+    return slot + ID_TABLE_SLOT_HEAD;
+}
+
+int mqtt_id_table_remove(mqtt_id_table *table,uint16_t pkt_id){
+    if(!mqtt_id_table_find(table,pkt_id)){
+        return -1;
+    }
+    uint32_t index = pkt_id & (table->_capacity - 1);
+    table->_bitmap[index >> 5] &= ~(1u << (index & 31));
+    --table->_count;
+    return 0;
+}
+
+uint32_t mqtt_id_table_count(mqtt_id_table *table){
+    CHECK_PTR(table,0);
+    return table->_count;
+}
+
+void *mqtt_id_table_next(mqtt_id_table *table,uint32_t *slot,uint16_t *pkt_id){
+    CHECK_PTR(table,NULL);
+    uint32_t index;
+    for(index = *slot ; index < table->_capacity ; ++index){
+        if(!table->_bitmap[index >> 5]){
+            //整个字都为空，跳过
+            index |= 31;
+            continue;
+        }
+        if(ID_TABLE_BUSY(table,index)){
+            char *ptr = ID_TABLE_SLOT(table,index);
+            *slot = index;
+            if(pkt_id){
+                *pkt_id = *((uint16_t *)ptr);
+            }
+            return ptr + ID_TABLE_SLOT_HEAD;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,90 @@
+//
+// Created by xzl on 2019/7/13.
+//
+
+#ifndef MQTT_MQTT_ID_TABLE_H
+#define MQTT_MQTT_ID_TABLE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 数据包id分配器以及以数据包id为索引的等待回复表
+ * 数据包id对应的槽位为 id & (_capacity - 1)，分配id时跳过0以及槽位被占用的id，
+ * 所以每个槽位最多只有一个数据包，查找、删除都无需探测；槽位用完时容量翻倍
+ */
+typedef struct {
+    //槽位数组，每个槽位为 uint16_t 数据包id + _value_size 字节的用户数据
+    char *_slots;
+    //槽位占用位图
+    uint32_t *_bitmap;
+    //槽位个数，为2的n次方
+    uint32_t _capacity;
+    //已经占用的槽位个数
+    uint32_t _count;
+    //每个槽位的用户数据大小
+    uint32_t _value_size;
+    //下次分配从此id开始查找
+    uint16_t _next_id;
+} mqtt_id_table;
+
+/**
+ * 初始化表对象
+ * @param table 表对象
+ * @param value_size 每个数据包id附带的用户数据大小
+ */
+void mqtt_id_table_init(mqtt_id_table *table,uint32_t value_size);
+
+/**
+ * 释放表对象的所有内存
+ * @param table 表对象
+ */
+void mqtt_id_table_release(mqtt_id_table *table);
+
+/**
+ * 分配一个未被占用的非0数据包id
+ * @param table 表对象
+ * @param value 返回该id对应的用户数据(已清零)，在下次分配前有效，可以为NULL
+ * @return 数据包id，0代表失败(内存不足或者65535个id全部被占用)
+ */
+uint16_t mqtt_id_table_alloc(mqtt_id_table *table,void **value);
+
+/**
+ * 查找数据包id对应的用户数据
+ * @param table 表对象
+ * @param pkt_id 数据包id
+ * @return 用户数据，在下次分配前有效；未找到返回NULL
+ */
+void *mqtt_id_table_find(mqtt_id_table *table,uint16_t pkt_id);
+
+/**
+ * 释放数据包id
+ * @param table 表对象
+ * @param pkt_id 数据包id
+ * @return 0代表成功，-1代表未找到
+ */
+int mqtt_id_table_remove(mqtt_id_table *table,uint16_t pkt_id);
+
+/**
+ * 获取已经分配的数据包id个数
+ * @param table 表对象
+ * @return 个数
+ */
+uint32_t mqtt_id_table_count(mqtt_id_table *table);
+
+/**
+ * 遍历已经分配的数据包id
+ * @param table 表对象
+ * @param slot 从该槽位开始查找，返回找到的槽位，下次请传入 *slot + 1；首次请传入0
+ * @param pkt_id 返回数据包id
+ * @return 用户数据，NULL代表遍历结束
+ */
+void *mqtt_id_table_next(mqtt_id_table *table,uint32_t *slot,uint16_t *pkt_id);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_ID_TABLE_H
@@ -0,0 +1,276 @@
+//
+// Created by xzl on 2019/7/12.
+//
+
+#include <memory.h>
+#include "mqtt_inflight.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+#define INFLIGHT_MIN_ARENA_SIZE 512
+#define INFLIGHT_MIN_MSG_COUNT 8
+
+void mqtt_inflight_init(mqtt_inflight *store){
+    memset(store,0, sizeof(mqtt_inflight));
+}
+
+void mqtt_inflight_release(mqtt_inflight *store){
+    int i;
+    for(i = 0 ; i < store->_used ; ++i){
+        if(store->_msgs[i]._pkt_id){
+            MqttPayload_Release(store->_msgs[i]._shared);
+        }
+    }
+    jimi_free(store->_arena);
+    jimi_free(store->_msgs);
+    jimi_free(store->_map);
+    mqtt_inflight_init(store);
+}
+
+/**
+ * 在哈希表中查找数据包id
+ * @return 哈希表中的位置，未找到返回-1
+ */
+static int32_t mqtt_inflight_lookup(mqtt_inflight *store,uint16_t pkt_id){
+    if(!pkt_id || !store->_map_capacity){
+        return -1;
+    }
+    uint32_t mask = store->_map_capacity - 1;
+    uint32_t pos = pkt_id & mask;
+    while(store->_map[pos] != -1){
+        if(store->_msgs[store->_map[pos]]._pkt_id == pkt_id){
+            return (int32_t)pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+static void mqtt_inflight_map_insert(mqtt_inflight *store,int32_t index){
+    uint32_t mask = store->_map_capacity - 1;
+    uint32_t pos = store->_msgs[index]._pkt_id & mask;
+    while(store->_map[pos] != -1){
+        pos = (pos + 1) & mask;
+    }
+    store->_map[pos] = index;
+}
+
+/**
+ * 从哈希表中删除，后续同一探测链上的元素向前移动填补空位，无需墓碑
+ */
+static void mqtt_inflight_map_erase(mqtt_inflight *store,uint32_t hole){
+    uint32_t mask = store->_map_capacity - 1;
+    uint32_t pos = hole;
+    while(1){
+        pos = (pos + 1) & mask;
+        if(store->_map[pos] == -1){
+            break;
+        }
+        uint32_t home = store->_msgs[store->_map[pos]]._pkt_id & mask;
+        //空位位于该元素的探测路径上时才能前移
+        if(((pos - home) & mask) >= ((pos - hole) & mask)){
+            store->_map[hole] = store->_map[pos];
+            hole = pos;
+        }
+    }
+    store->_map[hole] = -1;
+}
+
+static void mqtt_inflight_map_rebuild(mqtt_inflight *store){
+    memset(store->_map,0xFF,store->_map_capacity * sizeof(int32_t));
+    int i;
+    for(i = 0 ; i < store->_used ; ++i){
+        if(store->_msgs[i]._pkt_id){
+            mqtt_inflight_map_insert(store,i);
+        }
+    }
+}
+
+/**
+ * 整理内存池以及索引，删除已经删除的索引，把数据包按顺序移动到内存池头部，消除空洞
+ */
+static void mqtt_inflight_compact(mqtt_inflight *store){
+    uint32_t offset = 0;
+    int i,used = 0;
+    for(i = 0 ; i < store->_used ; ++i){
+        mqtt_inflight_msg *msg = store->_msgs + i;
+        if(!msg->_pkt_id){
+            continue;
+        }
+        if(msg->_offset != offset){
+            memmove(store->_arena + offset,store->_arena + msg->_offset,msg->_len);
+            msg->_offset = offset;
+        }
+        offset += msg->_len;
+        store->_msgs[used++] = *msg;
+    }
+    store->_used = used;
+    store->_arena_len = offset;
+    store->_garbage = 0;
+    if(store->_map_capacity){
+        mqtt_inflight_map_rebuild(store);
+    }
+}
+
+static int mqtt_inflight_grow_arena(mqtt_inflight *store,uint32_t len){
+    if(store->_garbage && store->_arena_len + len > store->_arena_capacity){
+        mqtt_inflight_compact(store);
+    }
+    if(store->_arena_len + len <= store->_arena_capacity){
+        return 0;
+    }
+
+    uint32_t capacity = store->_arena_capacity ? store->_arena_capacity : INFLIGHT_MIN_ARENA_SIZE;
+    while(capacity < store->_arena_len + len){
+        capacity *= 2;
+    }
+    char *arena = store->_arena ? jimi_realloc(store->_arena,capacity) : jimi_malloc(capacity);
+    if(!arena){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    store->_arena = arena;
+    store->_arena_capacity = capacity;
+    return 0;
+}
+
+static int mqtt_inflight_grow_msgs(mqtt_inflight *store){
+    if(store->_used < store->_capacity){
+        return 0;
+    }
+    if(store->_capacity && store->_used - store->_count >= store->_capacity / 4){
+        //已经删除的索引较多，整理即可腾出空间
+        mqtt_inflight_compact(store);
+        return 0;
+    }
+    int capacity = store->_capacity ? store->_capacity * 2 : INFLIGHT_MIN_MSG_COUNT;
+    //哈希表先开辟，保证索引数组扩容成功时哈希表一定足够大
+    int32_t *map = jimi_malloc(capacity * 2 * sizeof(int32_t));
+    mqtt_inflight_msg *msgs = map ? (store->_msgs ?
+                                     jimi_realloc(store->_msgs,capacity * sizeof(mqtt_inflight_msg)) :
+                                     jimi_malloc(capacity * sizeof(mqtt_inflight_msg))) : NULL;
+    if(!msgs){
+        LOGE("out of memory:%d",capacity);
+        jimi_free(map);
+        return -1;
+    }
+    store->_msgs = msgs;
+    store->_capacity = capacity;
+    jimi_free(store->_map);
+    store->_map = map;
+    store->_map_capacity = capacity * 2;
+    mqtt_inflight_map_rebuild(store);
+    return 0;
+}
+
+char *mqtt_inflight_reserve(mqtt_inflight *store,uint16_t pkt_id,uint32_t len){
+    return mqtt_inflight_reserve_shared(store,pkt_id,len,NULL);
+}
+
+char *mqtt_inflight_reserve_shared(mqtt_inflight *store,uint16_t pkt_id,uint32_t len,struct MqttPayload *shared){
+    CHECK_PTR(store,NULL);
+    if(!pkt_id){
+        return NULL;
+    }
+    mqtt_inflight_remove(store,pkt_id);
+    if(-1 == mqtt_inflight_grow_arena(store,len) || -1 == mqtt_inflight_grow_msgs(store)){
+        return NULL;
+    }
+
+    int32_t index = store->_used++;
+    mqtt_inflight_msg *msg = store->_msgs + index;
+    msg->_pkt_id = pkt_id;
+    msg->_offset = store->_arena_len;
+    msg->_len = len;
+    msg->_shared = shared ? MqttPayload_Retain(shared) : NULL;
+    store->_arena_len += len;
+    ++store->_count;
+    mqtt_inflight_map_insert(store,index);
+    return store->_arena + msg->_offset;
+}
+
+char *mqtt_inflight_find(mqtt_inflight *store,uint16_t pkt_id,uint32_t *len){
+    CHECK_PTR(store,NULL);
+    int32_t pos = mqtt_inflight_lookup(store,pkt_id);
+    if(pos == -1){
+        return NULL;
+    }
+    mqtt_inflight_msg *msg = store->_msgs + store->_map[pos];
+    if(len){
+        *len = msg->_len;
+    }
+    return store->_arena + msg->_offset;
+}
+
+struct MqttPayload *mqtt_inflight_find_shared(mqtt_inflight *store,uint16_t pkt_id){
+    CHECK_PTR(store,NULL);
+    int32_t pos = mqtt_inflight_lookup(store,pkt_id);
+    if(pos == -1){
+        return NULL;
+    }
+    return store->_msgs[store->_map[pos]]._shared;
+}
+
+int mqtt_inflight_remove(mqtt_inflight *store,uint16_t pkt_id){
+    CHECK_PTR(store,-1);
+    int32_t pos = mqtt_inflight_lookup(store,pkt_id);
+    if(pos == -1){
+        return -1;
+    }
+
+    int32_t index = store->_map[pos];
+    mqtt_inflight_map_erase(store,(uint32_t)pos);
+    mqtt_inflight_msg *msg = store->_msgs + index;
+    MqttPayload_Release(msg->_shared);
+    msg->_shared = NULL;
+    msg->_pkt_id = 0;
+    if(msg->_offset + msg->_len == store->_arena_len){
+        //位于内存池末尾，直接回收
+        store->_arena_len = msg->_offset;
+    }else{
+        store->_garbage += msg->_len;
+    }
+    --store->_count;
+    //回收末尾已经删除的索引
+    while(store->_used && !store->_msgs[store->_used - 1]._pkt_id){
+        --store->_used;
+    }
+
+    if(!store->_count){
+        store->_used = 0;
+        store->_arena_len = 0;
+        store->_garbage = 0;
+    }else if(store->_garbage > store->_arena_len / 2 || store->_used - store->_count > store->_used / 2){
+        //空洞或者已经删除的索引超过一半时整理
+        mqtt_inflight_compact(store);
+    }
+    return 0;
+}
+
+int mqtt_inflight_count(mqtt_inflight *store){
+    CHECK_PTR(store,0);
+    return store->_count;
+}
+
+mqtt_inflight_msg *mqtt_inflight_next(mqtt_inflight *store,int *index){
+    CHECK_PTR(store,NULL);
+    int i;
+    for(i = *index ; i < store->_used ; ++i){
+        if(store->_msgs[i]._pkt_id){
+            *index = i;
+            return store->_msgs + i;
+        }
+    }
+    return NULL;
+}
+
+char *mqtt_inflight_data(mqtt_inflight *store,mqtt_inflight_msg *msg){
+    CHECK_PTR(store,NULL);
+    CHECK_PTR(msg,NULL);
+    return store->_arena + msg->_offset;
+}
+
+uint32_t mqtt_inflight_bytes(mqtt_inflight *store){
+    CHECK_PTR(store,0);
+    return store->_arena_len - store->_garbage;
+}
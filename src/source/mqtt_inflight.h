@@ -0,0 +1,147 @@
+//
+// Created by xzl on 2019/7/12.
+//
+
+#ifndef MQTT_MQTT_INFLIGHT_H
+#define MQTT_MQTT_INFLIGHT_H
+
+#include <stdint.h>
+#include "mqtt_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 一个等待回复的数据包
+ */
+typedef struct {
+    //数据包id，0代表该数据包已经被删除，等待整理
+    uint16_t _pkt_id;
+    //数据包在内存池中的偏移量
+    uint32_t _offset;
+    //数据包长度，有共享负载时只包括负载之前的部分
+    uint32_t _len;
+    //共享负载，紧跟在内存池中的数据之后，为NULL代表数据包完整存放在内存池中
+    struct MqttPayload *_shared;
+} mqtt_inflight_msg;
+
+/**
+ * qos1/2发布消息的重发存储
+ * 所有数据包按发送顺序紧凑存放在同一块内存池中，删除数据包产生的空洞会被延迟整理
+ * 数据包id通过开放寻址哈希表映射到索引下标，查找、删除都是O(1)；
+ * 删除只把索引标记为已删除，保持发送顺序，已删除的索引与内存池空洞一起整理
+ */
+typedef struct {
+    //内存池
+    char *_arena;
+    //内存池已经使用的字节数(包括空洞)
+    uint32_t _arena_len;
+    //内存池开辟的字节数
+    uint32_t _arena_capacity;
+    //内存池中已经删除的数据包占用的字节数
+    uint32_t _garbage;
+    //按发送顺序排列的数据包索引，包括已经删除的
+    mqtt_inflight_msg *_msgs;
+    //_msgs已经使用的个数(包括已经删除的)
+    int _used;
+    //未删除的数据包个数
+    int _count;
+    int _capacity;
+    //数据包id到_msgs下标的哈希表，-1代表空位
+    int32_t *_map;
+    //哈希表大小，为2的n次方并且不小于_capacity的两倍
+    uint32_t _map_capacity;
+} mqtt_inflight;
+
+/**
+ * 初始化存储对象
+ * @param store 存储对象
+ */
+void mqtt_inflight_init(mqtt_inflight *store);
+
+/**
+ * 释放存储对象的所有内存
+ * @param store 存储对象
+ */
+void mqtt_inflight_release(mqtt_inflight *store);
+
+/**
+ * 为数据包预留内存，如果该数据包id已经存在则先删除
+ * @param store 存储对象
+ * @param pkt_id 数据包id
+ * @param len 数据包长度
+ * @return 可写入数据包的内存，在下次预留或删除前有效；失败返回NULL
+ */
+char *mqtt_inflight_reserve(mqtt_inflight *store,uint16_t pkt_id,uint32_t len);
+
+/**
+ * 为负载为共享负载的数据包预留内存，内存池中只存放负载之前的部分，负载与发送缓冲区共享
+ * @param store 存储对象
+ * @param pkt_id 数据包id
+ * @param len 负载之前部分的长度
+ * @param shared 共享负载，存储对象持有一个引用直到数据包被删除，为NULL时与mqtt_inflight_reserve相同
+ * @return 可写入负载之前部分的内存，在下次预留或删除前有效；失败返回NULL
+ */
+char *mqtt_inflight_reserve_shared(mqtt_inflight *store,uint16_t pkt_id,uint32_t len,struct MqttPayload *shared);
+
+/**
+ * 查找数据包
+ * @param store 存储对象
+ * @param pkt_id 数据包id
+ * @param len 返回数据包长度
+ * @return 数据包内存，在下次预留或删除前有效；未找到返回NULL
+ * @remark 数据包有共享负载时只返回负载之前的部分，负载通过mqtt_inflight_find_shared获取
+ */
+char *mqtt_inflight_find(mqtt_inflight *store,uint16_t pkt_id,uint32_t *len);
+
+/**
+ * 查找数据包的共享负载
+ * @param store 存储对象
+ * @param pkt_id 数据包id
+ * @return 共享负载，未找到或者没有共享负载时返回NULL
+ */
+struct MqttPayload *mqtt_inflight_find_shared(mqtt_inflight *store,uint16_t pkt_id);
+
+/**
+ * 删除数据包
+ * @param store 存储对象
+ * @param pkt_id 数据包id
+ * @return 0代表成功，-1代表未找到
+ */
+int mqtt_inflight_remove(mqtt_inflight *store,uint16_t pkt_id);
+
+/**
+ * 获取数据包个数
+ * @param store 存储对象
+ * @return 数据包个数
+ */
+int mqtt_inflight_count(mqtt_inflight *store);
+
+/**
+ * 按发送顺序遍历数据包，遍历期间不能预留或删除数据包
+ * @param store 存储对象
+ * @param index 从该下标开始查找，返回找到的下标，下次请传入 *index + 1；首次请传入0
+ * @return 数据包索引对象，NULL代表遍历结束
+ */
+mqtt_inflight_msg *mqtt_inflight_next(mqtt_inflight *store,int *index);
+
+/**
+ * 获取数据包在内存池中的数据
+ * @param store 存储对象
+ * @param msg mqtt_inflight_next返回的数据包索引对象
+ * @return 数据包内存，长度为msg->_len，在下次预留或删除前有效
+ */
+char *mqtt_inflight_data(mqtt_inflight *store,mqtt_inflight_msg *msg);
+
+/**
+ * 获取所有数据包占用内存池的字节数(不包括空洞以及共享负载)
+ * @param store 存储对象
+ * @return 字节数
+ */
+uint32_t mqtt_inflight_bytes(mqtt_inflight *store);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_INFLIGHT_H
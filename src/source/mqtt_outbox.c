@@ -0,0 +1,315 @@
+//
+// Created by xzl on 2019/7/15.
+//
+
+#include <memory.h>
+#include <string.h>
+#ifndef __alios__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "mqtt_outbox.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+#define OUTBOX_MAGIC 0x424F514D //"MQOB"
+//记录头：长度 + crc32
+#define OUTBOX_RECORD_HEAD 8
+//写到数据区末尾放不下时的回绕标记
+#define OUTBOX_WRAP 0xFFFFFFFF
+#define OUTBOX_ALIGN(n) (((n) + 3) & ~3)
+#define OUTBOX_RECORD_SIZE(len) OUTBOX_ALIGN(OUTBOX_RECORD_HEAD + (len))
+
+/**
+ * 文件头，位于映射内存的开始处
+ * 记录体格式：flags(1字节，qos | retain << 2) + 保留(1字节) + 主题长度(2字节，包括'\0') + 主题 + 负载
+ */
+typedef struct {
+    uint32_t _magic;
+    //数据区大小
+    uint32_t _capacity;
+    //最旧的记录的偏移量
+    uint32_t _head;
+    //下一条记录的写入偏移量
+    uint32_t _tail;
+    //记录条数
+    uint32_t _count;
+    uint32_t _reserved[3];
+} mqtt_outbox_head;
+
+#define OUTBOX_HEAD(outbox) ((mqtt_outbox_head *)(outbox)->_base)
+#define OUTBOX_DATA(outbox) ((outbox)->_base + sizeof(mqtt_outbox_head))
+
+static uint32_t s_crc_table[256];
+
+static uint32_t outbox_crc32(const char *data,uint32_t len){
+    if(!s_crc_table[1]){
+        uint32_t i,j;
+        for(i = 0 ; i < 256 ; ++i){
+            uint32_t c = i;
+            for(j = 0 ; j < 8 ; ++j){
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            }
+            s_crc_table[i] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    while(len--){
+        crc = s_crc_table[(crc ^ (uint8_t)*data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * 数据区末尾剩余空间放不下记录头或者遇到回绕标记时，下一条记录从数据区开始处读取
+ */
+static uint32_t outbox_normalize(mqtt_outbox *outbox,uint32_t pos){
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    if(head->_capacity - pos < OUTBOX_RECORD_HEAD ||
+       *((uint32_t *)(OUTBOX_DATA(outbox) + pos)) == OUTBOX_WRAP){
+        return 0;
+    }
+    return pos;
+}
+
+/**
+ * 校验pos处的记录
+ * @return 记录体长度，-1代表记录损坏
+ */
+static int64_t outbox_check_record(mqtt_outbox *outbox,uint32_t pos){
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    char *record = OUTBOX_DATA(outbox) + pos;
+    uint32_t len = ((uint32_t *)record)[0];
+    if(len < 4 || len > head->_capacity - pos - OUTBOX_RECORD_HEAD){
+        return -1;
+    }
+    if(outbox_crc32(record + OUTBOX_RECORD_HEAD,len) != ((uint32_t *)record)[1]){
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * 从最旧的记录开始校验，截断第一条损坏的记录及其之后的所有记录
+ */
+static void outbox_recover(mqtt_outbox *outbox){
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    if(head->_head >= head->_capacity || head->_tail >= head->_capacity){
+        head->_head = head->_tail = head->_count = 0;
+        return;
+    }
+    uint32_t pos = head->_head;
+    uint32_t count;
+    for(count = 0 ; count < head->_count ; ++count){
+        pos = outbox_normalize(outbox,pos);
+        int64_t len = outbox_check_record(outbox,pos);
+        if(len == -1){
+            LOGW("outbox record damaged, drop %d messages",head->_count - count);
+            break;
+        }
+        pos += OUTBOX_RECORD_SIZE(len);
+        if(pos == head->_capacity){
+            pos = 0;
+        }
+    }
+    head->_count = count;
+    head->_tail = pos;
+    if(!count){
+        head->_head = head->_tail = 0;
+    }
+}
+
+int mqtt_outbox_open(mqtt_outbox *outbox,const char *path,uint32_t capacity){
+    CHECK_PTR(outbox,-1);
+    memset(outbox,0, sizeof(mqtt_outbox));
+    outbox->_fd = -1;
+    capacity = OUTBOX_ALIGN(capacity);
+    outbox->_map_size = sizeof(mqtt_outbox_head) + capacity;
+
+#ifndef __alios__
+    if(path){
+        outbox->_fd = open(path,O_RDWR | O_CREAT,0644);
+        if(outbox->_fd == -1){
+            LOGE("open outbox file failed:%s",path);
+            return -1;
+        }
+        struct stat st;
+        int exist = (0 == fstat(outbox->_fd,&st) && st.st_size == outbox->_map_size);
+        if(!exist && -1 == ftruncate(outbox->_fd,outbox->_map_size)){
+            LOGE("ftruncate outbox file failed:%s",path);
+            close(outbox->_fd);
+            return -1;
+        }
+        outbox->_base = mmap(NULL,outbox->_map_size,PROT_READ | PROT_WRITE,MAP_SHARED,outbox->_fd,0);
+        if(outbox->_base == MAP_FAILED){
+            LOGE("mmap outbox file failed:%s",path);
+            outbox->_base = NULL;
+            close(outbox->_fd);
+            return -1;
+        }
+        mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+        if(exist && head->_magic == OUTBOX_MAGIC && head->_capacity == capacity){
+            outbox_recover(outbox);
+            LOGI("outbox recovered %d messages",head->_count);
+            return 0;
+        }
+    }
+#else
+    if(path){
+        LOGW("outbox file is not supported, messages are kept in memory only");
+    }
+#endif
+
+    if(!outbox->_base){
+        outbox->_base = jimi_malloc(outbox->_map_size);
+        if(!outbox->_base){
+            LOGE("out of memory:%d",outbox->_map_size);
+            return -1;
+        }
+    }
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    memset(head,0, sizeof(mqtt_outbox_head));
+    head->_magic = OUTBOX_MAGIC;
+    head->_capacity = capacity;
+    outbox->_dirty = 1;
+    return 0;
+}
+
+void mqtt_outbox_close(mqtt_outbox *outbox){
+    if(!outbox || !outbox->_base){
+        return;
+    }
+#ifndef __alios__
+    if(outbox->_fd != -1){
+        mqtt_outbox_sync(outbox);
+        munmap(outbox->_base,outbox->_map_size);
+        close(outbox->_fd);
+        outbox->_base = NULL;
+    }
+#endif
+    jimi_free(outbox->_base);
+    memset(outbox,0, sizeof(mqtt_outbox));
+    outbox->_fd = -1;
+}
+
+int mqtt_outbox_pop(mqtt_outbox *outbox){
+    CHECK_PTR(outbox,-1);
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    if(!head->_count){
+        return -1;
+    }
+    uint32_t pos = outbox_normalize(outbox,head->_head);
+    pos += OUTBOX_RECORD_SIZE(*((uint32_t *)(OUTBOX_DATA(outbox) + pos)));
+    head->_head = pos == head->_capacity ? 0 : pos;
+    if(!--head->_count){
+        head->_head = head->_tail = 0;
+    }
+    outbox->_dirty = 1;
+    return 0;
+}
+
+int mqtt_outbox_push(mqtt_outbox *outbox,const mqtt_outbox_msg *msg){
+    CHECK_PTR(outbox,-1);
+    CHECK_PTR(msg,-1);
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    uint32_t topic_len = strlen(msg->_topic) + 1;
+    uint32_t len = 4 + topic_len + msg->_payload_len;
+    uint32_t size = OUTBOX_RECORD_SIZE(len);
+    if(size > head->_capacity || topic_len > 0xFFFF){
+        LOGW("message too large for outbox:%d",size);
+        return -1;
+    }
+
+    //找到可以连续写入的位置，空间不足时丢弃最旧的消息
+    uint32_t pos;
+    while(1){
+        if(!head->_count){
+            head->_head = head->_tail = 0;
+        }
+        if(head->_count && head->_tail == head->_head){
+            //已经写满
+            mqtt_outbox_pop(outbox);
+            continue;
+        }
+        if(head->_tail >= head->_head){
+            if(head->_capacity - head->_tail >= size){
+                pos = head->_tail;
+                break;
+            }
+            if(head->_head >= size){
+                //末尾放不下，回绕到数据区开始处
+                if(head->_capacity - head->_tail >= OUTBOX_RECORD_HEAD){
+                    *((uint32_t *)(OUTBOX_DATA(outbox) + head->_tail)) = OUTBOX_WRAP;
+                }
+                pos = 0;
+                break;
+            }
+        }else if(head->_head - head->_tail >= size){
+            pos = head->_tail;
+            break;
+        }
+        LOGW("outbox is full, drop the oldest message");
+        mqtt_outbox_pop(outbox);
+    }
+
+    //先写记录体，再写记录头，最后更新文件头
+    char *record = OUTBOX_DATA(outbox) + pos;
+    char *body = record + OUTBOX_RECORD_HEAD;
+    body[0] = (char)((msg->_qos & 0x03) | (msg->_retain ? 0x04 : 0));
+    body[1] = 0;
+    body[2] = (char)(topic_len >> 8);
+    body[3] = (char)topic_len;
+    memcpy(body + 4,msg->_topic,topic_len);
+    memcpy(body + 4 + topic_len,msg->_payload,msg->_payload_len);
+    ((uint32_t *)record)[1] = outbox_crc32(body,len);
+    ((uint32_t *)record)[0] = len;
+
+    pos += size;
+    head->_tail = pos == head->_capacity ? 0 : pos;
+    ++head->_count;
+    outbox->_dirty = 1;
+    return 0;
+}
+
+int mqtt_outbox_peek(mqtt_outbox *outbox,mqtt_outbox_msg *msg){
+    CHECK_PTR(outbox,-1);
+    CHECK_PTR(msg,-1);
+    mqtt_outbox_head *head = OUTBOX_HEAD(outbox);
+    if(!head->_count){
+        return -1;
+    }
+    char *record = OUTBOX_DATA(outbox) + outbox_normalize(outbox,head->_head);
+    uint32_t len = ((uint32_t *)record)[0];
+    char *body = record + OUTBOX_RECORD_HEAD;
+    uint32_t topic_len = ((uint8_t)body[2] << 8) | (uint8_t)body[3];
+    msg->_qos = body[0] & 0x03;
+    msg->_retain = (body[0] & 0x04) ? 1 : 0;
+    msg->_topic = body + 4;
+    msg->_payload = body + 4 + topic_len;
+    msg->_payload_len = len - 4 - topic_len;
+    return 0;
+}
+
+uint32_t mqtt_outbox_count(mqtt_outbox *outbox){
+    if(!outbox || !outbox->_base){
+        return 0;
+    }
+    return OUTBOX_HEAD(outbox)->_count;
+}
+
+int mqtt_outbox_sync(mqtt_outbox *outbox){
+    CHECK_PTR(outbox,-1);
+    if(!outbox->_dirty){
+        return 0;
+    }
+    outbox->_dirty = 0;
+#ifndef __alios__
+    if(outbox->_fd != -1 && -1 == msync(outbox->_base,outbox->_map_size,MS_SYNC)){
+        LOGW("msync outbox failed");
+        return -1;
+    }
+#endif
+    return 0;
+}
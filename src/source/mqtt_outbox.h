@@ -0,0 +1,96 @@
+//
+// Created by xzl on 2019/7/15.
+//
+
+#ifndef MQTT_MQTT_OUTBOX_H
+#define MQTT_MQTT_OUTBOX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 离线消息队列，断线期间发布的消息暂存于此，重新登录后按顺序补发
+ * 数据存放在一个定长的环形日志中，每条记录带长度和crc32校验，空间不足时丢弃最旧的消息；
+ * 指定文件路径时通过mmap映射到文件，进程重启后仍然有效，否则只保存在内存中
+ */
+typedef struct {
+    //映射的内存，包括文件头和环形数据区
+    char *_base;
+    uint32_t _map_size;
+    //映射的文件描述符，-1代表只保存在内存中
+    int _fd;
+    //有未同步到磁盘的修改
+    int _dirty;
+} mqtt_outbox;
+
+/**
+ * 一条离线消息，指针指向队列内部，在下次写入或删除前有效
+ */
+typedef struct {
+    //以'\0'结尾的主题
+    const char *_topic;
+    const char *_payload;
+    uint32_t _payload_len;
+    int _qos;
+    int _retain;
+} mqtt_outbox_msg;
+
+/**
+ * 打开离线消息队列，文件已经存在时校验并恢复其中的消息
+ * @param outbox 队列对象
+ * @param path 文件路径，NULL代表只保存在内存中
+ * @param capacity 数据区大小，文件已经存在且大小不同时清空重建
+ * @return 0代表成功，-1代表失败
+ */
+int mqtt_outbox_open(mqtt_outbox *outbox,const char *path,uint32_t capacity);
+
+/**
+ * 同步到磁盘并释放队列对象
+ * @param outbox 队列对象
+ */
+void mqtt_outbox_close(mqtt_outbox *outbox);
+
+/**
+ * 追加一条消息，空间不足时丢弃最旧的消息
+ * @param outbox 队列对象
+ * @param msg 消息
+ * @return 0代表成功，-1代表消息比整个队列还大
+ */
+int mqtt_outbox_push(mqtt_outbox *outbox,const mqtt_outbox_msg *msg);
+
+/**
+ * 获取最旧的一条消息
+ * @param outbox 队列对象
+ * @param msg 返回消息
+ * @return 0代表成功，-1代表队列为空
+ */
+int mqtt_outbox_peek(mqtt_outbox *outbox,mqtt_outbox_msg *msg);
+
+/**
+ * 删除最旧的一条消息
+ * @param outbox 队列对象
+ * @return 0代表成功，-1代表队列为空
+ */
+int mqtt_outbox_pop(mqtt_outbox *outbox);
+
+/**
+ * 获取消息条数
+ * @param outbox 队列对象
+ * @return 消息条数
+ */
+uint32_t mqtt_outbox_count(mqtt_outbox *outbox);
+
+/**
+ * 把修改同步到磁盘，可能阻塞，请勿在发布消息的路径上调用
+ * @param outbox 队列对象
+ * @return 0代表成功，-1代表失败
+ */
+int mqtt_outbox_sync(mqtt_outbox *outbox);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_OUTBOX_H
@@ -0,0 +1,176 @@
+//
+// Created by xzl on 2019/7/23.
+//
+
+#include <stddef.h>
+#include <memory.h>
+#include "mqtt_stats.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+//峰值成员之前的成员都是计数
+#define STATS_COUNTERS ((int)(offsetof(mqtt_stats,_output_high_water) / sizeof(uint64_t)))
+#define STATS_FIELDS ((int)(sizeof(mqtt_stats) / sizeof(uint64_t)))
+
+//所有存活的统计对象以及已经销毁对象的累计统计
+static mqtt_stats **s_stats = NULL;
+static int s_stats_count = 0;
+static int s_stats_capacity = 0;
+static mqtt_stats s_retired;
+//对象创建销毁很少，使用自旋锁即可，不依赖具体平台的互斥锁
+static char s_stats_lock = 0;
+
+static void mqtt_stats_lock(){
+    while(__atomic_test_and_set(&s_stats_lock,__ATOMIC_ACQUIRE)){
+    }
+}
+
+static void mqtt_stats_unlock(){
+    __atomic_clear(&s_stats_lock,__ATOMIC_RELEASE);
+}
+
+void mqtt_stats_scanner_reset(mqtt_stats_scanner *scanner){
+    memset(scanner,0, sizeof(mqtt_stats_scanner));
+}
+
+static void mqtt_stats_count_pkt(mqtt_stats *stats,mqtt_stats_scanner *scanner,int output){
+    uint64_t bytes = 1 + scanner->_len_bytes + scanner->_remain;
+    if(output){
+        MQTT_STATS_ADD(stats->_pkts_out[scanner->_type],1);
+        MQTT_STATS_ADD(stats->_bytes_out[scanner->_type],bytes);
+    }else{
+        MQTT_STATS_ADD(stats->_pkts_in[scanner->_type],1);
+        MQTT_STATS_ADD(stats->_bytes_in[scanner->_type],bytes);
+    }
+}
+
+void mqtt_stats_scan(mqtt_stats *stats,mqtt_stats_scanner *scanner,int output,const char *data,uint32_t len){
+    const unsigned char *ptr = (const unsigned char *)data;
+    const unsigned char *end = ptr + len;
+    while(ptr < end){
+        switch (scanner->_state){
+            case 0:
+                scanner->_type = (*ptr++ >> 4) & 0x0F;
+                scanner->_len_bytes = 0;
+                scanner->_remain = 0;
+                scanner->_multiplier = 1;
+                scanner->_state = 1;
+                break;
+            case 1: {
+                unsigned char byte = *ptr++;
+                scanner->_remain += (byte & 0x7F) * scanner->_multiplier;
+                scanner->_multiplier *= 128;
+                ++scanner->_len_bytes;
+                if((byte & 0x80) && scanner->_len_bytes < 4){
+                    break;
+                }
+                mqtt_stats_count_pkt(stats,scanner,output);
+                scanner->_state = scanner->_remain ? 2 : 0;
+            }
+                break;
+            default: {
+                uint32_t skip = (uint32_t)(end - ptr);
+                if(skip > scanner->_remain){
+                    skip = scanner->_remain;
+                }
+                ptr += skip;
+                scanner->_remain -= skip;
+                if(!scanner->_remain){
+                    scanner->_state = 0;
+                }
+            }
+                break;
+        }
+    }
+}
+
+void mqtt_stats_snapshot(const mqtt_stats *stats,mqtt_stats *out){
+    const uint64_t *src = (const uint64_t *)stats;
+    uint64_t *dst = (uint64_t *)out;
+    int i;
+    for(i = 0 ; i < STATS_FIELDS ; ++i){
+        dst[i] = MQTT_STATS_LOAD(src[i]);
+    }
+}
+
+void mqtt_stats_merge(mqtt_stats *dst,const mqtt_stats *src){
+    const uint64_t *from = (const uint64_t *)src;
+    uint64_t *to = (uint64_t *)dst;
+    int i;
+    for(i = 0 ; i < STATS_COUNTERS ; ++i){
+        to[i] += from[i];
+    }
+    for(; i < STATS_FIELDS ; ++i){
+        if(from[i] > to[i]){
+            to[i] = from[i];
+        }
+    }
+}
+
+int mqtt_stats_register(mqtt_stats *stats){
+    CHECK_PTR(stats,-1);
+    int ret = 0;
+    mqtt_stats_lock();
+    if(s_stats_count == s_stats_capacity){
+        int capacity = s_stats_capacity ? s_stats_capacity * 2 : 8;
+        mqtt_stats **array = s_stats ? (mqtt_stats **)jimi_realloc(s_stats,capacity * sizeof(mqtt_stats *)) :
+                                       (mqtt_stats **)jimi_malloc(capacity * sizeof(mqtt_stats *));
+        if(array){
+            s_stats = array;
+            s_stats_capacity = capacity;
+        }else{
+            ret = -1;
+        }
+    }
+    if(ret == 0){
+        s_stats[s_stats_count++] = stats;
+    }
+    mqtt_stats_unlock();
+    return ret;
+}
+
+void mqtt_stats_unregister(mqtt_stats *stats){
+    mqtt_stats snapshot;
+    mqtt_stats_snapshot(stats,&snapshot);
+    mqtt_stats_lock();
+    int i;
+    for(i = 0 ; i < s_stats_count ; ++i){
+        if(s_stats[i] == stats){
+            s_stats[i] = s_stats[--s_stats_count];
+            mqtt_stats_merge(&s_retired,&snapshot);
+            break;
+        }
+    }
+    if(!s_stats_count){
+        jimi_free(s_stats);
+        s_stats = NULL;
+        s_stats_capacity = 0;
+    }
+    mqtt_stats_unlock();
+}
+
+int mqtt_stats_aggregate(mqtt_stats *out){
+    CHECK_PTR(out,-1);
+    mqtt_stats snapshot;
+    mqtt_stats_lock();
+    memcpy(out,&s_retired, sizeof(mqtt_stats));
+    int i;
+    for(i = 0 ; i < s_stats_count ; ++i){
+        mqtt_stats_snapshot(s_stats[i],&snapshot);
+        mqtt_stats_merge(out,&snapshot);
+    }
+    int count = s_stats_count;
+    mqtt_stats_unlock();
+    return count;
+}
+
+const char *mqtt_stats_pkt_name(int type){
+    static const char *names[MQTT_STATS_PKT_TYPES] = {
+            "RESERVED","CONNECT","CONNACK","PUBLISH","PUBACK","PUBREC","PUBREL","PUBCOMP",
+            "SUBSCRIBE","SUBACK","UNSUBSCRIBE","UNSUBACK","PINGREQ","PINGRESP","DISCONNECT","AUTH"
+    };
+    if(type < 0 || type >= MQTT_STATS_PKT_TYPES){
+        return "UNKNOWN";
+    }
+    return names[type];
+}
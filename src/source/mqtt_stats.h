@@ -0,0 +1,138 @@
+//
+// Created by xzl on 2019/7/23.
+//
+
+#ifndef MQTT_MQTT_STATS_H
+#define MQTT_MQTT_STATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+//数据包类型个数，以MqttPacketType为下标，0为无效类型
+#define MQTT_STATS_PKT_TYPES 16
+
+/**
+ * mqtt客户端对象的运行统计，所有成员均为uint64_t
+ * 每个对象的计数只由驱动该对象的线程修改，其他线程(例如shell命令)可以随时读取快照
+ */
+typedef struct {
+    //按数据包类型统计的收发包数与字节数
+    uint64_t _pkts_in[MQTT_STATS_PKT_TYPES];
+    uint64_t _bytes_in[MQTT_STATS_PKT_TYPES];
+    uint64_t _pkts_out[MQTT_STATS_PKT_TYPES];
+    uint64_t _bytes_out[MQTT_STATS_PKT_TYPES];
+    //发布成功的消息数(不含重发)
+    uint64_t _publishes;
+    //收到确认(PUBACK/PUBCOMP)的消息数
+    uint64_t _acks;
+    //等待回复超时(重发次数用完)的请求数
+    uint64_t _timeouts;
+    //超时重发以及重新登录后重发的数据包数
+    uint64_t _retransmits;
+    //解析收到的数据失败次数
+    uint64_t _parse_errors;
+    //登录成功次数以及其中重新登录的次数
+    uint64_t _connects;
+    uint64_t _reconnects;
+    //以下为峰值，汇总时取最大值而不是求和
+    //待发送字节数峰值
+    uint64_t _output_high_water;
+    //接收缓冲区中未处理字节数峰值
+    uint64_t _input_high_water;
+    //未确认的qos1/2消息个数峰值
+    uint64_t _inflight_high_water;
+} mqtt_stats;
+
+/**
+ * 从字节流中识别数据包边界，按类型统计包数与字节数
+ */
+typedef struct {
+    //0:等待固定头第一个字节，1:读取剩余长度，2:跳过剩余数据
+    uint8_t _state;
+    uint8_t _type;
+    uint8_t _len_bytes;
+    uint32_t _remain;
+    uint32_t _multiplier;
+} mqtt_stats_scanner;
+
+//计数器修改，只允许单线程写入，因此不需要原子加法；原子读写保证其他线程读取时不会撕裂
+//64位原子操作需要库函数支持的平台(例如32位Cortex-M的裸机libgcc不提供__atomic_load_8)，退化为普通读写，其他线程读取时可能撕裂
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define MQTT_STATS_LOAD(field) __atomic_load_n(&(field),__ATOMIC_RELAXED)
+#define MQTT_STATS_STORE(field,val) __atomic_store_n(&(field),(val),__ATOMIC_RELAXED)
+#else
+#define MQTT_STATS_LOAD(field) (*(volatile uint64_t *)&(field))
+#define MQTT_STATS_STORE(field,val) (*(volatile uint64_t *)&(field) = (val))
+#endif
+#define MQTT_STATS_ADD(field,n) MQTT_STATS_STORE(field,MQTT_STATS_LOAD(field) + (n))
+#define MQTT_STATS_MAX(field,val) do{ \
+        uint64_t _v = (val); \
+        if(_v > MQTT_STATS_LOAD(field)){ \
+            MQTT_STATS_STORE(field,_v); \
+        } \
+    }while(0)
+
+/**
+ * 重置数据包边界识别状态，断线后调用
+ * @param scanner 识别对象
+ */
+void mqtt_stats_scanner_reset(mqtt_stats_scanner *scanner);
+
+/**
+ * 统计收到或者发出的字节流
+ * @param stats 统计对象
+ * @param scanner 该方向的识别对象
+ * @param output 非0代表发出的数据
+ * @param data 数据
+ * @param len 数据长度
+ */
+void mqtt_stats_scan(mqtt_stats *stats,mqtt_stats_scanner *scanner,int output,const char *data,uint32_t len);
+
+/**
+ * 读取统计快照
+ * @param stats 统计对象
+ * @param out 快照
+ */
+void mqtt_stats_snapshot(const mqtt_stats *stats,mqtt_stats *out);
+
+/**
+ * 把src快照累加到dst，计数求和，峰值取最大值
+ * @param dst 目标
+ * @param src 源快照
+ */
+void mqtt_stats_merge(mqtt_stats *dst,const mqtt_stats *src);
+
+/**
+ * 登记统计对象，参与全局汇总
+ * @param stats 统计对象
+ * @return 0为成功
+ */
+int mqtt_stats_register(mqtt_stats *stats);
+
+/**
+ * 注销统计对象，其计数累加到全局汇总中已销毁对象的部分
+ * @param stats 统计对象
+ */
+void mqtt_stats_unregister(mqtt_stats *stats);
+
+/**
+ * 汇总进程内所有mqtt客户端对象(包括已经销毁的)的统计，可以在任意线程调用
+ * @param out 汇总结果
+ * @return 当前存活的对象个数
+ */
+int mqtt_stats_aggregate(mqtt_stats *out);
+
+/**
+ * 获取数据包类型名称
+ * @param type 数据包类型，@see MqttPacketType
+ * @return 名称
+ */
+const char *mqtt_stats_pkt_name(int type);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_STATS_H
@@ -0,0 +1,235 @@
+//
+// Created by xzl on 2019/7/14.
+//
+
+#include <memory.h>
+#include "mqtt_timer_wheel.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MIN_NODES 16
+//最高层能表示的最大定时时长
+#define TIMER_WHEEL_MAX_DELAY (((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+void mqtt_timer_wheel_init(mqtt_timer_wheel *wheel,uint64_t now){
+    memset(wheel,0, sizeof(mqtt_timer_wheel));
+    memset(wheel->_heads,0xFF, sizeof(wheel->_heads));
+    wheel->_current = now;
+    wheel->_free = -1;
+}
+
+void mqtt_timer_wheel_release(mqtt_timer_wheel *wheel){
+    jimi_free(wheel->_nodes);
+    mqtt_timer_wheel_init(wheel,wheel->_current);
+}
+
+static void mqtt_timer_wheel_link(mqtt_timer_wheel *wheel,int32_t index,int level,int slot){
+    mqtt_timer_node *node = wheel->_nodes + index;
+    int32_t *head = &wheel->_heads[level][slot];
+    node->_slot = level * TIMER_WHEEL_SLOTS + slot;
+    node->_prev = -1;
+    node->_next = *head;
+    if(*head != -1){
+        wheel->_nodes[*head]._prev = index;
+    }
+    *head = index;
+    wheel->_occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void mqtt_timer_wheel_unlink(mqtt_timer_wheel *wheel,int32_t index){
+    mqtt_timer_node *node = wheel->_nodes + index;
+    int level = node->_slot / TIMER_WHEEL_SLOTS;
+    int slot = node->_slot % TIMER_WHEEL_SLOTS;
+    if(node->_prev != -1){
+        wheel->_nodes[node->_prev]._next = node->_next;
+    }else{
+        wheel->_heads[level][slot] = node->_next;
+        if(node->_next == -1){
+            wheel->_occupied[level] &= ~((uint64_t)1 << slot);
+        }
+    }
+    if(node->_next != -1){
+        wheel->_nodes[node->_next]._prev = node->_prev;
+    }
+}
+
+/**
+ * 根据到期时间把节点放入对应层的槽位
+ * @param earliest 最早的触发时间，添加定时器时当前槽位已经处理过，只能放在下一毫秒；
+ *                 降层时当前槽位还未处理
+ */
+static void mqtt_timer_wheel_place(mqtt_timer_wheel *wheel,int32_t index,uint64_t earliest){
+    uint64_t expires = wheel->_nodes[index]._expires;
+    if(expires < earliest){
+        expires = earliest;
+    }
+    uint64_t delta = expires - wheel->_current;
+    if(delta > TIMER_WHEEL_MAX_DELAY){
+        //超过最大定时时长，先放在最高层，到时再重新计算
+        expires = wheel->_current + TIMER_WHEEL_MAX_DELAY;
+        delta = TIMER_WHEEL_MAX_DELAY;
+    }
+    int level = 0;
+    while(delta >> (TIMER_WHEEL_BITS * (level + 1))){
+        ++level;
+    }
+    mqtt_timer_wheel_link(wheel,index,level,(int)((expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK));
+}
+
+static int mqtt_timer_wheel_grow(mqtt_timer_wheel *wheel){
+    int32_t capacity = wheel->_capacity ? wheel->_capacity * 2 : TIMER_WHEEL_MIN_NODES;
+    mqtt_timer_node *nodes = wheel->_nodes ?
+                             jimi_realloc(wheel->_nodes,capacity * sizeof(mqtt_timer_node)) :
+                             jimi_malloc(capacity * sizeof(mqtt_timer_node));
+    if(!nodes){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    int32_t i;
+    for(i = capacity - 1 ; i >= wheel->_capacity ; --i){
+        nodes[i]._slot = -1;
+        nodes[i]._next = wheel->_free;
+        wheel->_free = i;
+    }
+    wheel->_nodes = nodes;
+    wheel->_capacity = capacity;
+    return 0;
+}
+
+uint32_t mqtt_timer_wheel_add(mqtt_timer_wheel *wheel,uint64_t now,uint32_t delay_ms,uint32_t key){
+    CHECK_PTR(wheel,0);
+    if(wheel->_free == -1 && -1 == mqtt_timer_wheel_grow(wheel)){
+        return 0;
+    }
+    if(!wheel->_count && now > wheel->_current){
+        //时间轮为空，直接同步到当前时间
+        wheel->_current = now;
+    }
+    int32_t index = wheel->_free;
+    mqtt_timer_node *node = wheel->_nodes + index;
+    wheel->_free = node->_next;
+    node->_expires = now + delay_ms;
+    node->_key = key;
+    mqtt_timer_wheel_place(wheel,index,wheel->_current + 1);
+    ++wheel->_count;
+    return (uint32_t)index + 1;
+}
+
+void mqtt_timer_wheel_cancel(mqtt_timer_wheel *wheel,uint32_t timer){
+    if(!wheel || !timer || timer > (uint32_t)wheel->_capacity){
+        return;
+    }
+    int32_t index = (int32_t)timer - 1;
+    mqtt_timer_node *node = wheel->_nodes + index;
+    if(node->_slot == -1){
+        LOGW("timer already canceled:%d",timer);
+        return;
+    }
+    mqtt_timer_wheel_unlink(wheel,index);
+    node->_slot = -1;
+    node->_next = wheel->_free;
+    wheel->_free = index;
+    --wheel->_count;
+}
+
+/**
+ * 第0层转完一圈，把高层对应槽位的定时器重新放置到低层
+ */
+static void mqtt_timer_wheel_cascade(mqtt_timer_wheel *wheel){
+    int level;
+    for(level = 1 ; level < TIMER_WHEEL_LEVELS ; ++level){
+        int slot = (int)((wheel->_current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        int32_t index = wheel->_heads[level][slot];
+        wheel->_heads[level][slot] = -1;
+        wheel->_occupied[level] &= ~((uint64_t)1 << slot);
+        while(index != -1){
+            int32_t next = wheel->_nodes[index]._next;
+            mqtt_timer_wheel_place(wheel,index,wheel->_current);
+            index = next;
+        }
+        if(slot){
+            //本层还没转完一圈，更高层不需要处理
+            break;
+        }
+    }
+}
+
+void mqtt_timer_wheel_expire(mqtt_timer_wheel *wheel,uint64_t now,mqtt_timer_cb cb,void *arg){
+    CHECK_PTR(wheel,);
+    while(wheel->_current < now){
+        if(!wheel->_count){
+            wheel->_current = now;
+            break;
+        }
+        //查找第0层本圈内下一个非空槽位，没有则直接跳到下一圈开始
+        int slot = (int)(wheel->_current & TIMER_WHEEL_MASK) + 1;
+        while(slot < TIMER_WHEEL_SLOTS && !(wheel->_occupied[0] & ((uint64_t)1 << slot))){
+            ++slot;
+        }
+        uint64_t next = (wheel->_current & ~(uint64_t)TIMER_WHEEL_MASK) + slot;
+        if(next > now){
+            wheel->_current = now;
+            break;
+        }
+        wheel->_current = next;
+        if(!(next & TIMER_WHEEL_MASK)){
+            mqtt_timer_wheel_cascade(wheel);
+        }
+
+        //逐个摘下到期节点再回调，回调中添加的定时器不会落在本槽位
+        slot = (int)(next & TIMER_WHEEL_MASK);
+        while(wheel->_heads[0][slot] != -1){
+            int32_t index = wheel->_heads[0][slot];
+            uint32_t key = wheel->_nodes[index]._key;
+            mqtt_timer_wheel_cancel(wheel,(uint32_t)index + 1);
+            if(cb){
+                cb(arg,key);
+            }
+        }
+    }
+}
+
+int mqtt_timer_wheel_next(mqtt_timer_wheel *wheel,uint64_t *expires){
+    CHECK_PTR(wheel,-1);
+    if(!wheel->_count){
+        return -1;
+    }
+    int found = 0;
+    int level;
+    for(level = 0 ; level < TIMER_WHEEL_LEVELS ; ++level){
+        if(!wheel->_occupied[level]){
+            continue;
+        }
+        //按转动顺序查找本层第一个非空槽位，该槽位中的定时器是本层最早到期的
+        int shift = TIMER_WHEEL_BITS * level;
+        int start = (int)((wheel->_current >> shift) & TIMER_WHEEL_MASK) + 1;
+        int i;
+        for(i = 0 ; i < TIMER_WHEEL_SLOTS ; ++i){
+            int slot = (start + i) & TIMER_WHEEL_MASK;
+            if(!(wheel->_occupied[level] & ((uint64_t)1 << slot))){
+                continue;
+            }
+            //槽位开始的时间，此时该槽位的定时器降层或者触发
+            uint64_t slot_time = ((wheel->_current >> shift) + 1 + i) << shift;
+            int32_t index;
+            for(index = wheel->_heads[level][slot] ; index != -1 ; index = wheel->_nodes[index]._next){
+                uint64_t node_expires = wheel->_nodes[index]._expires;
+                if(node_expires >= slot_time + ((uint64_t)1 << shift)){
+                    //超过最大定时时长被放在最高层的定时器，到槽位时间时需要重新放置
+                    node_expires = slot_time;
+                }
+                if(!found || node_expires < *expires){
+                    *expires = node_expires;
+                    found = 1;
+                }
+            }
+            break;
+        }
+    }
+    if(found && *expires <= wheel->_current){
+        //已经到期的定时器在下一毫秒触发
+        *expires = wheel->_current + 1;
+    }
+    return found ? 0 : -1;
+}
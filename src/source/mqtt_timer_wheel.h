@@ -0,0 +1,112 @@
+//
+// Created by xzl on 2019/7/14.
+//
+
+#ifndef MQTT_MQTT_TIMER_WHEEL_H
+#define MQTT_MQTT_TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+//每层时间轮的槽位个数(2的n次方)
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+//时间轮层数，4层的最大定时时长为 2^24 毫秒(约4.6小时)，更长的定时器在最高层循环等待
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * 定时器节点，通过数组下标组成双向链表，节点数组扩容时链表依然有效
+ */
+typedef struct {
+    //到期时间，单位毫秒
+    uint64_t _expires;
+    //用户指定的定时器标识
+    uint32_t _key;
+    //所在槽位(层 * TIMER_WHEEL_SLOTS + 槽位)，-1代表空闲节点
+    int32_t _slot;
+    int32_t _prev;
+    int32_t _next;
+} mqtt_timer_node;
+
+/**
+ * 分层时间轮，精度为1毫秒
+ * 添加、取消定时器都是O(1)，到期处理时只访问有定时器的槽位
+ */
+typedef struct {
+    //时间轮当前时间，单位毫秒
+    uint64_t _current;
+    //每个槽位的链表头，-1代表空
+    int32_t _heads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    //每层槽位非空位图
+    uint64_t _occupied[TIMER_WHEEL_LEVELS];
+    //节点数组
+    mqtt_timer_node *_nodes;
+    int32_t _capacity;
+    //空闲节点链表头
+    int32_t _free;
+    //定时器个数
+    int32_t _count;
+} mqtt_timer_wheel;
+
+/**
+ * 定时器到期回调
+ * @param arg 用户数据指针
+ * @param key 定时器标识
+ */
+typedef void (*mqtt_timer_cb)(void *arg,uint32_t key);
+
+/**
+ * 初始化时间轮
+ * @param wheel 时间轮对象
+ * @param now 当前时间，单位毫秒，请使用单调递增的时钟
+ */
+void mqtt_timer_wheel_init(mqtt_timer_wheel *wheel,uint64_t now);
+
+/**
+ * 释放时间轮的所有内存
+ * @param wheel 时间轮对象
+ */
+void mqtt_timer_wheel_release(mqtt_timer_wheel *wheel);
+
+/**
+ * 添加定时器
+ * @param wheel 时间轮对象
+ * @param now 当前时间，单位毫秒
+ * @param delay_ms 多少毫秒后到期
+ * @param key 定时器标识，到期时传给回调函数
+ * @return 定时器句柄，用于取消定时器；0代表失败
+ */
+uint32_t mqtt_timer_wheel_add(mqtt_timer_wheel *wheel,uint64_t now,uint32_t delay_ms,uint32_t key);
+
+/**
+ * 取消定时器，定时器到期触发回调后句柄即失效，请勿再取消
+ * @param wheel 时间轮对象
+ * @param timer 定时器句柄
+ */
+void mqtt_timer_wheel_cancel(mqtt_timer_wheel *wheel,uint32_t timer);
+
+/**
+ * 推进时间轮，触发所有到期的定时器
+ * 回调中可以添加、取消定时器
+ * @param wheel 时间轮对象
+ * @param now 当前时间，单位毫秒
+ * @param cb 定时器到期回调
+ * @param arg 回调用户数据指针
+ */
+void mqtt_timer_wheel_expire(mqtt_timer_wheel *wheel,uint64_t now,mqtt_timer_cb cb,void *arg);
+
+/**
+ * 获取最近一个定时器的到期时间
+ * @param wheel 时间轮对象
+ * @param expires 返回到期时间，单位毫秒；已经到期的定时器返回时间轮当前时间加1毫秒
+ * @return 0代表成功，-1代表没有定时器
+ */
+int mqtt_timer_wheel_next(mqtt_timer_wheel *wheel,uint64_t *expires);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_TIMER_WHEEL_H
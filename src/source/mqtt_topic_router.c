@@ -0,0 +1,465 @@
+//
+// Created by xzl on 2019/7/16.
+//
+
+#include <stddef.h>
+#include <memory.h>
+#include <string.h>
+#include "mqtt_topic_router.h"
+#include "jimi_memory.h"
+#include "jimi_log.h"
+
+#define ROUTER_MIN_SIZE 16
+#define ROUTER_BUCKET_EMPTY (-1)
+#define ROUTER_BUCKET_DELETED (-2)
+#define ROUTER_ROOT 0
+
+/**
+ * (父节点，本层名称)的哈希值，FNV-1a
+ */
+static uint32_t router_hash(int32_t parent,const char *segment,uint32_t len){
+    uint32_t hash = 2166136261u ^ ((uint32_t)parent * 0x9E3779B1u);
+    while(len--){
+        hash = (hash ^ (uint8_t)*segment++) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * 扩大数组容量，新增的元素通过 next_field 串成空闲链表
+ */
+static void *router_grow(void *array,int32_t *capacity,int32_t *free_head,uint32_t elem_size,uint32_t next_offset){
+    int32_t size = *capacity ? *capacity * 2 : ROUTER_MIN_SIZE;
+    char *ptr = array ? jimi_realloc(array,size * elem_size) : jimi_malloc(size * elem_size);
+    if(!ptr){
+        LOGE("out of memory:%d",size);
+        return NULL;
+    }
+    int32_t i;
+    for(i = size - 1 ; i >= *capacity ; --i){
+        memset(ptr + i * elem_size,0xFF,elem_size);
+        *((int32_t *)(ptr + i * elem_size + next_offset)) = *free_head;
+        *free_head = i;
+    }
+    *capacity = size;
+    return ptr;
+}
+
+void mqtt_topic_router_init(mqtt_topic_router *router){
+    memset(router,0, sizeof(mqtt_topic_router));
+    router->_node_free = -1;
+    router->_route_free = -1;
+}
+
+void mqtt_topic_router_release(mqtt_topic_router *router){
+    int32_t i;
+    for(i = 0 ; i < router->_node_capacity ; ++i){
+        if(router->_nodes[i]._segment != (char *)-1){
+            jimi_free(router->_nodes[i]._segment);
+        }
+    }
+    jimi_free(router->_nodes);
+    jimi_free(router->_routes);
+    jimi_free(router->_buckets);
+    mqtt_topic_router_init(router);
+}
+
+/**
+ * 查找普通子节点
+ * @return 节点下标，-1代表未找到
+ */
+static int32_t router_find_child(mqtt_topic_router *router,int32_t parent,const char *segment,uint32_t len){
+    if(!router->_bucket_capacity){
+        return -1;
+    }
+    uint32_t hash = router_hash(parent,segment,len);
+    uint32_t mask = router->_bucket_capacity - 1;
+    uint32_t i;
+    for(i = hash & mask ; ; i = (i + 1) & mask){
+        int32_t index = router->_buckets[i];
+        if(index == ROUTER_BUCKET_EMPTY){
+            return -1;
+        }
+        if(index == ROUTER_BUCKET_DELETED){
+            continue;
+        }
+        mqtt_topic_node *node = router->_nodes + index;
+        if(node->_hash == hash && node->_parent == parent && node->_seg_len == len &&
+           0 == memcmp(node->_segment,segment,len)){
+            return index;
+        }
+    }
+}
+
+static void router_bucket_put(int32_t *buckets,uint32_t capacity,uint32_t hash,int32_t index){
+    uint32_t i;
+    for(i = hash & (capacity - 1) ; buckets[i] >= 0 ; i = (i + 1) & (capacity - 1));
+    buckets[i] = index;
+}
+
+/**
+ * 负载因子超过1/2时重建哈希表，同时清理已删除标记
+ */
+static int router_bucket_reserve(mqtt_topic_router *router){
+    if((router->_bucket_used + 1) * 2 <= router->_bucket_capacity){
+        return 0;
+    }
+    uint32_t live = 0;
+    uint32_t i;
+    for(i = 0 ; i < router->_bucket_capacity ; ++i){
+        if(router->_buckets[i] >= 0){
+            ++live;
+        }
+    }
+    uint32_t capacity = ROUTER_MIN_SIZE;
+    while(capacity < (live + 1) * 4){
+        capacity <<= 1;
+    }
+    int32_t *buckets = jimi_malloc(capacity * sizeof(int32_t));
+    if(!buckets){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    memset(buckets,0xFF,capacity * sizeof(int32_t));
+    for(i = 0 ; i < router->_bucket_capacity ; ++i){
+        int32_t index = router->_buckets[i];
+        if(index >= 0){
+            router_bucket_put(buckets,capacity,router->_nodes[index]._hash,index);
+        }
+    }
+    jimi_free(router->_buckets);
+    router->_buckets = buckets;
+    router->_bucket_capacity = capacity;
+    router->_bucket_used = live;
+    return 0;
+}
+
+/**
+ * 分配一个节点并挂到父节点下
+ * @param type '+'、'#'或者0(普通节点)
+ * @return 节点下标，-1代表内存不足
+ */
+static int32_t router_new_node(mqtt_topic_router *router,int32_t parent,char type,const char *segment,uint32_t len){
+    if(router->_node_free == -1){
+        mqtt_topic_node *nodes = router_grow(router->_nodes,&router->_node_capacity,&router->_node_free,
+                                             sizeof(mqtt_topic_node),offsetof(mqtt_topic_node,_parent));
+        if(!nodes){
+            return -1;
+        }
+        router->_nodes = nodes;
+    }
+    char *copy = NULL;
+    if(parent != -1 && !type){
+        if(-1 == router_bucket_reserve(router)){
+            return -1;
+        }
+        copy = jimi_malloc(len + 1);
+        if(!copy){
+            LOGE("out of memory:%d",len + 1);
+            return -1;
+        }
+        memcpy(copy,segment,len);
+        copy[len] = '\0';
+    }
+
+    int32_t index = router->_node_free;
+    mqtt_topic_node *node = router->_nodes + index;
+    router->_node_free = node->_parent;
+    node->_segment = copy;
+    node->_seg_len = len;
+    node->_hash = 0;
+    node->_parent = parent;
+    node->_plus = node->_multi = -1;
+    node->_children = 0;
+    node->_routes = -1;
+    if(parent == -1){
+        return index;
+    }
+
+    mqtt_topic_node *parent_node = router->_nodes + parent;
+    ++parent_node->_children;
+    if(type == '+'){
+        parent_node->_plus = index;
+    }else if(type == '#'){
+        parent_node->_multi = index;
+    }else{
+        node->_hash = router_hash(parent,segment,len);
+        router_bucket_put(router->_buckets,router->_bucket_capacity,node->_hash,index);
+        ++router->_bucket_used;
+    }
+    return index;
+}
+
+/**
+ * 从节点开始向上删除没有路由也没有子节点的节点
+ */
+static void router_prune(mqtt_topic_router *router,int32_t index){
+    while(index != ROUTER_ROOT){
+        mqtt_topic_node *node = router->_nodes + index;
+        if(node->_routes != -1 || node->_children){
+            return;
+        }
+        int32_t parent = node->_parent;
+        mqtt_topic_node *parent_node = router->_nodes + parent;
+        if(parent_node->_plus == index){
+            parent_node->_plus = -1;
+        }else if(parent_node->_multi == index){
+            parent_node->_multi = -1;
+        }else{
+            uint32_t mask = router->_bucket_capacity - 1;
+            uint32_t i;
+            for(i = node->_hash & mask ; router->_buckets[i] != index ; i = (i + 1) & mask);
+            router->_buckets[i] = ROUTER_BUCKET_DELETED;
+        }
+        --parent_node->_children;
+        jimi_free(node->_segment);
+        node->_segment = (char *)-1;
+        node->_parent = router->_node_free;
+        router->_node_free = index;
+        index = parent;
+    }
+}
+
+uint32_t mqtt_topic_router_add(mqtt_topic_router *router,const char *filter,mqtt_handle_topic cb,void *user_data){
+    CHECK_PTR(router,0);
+    CHECK_PTR(filter,0);
+    CHECK_PTR(cb,0);
+    if(!*filter){
+        LOGW("empty topic filter");
+        return 0;
+    }
+    if(!router->_node_capacity && -1 == router_new_node(router,-1,0,NULL,0)){
+        return 0;
+    }
+
+    int32_t index = ROUTER_ROOT;
+    const char *level = filter;
+    while(1){
+        const char *end = strchr(level,'/');
+        uint32_t len = end ? end - level : strlen(level);
+        char type = 0;
+        if(len == 1 && (*level == '+' || *level == '#')){
+            type = *level;
+        }else if(memchr(level,'+',len) || memchr(level,'#',len)){
+            LOGW("invalid topic filter:%s",filter);
+            router_prune(router,index);
+            return 0;
+        }
+        if(type == '#' && end){
+            LOGW("'#' must be the last level:%s",filter);
+            router_prune(router,index);
+            return 0;
+        }
+
+        int32_t child;
+        if(type == '+'){
+            child = router->_nodes[index]._plus;
+        }else if(type == '#'){
+            child = router->_nodes[index]._multi;
+        }else{
+            child = router_find_child(router,index,level,len);
+        }
+        if(child == -1){
+            child = router_new_node(router,index,type,level,len);
+            if(child == -1){
+                router_prune(router,index);
+                return 0;
+            }
+        }
+        index = child;
+        if(!end){
+            break;
+        }
+        level = end + 1;
+    }
+
+    if(router->_route_free == -1){
+        mqtt_topic_route *routes = router_grow(router->_routes,&router->_route_capacity,&router->_route_free,
+                                               sizeof(mqtt_topic_route),offsetof(mqtt_topic_route,_next));
+        if(!routes){
+            router_prune(router,index);
+            return 0;
+        }
+        router->_routes = routes;
+    }
+    int32_t id = router->_route_free;
+    mqtt_topic_route *route = router->_routes + id;
+    mqtt_topic_node *node = router->_nodes + index;
+    router->_route_free = route->_next;
+    route->_cb = cb;
+    route->_user_data = user_data;
+    route->_node = index;
+    route->_prev = -1;
+    route->_next = node->_routes;
+    if(node->_routes != -1){
+        router->_routes[node->_routes]._prev = id;
+    }
+    node->_routes = id;
+    ++router->_route_count;
+    return (uint32_t)id + 1;
+}
+
+static void router_unlink_route(mqtt_topic_router *router,int32_t id){
+    mqtt_topic_route *route = router->_routes + id;
+    int32_t index = route->_node;
+    if(route->_prev != -1){
+        router->_routes[route->_prev]._next = route->_next;
+    }else{
+        router->_nodes[index]._routes = route->_next;
+    }
+    if(route->_next != -1){
+        router->_routes[route->_next]._prev = route->_prev;
+    }
+    route->_node = -1;
+    route->_cb = NULL;
+    route->_next = router->_route_free;
+    router->_route_free = id;
+    --router->_route_count;
+    router_prune(router,index);
+}
+
+int mqtt_topic_router_remove(mqtt_topic_router *router,uint32_t route){
+    CHECK_PTR(router,-1);
+    if(!route || route > (uint32_t)router->_route_capacity){
+        return -1;
+    }
+    int32_t id = (int32_t)route - 1;
+    if(router->_routes[id]._node == -1 || !router->_routes[id]._cb){
+        LOGW("route already removed:%d",route);
+        return -1;
+    }
+    if(router->_dispatching){
+        //正在遍历路由链表，先标记，分发结束后再删除
+        router->_routes[id]._cb = NULL;
+        ++router->_dead;
+        return 0;
+    }
+    router_unlink_route(router,id);
+    return 0;
+}
+
+/**
+ * 回调节点上的所有路由，回调中添加的路由插入链表头，本次不会被回调
+ */
+static int router_notify(mqtt_topic_router *router,
+                         int32_t index,
+                         uint16_t pkt_id,
+                         const char *topic,
+                         const char *payload,
+                         uint32_t payloadsize,
+                         int dup,
+                         enum MqttQosLevel qos){
+    int count = 0;
+    int32_t id = router->_nodes[index]._routes;
+    while(id != -1){
+        //回调中可能扩容路由数组，先取出所需字段
+        mqtt_handle_topic cb = router->_routes[id]._cb;
+        void *user_data = router->_routes[id]._user_data;
+        int32_t next = router->_routes[id]._next;
+        if(cb){
+            cb(user_data,pkt_id,topic,payload,payloadsize,dup,qos);
+            ++count;
+        }
+        id = next;
+    }
+    return count;
+}
+
+/**
+ * 按层匹配主题，level为本层名称起始位置，NULL代表主题已经匹配完
+ */
+static int router_match(mqtt_topic_router *router,
+                        int32_t index,
+                        const char *level,
+                        uint16_t pkt_id,
+                        const char *topic,
+                        const char *payload,
+                        uint32_t payloadsize,
+                        int dup,
+                        enum MqttQosLevel qos){
+    int count = 0;
+    //'$'开头的主题不匹配首层的通配符
+    int wildcard = !(index == ROUTER_ROOT && *topic == '$');
+    if(!level){
+        count += router_notify(router,index,pkt_id,topic,payload,payloadsize,dup,qos);
+        //"a/#"也匹配"a"
+        if(router->_nodes[index]._multi != -1){
+            count += router_notify(router,router->_nodes[index]._multi,pkt_id,topic,payload,payloadsize,dup,qos);
+        }
+        return count;
+    }
+
+    const char *end = strchr(level,'/');
+    uint32_t len = end ? end - level : strlen(level);
+    const char *next = end ? end + 1 : NULL;
+    if(wildcard && router->_nodes[index]._multi != -1){
+        count += router_notify(router,router->_nodes[index]._multi,pkt_id,topic,payload,payloadsize,dup,qos);
+    }
+    //回调中可能扩容节点数组，每次都重新取节点
+    if(wildcard && router->_nodes[index]._plus != -1){
+        count += router_match(router,router->_nodes[index]._plus,next,pkt_id,topic,payload,payloadsize,dup,qos);
+    }
+    int32_t child = router_find_child(router,index,level,len);
+    if(child != -1){
+        count += router_match(router,child,next,pkt_id,topic,payload,payloadsize,dup,qos);
+    }
+    return count;
+}
+
+int mqtt_topic_router_dispatch(mqtt_topic_router *router,
+                               uint16_t pkt_id,
+                               const char *topic,
+                               const char *payload,
+                               uint32_t payloadsize,
+                               int dup,
+                               enum MqttQosLevel qos){
+    CHECK_PTR(router,0);
+    CHECK_PTR(topic,0);
+    if(!router->_route_count){
+        return 0;
+    }
+    ++router->_dispatching;
+    int count = router_match(router,ROUTER_ROOT,topic,pkt_id,topic,payload,payloadsize,dup,qos);
+    if(!--router->_dispatching && router->_dead){
+        //删除分发期间被标记的路由
+        int32_t id;
+        for(id = 0 ; id < router->_route_capacity && router->_dead ; ++id){
+            if(router->_routes[id]._node != -1 && !router->_routes[id]._cb){
+                router_unlink_route(router,id);
+                --router->_dead;
+            }
+        }
+    }
+    return count;
+}
+
+int mqtt_topic_router_match(const char *filter,const char *topic){
+    CHECK_PTR(filter,0);
+    CHECK_PTR(topic,0);
+    //与分发时的规则相同：'$'开头的主题不匹配首层的通配符
+    if(*topic == '$' && (*filter == '+' || *filter == '#')){
+        return 0;
+    }
+    const char *level = topic;
+    while(1){
+        const char *end = strchr(filter,'/');
+        uint32_t len = end ? end - filter : strlen(filter);
+        if(len == 1 && *filter == '#'){
+            //匹配剩余所有层，"a/#"也匹配"a"
+            return 1;
+        }
+        if(!level){
+            return 0;
+        }
+        const char *level_end = strchr(level,'/');
+        uint32_t level_len = level_end ? level_end - level : strlen(level);
+        if(!(len == 1 && *filter == '+') && (len != level_len || memcmp(filter,level,len))){
+            return 0;
+        }
+        level = level_end ? level_end + 1 : NULL;
+        if(!end){
+            return !level;
+        }
+        filter = end + 1;
+    }
+}
@@ -0,0 +1,146 @@
+//
+// Created by xzl on 2019/7/16.
+//
+
+#ifndef MQTT_MQTT_TOPIC_ROUTER_H
+#define MQTT_MQTT_TOPIC_ROUTER_H
+
+#include <stdint.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * 收到与主题过滤器匹配的消息
+ * @param arg 添加路由时指定的用户数据指针
+ * @param pkt_id 数据包号
+ * @param topic 主题
+ * @param payload 消息负载
+ * @param payloadsize 消息长度
+ * @param dup 是否为重复包
+ * @param qos qos等级
+ */
+typedef void (*mqtt_handle_topic)(void *arg,
+                                  uint16_t pkt_id,
+                                  const char *topic,
+                                  const char *payload,
+                                  uint32_t payloadsize,
+                                  int dup,
+                                  enum MqttQosLevel qos);
+
+/**
+ * 主题树节点，对应主题过滤器中的一层
+ */
+typedef struct {
+    //本层名称(不以'\0'结尾)，根节点以及'+'、'#'节点为NULL
+    char *_segment;
+    uint32_t _seg_len;
+    //(父节点，本层名称)的哈希值
+    uint32_t _hash;
+    //父节点下标，空闲节点为下一个空闲节点下标
+    int32_t _parent;
+    //'+'、'#'子节点下标，-1代表没有
+    int32_t _plus;
+    int32_t _multi;
+    //子节点个数，包括'+'、'#'子节点
+    uint32_t _children;
+    //挂在本节点上的路由链表头
+    int32_t _routes;
+} mqtt_topic_node;
+
+/**
+ * 路由，即一个主题过滤器上的一个回调
+ */
+typedef struct {
+    mqtt_handle_topic _cb;
+    void *_user_data;
+    //所在节点下标，-1代表空闲路由
+    int32_t _node;
+    //同一节点的路由链表，空闲路由为空闲链表
+    int32_t _prev;
+    int32_t _next;
+} mqtt_topic_route;
+
+/**
+ * 主题路由器，主题过滤器按层组成一棵树，普通子节点保存在以(父节点，本层名称)为键的开放寻址哈希表中
+ * 分发消息时每一层只做一次哈希查找，耗时与主题层数成正比，与过滤器个数无关，且不分配内存
+ */
+typedef struct {
+    //节点数组，下标0为根节点
+    mqtt_topic_node *_nodes;
+    int32_t _node_capacity;
+    int32_t _node_free;
+    //路由数组，路由句柄为下标加1
+    mqtt_topic_route *_routes;
+    int32_t _route_capacity;
+    int32_t _route_free;
+    uint32_t _route_count;
+    //子节点哈希表，保存节点下标，-1代表空，-2代表已删除
+    int32_t *_buckets;
+    uint32_t _bucket_capacity;
+    //已使用的桶个数，包括已删除
+    uint32_t _bucket_used;
+    //分发消息的嵌套层数，分发期间删除路由延后到分发结束
+    int _dispatching;
+    //延后删除的路由个数
+    int _dead;
+} mqtt_topic_router;
+
+/**
+ * 初始化路由器
+ * @param router 路由器对象
+ */
+void mqtt_topic_router_init(mqtt_topic_router *router);
+
+/**
+ * 释放路由器的所有内存
+ * @param router 路由器对象
+ */
+void mqtt_topic_router_release(mqtt_topic_router *router);
+
+/**
+ * 添加路由，同一个主题过滤器可以添加多个回调
+ * @param router 路由器对象
+ * @param filter 主题过滤器，支持'+'(单层)以及'#'(多层，只能在末尾)通配符
+ * @param cb 回调函数
+ * @param user_data 回调用户数据指针
+ * @return 路由句柄，0代表失败(过滤器不合法或者内存不足)
+ */
+uint32_t mqtt_topic_router_add(mqtt_topic_router *router,const char *filter,mqtt_handle_topic cb,void *user_data);
+
+/**
+ * 删除路由，可以在回调中调用
+ * @param router 路由器对象
+ * @param route 路由句柄
+ * @return 0代表成功，-1代表句柄无效
+ */
+int mqtt_topic_router_remove(mqtt_topic_router *router,uint32_t route);
+
+/**
+ * 把消息分发给所有匹配的路由；'$'开头的主题不匹配首层的通配符
+ * @param router 路由器对象
+ * @param topic 以'\0'结尾的主题
+ * @return 匹配的路由个数
+ */
+int mqtt_topic_router_dispatch(mqtt_topic_router *router,
+                               uint16_t pkt_id,
+                               const char *topic,
+                               const char *payload,
+                               uint32_t payloadsize,
+                               int dup,
+                               enum MqttQosLevel qos);
+
+/**
+ * 判断主题是否匹配主题过滤器，规则与mqtt_topic_router_dispatch相同，用于不经过路由器的单次匹配
+ * @param filter 主题过滤器
+ * @param topic 以'\0'结尾的主题
+ * @return 1代表匹配
+ */
+int mqtt_topic_router_match(const char *filter,const char *topic);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+#endif //MQTT_MQTT_TOPIC_ROUTER_H
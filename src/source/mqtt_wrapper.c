@@ -3,30 +3,149 @@
 //
 
 #include "mqtt_wrapper.h"
-#include "jimi_buffer.h"
 #include "jimi_memory.h"
-#include "hash-table.h"
+#include "mqtt_id_table.h"
+#include "mqtt_inflight.h"
+#include "mqtt_timer_wheel.h"
+#include "mqtt_outbox.h"
+#include "mqtt_histogram.h"
 #include <memory.h>
 #include <stdlib.h>
+#ifdef __alios__
+#include <aos/kernel.h>
+#endif
 
 //////////////////////////////////////////////////////////////////////
+//存入离线消息队列的发布消息的回调，补发时再登记为等待回复
+typedef struct {
+    mqtt_handle_pub_ack _cb;
+    void *_user_data;
+    free_user_data _free_cb;
+    int _timeout_sec;
+    enum MqttQosLevel _qos;
+} mqtt_outbox_cb;
+
 typedef struct{
     //回调指针
     mqtt_callback _callback;
-    //只读，最近包id
-    unsigned int _pkt_id;
     //私有成员变量，请勿访问
     struct MqttContext _ctx;
     struct MqttBuffer _buffer;
-    buffer _remain_data;
-    //hash树回调列表
-    HashTable *_req_cb_map;
+    //_buffer使用的空闲内存块池
+    struct MqttChunkPool _chunk_pool;
+    //_buffer中已经被网络层接收的字节数，发送缓冲区满时从此处继续发送
+    uint32_t _sent_bytes;
+    struct MqttParser _parser;
+    //环形接收缓冲区
+    char *_ring;
+    //环形接收缓冲区读取位置
+    uint32_t _ring_head;
+    //环形接收缓冲区中未处理的字节数
+    uint32_t _ring_len;
+    //数据包id分配器以及等待回复的回调列表，以数据包id为索引
+    mqtt_id_table _req_table;
+    //qos1/2发布消息的重发存储
+    mqtt_inflight _inflight;
+    //发布消息超时后最多重发次数
+    int _max_retries;
+    //流量控制，最多未确认的qos1/2消息个数以及最多未发送完毕的字节数，0为不限制
+    int _max_inflight;
+    uint32_t _max_output_bytes;
+    //发布消息返回过MQTTERR_WOULDBLOCK，等待恢复可发送
+    int _blocked;
+    mqtt_handle_credit _credit_cb;
+    //已经登录成功，断线时清零
+    int _connected;
+    //离线消息队列，NULL代表未启用
+    mqtt_outbox *_outbox;
+    //离线消息队列同步到磁盘的间隔以及定时器
+    int _outbox_sync_ms;
+    uint32_t _outbox_timer;
+    //补发离线消息遇到暂时性错误(例如内存不足、发送失败)后的重试定时器
+    uint32_t _outbox_replay_timer;
+    //本进程存入离线消息队列的消息的回调(环形数组)，与队列末尾的消息按顺序一一对应，
+    //队列头部多出的消息来自上次进程，没有回调
+    mqtt_outbox_cb *_outbox_cbs;
+    uint32_t _outbox_cb_head;
+    uint32_t _outbox_cb_count;
+    uint32_t _outbox_cb_capacity;
+    //按主题过滤器分发收到的消息，未匹配的消息交给mqtt_handle_publish
+    mqtt_topic_router _router;
+    //请求超时以及心跳定时器
+    mqtt_timer_wheel _timers;
     //心跳包相关
     int _keep_alive;
-    time_t _last_ping;
+    uint32_t _ping_timer;
+    //批量发送相关
+    int _batching;
+    uint32_t _batch_max_bytes;
+    int _batch_max_pkts;
+    int _batch_max_delay_ms;
+    //已经缓存的数据包个数
+    int _batch_pkts;
+    //缓存的数据包最迟发送时间，单位毫秒
+    uint64_t _batch_deadline;
+    //qos1、qos2发布消息的确认耗时，单位微秒，第一次收到确认时开辟
+    mqtt_histogram *_latency[2];
+    //运行统计以及收发两个方向的数据包边界识别
+    mqtt_stats _stats;
+    mqtt_stats_scanner _scan_in;
+    mqtt_stats_scanner _scan_out;
+    //曾经登录成功过，再次登录成功时计为重新登录
+    int _ever_connected;
 } mqtt_context;
 
 
+//发布消息超时后默认最多重发次数
+#ifndef MQTT_DEFAULT_PUBLISH_RETRIES
+#define MQTT_DEFAULT_PUBLISH_RETRIES 3
+#endif
+
+//最多未确认的qos1/2消息个数，默认与MQTT5的Receive Maximum默认值相同
+#ifndef MQTT_DEFAULT_MAX_INFLIGHT
+#define MQTT_DEFAULT_MAX_INFLIGHT 65535
+#endif
+
+//最多未发送完毕的字节数，默认不限制
+#ifndef MQTT_DEFAULT_MAX_OUTPUT_BYTES
+#define MQTT_DEFAULT_MAX_OUTPUT_BYTES 0
+#endif
+
+//发送缓冲区最多缓存的空闲内存块个数，批量发送时多出的内存块在数据包之间循环使用
+#ifndef MQTT_CHUNK_POOL_SIZE
+#define MQTT_CHUNK_POOL_SIZE 16
+#endif
+
+//心跳定时器的标识，数据包id不会为0，其他定时器的标识为数据包id
+#define MQTT_TIMER_KEEPALIVE 0
+//离线消息队列同步到磁盘的定时器标识
+#define MQTT_TIMER_OUTBOX_SYNC 0x10000
+//补发离线消息失败后重试的定时器标识
+#define MQTT_TIMER_OUTBOX_REPLAY 0x10001
+
+//补发离线消息遇到暂时性错误后多少毫秒重试
+#ifndef MQTT_OUTBOX_RETRY_MS
+#define MQTT_OUTBOX_RETRY_MS 1000
+#endif
+
+//补发离线消息时等待回复的超时时间
+#ifndef MQTT_OUTBOX_TIMEOUT_SEC
+#define MQTT_OUTBOX_TIMEOUT_SEC 10
+#endif
+
+//补发离线消息时每次合并发送的字节数和数据包个数上限，避免整个离线队列堆积在一个发送缓冲区中
+#ifndef MQTT_OUTBOX_BATCH_BYTES
+#define MQTT_OUTBOX_BATCH_BYTES (16 * 1024)
+#endif
+#ifndef MQTT_OUTBOX_BATCH_PKTS
+#define MQTT_OUTBOX_BATCH_PKTS 32
+#endif
+
+//环形接收缓冲区大小
+#ifndef MQTT_INPUT_RING_SIZE
+#define MQTT_INPUT_RING_SIZE 2048
+#endif
+
 //回复回调函数类型
 typedef enum {
     res_pub_ack = 0,
@@ -44,11 +163,58 @@ typedef struct {
         mqtt_handle_unsub_ack _mqtt_handle_unsub_ack;
     } _callback;
     res_type _cb_type;
-    time_t _end_time_line;
+    //等待回复的超时定时器
+    uint32_t _timer;
+    //等待回复的超时时间，重发时重新计时
+    int _timeout_sec;
+    //已经重发的次数
+    int _retries;
+    //发布消息进入发送缓冲区的时间(不是写入网络的时间)，单位微秒，重发时不更新
+    uint64_t _send_us;
 } mqtt_req_cb_value;
 
+int mqtt_send_packet(void *arg);
+static void mqtt_check_credit(mqtt_context *ctx);
+static void mqtt_outbox_replay(mqtt_context *ctx);
+static void mqtt_outbox_schedule_sync(mqtt_context *ctx);
+static int mqtt_outbox_cb_reserve(mqtt_context *ctx);
+static void mqtt_outbox_cb_push(mqtt_context *ctx,const mqtt_outbox_cb *cb);
+static void mqtt_outbox_cb_trim(mqtt_context *ctx);
+static void mqtt_outbox_cb_flush(mqtt_context *ctx);
+static int mqtt_output_would_block(mqtt_context *ctx,enum MqttQosLevel qos);
+static int mqtt_resend_inflight(mqtt_context *ctx,uint16_t pkt_id);
+static void mqtt_resend_all_inflight(mqtt_context *ctx);
+
 
 //////////////////////////////////////////////////////////////////////
+/**
+ * 获取单调递增的时间戳，不受系统时间修改影响
+ * @return 毫秒
+ */
+static uint64_t mqtt_now_ms(){
+#ifdef __alios__
+    return aos_now_ms();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+/**
+ * 获取单调递增的时间戳，用于统计耗时
+ * @return 微秒
+ */
+static uint64_t mqtt_now_us(){
+#ifdef __alios__
+    return aos_now() / 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 /**
  * 根据回复包序号查找回调函数
  * @param ctx
@@ -56,39 +222,100 @@ typedef struct {
  * @return
  */
 static mqtt_req_cb_value *lookup_req_cb_value(mqtt_context *ctx,uint16_t pkt_id){
-    return (mqtt_req_cb_value *)hash_table_lookup(ctx->_req_cb_map,(HashTableKey)pkt_id);
+    return (mqtt_req_cb_value *)mqtt_id_table_find(&ctx->_req_table,pkt_id);
 }
 
 /**
- * 获取hash表key的hash值
- * @param value
- * @return
+ * 释放数据包id以及回调的用户数据
+ * @param ctx
+ * @param pkt_id
  */
-static unsigned int mqtt_HashTableHashFunc(HashTableKey value){
-    unsigned int pkt_id = (unsigned int)value;
-    return pkt_id;
+static void remove_req_cb_value(mqtt_context *ctx,uint16_t pkt_id){
+    mqtt_req_cb_value *cb = lookup_req_cb_value(ctx,pkt_id);
+    if(!cb){
+        return;
+    }
+    void *user_data = cb->_user_data;
+    free_user_data free_cb = cb->_free_user_data;
+    mqtt_timer_wheel_cancel(&ctx->_timers,cb->_timer);
+    mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+    if(free_cb){
+        free_cb(user_data);
+    }
 }
 
 /**
- * 判断两个key是否相等
- * @param value1
- * @param value2
- * @return
+ * 重新开始等待回复的超时计时
+ * @param ctx
+ * @param pkt_id 数据包id
+ * @param value 回调对象
+ */
+static void restart_req_timer(mqtt_context *ctx,uint16_t pkt_id,mqtt_req_cb_value *value){
+    mqtt_timer_wheel_cancel(&ctx->_timers,value->_timer);
+    value->_timer = mqtt_timer_wheel_add(&ctx->_timers,
+                                         mqtt_now_ms(),
+                                         value->_timeout_sec > 0 ? value->_timeout_sec * 1000 : 0,
+                                         pkt_id);
+}
+
+/**
+ * 开始心跳计时，keep_alive为0时不发送心跳包
+ * @param ctx
+ */
+static void restart_ping_timer(mqtt_context *ctx){
+    mqtt_timer_wheel_cancel(&ctx->_timers,ctx->_ping_timer);
+    ctx->_ping_timer = 0;
+    if(ctx->_keep_alive > 0){
+        ctx->_ping_timer = mqtt_timer_wheel_add(&ctx->_timers,
+                                                mqtt_now_ms(),
+                                                ctx->_keep_alive * 1000,
+                                                MQTT_TIMER_KEEPALIVE);
+    }
+}
+
+/**
+ * 登记等待回复的回调
+ * @param ctx
+ * @param pkt_id 已经由mqtt_id_table_alloc分配的数据包id
+ * @param type 回调类型
+ * @param user_data 回调用户数据指针
+ * @param free_cb 回调用户数据销毁回调函数指针
+ * @param timeout_sec 最大等待回复的时间，单位秒
+ * @return 回调对象，请设置_callback成员
  */
-static int mqtt_HashTableEqualFunc(HashTableKey value1, HashTableKey value2){
-    return value1 == value2;
+static mqtt_req_cb_value *regist_req_cb_value(mqtt_context *ctx,
+                                              uint16_t pkt_id,
+                                              res_type type,
+                                              void *user_data,
+                                              free_user_data free_cb,
+                                              int timeout_sec){
+    mqtt_req_cb_value *value = lookup_req_cb_value(ctx,pkt_id);
+    value->_user_data = user_data;
+    value->_free_user_data = free_cb;
+    value->_cb_type = type;
+    value->_timeout_sec = timeout_sec;
+    value->_retries = 0;
+    restart_req_timer(ctx,pkt_id,value);
+    return value;
 }
 
 /**
- * 释放hash表value的回调函数
- * @param value
+ * 记录发布消息从进入发送缓冲区到确认的耗时
+ * @param ctx
+ * @param value 回调对象
+ * @param qos 1代表收到PUBACK，2代表收到PUBCOMP
  */
-static void mqtt_HashTableValueFreeFunc(HashTableValue value){
-    mqtt_req_cb_value *cb = (mqtt_req_cb_value *)value;
-    if(cb->_free_user_data){
-        cb->_free_user_data(cb->_user_data);
+static void record_pub_latency(mqtt_context *ctx,mqtt_req_cb_value *value,int qos){
+    mqtt_histogram **hist = &ctx->_latency[qos - 1];
+    if(!*hist){
+        *hist = (mqtt_histogram *)jimi_malloc(sizeof(mqtt_histogram));
+        if(!*hist){
+            return;
+        }
+        mqtt_histogram_init(*hist);
     }
-    jimi_free(cb);
+    uint64_t elapsed = mqtt_now_us() - value->_send_us;
+    mqtt_histogram_record(*hist,elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -102,7 +329,32 @@ static void mqtt_HashTableValueFreeFunc(HashTableValue value){
 static int mqtt_write_sock(void *arg, const struct iovec *iov, int iovcnt){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx->_callback.mqtt_data_output,-1);
-    return ctx->_callback.mqtt_data_output(ctx->_callback._user_data,iov,iovcnt);
+    int ret = ctx->_callback.mqtt_data_output(ctx->_callback._user_data,iov,iovcnt);
+    //只统计网络层已经接收的部分，其余部分下次发送时再统计
+    int sent = ret;
+    int i;
+    for(i = 0 ; i < iovcnt && sent > 0 ; ++i){
+        uint32_t len = (uint32_t)iov[i].iov_len < (uint32_t)sent ? (uint32_t)iov[i].iov_len : (uint32_t)sent;
+        mqtt_stats_scan(&ctx->_stats,&ctx->_scan_out,1,(const char *)iov[i].iov_base,len);
+        sent -= len;
+    }
+    return ret;
+}
+
+/**
+ * 发送编解码层自动回复的响应包(PUBACK/PUBREC/PUBREL/PUBCOMP)
+ * 响应包追加到发送缓冲区末尾，与其他数据包一样按顺序发送，不会插入未发送完毕的数据包中间
+ * @param arg 用户数据指针
+ * @param response 响应包，内存在本函数返回后失效，必须拷贝
+ * @return 0成功，其他错误
+ */
+static int mqtt_send_response(void *arg, const struct MqttBuffer *response){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    const struct MqttExtent *cursor;
+    for(cursor = response->first_ext ; cursor ; cursor = cursor->next){
+        CHECK_RET(-1,MqttBuffer_Append(&ctx->_buffer,cursor->payload,cursor->len,1));
+    }
+    return mqtt_send_packet(ctx);
 }
 
 /**
@@ -115,7 +367,7 @@ static int handle_ping_resp(void *arg){/**< 处理ping响应的回调函数，
     LOGT("");
     CHECK_PTR(ctx->_callback.mqtt_handle_ping_resp,-1);
     ctx->_callback.mqtt_handle_ping_resp(ctx->_callback._user_data);
-    ctx->_last_ping = time(NULL);
+    restart_ping_timer(ctx);
     return 0;
 }
 
@@ -129,6 +381,17 @@ static int handle_ping_resp(void *arg){/**< 处理ping响应的回调函数，
 static int handle_conn_ack(void *arg, char flags, char ret_code){
     mqtt_context *ctx = (mqtt_context *)arg;
     LOGT("flags:%d , ret_code:%d",(int)flags,(int)(ret_code));
+    if(ret_code == 0){
+        ctx->_connected = 1;
+        MQTT_STATS_ADD(ctx->_stats._connects,1);
+        if(ctx->_ever_connected){
+            MQTT_STATS_ADD(ctx->_stats._reconnects,1);
+        }
+        ctx->_ever_connected = 1;
+        //重新登录成功，重发所有未确认的消息，再补发离线期间的消息
+        mqtt_resend_all_inflight(ctx);
+        mqtt_outbox_replay(ctx);
+    }
     CHECK_PTR(ctx->_callback.mqtt_handle_conn_ack,-1);
     ctx->_callback.mqtt_handle_conn_ack(ctx->_callback._user_data,flags,ret_code);
     return 0;
@@ -143,6 +406,7 @@ static int handle_conn_ack(void *arg, char flags, char ret_code){
  * @param payloadsize 负载数据长度
  * @param dup 是否为重复包
  * @param qos qos等级，如果为2，那么还将触发一次handle_pub_rel回调
+ * @param retain 是否为保留消息
  * @return 0成功
  */
 static int handle_publish(void *arg,
@@ -151,7 +415,8 @@ static int handle_publish(void *arg,
                           const char *payload,
                           uint32_t payloadsize,
                           int dup,
-                          enum MqttQosLevel qos){
+                          enum MqttQosLevel qos,
+                          int retain){
     uint8_t tail = 0 ;
     if(payload && payloadsize){
         tail = payload[payloadsize];
@@ -159,8 +424,13 @@ static int handle_publish(void *arg,
     }
     mqtt_context *ctx = (mqtt_context *)arg;
     LOGT("pkt_id:%d , topic: %s , payload:%s , dup:%d , qos:%d",(int)pkt_id,topic,payload,dup,(int)qos);
-    CHECK_PTR(ctx->_callback.mqtt_handle_publish,-1);
-    ctx->_callback.mqtt_handle_publish(ctx->_callback._user_data,pkt_id,topic,payload,payloadsize,dup,qos);
+    if(!mqtt_topic_router_dispatch(&ctx->_router,pkt_id,topic,payload,payloadsize,dup,qos)){
+        if(ctx->_callback.mqtt_handle_publish){
+            ctx->_callback.mqtt_handle_publish(ctx->_callback._user_data,pkt_id,topic,payload,payloadsize,dup,qos);
+        }else{
+            LOGW("unhandled publish, topic:%s",topic);
+        }
+    }
 
     if(tail != 0){
         ((uint8_t*)payload)[payloadsize] = tail;
@@ -196,16 +466,21 @@ static int handle_pub_rel(void *arg, uint16_t pkt_id){
 static int handle_pub_ack(void *arg, uint16_t pkt_id){
     mqtt_context *ctx = (mqtt_context *)arg;
     LOGT("pkt_id: %d",(int)pkt_id);
+    mqtt_inflight_remove(&ctx->_inflight,pkt_id);
 
     mqtt_req_cb_value *value = lookup_req_cb_value(ctx,pkt_id);
     if(!value){
         LOGW("can not find callback!");
+        mqtt_check_credit(ctx);
         return 0;
     }
+    record_pub_latency(ctx,value,1);
+    MQTT_STATS_ADD(ctx->_stats._acks,1);
     if(value->_callback._mqtt_handle_pub_ack){
         value->_callback._mqtt_handle_pub_ack(value->_user_data,0,pub_ack);
     }
-    hash_table_remove(ctx->_req_cb_map,(HashTableKey)pkt_id);
+    remove_req_cb_value(ctx,pkt_id);
+    mqtt_check_credit(ctx);
     return 0;
 }
 
@@ -224,6 +499,17 @@ static int handle_pub_rec(void *arg, uint16_t pkt_id){
     mqtt_context *ctx = (mqtt_context *)arg;
     LOGT("pkt_id: %d",(int)pkt_id);
 
+    if(mqtt_inflight_find(&ctx->_inflight,pkt_id,NULL)){
+        //服务器已经收到publish，此后超时只能重发Publish Release (6)
+        char *pub_rel = mqtt_inflight_reserve(&ctx->_inflight,pkt_id,4);
+        if(pub_rel){
+            pub_rel[0] = (char)(MQTT_PKT_PUBREL << 4 | 0x02);
+            pub_rel[1] = 2;
+            pub_rel[2] = (char)(pkt_id >> 8);
+            pub_rel[3] = (char)pkt_id;
+        }
+    }
+
     mqtt_req_cb_value *value = lookup_req_cb_value(ctx,pkt_id);
     if(!value){
         LOGW("can not find callback!");
@@ -233,7 +519,6 @@ static int handle_pub_rec(void *arg, uint16_t pkt_id){
         value->_callback._mqtt_handle_pub_ack(value->_user_data,0,pub_rec);
     }
     //中间态不移除监听，后续还将触发handle_pub_comp回调
-//    hash_table_remove(ctx->_req_cb_map,(HashTableKey)pkt_id);
     return 0;
 }
 
@@ -247,16 +532,21 @@ static int handle_pub_rec(void *arg, uint16_t pkt_id){
 static int handle_pub_comp(void *arg, uint16_t pkt_id){
     mqtt_context *ctx = (mqtt_context *)arg;
     LOGT("pkt_id: %d",(int)pkt_id);
+    mqtt_inflight_remove(&ctx->_inflight,pkt_id);
 
     mqtt_req_cb_value *value = lookup_req_cb_value(ctx,pkt_id);
     if(!value){
         LOGW("can not find callback!");
+        mqtt_check_credit(ctx);
         return 0;
     }
+    record_pub_latency(ctx,value,2);
+    MQTT_STATS_ADD(ctx->_stats._acks,1);
     if(value->_callback._mqtt_handle_pub_ack){
         value->_callback._mqtt_handle_pub_ack(value->_user_data,0,pub_comp);
     }
-    hash_table_remove(ctx->_req_cb_map,(HashTableKey)pkt_id);
+    remove_req_cb_value(ctx,pkt_id);
+    mqtt_check_credit(ctx);
     return 0;
 }
 
@@ -280,7 +570,7 @@ static int handle_sub_ack(void *arg, uint16_t pkt_id,const char *codes, uint32_t
     if(value->_callback._mqtt_handle_sub_ack){
         value->_callback._mqtt_handle_sub_ack(value->_user_data,0,codes,count);
     }
-    hash_table_remove(ctx->_req_cb_map,(HashTableKey)pkt_id);
+    remove_req_cb_value(ctx,pkt_id);
     return 0;
 }
 
@@ -296,7 +586,7 @@ static int handle_unsub_ack(void *arg, uint16_t pkt_id){
     if(value->_callback._mqtt_handle_unsub_ack){
         value->_callback._mqtt_handle_unsub_ack(value->_user_data,0);
     }
-    hash_table_remove(ctx->_req_cb_map,(HashTableKey)pkt_id);
+    remove_req_cb_value(ctx,pkt_id);
     return 0;
 }
 
@@ -313,6 +603,7 @@ void *mqtt_alloc_contex(mqtt_callback *callback){
 
     ctx->_ctx.user_data = ctx;
     ctx->_ctx.writev_func = mqtt_write_sock;
+    ctx->_ctx.send_response = mqtt_send_response;
     ctx->_ctx.handle_ping_resp = handle_ping_resp;
     ctx->_ctx.handle_conn_ack = handle_conn_ack;
     ctx->_ctx.handle_publish = handle_publish;
@@ -324,77 +615,282 @@ void *mqtt_alloc_contex(mqtt_callback *callback){
     ctx->_ctx.handle_unsub_ack = handle_unsub_ack;
 
     MqttBuffer_Init(&ctx->_buffer);
-    buffer_init(&ctx->_remain_data);
+    MqttChunkPool_Init(&ctx->_chunk_pool,MQTT_CHUNK_POOL_SIZE);
+    MqttBuffer_SetPool(&ctx->_buffer,&ctx->_chunk_pool);
+    MqttParser_Init(&ctx->_parser);
+    mqtt_inflight_init(&ctx->_inflight);
+    mqtt_timer_wheel_init(&ctx->_timers,mqtt_now_ms());
+    mqtt_topic_router_init(&ctx->_router);
+    ctx->_max_retries = MQTT_DEFAULT_PUBLISH_RETRIES;
+    ctx->_max_inflight = MQTT_DEFAULT_MAX_INFLIGHT;
+    ctx->_max_output_bytes = MQTT_DEFAULT_MAX_OUTPUT_BYTES;
 
-    ctx->_req_cb_map = hash_table_new(mqtt_HashTableHashFunc,mqtt_HashTableEqualFunc);
-    if(!ctx->_req_cb_map){
-        LOGE("malloc hash_table_new failed!");
-        mqtt_free_contex(ctx);
-        return NULL;
+    mqtt_id_table_init(&ctx->_req_table, sizeof(mqtt_req_cb_value));
+    if(0 != mqtt_stats_register(&ctx->_stats)){
+        LOGW("mqtt_stats_register failed, stats of this context will not be aggregated");
     }
-    hash_table_register_free_functions(ctx->_req_cb_map,NULL,mqtt_HashTableValueFreeFunc);
     return ctx;
 }
 
-void for_each_map(HashTable *hash_table,int flush);
+static void mqtt_flush_req_cb(mqtt_context *ctx);
 
 int mqtt_free_contex(void *arg){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
     MqttBuffer_Destroy(&ctx->_buffer);
-    buffer_release(&ctx->_remain_data);
-    for_each_map(ctx->_req_cb_map,1);
-    hash_table_free(ctx->_req_cb_map);
+    MqttChunkPool_Destroy(&ctx->_chunk_pool);
+    MqttParser_Destroy(&ctx->_parser);
+    jimi_free(ctx->_ring);
+    mqtt_flush_req_cb(ctx);
+    mqtt_outbox_cb_flush(ctx);
+    mqtt_id_table_release(&ctx->_req_table);
+    mqtt_timer_wheel_release(&ctx->_timers);
+    if(ctx->_outbox){
+        mqtt_outbox_close(ctx->_outbox);
+        jimi_free(ctx->_outbox);
+    }
+    mqtt_inflight_release(&ctx->_inflight);
+    mqtt_topic_router_release(&ctx->_router);
+    jimi_free(ctx->_latency[0]);
+    jimi_free(ctx->_latency[1]);
+    mqtt_stats_unregister(&ctx->_stats);
     jimi_free(ctx);
     return 0;
 }
 
+/**
+ * 把缓存的所有数据包通过一次writev发送出去
+ * @param ctx mqtt客户端对象
+ * @return 0代表成功
+ */
+static int mqtt_flush_packet(mqtt_context *ctx){
+    ctx->_batch_pkts = 0;
+    if(ctx->_sent_bytes >= ctx->_buffer.buffered_bytes){
+        return 0;
+    }
+    int ret = Mqtt_SendPkt(&ctx->_ctx,&ctx->_buffer,ctx->_sent_bytes);
+    if(ret < 0){
+        LOGW("Mqtt_SendPkt failed:%d",ret);
+        //数据仍留在缓冲区中等待下次发送，不能再引用调用者的内存
+        MqttBuffer_OwnExtents(&ctx->_buffer,ctx->_sent_bytes);
+        return ret;
+    }
+
+    ctx->_sent_bytes += ret;
+    if(ctx->_sent_bytes < ctx->_buffer.buffered_bytes){
+        //发送缓冲区已满，剩余数据等待mqtt_on_writable继续发送，不能再引用调用者的内存
+        return MqttBuffer_OwnExtents(&ctx->_buffer,ctx->_sent_bytes);
+    }
+    //保留第一个内存块给下一个数据包，稳定发送时不再开辟内存
+    MqttBuffer_ResetRetain(&ctx->_buffer);
+    ctx->_sent_bytes = 0;
+    return 0;
+}
+
+/**
+ * 判断批量发送模式下缓存的数据包是否需要发送
+ * @param ctx mqtt客户端对象
+ * @return 非0代表需要
+ */
+static int mqtt_batch_full(mqtt_context *ctx){
+    if(ctx->_batch_max_bytes && ctx->_buffer.buffered_bytes >= ctx->_batch_max_bytes){
+        return 1;
+    }
+    if(ctx->_batch_max_pkts && ctx->_batch_pkts >= ctx->_batch_max_pkts){
+        return 1;
+    }
+    return ctx->_batch_max_delay_ms && mqtt_now_ms() >= ctx->_batch_deadline;
+}
+
 int mqtt_send_packet(void *arg){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    CHECK_RET(0,Mqtt_SendPkt(&ctx->_ctx,&ctx->_buffer,0));
-    MqttBuffer_Reset(&ctx->_buffer);
+    MQTT_STATS_MAX(ctx->_stats._output_high_water,ctx->_buffer.buffered_bytes - ctx->_sent_bytes);
+    if(ctx->_batching){
+        if(++ctx->_batch_pkts == 1){
+            ctx->_batch_deadline = mqtt_now_ms() + ctx->_batch_max_delay_ms;
+        }
+        if(!mqtt_batch_full(ctx)){
+            //暂不发送，等待合并
+            return 0;
+        }
+    }
+    return mqtt_flush_packet(ctx);
+}
+
+int mqtt_on_writable(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    if(ctx->_batching && !mqtt_batch_full(ctx)){
+        //只继续发送上次未发送完毕的数据包
+        if(!ctx->_sent_bytes){
+            return 0;
+        }
+    }
+    int ret = mqtt_flush_packet(ctx);
+    mqtt_check_credit(ctx);
+    return ret;
+}
+
+uint32_t mqtt_output_pending(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,0);
+    return ctx->_buffer.buffered_bytes - ctx->_sent_bytes;
+}
+
+int mqtt_batch_begin(void *arg,uint32_t max_bytes,int max_pkts,int max_delay_ms){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    ctx->_batching = 1;
+    ctx->_batch_max_bytes = max_bytes;
+    ctx->_batch_max_pkts = max_pkts > 0 ? max_pkts : 0;
+    ctx->_batch_max_delay_ms = max_delay_ms > 0 ? max_delay_ms : 0;
     return 0;
 }
 
+int mqtt_batch_flush(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_flush_packet(ctx);
+}
 
-int mqtt_input_data_l(void *arg,char *data,int len) {
+int mqtt_batch_end(void *arg){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    int customed = 0;
-    int ret = Mqtt_RecvPkt(&ctx->_ctx,data,len,&customed);
+    ctx->_batching = 0;
+    return mqtt_flush_packet(ctx);
+}
+
+
+int mqtt_input_data(void *arg,char *data,int len){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    if(len > 0){
+        mqtt_stats_scan(&ctx->_stats,&ctx->_scan_in,0,data,len);
+    }
+    int ret = Mqtt_ParsePkt(&ctx->_ctx,&ctx->_parser,data,len);
     if(ret != MQTTERR_NOERROR){
-        LOGW("Mqtt_RecvPkt failed:%d", ret);
-        return ret;
+        LOGW("Mqtt_ParsePkt failed:%d", ret);
+        MQTT_STATS_ADD(ctx->_stats._parse_errors,1);
     }
+    return ret;
+}
 
-    if(customed == 0){
-        //完全为消费数据
-        if(!ctx->_remain_data._len){
-            buffer_assign(&ctx->_remain_data,data,len);
+int mqtt_input_prepare(void *arg,struct iovec *iov){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    CHECK_PTR(iov,-1);
+    if(!ctx->_ring){
+        //多开辟一个字节，handle_publish会在负载末尾写'\0'
+        ctx->_ring = (char *)jimi_malloc(MQTT_INPUT_RING_SIZE + 1);
+        if(!ctx->_ring){
+            LOGE("malloc input ring failed!");
+            return -1;
         }
-        return 0;
+        ctx->_ring_head = 0;
+        ctx->_ring_len = 0;
+    }
+
+    uint32_t tail = ctx->_ring_head + ctx->_ring_len;
+    if(tail >= MQTT_INPUT_RING_SIZE){
+        //已经回绕，可写区域只有一块
+        tail -= MQTT_INPUT_RING_SIZE;
+        iov[0].iov_base = ctx->_ring + tail;
+        iov[0].iov_len = ctx->_ring_head - tail;
+        return iov[0].iov_len ? 1 : 0;
     }
-    if(customed < len){
-        //消费部分数据
-        buffer buffer;
-        buffer_assign(&buffer,data + customed,len - customed);
-        buffer_move(&ctx->_remain_data,&buffer);
+
+    iov[0].iov_base = ctx->_ring + tail;
+    iov[0].iov_len = MQTT_INPUT_RING_SIZE - tail;
+    if(!ctx->_ring_head){
+        return 1;
+    }
+    iov[1].iov_base = ctx->_ring;
+    iov[1].iov_len = ctx->_ring_head;
+    return 2;
+}
+
+/**
+ * 判断环形缓冲区中不完整的数据包是否永远无法在缓冲区中连续存放
+ * @param data 不完整的数据包
+ * @param len 不完整数据包的长度
+ * @return 非0代表是
+ */
+static int mqtt_ring_too_small(const char *data,int len){
+    uint32_t remaining_len = 0;
+    int bytes = Mqtt_ReadLength(data + 1, len - 1, &remaining_len);
+    if(bytes < 0){
+        //长度字段不完整，至多5个字节，缓冲区总能容纳
         return 0;
     }
-    //消费全部数据
-    buffer_release(&ctx->_remain_data);
-    return 0;
+    return 1 + bytes + remaining_len > MQTT_INPUT_RING_SIZE;
 }
 
-int mqtt_input_data(void *arg,char *data,int len){
+int mqtt_input_commit(void *arg,int len){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    if(!ctx->_remain_data._len){
-        return mqtt_input_data_l(ctx,data,len);
+    CHECK_PTR(ctx->_ring,-1);
+    if(len <= 0 || ctx->_ring_len + len > MQTT_INPUT_RING_SIZE){
+        LOGW("invalid commit length:%d",len);
+        return -1;
+    }
+    //新写入的数据可能跨越缓冲区末尾
+    uint32_t tail = (ctx->_ring_head + ctx->_ring_len) % MQTT_INPUT_RING_SIZE;
+    uint32_t first = MQTT_INPUT_RING_SIZE - tail < (uint32_t)len ? MQTT_INPUT_RING_SIZE - tail : (uint32_t)len;
+    mqtt_stats_scan(&ctx->_stats,&ctx->_scan_in,0,ctx->_ring + tail,first);
+    if(first < (uint32_t)len){
+        mqtt_stats_scan(&ctx->_stats,&ctx->_scan_in,0,ctx->_ring,len - first);
     }
-    buffer_append(&ctx->_remain_data,data,len);
-    return mqtt_input_data_l(ctx,ctx->_remain_data._data,ctx->_remain_data._len);
+    ctx->_ring_len += len;
+    MQTT_STATS_MAX(ctx->_stats._input_high_water,ctx->_ring_len);
+
+    int ret = MQTTERR_NOERROR;
+    while(ctx->_ring_len){
+        //从读取位置到缓冲区末尾的连续数据
+        char *data = ctx->_ring + ctx->_ring_head;
+        int seg = MQTT_INPUT_RING_SIZE - ctx->_ring_head;
+        if(seg > ctx->_ring_len){
+            seg = ctx->_ring_len;
+        }
+        int wrapped = seg < ctx->_ring_len;
+        int customed = seg;
+
+        if(MqttParser_Pending(&ctx->_parser)){
+            //解析器中有不完整的数据包，继续拼接
+            ret = Mqtt_ParsePkt(&ctx->_ctx,&ctx->_parser,data,seg);
+        }else{
+            //完整的数据包直接在缓冲区内处理
+            ret = Mqtt_RecvPkt(&ctx->_ctx,data,seg,&customed);
+            if(ret == MQTTERR_NOERROR && customed < seg &&
+               (wrapped || mqtt_ring_too_small(data + customed,seg - customed))){
+                //数据包跨越了缓冲区末尾或者比缓冲区还大，交给解析器拼接
+                ret = Mqtt_ParsePkt(&ctx->_ctx,&ctx->_parser,data + customed,seg - customed);
+                customed = seg;
+            }
+        }
+
+        if(ret != MQTTERR_NOERROR){
+            LOGW("parse input ring failed:%d", ret);
+            MQTT_STATS_ADD(ctx->_stats._parse_errors,1);
+            MqttParser_Reset(&ctx->_parser);
+            ctx->_ring_head = 0;
+            ctx->_ring_len = 0;
+            return ret;
+        }
+
+        ctx->_ring_head = (ctx->_ring_head + customed) % MQTT_INPUT_RING_SIZE;
+        ctx->_ring_len -= customed;
+        if(customed < seg){
+            //不完整的数据包留在缓冲区中，等待更多数据
+            break;
+        }
+    }
+
+    if(!ctx->_ring_len){
+        //缓冲区已空，下次写入时可用内存连续
+        ctx->_ring_head = 0;
+    }
+    return ret;
 }
 
 int mqtt_send_connect_pkt(void *arg,
@@ -441,7 +937,163 @@ int mqtt_send_connect_pkt(void *arg,
     CHECK_RET(-1,mqtt_send_packet(ctx));
 
     ctx->_keep_alive = keep_alive;
-    ctx->_last_ping = time(NULL);
+    restart_ping_timer(ctx);
+    return 0;
+}
+
+static int mqtt_send_publish(void *arg,
+                             const char *topic,
+                             const char *payload,
+                             int payload_len,
+                             struct MqttPayload *shared,
+                             enum MqttQosLevel qos,
+                             int retain,
+                             int dup,
+                             mqtt_handle_pub_ack cb,
+                             void *user_data,
+                             free_user_data free_cb,
+                             int timeout_sec){
+    if(payload && payload_len <= 0){
+        payload_len = strlen(payload);
+    }
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    if(mqtt_output_would_block(ctx,qos)){
+        //等待服务器确认或者网络层发送后再重试
+        return MQTTERR_WOULDBLOCK;
+    }
+    //qos0消息服务器不会回复，不占用数据包id，打包时的id仅用于通过参数检查
+    uint16_t pkt_id = 1;
+    if(qos != MQTT_QOS_LEVEL0){
+        pkt_id = mqtt_id_table_alloc(&ctx->_req_table,NULL);
+        if(!pkt_id){
+            return MQTTERR_OUTOFMEMORY;
+        }
+    }
+    //批量发送模式下缓冲区中可能已经有其他数据包，本数据包的固定头在此数据块之后
+    struct MqttExtent *tail = ctx->_buffer.last_ext;
+    //批量发送模式下负载在本函数返回后才发送，必须拷贝；共享负载由缓冲区持有引用，无需拷贝
+    int ret = shared ? Mqtt_PackPublishPktShared(&ctx->_buffer,
+                                                 pkt_id,
+                                                 topic,
+                                                 shared,
+                                                 qos,
+                                                 retain) :
+                       Mqtt_PackPublishPkt(&ctx->_buffer,
+                                           pkt_id,
+                                           topic,
+                                           payload,
+                                           payload_len,
+                                           qos,
+                                           retain,
+                                           ctx->_batching);
+    if(ret < 0){
+        LOGW("Mqtt_PackPublishPkt failed:%d",ret);
+        if(qos != MQTT_QOS_LEVEL0){
+            mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+        }
+        return ret;
+    }
+    struct MqttExtent *fix_head = tail ? tail->next : ctx->_buffer.first_ext;
+    if(dup){
+        Mqtt_SetPktDupAt(fix_head);
+    }
+    if(qos != MQTT_QOS_LEVEL0){
+        //保存数据包副本，超时或重连后重发；共享负载是最后一个数据块，只保存引用
+        struct MqttPayload *inflight_shared = shared && shared->len ? shared : NULL;
+        struct MqttExtent *end = inflight_shared ? ctx->_buffer.last_ext : NULL;
+        uint32_t len = 0;
+        struct MqttExtent *cursor;
+        for(cursor = fix_head ; cursor != end ; cursor = cursor->next){
+            len += cursor->len;
+        }
+        char *copy = mqtt_inflight_reserve_shared(&ctx->_inflight,pkt_id,len,inflight_shared);
+        if(!copy){
+            //没有重发副本的消息超时或重连后无法重发，不能发送
+            LOGW("mqtt_inflight_reserve failed, pkt_id:%d",(int)pkt_id);
+            MqttBuffer_Truncate(&ctx->_buffer,tail);
+            mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+            return MQTTERR_OUTOFMEMORY;
+        }
+        for(cursor = fix_head ; cursor != end ; cursor = cursor->next){
+            memcpy(copy,cursor->payload,cursor->len);
+            copy += cursor->len;
+        }
+        MQTT_STATS_MAX(ctx->_stats._inflight_high_water,mqtt_inflight_count(&ctx->_inflight));
+    }
+    ret = mqtt_send_packet(ctx);
+    if(ret < 0){
+        LOGW("mqtt_send_packet failed:%d",ret);
+        //撤销本数据包，之后不会再被发送
+        MqttBuffer_Truncate(&ctx->_buffer,tail);
+        if(qos != MQTT_QOS_LEVEL0){
+            mqtt_inflight_remove(&ctx->_inflight,pkt_id);
+            mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+        }
+        return ret;
+    }
+
+    MQTT_STATS_ADD(ctx->_stats._publishes,1);
+    if(qos == MQTT_QOS_LEVEL0){
+        //没有回复，不再等待超时，直接释放用户数据
+        if(free_cb){
+            free_cb(user_data);
+        }
+        return 0;
+    }
+    mqtt_req_cb_value *value = regist_req_cb_value(ctx,pkt_id,res_pub_ack,user_data,free_cb,timeout_sec);
+    value->_callback._mqtt_handle_pub_ack = cb;
+    value->_send_us = mqtt_now_us();
+    return 0;
+}
+
+/**
+ * 在线时直接发布，离线或者还有未补发的离线消息时存入离线消息队列
+ */
+static int mqtt_publish_or_store(mqtt_context *ctx,
+                                 const char *topic,
+                                 const char *payload,
+                                 int payload_len,
+                                 struct MqttPayload *shared,
+                                 enum MqttQosLevel qos,
+                                 int retain,
+                                 int dup,
+                                 mqtt_handle_pub_ack cb,
+                                 void *user_data,
+                                 free_user_data free_cb,
+                                 int timeout_sec){
+    if(!ctx->_outbox || (ctx->_connected && !mqtt_outbox_count(ctx->_outbox))){
+        return mqtt_send_publish(ctx,topic,payload,payload_len,shared,qos,retain,dup,cb,user_data,free_cb,timeout_sec);
+    }
+
+    //离线或者还有未补发的离线消息，为保证顺序先存入离线消息队列
+    mqtt_outbox_msg msg;
+    msg._topic = topic;
+    msg._payload = payload ? payload : "";
+    msg._payload_len = payload ? (payload_len > 0 ? payload_len : strlen(payload)) : 0;
+    msg._qos = qos;
+    msg._retain = retain;
+    //补发时无法再通知调用者，参数错误必须现在报告
+    int ret = Mqtt_CheckPublishParam(topic,msg._payload_len,qos);
+    if(ret != MQTTERR_NOERROR){
+        LOGW("invalid publish:%d, topic:%s",ret,topic ? topic : "");
+        return ret;
+    }
+    //先开辟回调的存储，保证消息存入后回调一定能对应上
+    if(-1 == mqtt_outbox_cb_reserve(ctx)){
+        return MQTTERR_OUTOFMEMORY;
+    }
+    ret = mqtt_outbox_push(ctx->_outbox,&msg);
+    if(ret == -1){
+        //与直接发送失败时一致，由调用者释放用户数据
+        return MQTTERR_PKT_TOO_LARGE;
+    }
+    //补发并收到确认(或者超时)后回调
+    mqtt_outbox_cb cb_value = {cb,user_data,free_cb,timeout_sec,qos};
+    mqtt_outbox_cb_push(ctx,&cb_value);
+    //队列满时丢弃了最旧的消息，这些消息以超时回调
+    mqtt_outbox_cb_trim(ctx);
+    mqtt_outbox_schedule_sync(ctx);
     return 0;
 }
 
@@ -456,34 +1108,26 @@ int mqtt_send_publish_pkt(void *arg,
                           void *user_data,
                           free_user_data free_cb,
                           int timeout_sec){
-    if(payload && payload_len <= 0){
-        payload_len = strlen(payload);
-    }
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    CHECK_RET(-1,Mqtt_PackPublishPkt(&ctx->_buffer,
-                                     ++ctx->_pkt_id,
-                                     topic,
-                                     payload,
-                                     payload_len,
-                                     qos,
-                                     retain,
-                                     0));
-    if(dup){
-        CHECK_RET(-1,Mqtt_SetPktDup(&ctx->_buffer));
-    }
-    CHECK_RET(-1,mqtt_send_packet(ctx));
+    return mqtt_publish_or_store(ctx,topic,payload,payload_len,NULL,qos,retain,dup,cb,user_data,free_cb,timeout_sec);
+}
 
-    mqtt_req_cb_value *value = jimi_malloc(sizeof(mqtt_req_cb_value));
-    if(value){
-        value->_user_data = user_data;
-        value->_free_user_data = free_cb;
-        value->_callback._mqtt_handle_pub_ack = cb;
-        value->_cb_type = res_pub_ack;
-        value->_end_time_line = time(NULL) + timeout_sec;
-        hash_table_insert(ctx->_req_cb_map,(HashTableKey)ctx->_pkt_id,value);
-    }
-    return 0;
+int mqtt_send_publish_shared_pkt(void *arg,
+                                 const char *topic,
+                                 struct MqttPayload *payload,
+                                 enum MqttQosLevel qos,
+                                 int retain,
+                                 int dup,
+                                 mqtt_handle_pub_ack cb,
+                                 void *user_data,
+                                 free_user_data free_cb,
+                                 int timeout_sec){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    CHECK_PTR(payload,-1);
+    return mqtt_publish_or_store(ctx,topic,payload->len ? MqttPayload_Data(payload) : NULL,payload->len,payload,
+                                 qos,retain,dup,cb,user_data,free_cb,timeout_sec);
 }
 
 
@@ -497,22 +1141,26 @@ int mqtt_send_subscribe_pkt(void *arg,
                             int timeout_sec){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    CHECK_RET(-1,Mqtt_PackSubscribePkt(&ctx->_buffer,
-                                       ++ctx->_pkt_id,
-                                       qos,
-                                       topics,
-                                       topics_len));
-    CHECK_RET(-1,mqtt_send_packet(ctx));
-
-    mqtt_req_cb_value *value = jimi_malloc(sizeof(mqtt_req_cb_value));
-    if(value){
-        value->_user_data = user_data;
-        value->_free_user_data = free_cb;
-        value->_callback._mqtt_handle_sub_ack = cb;
-        value->_cb_type = res_sub_ack;
-        value->_end_time_line = time(NULL) + timeout_sec;
-        hash_table_insert(ctx->_req_cb_map,(HashTableKey)ctx->_pkt_id,value);
+    uint16_t pkt_id = mqtt_id_table_alloc(&ctx->_req_table,NULL);
+    if(!pkt_id){
+        return MQTTERR_OUTOFMEMORY;
     }
+    int ret = Mqtt_PackSubscribePkt(&ctx->_buffer,
+                                    pkt_id,
+                                    qos,
+                                    topics,
+                                    topics_len);
+    if(ret >= 0){
+        ret = mqtt_send_packet(ctx);
+    }
+    if(ret < 0){
+        LOGW("send subscribe packet failed:%d",ret);
+        mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+        return ret;
+    }
+
+    mqtt_req_cb_value *value = regist_req_cb_value(ctx,pkt_id,res_sub_ack,user_data,free_cb,timeout_sec);
+    value->_callback._mqtt_handle_sub_ack = cb;
     return 0;
 }
 
@@ -525,21 +1173,25 @@ int mqtt_send_unsubscribe_pkt(void *arg,
                               int timeout_sec){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    CHECK_RET(-1,Mqtt_PackUnsubscribePkt(&ctx->_buffer,
-                                         ++ctx->_pkt_id,
-                                         topics,
-                                         topics_len));
-    CHECK_RET(-1,mqtt_send_packet(ctx));
-
-    mqtt_req_cb_value *value = jimi_malloc(sizeof(mqtt_req_cb_value));
-    if(value){
-        value->_user_data = user_data;
-        value->_free_user_data = free_cb;
-        value->_callback._mqtt_handle_unsub_ack = cb;
-        value->_cb_type = res_unsub_ack;
-        value->_end_time_line = time(NULL) + timeout_sec;
-        hash_table_insert(ctx->_req_cb_map,(HashTableKey)ctx->_pkt_id,value);
+    uint16_t pkt_id = mqtt_id_table_alloc(&ctx->_req_table,NULL);
+    if(!pkt_id){
+        return MQTTERR_OUTOFMEMORY;
+    }
+    int ret = Mqtt_PackUnsubscribePkt(&ctx->_buffer,
+                                      pkt_id,
+                                      topics,
+                                      topics_len);
+    if(ret >= 0){
+        ret = mqtt_send_packet(ctx);
+    }
+    if(ret < 0){
+        LOGW("send unsubscribe packet failed:%d",ret);
+        mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+        return ret;
     }
+
+    mqtt_req_cb_value *value = regist_req_cb_value(ctx,pkt_id,res_unsub_ack,user_data,free_cb,timeout_sec);
+    value->_callback._mqtt_handle_unsub_ack = cb;
     return 0;
 }
 
@@ -566,46 +1218,575 @@ int mqtt_send_disconnect_pkt(void *arg){
 }
 
 
-void for_each_map(HashTable *hash_table,int flush){
-    time_t now = time(NULL);
-    HashTableIterator it;
-    hash_table_iterate(hash_table,&it);
-    while(hash_table_iter_has_more(&it)) {
-        HashTablePair pr = hash_table_iter_next(&it);
-        mqtt_req_cb_value *value = (mqtt_req_cb_value *)pr.value;
-        if(value->_end_time_line > now && !flush){
-            continue;
-        }
+/**
+ * 把一个未确认的数据包重新放入发送缓冲区并发送
+ * @param ctx 对象指针
+ * @param data 数据包在重发存储中的数据
+ * @param len 数据长度
+ * @param shared 共享负载，可以为NULL
+ * @return 0成功，否则为发送失败
+ */
+static int mqtt_resend_data(mqtt_context *ctx,char *data,uint32_t len,struct MqttPayload *shared){
+    struct MqttExtent *tail = ctx->_buffer.last_ext;
+    //存储中的数据在确认后会被覆盖，必须拷贝；共享负载只增加引用
+    CHECK_RET(-1,MqttBuffer_Append(&ctx->_buffer,data,len,1));
+    if(shared){
+        CHECK_RET(-1,MqttBuffer_AppendShared(&ctx->_buffer,shared));
+    }
+    if(((data[0] >> 4) & 0x0F) == MQTT_PKT_PUBLISH){
+        CHECK_RET(-1,Mqtt_SetPktDupAt(tail ? tail->next : ctx->_buffer.first_ext));
+    }
+    MQTT_STATS_ADD(ctx->_stats._retransmits,1);
+    return mqtt_send_packet(ctx);
+}
 
-        LOGW("wait response callback timeouted,callback type:%d",value->_cb_type);
-        //触发超时回调
-        switch (value->_cb_type){
-            case res_pub_ack:
-                value->_callback._mqtt_handle_pub_ack(value->_user_data,1,pub_invalid);
-                break;
-            case res_sub_ack:
-                value->_callback._mqtt_handle_sub_ack(value->_user_data,1,NULL,0);
-                break;
-            case res_unsub_ack:
-                value->_callback._mqtt_handle_unsub_ack(value->_user_data,1);
-                break;
-
-            default:
-                LOGE("bad response callback type:%d",(int)value->_cb_type);
-                break;
+/**
+ * 重发一个未确认的数据包
+ * @param ctx 对象指针
+ * @param pkt_id 数据包id
+ * @return 0成功，-1代表未找到该数据包或发送失败
+ */
+static int mqtt_resend_inflight(mqtt_context *ctx,uint16_t pkt_id){
+    uint32_t len = 0;
+    char *data = mqtt_inflight_find(&ctx->_inflight,pkt_id,&len);
+    if(!data){
+        return -1;
+    }
+    return mqtt_resend_data(ctx,data,len,mqtt_inflight_find_shared(&ctx->_inflight,pkt_id));
+}
+
+/**
+ * 按发送顺序重发所有未确认的数据包，并重新计时；遇到发送失败立即停止
+ * @param ctx 对象指针
+ */
+static void mqtt_resend_all_inflight(mqtt_context *ctx){
+    int count = mqtt_inflight_count(&ctx->_inflight);
+    if(!count){
+        return;
+    }
+    LOGI("resend %d inflight packets",count);
+    //重发不会预留或删除数据包，可以直接遍历
+    mqtt_inflight_msg *msg;
+    int index;
+    for(index = 0 ; (msg = mqtt_inflight_next(&ctx->_inflight,&index)) != NULL ; ++index){
+        if(0 != mqtt_resend_data(ctx,mqtt_inflight_data(&ctx->_inflight,msg),msg->_len,msg->_shared)){
+            //发送已经失败，继续重发只会重复失败；剩余数据包由各自的超时或者下次重连重发
+            LOGW("resend inflight packet failed, pkt_id:%d",(int)msg->_pkt_id);
+            break;
+        }
+        mqtt_req_cb_value *value = lookup_req_cb_value(ctx,msg->_pkt_id);
+        if(value){
+            restart_req_timer(ctx,msg->_pkt_id,value);
         }
-        hash_table_remove(hash_table,pr.key);
     }
 }
 
+/**
+ * 等待回复超时或者对象销毁时触发超时回调
+ * @param ctx 对象指针
+ * @param pkt_id 数据包id
+ * @param flush 非0代表对象销毁，不再重发
+ */
+static void mqtt_req_timeout(mqtt_context *ctx,uint16_t pkt_id,int flush){
+    mqtt_req_cb_value *value = lookup_req_cb_value(ctx,pkt_id);
+    if(!value){
+        return;
+    }
+    if(!flush && value->_cb_type == res_pub_ack && !ctx->_connected &&
+       mqtt_inflight_find(&ctx->_inflight,pkt_id,NULL)){
+        //离线期间不重发也不计入重试次数，重新登录后由mqtt_resend_all_inflight重发并重新计时
+        LOGD("publish timeouted while offline, wait for reconnect, pkt_id:%d",(int)pkt_id);
+        return;
+    }
+    if(!flush && value->_cb_type == res_pub_ack && value->_retries < ctx->_max_retries &&
+       0 == mqtt_resend_inflight(ctx,pkt_id)){
+        //超时重发，重新计时
+        LOGW("publish timeouted, resend pkt_id:%d, retries:%d",(int)pkt_id,value->_retries + 1);
+        ++value->_retries;
+        restart_req_timer(ctx,pkt_id,value);
+        return;
+    }
+
+    LOGW("wait response callback timeouted,callback type:%d",value->_cb_type);
+    if(!flush){
+        //对象销毁时清理的请求不是真正的超时，不计入统计
+        MQTT_STATS_ADD(ctx->_stats._timeouts,1);
+    }
+    //先释放数据包id再触发超时回调，回调中可以复用该id
+    mqtt_req_cb_value cb = *value;
+    mqtt_timer_wheel_cancel(&ctx->_timers,cb._timer);
+    mqtt_id_table_remove(&ctx->_req_table,pkt_id);
+    switch (cb._cb_type){
+        case res_pub_ack:
+            mqtt_inflight_remove(&ctx->_inflight,pkt_id);
+            if(cb._callback._mqtt_handle_pub_ack){
+                cb._callback._mqtt_handle_pub_ack(cb._user_data,1,pub_invalid);
+            }
+            break;
+        case res_sub_ack:
+            if(cb._callback._mqtt_handle_sub_ack){
+                cb._callback._mqtt_handle_sub_ack(cb._user_data,1,NULL,0);
+            }
+            break;
+        case res_unsub_ack:
+            if(cb._callback._mqtt_handle_unsub_ack){
+                cb._callback._mqtt_handle_unsub_ack(cb._user_data,1);
+            }
+            break;
+
+        default:
+            LOGE("bad response callback type:%d",(int)cb._cb_type);
+            break;
+    }
+    if(cb._free_user_data){
+        cb._free_user_data(cb._user_data);
+    }
+    if(!flush){
+        mqtt_check_credit(ctx);
+    }
+}
+
+/**
+ * 对象销毁时触发所有等待回复的超时回调
+ * @param ctx 对象指针
+ */
+static void mqtt_flush_req_cb(mqtt_context *ctx){
+    uint32_t slot;
+    uint16_t pkt_id;
+    for(slot = 0 ; mqtt_id_table_next(&ctx->_req_table,&slot,&pkt_id) ; ++slot) {
+        mqtt_req_timeout(ctx,pkt_id,1);
+    }
+}
+
+/**
+ * 定时器到期回调
+ * @param arg 对象指针
+ * @param key 定时器标识
+ */
+static void mqtt_on_timer(void *arg,uint32_t key){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    if(key == MQTT_TIMER_OUTBOX_SYNC){
+        ctx->_outbox_timer = 0;
+        mqtt_outbox_sync(ctx->_outbox);
+        return;
+    }
+    if(key == MQTT_TIMER_OUTBOX_REPLAY){
+        ctx->_outbox_replay_timer = 0;
+        mqtt_outbox_replay(ctx);
+        return;
+    }
+    if(key == MQTT_TIMER_KEEPALIVE){
+        ctx->_ping_timer = 0;
+        mqtt_send_ping_pkt(ctx);
+        //未收到心跳回复时，每个心跳周期重发一次
+        restart_ping_timer(ctx);
+        return;
+    }
+    mqtt_req_cb_value *value = lookup_req_cb_value(ctx,(uint16_t)key);
+    if(value){
+        //定时器已经触发，句柄失效
+        value->_timer = 0;
+    }
+    mqtt_req_timeout(ctx,(uint16_t)key,0);
+}
+
 int mqtt_timer_schedule(void *arg){
     mqtt_context *ctx = (mqtt_context *)arg;
     CHECK_PTR(ctx,-1);
-    for_each_map(ctx->_req_cb_map,0);
+    mqtt_timer_wheel_expire(&ctx->_timers,mqtt_now_ms(),mqtt_on_timer,ctx);
 
-    time_t now = time(NULL);
-    if(now - ctx->_last_ping > ctx->_keep_alive){
-        return mqtt_send_ping_pkt(arg);
+    if(ctx->_batching && ctx->_batch_pkts && mqtt_batch_full(ctx)){
+        //缓存的数据包已经到了最迟发送时间
+        mqtt_flush_packet(ctx);
+        mqtt_check_credit(ctx);
+    }
+    return 0;
+}
+
+int mqtt_next_timeout(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    uint64_t deadline = 0;
+    int found = (0 == mqtt_timer_wheel_next(&ctx->_timers,&deadline));
+    if(ctx->_batching && ctx->_batch_pkts && ctx->_batch_max_delay_ms &&
+       (!found || ctx->_batch_deadline < deadline)){
+        deadline = ctx->_batch_deadline;
+        found = 1;
+    }
+    if(!found){
+        return -1;
+    }
+    uint64_t now = mqtt_now_ms();
+    if(deadline <= now){
+        return 0;
+    }
+    return deadline - now > 0x7FFFFFFF ? 0x7FFFFFFF : (int)(deadline - now);
+}
+
+int mqtt_get_publish_latency(void *arg,enum MqttQosLevel qos,mqtt_latency *latency){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    CHECK_PTR(latency,-1);
+    if(qos != MQTT_QOS_LEVEL1 && qos != MQTT_QOS_LEVEL2){
+        LOGE("qos0 publish has no acknowledgement");
+        return -1;
+    }
+    memset(latency,0, sizeof(mqtt_latency));
+    mqtt_histogram *hist = ctx->_latency[qos - 1];
+    if(!hist || !hist->_total){
+        return 0;
+    }
+    latency->_count = hist->_total;
+    latency->_min_us = hist->_min;
+    latency->_max_us = hist->_max;
+    latency->_mean_us = (uint32_t)(hist->_sum / hist->_total);
+    latency->_p50_us = mqtt_histogram_percentile(hist,50);
+    latency->_p90_us = mqtt_histogram_percentile(hist,90);
+    latency->_p99_us = mqtt_histogram_percentile(hist,99);
+    latency->_p999_us = mqtt_histogram_percentile(hist,99.9);
+    return 0;
+}
+
+int mqtt_merge_publish_latency(void *arg,enum MqttQosLevel qos,mqtt_histogram *hist){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    CHECK_PTR(hist,-1);
+    if(qos != MQTT_QOS_LEVEL1 && qos != MQTT_QOS_LEVEL2){
+        LOGE("qos0 publish has no acknowledgement");
+        return -1;
+    }
+    if(ctx->_latency[qos - 1]){
+        mqtt_histogram_merge(hist,ctx->_latency[qos - 1]);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+int mqtt_get_stats(void *arg,mqtt_stats *stats){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    CHECK_PTR(stats,-1);
+    mqtt_stats_snapshot(&ctx->_stats,stats);
+    return 0;
+}
+
+int mqtt_reset_publish_latency(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    int i;
+    for(i = 0 ; i < 2 ; ++i){
+        if(ctx->_latency[i]){
+            mqtt_histogram_init(ctx->_latency[i]);
+        }
+    }
+    return 0;
+}
+
+int mqtt_set_publish_retry(void *arg,int max_retries){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    ctx->_max_retries = max_retries < 0 ? 0 : max_retries;
+    return 0;
+}
+
+int mqtt_connection_lost(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    //丢弃旧连接上未解析完的数据和未发送完的数据，未确认的消息在重新登录后重发
+    MqttParser_Reset(&ctx->_parser);
+    ctx->_ring_head = 0;
+    ctx->_ring_len = 0;
+    MqttBuffer_Reset(&ctx->_buffer);
+    ctx->_sent_bytes = 0;
+    ctx->_batch_pkts = 0;
+    ctx->_connected = 0;
+    mqtt_stats_scanner_reset(&ctx->_scan_in);
+    mqtt_stats_scanner_reset(&ctx->_scan_out);
+    //断线期间不发送心跳包，重新登录时再开始计时
+    mqtt_timer_wheel_cancel(&ctx->_timers,ctx->_ping_timer);
+    ctx->_ping_timer = 0;
+    //重新登录后会立即补发
+    mqtt_timer_wheel_cancel(&ctx->_timers,ctx->_outbox_replay_timer);
+    ctx->_outbox_replay_timer = 0;
+    return 0;
+}
+
+int mqtt_set_flow_control(void *arg,int max_inflight,uint32_t max_output_bytes,mqtt_handle_credit cb){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    ctx->_max_inflight = max_inflight > 0 ? max_inflight : 0;
+    ctx->_max_output_bytes = max_output_bytes;
+    ctx->_credit_cb = cb;
+    return 0;
+}
+
+/**
+ * 未确认的消息个数或者待发送的字节数是否已达上限，达到上限时标记为阻塞，恢复后触发可发送回调
+ * @param ctx 对象指针
+ * @param qos 消息质量
+ * @return 1代表已达上限
+ */
+static int mqtt_output_would_block(mqtt_context *ctx,enum MqttQosLevel qos){
+    if(qos != MQTT_QOS_LEVEL0 && ctx->_max_inflight &&
+       mqtt_inflight_count(&ctx->_inflight) >= ctx->_max_inflight){
+        ctx->_blocked = 1;
+        return 1;
+    }
+    if(ctx->_max_output_bytes && mqtt_output_pending(ctx) >= ctx->_max_output_bytes){
+        ctx->_blocked = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int mqtt_publish_would_block(void *arg,enum MqttQosLevel qos){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,0);
+    if(ctx->_outbox && (!ctx->_connected || mqtt_outbox_count(ctx->_outbox))){
+        //消息将存入离线消息队列
+        return 0;
+    }
+    return mqtt_output_would_block(ctx,qos);
+}
+
+/**
+ * 发布消息被阻塞后，未确认的消息个数低于上限并且未发送的字节数降到上限的一半以下时通知用户
+ * @param ctx 对象指针
+ */
+static void mqtt_check_credit(mqtt_context *ctx){
+    if(!ctx->_blocked){
+        return;
+    }
+    if(ctx->_max_inflight && mqtt_inflight_count(&ctx->_inflight) >= ctx->_max_inflight){
+        return;
+    }
+    if(ctx->_max_output_bytes && mqtt_output_pending(ctx) > ctx->_max_output_bytes / 2){
+        return;
+    }
+    ctx->_blocked = 0;
+    //先补发离线消息，补发过程中再次被阻塞时不通知用户
+    mqtt_outbox_replay(ctx);
+    if(ctx->_blocked){
+        return;
+    }
+    if(ctx->_credit_cb){
+        ctx->_credit_cb(ctx->_callback._user_data);
+    }
+}
+
+int mqtt_outbox_enable(void *arg,const char *path,uint32_t capacity,int sync_interval_ms){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    if(ctx->_outbox){
+        LOGW("outbox already enabled");
+        return -1;
+    }
+    ctx->_outbox = (mqtt_outbox *)jimi_malloc(sizeof(mqtt_outbox));
+    CHECK_PTR(ctx->_outbox,MQTTERR_OUTOFMEMORY);
+    if(-1 == mqtt_outbox_open(ctx->_outbox,path,capacity)){
+        jimi_free(ctx->_outbox);
+        ctx->_outbox = NULL;
+        return -1;
+    }
+    ctx->_outbox_sync_ms = sync_interval_ms > 0 ? sync_interval_ms : 0;
+    //已经在线时补发上次进程退出前未发送的消息
+    mqtt_outbox_replay(ctx);
+    return 0;
+}
+
+uint32_t mqtt_outbox_pending(void *arg){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,0);
+    return mqtt_outbox_count(ctx->_outbox);
+}
+
+uint32_t mqtt_topic_route_add(void *arg,const char *filter,mqtt_handle_topic cb,void *user_data){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,0);
+    return mqtt_topic_router_add(&ctx->_router,filter,cb,user_data);
+}
+
+int mqtt_topic_route_remove(void *arg,uint32_t route){
+    mqtt_context *ctx = (mqtt_context *)arg;
+    CHECK_PTR(ctx,-1);
+    return mqtt_topic_router_remove(&ctx->_router,route);
+}
+
+/**
+ * 离线消息队列有修改，在同步间隔到达后同步到磁盘，避免在发布消息的路径上阻塞
+ * @param ctx 对象指针
+ */
+static void mqtt_outbox_schedule_sync(mqtt_context *ctx){
+    if(ctx->_outbox_timer){
+        return;
+    }
+    ctx->_outbox_timer = mqtt_timer_wheel_add(&ctx->_timers,mqtt_now_ms(),ctx->_outbox_sync_ms,MQTT_TIMER_OUTBOX_SYNC);
+}
+
+/**
+ * 确保还能再保存一个离线消息的回调
+ * @param ctx 对象指针
+ * @return 0代表成功，-1代表内存不足
+ */
+static int mqtt_outbox_cb_reserve(mqtt_context *ctx){
+    if(ctx->_outbox_cb_count < ctx->_outbox_cb_capacity){
+        return 0;
+    }
+    uint32_t capacity = ctx->_outbox_cb_capacity ? ctx->_outbox_cb_capacity * 2 : 8;
+    mqtt_outbox_cb *cbs = (mqtt_outbox_cb *)jimi_malloc(capacity * sizeof(mqtt_outbox_cb));
+    if(!cbs){
+        LOGE("out of memory:%d",capacity);
+        return -1;
+    }
+    //按顺序搬移到新数组头部
+    uint32_t i;
+    for(i = 0 ; i < ctx->_outbox_cb_count ; ++i){
+        cbs[i] = ctx->_outbox_cbs[(ctx->_outbox_cb_head + i) & (ctx->_outbox_cb_capacity - 1)];
+    }
+    jimi_free(ctx->_outbox_cbs);
+    ctx->_outbox_cbs = cbs;
+    ctx->_outbox_cb_head = 0;
+    ctx->_outbox_cb_capacity = capacity;
+    return 0;
+}
+
+/**
+ * 保存一个离线消息的回调，必须先调用mqtt_outbox_cb_reserve
+ * @param ctx 对象指针
+ * @param cb 回调
+ */
+static void mqtt_outbox_cb_push(mqtt_context *ctx,const mqtt_outbox_cb *cb){
+    ctx->_outbox_cbs[(ctx->_outbox_cb_head + ctx->_outbox_cb_count) & (ctx->_outbox_cb_capacity - 1)] = *cb;
+    ++ctx->_outbox_cb_count;
+}
+
+/**
+ * 删除最旧的离线消息回调，并以超时回调
+ * @param ctx 对象指针
+ */
+static void mqtt_outbox_cb_pop_timeout(mqtt_context *ctx){
+    mqtt_outbox_cb cb = ctx->_outbox_cbs[ctx->_outbox_cb_head];
+    ctx->_outbox_cb_head = (ctx->_outbox_cb_head + 1) & (ctx->_outbox_cb_capacity - 1);
+    --ctx->_outbox_cb_count;
+    if(cb._cb && cb._qos != MQTT_QOS_LEVEL0){
+        cb._cb(cb._user_data,1,pub_invalid);
+    }
+    if(cb._free_cb){
+        cb._free_cb(cb._user_data);
+    }
+}
+
+/**
+ * 离线消息被丢弃(队列满或者无法补发)后，删除多出的回调并以超时回调
+ * @param ctx 对象指针
+ */
+static void mqtt_outbox_cb_trim(mqtt_context *ctx){
+    while(ctx->_outbox_cb_count > mqtt_outbox_count(ctx->_outbox)){
+        mqtt_outbox_cb_pop_timeout(ctx);
+    }
+}
+
+/**
+ * 对象销毁时触发所有离线消息的超时回调
+ * @param ctx 对象指针
+ */
+static void mqtt_outbox_cb_flush(mqtt_context *ctx){
+    while(ctx->_outbox_cb_count){
+        mqtt_outbox_cb_pop_timeout(ctx);
+    }
+    jimi_free(ctx->_outbox_cbs);
+    ctx->_outbox_cbs = NULL;
+    ctx->_outbox_cb_capacity = 0;
+}
+
+/**
+ * 发布消息的错误是否与网络、内存状态无关，重试也不会成功
+ * @param err 错误代码
+ * @return 非0代表是
+ */
+static int mqtt_publish_error_permanent(int err){
+    switch (err){
+        case MQTTERR_ILLEGAL_CHARACTER:
+        case MQTTERR_NOT_UTF8:
+        case MQTTERR_INVALID_PARAMETER:
+        case MQTTERR_PKT_TOO_LARGE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * 在线时按顺序补发离线消息，按批量上限合并为writev发送；
+ * 发送缓冲区已满或者被流量控制阻塞时停止，在mqtt_on_writable恢复可发送后继续
+ * @param ctx 对象指针
+ */
+static void mqtt_outbox_replay(mqtt_context *ctx){
+    if(!ctx->_connected || !mqtt_outbox_count(ctx->_outbox)){
+        return;
+    }
+    LOGI("replay %d offline messages",mqtt_outbox_count(ctx->_outbox));
+    int batching = ctx->_batching;
+    if(!batching){
+        mqtt_batch_begin(ctx,MQTT_OUTBOX_BATCH_BYTES,MQTT_OUTBOX_BATCH_PKTS,0);
+    }
+    mqtt_outbox_msg msg;
+    mqtt_outbox_cb_trim(ctx);
+    while(0 == mqtt_outbox_peek(ctx->_outbox,&msg)){
+        if(ctx->_sent_bytes){
+            //网络层发送缓冲区已满，等待可发送后由mqtt_check_credit继续补发
+            ctx->_blocked = 1;
+            break;
+        }
+        //队列中的消息与回调个数相同时，头部消息是本进程存入的，有回调
+        mqtt_outbox_cb cb = {NULL,NULL,NULL,MQTT_OUTBOX_TIMEOUT_SEC,msg._qos};
+        int has_cb = ctx->_outbox_cb_count == mqtt_outbox_count(ctx->_outbox);
+        if(has_cb){
+            cb = ctx->_outbox_cbs[ctx->_outbox_cb_head];
+        }
+        //批量发送模式下负载被拷贝，删除消息后依然有效
+        int ret = mqtt_send_publish(ctx,
+                                    msg._topic,
+                                    msg._payload,
+                                    msg._payload_len,
+                                    NULL,
+                                    msg._qos,
+                                    msg._retain,
+                                    0,
+                                    cb._cb,
+                                    cb._user_data,
+                                    cb._free_cb,
+                                    cb._timeout_sec);
+        if(ret == MQTTERR_WOULDBLOCK){
+            break;
+        }
+        if(ret < 0 && mqtt_publish_error_permanent(ret)){
+            //重试也不会成功(例如旧版本存入的非法主题)，丢弃以免阻塞后续消息
+            LOGE("drop offline message:%d, topic:%s",ret,msg._topic);
+            mqtt_outbox_pop(ctx->_outbox);
+            //剩余回调个数超过剩余消息个数，删除头部消息的回调并以超时回调
+            mqtt_outbox_cb_trim(ctx);
+            continue;
+        }
+        if(ret < 0){
+            //保留在离线消息队列中，稍后按原顺序重试
+            LOGW("replay offline message failed:%d, topic:%s",ret,msg._topic);
+            if(!ctx->_outbox_replay_timer){
+                ctx->_outbox_replay_timer = mqtt_timer_wheel_add(&ctx->_timers,
+                                                                 mqtt_now_ms(),
+                                                                 MQTT_OUTBOX_RETRY_MS,
+                                                                 MQTT_TIMER_OUTBOX_REPLAY);
+            }
+            break;
+        }
+        mqtt_outbox_pop(ctx->_outbox);
+        if(has_cb){
+            //回调已经登记为等待回复
+            ctx->_outbox_cb_head = (ctx->_outbox_cb_head + 1) & (ctx->_outbox_cb_capacity - 1);
+            --ctx->_outbox_cb_count;
+        }
+    }
+    mqtt_outbox_schedule_sync(ctx);
+    if(!batching){
+        mqtt_batch_end(ctx);
+    }
+}
@@ -7,6 +7,9 @@
 
 #include <stdio.h>
 #include "mqtt.h"
+#include "mqtt_topic_router.h"
+#include "mqtt_histogram.h"
+#include "mqtt_stats.h"
 #include "jimi_log.h"
 
 //debug模式下才答应内部调试信息
@@ -32,6 +35,8 @@ typedef struct {
      * @param arg 用户数据指针
      * @param iov 数据块
      * @param iovcnt 数据块个数
+     * @return 实际发送的字节数，-1为失败；发送缓冲区满时可以只发送部分数据，
+     *         剩余数据在调用mqtt_on_writable时继续发送
      */
     int (*mqtt_data_output)(void *arg, const struct iovec *iov, int iovcnt);
 
@@ -50,7 +55,7 @@ typedef struct {
     void (*mqtt_handle_ping_resp)(void *arg);
 
     /**
-     * 收到服务器主题发布的消息
+     * 收到服务器主题发布的消息，只有未匹配任何主题路由的消息才会触发此回调，@see mqtt_topic_route_add
      * @param arg 用户数据指针
      * @param pkt_id 数据包号
      * @param topic 主题
@@ -119,6 +124,12 @@ typedef void (*mqtt_handle_sub_ack)(void *arg,int time_out,const char *codes, ui
  */
 typedef void (*mqtt_handle_unsub_ack)(void *arg,int time_out);
 
+/**
+ * 发布消息因流量控制返回MQTTERR_WOULDBLOCK后，恢复可发送时的回调
+ * @param arg 用户数据指针，即mqtt_callback::_user_data
+ */
+typedef void (*mqtt_handle_credit)(void *arg);
+
 //////////////////////////////////////////////////////////////////////
 /**
  * 创建mqtt客户端对象
@@ -145,12 +156,201 @@ int mqtt_free_contex(void *ctx);
 int mqtt_input_data(void *ctx,char *data,int len);
 
 /**
- * 定时器轮询，建议每1秒调用一次;内部会触发心跳包以及回复超时回调
+ * 获取接收缓冲区中可写入的内存，网络层可以直接把数据读取到此处，免去一次拷贝
+ * 接收缓冲区为环形缓冲区，回绕时返回两块内存，可以用readv一次读满
+ * 写入后请调用 @see mqtt_input_commit 提交
+ * @param ctx mqtt客户端对象
+ * @param iov 返回可写入的内存块数组，至少有两个成员
+ * @return 可写入的内存块个数，-1为失败
+ */
+int mqtt_input_prepare(void *ctx,struct iovec *iov);
+
+/**
+ * 提交已经写入接收缓冲区的数据，并在缓冲区内直接解析
+ * @see mqtt_input_prepare
+ * @param ctx mqtt客户端对象
+ * @param len 实际写入的字节数
+ * @return 0成功 @see MqttError
+ */
+int mqtt_input_commit(void *ctx,int len);
+
+/**
+ * 定时器轮询，内部会触发心跳包以及回复超时回调;
+ * 请在mqtt_next_timeout返回的时间到达后调用，或者每1秒调用一次
  * @param ctx  mqtt客户端对象
  * @return 0成功 @see MqttError
  */
 int mqtt_timer_schedule(void *ctx);
 
+/**
+ * 获取距离下一个定时器到期的时间，事件循环可以据此设置等待超时
+ * @param ctx  mqtt客户端对象
+ * @return 毫秒，0代表已经有定时器到期，-1代表没有定时器
+ */
+int mqtt_next_timeout(void *ctx);
+
+/**
+ * 网络层可写时请调用此方法，继续发送上次因发送缓冲区满而未发送完毕的数据
+ * @param ctx mqtt客户端对象
+ * @return 0代表成功，否则为错误代码，@see MqttError
+ */
+int mqtt_on_writable(void *ctx);
+
+/**
+ * 获取对象内部已经打包但尚未被网络层接收的字节数
+ * @param ctx mqtt客户端对象
+ * @return 字节数，为0时无需监听可写事件
+ */
+uint32_t mqtt_output_pending(void *ctx);
+
+/**
+ * 开始批量发送模式，此后的数据包先缓存在对象内部，满足任一条件时合并为一次writev发送
+ * @param ctx mqtt客户端对象
+ * @param max_bytes 缓存的字节数达到该值时发送，0为不限制
+ * @param max_pkts 缓存的数据包个数达到该值时发送，0为不限制
+ * @param max_delay_ms 第一个数据包缓存后最多等待的时间，由mqtt_timer_schedule触发发送，0为不限制
+ * @return 0代表成功
+ */
+int mqtt_batch_begin(void *ctx,uint32_t max_bytes,int max_pkts,int max_delay_ms);
+
+/**
+ * 立即发送批量发送模式下缓存的数据包
+ * @param ctx mqtt客户端对象
+ * @return 0代表成功，否则为错误代码，@see MqttError
+ */
+int mqtt_batch_flush(void *ctx);
+
+/**
+ * 结束批量发送模式，并发送缓存的数据包
+ * @param ctx mqtt客户端对象
+ * @return 0代表成功，否则为错误代码，@see MqttError
+ */
+int mqtt_batch_end(void *ctx);
+
+/**
+ * 发布消息从发送到确认(qos1为PUBACK，qos2为PUBCOMP)的耗时统计，单位微秒
+ * 从调用发布接口、数据包进入发送缓冲区时开始计时，而不是写入网络的时刻；
+ * 因此包括批量发送模式下的合并等待、发送缓冲区满时的排队以及超时重发、断线重发的耗时
+ */
+typedef struct {
+    //样本个数
+    uint64_t _count;
+    uint32_t _min_us;
+    uint32_t _max_us;
+    uint32_t _mean_us;
+    uint32_t _p50_us;
+    uint32_t _p90_us;
+    uint32_t _p99_us;
+    uint32_t _p999_us;
+} mqtt_latency;
+
+/**
+ * 获取发布消息的确认耗时统计
+ * @param ctx mqtt客户端对象
+ * @param qos MQTT_QOS_LEVEL1或者MQTT_QOS_LEVEL2
+ * @param latency 返回统计结果，没有样本时全部为0
+ * @return 0代表成功
+ */
+int mqtt_get_publish_latency(void *ctx,enum MqttQosLevel qos,mqtt_latency *latency);
+
+/**
+ * 把发布消息的确认耗时直方图合并到hist，用于汇总多个对象的统计
+ * @param ctx mqtt客户端对象
+ * @param qos MQTT_QOS_LEVEL1或者MQTT_QOS_LEVEL2
+ * @param hist 目标直方图，单位微秒
+ * @return 0代表成功
+ */
+int mqtt_merge_publish_latency(void *ctx,enum MqttQosLevel qos,mqtt_histogram *hist);
+
+/**
+ * 获取运行统计快照，可以在其他线程调用；汇总所有对象的统计请调用mqtt_stats_aggregate
+ * @param ctx mqtt客户端对象
+ * @param stats 返回统计快照
+ * @return 0代表成功
+ */
+int mqtt_get_stats(void *ctx,mqtt_stats *stats);
+
+/**
+ * 清空发布消息的确认耗时统计
+ * @param ctx mqtt客户端对象
+ * @return 0代表成功
+ */
+int mqtt_reset_publish_latency(void *ctx);
+
+/**
+ * 设置qos1/2发布消息等待回复超时后的最多重发次数，重发次数用完后才触发超时回调
+ * @param ctx mqtt客户端对象
+ * @param max_retries 最多重发次数，0为不重发
+ * @return 0代表成功
+ */
+int mqtt_set_publish_retry(void *ctx,int max_retries);
+
+/**
+ * 设置发布消息的流量控制，超过限制时mqtt_send_publish_pkt返回MQTTERR_WOULDBLOCK
+ * @param ctx mqtt客户端对象
+ * @param max_inflight 最多未确认的qos1/2消息个数(类似MQTT5的Receive Maximum)，0为不限制
+ * @param max_output_bytes 最多未发送完毕的字节数，0为不限制
+ * @param cb 返回MQTTERR_WOULDBLOCK之后，未确认的消息个数低于上限并且未发送的字节数低于上限的一半时回调一次
+ * @return 0代表成功
+ */
+int mqtt_set_flow_control(void *ctx,int max_inflight,uint32_t max_output_bytes,mqtt_handle_credit cb);
+
+/**
+ * 判断发布消息是否会因流量控制而返回MQTTERR_WOULDBLOCK，
+ * 返回非0时与发布消息返回MQTTERR_WOULDBLOCK一样，恢复可发送后会触发回调
+ * @param ctx mqtt客户端对象
+ * @param qos 发布消息的qos等级
+ * @return 非0代表会
+ */
+int mqtt_publish_would_block(void *ctx,enum MqttQosLevel qos);
+
+/**
+ * 启用离线消息队列，此后未登录成功或者断线期间发布的消息存入队列，重新登录成功后按顺序补发；
+ * 存入队列的消息在补发并收到服务器回复后触发回调，等待回复的时间从补发时开始计算；
+ * 队列满时丢弃最旧的消息，被丢弃或者直到对象销毁都未补发的消息以超时触发回调；
+ * 上次进程退出前存入队列的消息补发时没有回调
+ * @param ctx mqtt客户端对象
+ * @param path 队列文件路径，进程重启后仍然有效；NULL代表只保存在内存中
+ * @param capacity 队列大小，单位字节
+ * @param sync_interval_ms 队列修改后最多间隔多少毫秒同步到磁盘，由mqtt_timer_schedule触发
+ * @return 0代表成功
+ */
+int mqtt_outbox_enable(void *ctx,const char *path,uint32_t capacity,int sync_interval_ms);
+
+/**
+ * 获取离线消息队列中等待补发的消息条数
+ * @param ctx mqtt客户端对象
+ * @return 消息条数
+ */
+uint32_t mqtt_outbox_pending(void *ctx);
+
+/**
+ * 添加主题路由，收到与过滤器匹配的消息时触发回调，一条消息匹配多个路由时全部触发
+ * 分发耗时只与主题层数有关，适合订阅大量主题的场景
+ * @param ctx mqtt客户端对象
+ * @param filter 主题过滤器，支持'+'以及'#'通配符
+ * @param cb 回调函数
+ * @param user_data 回调用户数据指针
+ * @return 路由句柄，0代表失败
+ */
+uint32_t mqtt_topic_route_add(void *ctx,const char *filter,mqtt_handle_topic cb,void *user_data);
+
+/**
+ * 删除主题路由，可以在路由回调中调用
+ * @param ctx mqtt客户端对象
+ * @param route 路由句柄
+ * @return 0代表成功
+ */
+int mqtt_topic_route_remove(void *ctx,uint32_t route);
+
+/**
+ * 网络连接断开时请调用此方法，丢弃未解析完和未发送完的数据；
+ * 未确认的qos1/2消息会保留，重新登录成功后按顺序重发
+ * @param ctx mqtt客户端对象
+ * @return 0代表成功
+ */
+int mqtt_connection_lost(void *ctx);
+
 /**
  * 发送登录包给服务器
  * @param ctx mqtt客户端对象
@@ -188,11 +388,11 @@ int mqtt_send_connect_pkt(void *ctx,
  * @param qos 数据qos等级
  * @param retain 非0时，服务器将该publish消息保存到topic下，并替换已有的publish消息
  * @param dup 是否为重复发布
- * @param cb 服务器回复回调函数指针
+ * @param cb 服务器回复回调函数指针，qos0消息服务器不回复，不会触发
  * @param user_data 服务器回复回调用户数据指针
- * @param free_cb 服务器回复回调用户数据销毁回调函数指针
+ * @param free_cb 服务器回复回调用户数据销毁回调函数指针，qos0消息发送后立即触发
  * @param timeout_sec 最大等待回复的时间，单位秒
- * @return 0代表成功，否则为错误代码，@see MqttError
+ * @return 0代表成功(包括离线时存入离线消息队列，回调规则@see mqtt_outbox_enable)，否则为错误代码，@see MqttError
  */
 int mqtt_send_publish_pkt(void *ctx,
                           const char *topic,
@@ -206,6 +406,33 @@ int mqtt_send_publish_pkt(void *ctx,
                           free_user_data free_cb,
                           int timeout_sec  );
 
+/**
+ * 发布共享负载至服务器，负载不拷贝，发送缓冲区与重发存储各自持有一个引用
+ * 同一份数据发布到多个主题时只需创建一次共享负载，发布后调用者即可释放自己的引用
+ * 离线时与mqtt_send_publish_pkt一样拷贝到离线消息队列
+ * @param ctx mqtt客户端对象
+ * @param topic 主题
+ * @param payload 共享负载，@see MqttPayload_Create
+ * @param qos 数据qos等级
+ * @param retain 非0时，服务器将该publish消息保存到topic下，并替换已有的publish消息
+ * @param dup 是否为重复发布
+ * @param cb 服务器回复回调函数指针，qos0消息服务器不回复，不会触发
+ * @param user_data 服务器回复回调用户数据指针
+ * @param free_cb 服务器回复回调用户数据销毁回调函数指针，qos0消息发送后立即触发
+ * @param timeout_sec 最大等待回复的时间，单位秒
+ * @return 0代表成功，否则为错误代码，@see MqttError
+ */
+int mqtt_send_publish_shared_pkt(void *ctx,
+                                 const char *topic,
+                                 struct MqttPayload *payload,
+                                 enum MqttQosLevel qos,
+                                 int retain,
+                                 int dup,
+                                 mqtt_handle_pub_ack cb,
+                                 void *user_data,
+                                 free_user_data free_cb,
+                                 int timeout_sec);
+
 /**
  * 订阅主题
  * @param ctx mqtt客户端对象